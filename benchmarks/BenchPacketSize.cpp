@@ -0,0 +1,123 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 00:45:58 2026 Francois Michaut
+** Last update Mon Oct 19 00:45:58 2026 Francois Michaut
+**
+** BenchPacketSize.cpp : Loopback file transfer throughput for each packet size
+*/
+
+#include "FileShare/Server.hpp"
+
+#include <CppSockets/IPv4.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace FileShare;
+
+namespace {
+    constexpr std::uint16_t RECEIVER_PORT = 12346;
+    constexpr std::size_t DEFAULT_FILE_SIZE = 0x4000000; // 64 MiB
+    constexpr double MEBIBYTE = 1024.0 * 1024.0;
+
+    auto make_server_config(const std::filesystem::path &root, const std::string &name) -> ServerConfig {
+        ServerConfig config;
+
+        config.set_private_keys_dir((root / name / "private").string());
+        config.set_device_name(name);
+        return config;
+    }
+
+    void generate_file(const std::filesystem::path &path, std::size_t size) {
+        std::mt19937_64 rng(0);
+        std::ofstream file(path, std::ios_base::binary | std::ios_base::trunc);
+
+        for (std::size_t i = 0; i < size; i += sizeof(std::uint64_t)) {
+            std::uint64_t value = rng();
+
+            file.write(reinterpret_cast<const char *>(&value), static_cast<std::streamsize>(std::min(sizeof(value), size - i)));
+        }
+    }
+
+    // The download is renamed to its final name once fully received and verified
+    auto find_download(const std::filesystem::path &downloads, const std::filesystem::path &filename) -> std::filesystem::path {
+        std::error_code ec;
+
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(downloads, ec)) {
+            if (entry.is_regular_file() && entry.path().filename() == filename) {
+                return entry.path();
+            }
+        }
+        return {};
+    }
+}
+
+auto main(int argc, char **argv) -> int {
+    std::size_t file_size = argc > 1 ? std::stoull(argv[1]) : DEFAULT_FILE_SIZE;
+    auto root = std::filesystem::temp_directory_path() / "fsp_bench_packet_size";
+    auto source = root / "payload.bin";
+    auto downloads = root / "downloads";
+    std::atomic_bool running = true;
+
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root);
+    generate_file(source, file_size);
+
+    Config receiver_peer_config;
+    auto receiver_endpoint = std::make_shared<CppSockets::EndpointV4>(CppSockets::IPv4("127.0.0.1"), RECEIVER_PORT);
+
+    receiver_peer_config.set_downloads_folder(downloads);
+    Server receiver(receiver_endpoint, make_server_config(root, "receiver"), receiver_peer_config);
+    std::thread receiver_thread([&receiver, &running]() {
+        while (running) {
+            receiver.process_events(
+                [](Server &, PreAuthPeer_ptr &) { return true; },
+                [](Server &, Peer_ptr &peer, Protocol::Request &request) {
+                    peer->respond_to_request(request, Protocol::StatusCode::STATUS_OK);
+                }
+            );
+        }
+    });
+
+    Server sender(make_server_config(root, "sender").set_server_disabled(true));
+    Peer_ptr peer = sender.connect(*receiver_endpoint);
+
+    // Requests are rejected as UNAUTHORIZED until the receiver accepted us
+    while (peer->list_files().code == Protocol::StatusCode::UNAUTHORIZED) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    std::cout << "file_size=" << file_size << '\n';
+    std::cout << std::setw(12) << "packet_size" << std::setw(12) << "seconds" << std::setw(12) << "MiB/s" << '\n';
+    for (std::size_t packet_size = Protocol::MIN_PACKET_SIZE; packet_size <= Protocol::MAX_PACKET_SIZE; packet_size *= 2) {
+        std::filesystem::path download;
+
+        peer->get_config().set_packet_size(packet_size);
+        auto start = std::chrono::steady_clock::now();
+
+        peer->send_file(source.string());
+        while ((download = find_download(downloads, source.filename())).empty()) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        std::cout << std::setw(12) << packet_size << std::setw(12) << std::fixed << std::setprecision(3) << elapsed.count()
+            << std::setw(12) << std::setprecision(1) << (static_cast<double>(file_size) / MEBIBYTE / elapsed.count()) << '\n';
+        std::filesystem::remove(download);
+    }
+
+    running = false;
+    receiver_thread.join();
+    std::filesystem::remove_all(root);
+    return 0;
+}
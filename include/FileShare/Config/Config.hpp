@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Tue Sep 13 11:23:57 2022 Francois Michaut
-** Last update Fri Aug 22 18:59:52 2025 Francois Michaut
+** Last update Mon Oct 19 08:53:59 2026 Francois Michaut
 **
 ** Config.hpp : Configuration of the file sharing
 */
@@ -12,6 +12,8 @@
 #pragma once
 
 #include "FileShare/Config/FileMapping.hpp"
+#include "FileShare/Protocol/Definitions.hpp"
+#include "FileShare/Utils/Compression.hpp"
 
 #include <filesystem>
 
@@ -25,6 +27,13 @@ namespace FileShare {
                                      // on current operation and errors/latency
             };
 
+            // Transfers of a higher priority class always send before the ones of a lower class
+            enum TransferPriority : std::uint8_t {
+                HIGH,
+                NORMAL,
+                BACKGROUND
+            };
+
             Config();
 
             // paths starting with '~/' will have this part replaced by the current user's home directory
@@ -41,6 +50,36 @@ namespace FileShare {
             [[nodiscard]] auto get_transport_mode() const -> TransportMode { return m_transport_mode; }
             auto set_transport_mode(TransportMode mode) -> Config & { m_transport_mode = mode; return *this; }
 
+            [[nodiscard]] auto get_packet_size() const -> std::size_t { return m_packet_size; }
+            auto set_packet_size(std::size_t packet_size) -> Config &;
+
+            [[nodiscard]] auto get_hash_chunk_size() const -> std::size_t { return m_hash_chunk_size; }
+            auto set_hash_chunk_size(std::size_t chunk_size) -> Config & { m_hash_chunk_size = chunk_size; return *this; }
+
+            [[nodiscard]] auto get_delta_block_size() const -> std::size_t { return m_delta_block_size; }
+            auto set_delta_block_size(std::size_t block_size) -> Config & { m_delta_block_size = block_size; return *this; }
+
+            [[nodiscard]] auto get_compression() const -> Utils::CompressionAlgorithm { return m_compression; }
+            auto set_compression(Utils::CompressionAlgorithm compression) -> Config & { m_compression = compression; return *this; }
+
+            [[nodiscard]] auto get_data_connections() const -> std::size_t { return m_data_connections; }
+            auto set_data_connections(std::size_t count) -> Config & { m_data_connections = count; return *this; }
+
+            [[nodiscard]] auto get_deduplication() const -> bool { return m_deduplication; }
+            auto set_deduplication(bool enabled) -> Config & { m_deduplication = enabled; return *this; }
+
+            [[nodiscard]] auto get_read_ahead_depth() const -> std::size_t { return m_read_ahead_depth; }
+            auto set_read_ahead_depth(std::size_t depth) -> Config & { m_read_ahead_depth = depth; return *this; }
+
+            [[nodiscard]] auto get_read_ahead_threads() const -> std::size_t { return m_read_ahead_threads; }
+            auto set_read_ahead_threads(std::size_t threads) -> Config & { m_read_ahead_threads = threads; return *this; }
+
+            [[nodiscard]] auto get_transfer_priority() const -> TransferPriority { return m_transfer_priority; }
+            auto set_transfer_priority(TransferPriority priority) -> Config & { m_transfer_priority = priority; return *this; }
+
+            [[nodiscard]] auto get_transfer_weight() const -> std::size_t { return m_transfer_weight; }
+            auto set_transfer_weight(std::size_t weight) -> Config & { m_transfer_weight = weight; return *this; }
+
         private:
             template <class Archive>
             friend void serialize(Archive &archive, Config &config, std::uint32_t version);
@@ -72,5 +111,40 @@ namespace FileShare {
             // Default location for downloads. Default to a 'FileShare/' folder
             // in the local Downloads folder if empty string.
             std::filesystem::path m_downloads_folder = "";
+            // Packet size used for the transfers we initiate, and proposed when the
+            // peer lets us choose. Must be between Protocol::MIN_PACKET_SIZE and
+            // Protocol::MAX_PACKET_SIZE.
+            std::size_t m_packet_size = Protocol::DEFAULT_PACKET_SIZE;
+            // When not 0, files we send come with a hash tree of chunks of this size (rounded
+            // down to a multiple of the packet size), so the peer can verify each chunk as it
+            // arrives and ask for a bad one again. Costs an extra read of the file to build it.
+            std::size_t m_hash_chunk_size = 0;
+            // When not 0 and a file we download already exists, send the peer the checksums of
+            // each block of this size of our copy, so only the changed parts are transferred.
+            // Costs an extra read of our copy, and of the file on the peer's side.
+            std::size_t m_delta_block_size = 0;
+            // Compression of the data of the files we exchange: we accept it for the files we receive, and
+            // use it for the files we send if the peer accepts it too. It is turned off for a file if its
+            // first packets don't compress well (eg: media, archives), so it costs little CPU for those.
+            // Off by default: both peers must enable it.
+            Utils::CompressionAlgorithm m_compression = Utils::CompressionAlgorithm::NONE;
+            // Number of extra connections Server::connect opens to the peer. The packets of big files
+            // are spread over all the connections, each with its own TLS stream and window: this helps
+            // on fast links, where a single connection is limited by encryption or congestion control.
+            std::size_t m_data_connections = 0;
+            // Files we send are cut in content-defined chunks, and the peer only receives the ones it
+            // doesn't have yet, from any file. The chunks of the files we download are kept in a store
+            // in the downloads folder, which takes as much space as them unless the filesystem
+            // supports reflinks. Replaces the hash tree for the files it applies to.
+            bool m_deduplication = false;
+            // Number of packets of the big files we send which are read ahead of the network, on up to
+            // m_read_ahead_threads threads in parallel. Hides the disk latency, and lets fast drives
+            // (eg: NVMe) serve several reads at once. 0 disables it: packets are read when sent.
+            std::size_t m_read_ahead_depth = 16;
+            std::size_t m_read_ahead_threads = 4;
+            // How the uploads to this Peer are scheduled against the ones to other Peers of the Server:
+            // the priority class goes first, then the Peer gets a share of the packets proportional to its weight.
+            TransferPriority m_transfer_priority = NORMAL;
+            std::size_t m_transfer_weight = 1;
     };
 }
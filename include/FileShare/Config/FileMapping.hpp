@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Sun Nov 19 11:23:07 2023 Francois Michaut
-** Last update Sun Aug 24 11:28:31 2025 Francois Michaut
+** Last update Mon Oct 19 09:13:00 2026 Francois Michaut
 **
 ** FileMapping.hpp : Class to hold information about which files are available for listing/download
 */
@@ -155,7 +155,8 @@ namespace FileShare {
             auto host_to_virtual(const std::filesystem::path &path) const -> std::filesystem::path;
             auto virtual_to_host(const std::filesystem::path &path) const -> std::filesystem::path;
             static auto virtual_to_host(const std::filesystem::path &virtual_path, const std::optional<PathNode> &node, std::filesystem::path::iterator iter) -> std::filesystem::path;
-            auto find_virtual_node(std::filesystem::path virtual_path, std::filesystem::path::iterator &out, bool only_visible = true) const -> std::optional<PathNode>;
+            // `out` points in `virtual_path`, past the node found
+            auto find_virtual_node(const std::filesystem::path &virtual_path, std::filesystem::path::iterator &out, bool only_visible = true) const -> std::optional<PathNode>;
             auto find_virtual_node(std::filesystem::path virtual_path, bool only_visible = true) const -> std::optional<PathNode>;
 
             auto is_forbidden(const std::filesystem::path &path) const -> bool;
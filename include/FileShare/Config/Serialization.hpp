@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Sun Dec 10 10:56:44 2023 Francois Michaut
-** Last update Sat Aug 23 20:42:50 2025 Francois Michaut
+** Last update Mon Oct 19 08:59:53 2026 Francois Michaut
 **
 ** Serialization.hpp : FileShare Config serialization functions
 */
@@ -20,8 +20,8 @@
 #include <cereal/types/unordered_map.hpp>
 #include <cereal/types/unordered_set.hpp>
 
-static constexpr std::uint32_t FILE_SHARE_CONFIG_VERSION = 0;
-static constexpr std::uint32_t FILE_SHARE_SERVER_CONFIG_VERSION = 0;
+static constexpr std::uint32_t FILE_SHARE_CONFIG_VERSION = 1;
+static constexpr std::uint32_t FILE_SHARE_SERVER_CONFIG_VERSION = 1;
 static constexpr std::uint32_t FILE_SHARE_FILE_MAPPING_VERSION = 0;
 static constexpr std::uint32_t FILE_SHARE_PATH_NODE_VERSION = 0;
 
@@ -43,6 +43,12 @@ namespace FileShare {
         }
 
         if (version == FILE_SHARE_SERVER_CONFIG_VERSION) {
+            archive(
+                config.m_uuid, config.m_device_name, config.m_private_keys_dir,
+                config.m_private_key_name, config.m_disable_server, config.m_max_active_transfers,
+                config.m_transfer_journal, config.m_hash_cache
+            );
+        } else if (version == 0) {
             archive(
                 config.m_uuid, config.m_device_name, config.m_private_keys_dir,
                 config.m_private_key_name, config.m_disable_server
@@ -59,6 +65,13 @@ namespace FileShare {
         }
 
         if (version == FILE_SHARE_CONFIG_VERSION) {
+            archive(
+                config.m_transport_mode, config.m_filemap, config.m_downloads_folder, config.m_packet_size,
+                config.m_hash_chunk_size, config.m_delta_block_size, config.m_compression,
+                config.m_data_connections, config.m_deduplication, config.m_read_ahead_depth,
+                config.m_read_ahead_threads, config.m_transfer_priority, config.m_transfer_weight
+            );
+        } else if (version == 0) {
             archive(config.m_transport_mode, config.m_filemap, config.m_downloads_folder);
         } else {
             throw std::runtime_error("Config file format is unsupported");
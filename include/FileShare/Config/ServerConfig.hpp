@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Wed Aug  6 15:09:50 2025 Francois Michaut
-** Last update Fri Aug 22 20:41:53 2025 Francois Michaut
+** Last update Mon Oct 19 08:59:53 2026 Francois Michaut
 **
 ** ServerConfig.hpp : Server Configuration
 */
@@ -22,6 +22,8 @@ namespace FileShare {
             static constexpr std::filesystem::perms SECURE_FOLDER_PERMS = std::filesystem::perms::owner_all;
 
             static auto default_private_keys_dir() -> const std::filesystem::path &;
+            static auto default_transfer_journal() -> const std::filesystem::path &;
+            static auto default_hash_cache() -> const std::filesystem::path &;
 
             // paths starting with '~/' will have this part replaced by the current user's home directory
             static auto load(std::filesystem::path config_file = "") -> ServerConfig;
@@ -39,6 +41,17 @@ namespace FileShare {
             [[nodiscard]] auto is_server_disabled() const -> bool { return m_disable_server; }
             auto set_server_disabled(bool disabled) -> ServerConfig & { m_disable_server = disabled; return *this; }
 
+            [[nodiscard]] auto get_max_active_transfers() const -> std::size_t { return m_max_active_transfers; }
+            auto set_max_active_transfers(std::size_t count) -> ServerConfig & { m_max_active_transfers = count; return *this; }
+
+            [[nodiscard]] auto get_transfer_journal() const -> const std::filesystem::path & { return m_transfer_journal; }
+            // An empty path disables the journal
+            auto set_transfer_journal(std::string_view path) -> ServerConfig &;
+
+            [[nodiscard]] auto get_hash_cache() const -> const std::filesystem::path & { return m_hash_cache; }
+            // An empty path keeps the file hashes in memory only
+            auto set_hash_cache(std::string_view path) -> ServerConfig &;
+
             void validate_config() const;
         private:
             template <class Archive>
@@ -69,5 +82,15 @@ namespace FileShare {
             // Note that when you initiate a connection to another server it will
             // be able to send commands as well.
             bool m_disable_server = false;
+
+            // Uploads sending packets at once, to all Peers. The others wait for one of them to finish.
+            // Bounds the files read at the same time. 0 means no limit.
+            std::size_t m_max_active_transfers = 8;
+            // Where the downloads in progress are recorded, to resume them once their peer
+            // reconnects, even after a crash. See TransferJournal.
+            std::filesystem::path m_transfer_journal = ServerConfig::default_transfer_journal();
+            // Where the file hashes are saved, so unchanged files are not hashed again after a restart.
+            // See Utils::HashCache.
+            std::filesystem::path m_hash_cache = ServerConfig::default_hash_cache();
     };
 }
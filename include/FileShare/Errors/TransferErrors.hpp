@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Sun Oct 22 13:22:09 2023 Francois Michaut
-** Last update Thu Nov 23 18:32:17 2023 Francois Michaut
+** Last update Mon Oct 19 08:43:01 2026 Francois Michaut
 **
 ** TransferErrors.hpp : Transfer related errors
 */
@@ -24,4 +24,22 @@ namespace FileShare::Errors::Transfer {
         private:
             std::string m_filename;
     };
+
+    class ResumeError : public FileShare::Error {
+        public:
+            ResumeError(const char *filename);
+            ResumeError(std::string filename);
+
+        private:
+            std::string m_filename;
+    };
+
+    class HashMismatchError : public FileShare::Error {
+        public:
+            HashMismatchError(const char *filename);
+            HashMismatchError(std::string filename);
+
+        private:
+            std::string m_filename;
+    };
 }
@@ -0,0 +1,97 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 04:58:24 2026 Francois Michaut
+** Last update Mon Oct 19 09:22:38 2026 Francois Michaut
+**
+** ListingCache.hpp : Content of the host folders listed, kept until they change
+*/
+
+#pragma once
+
+#include "FileShare/Protocol/Definitions.hpp"
+#include "FileShare/Utils/FileDescriptor.hpp"
+
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace FileShare {
+    // Content of a host folder, as listed in FILE_LIST
+    struct CachedListing {
+        struct Entry {
+            Protocol::FileInfo info; // `path` is only the file name
+            bool is_symlink;
+        };
+
+        // The FileInfoField filled in the entries. Never the hash: the HashCache checks the file did not change.
+        std::uint8_t fields = 0;
+        std::vector<Entry> entries;
+    };
+
+    // Listings of the host folders, shared by the Peers of a Server so a folder listed again
+    // is served from memory. Each folder cached is watched with inotify, and dropped from the
+    // cache as soon as anything in it changes. Caches nothing where inotify is not available.
+    // Folders too big to be kept are remembered as such, until they change as well.
+    class ListingCache {
+        public:
+            using Reader = std::function<std::optional<CachedListing>()>;
+            using ReadID = std::uint64_t;
+
+            // Folders kept, each of them using an inotify watch
+            static constexpr std::size_t DEFAULT_CAPACITY = 256;
+
+            ListingCache(std::size_t capacity = DEFAULT_CAPACITY);
+            ~ListingCache();
+
+            ListingCache(const ListingCache &) = delete;
+            ListingCache(ListingCache &&) = delete;
+            auto operator=(const ListingCache &) -> ListingCache & = delete;
+            auto operator=(ListingCache &&) -> ListingCache & = delete;
+
+            // Returns the cached listing of the folder if it has all of `fields`, nullptr otherwise
+            auto find(const std::filesystem::path &host_path, std::uint8_t fields) -> std::shared_ptr<const CachedListing>;
+            // Called before reading the folder, so a change while it is read is not missed. Returns nullopt if
+            // the listing would not be kept: the cache is disabled, or the folder is known to be too big.
+            auto start_read(const std::filesystem::path &host_path) -> std::optional<ReadID>;
+            // The folder was read since start_read(): the listing is cached unless the folder changed meanwhile,
+            // or was read again since. nullptr means it is too big, it is then not read again until it changes.
+            void finish_read(const std::filesystem::path &host_path, ReadID id, std::shared_ptr<const CachedListing> listing);
+            // find(), or `read` lists the folder and the result is stored with start_read() and finish_read().
+            // Returns nullptr if `read` did (eg: the folder is too big to be kept in memory).
+            auto get(const std::filesystem::path &host_path, std::uint8_t fields, const Reader &read) -> std::shared_ptr<const CachedListing>;
+            void invalidate(const std::filesystem::path &host_path);
+            void clear();
+
+            [[nodiscard]] auto is_enabled() const -> bool { return m_inotify.has_value(); }
+            [[nodiscard]] auto size() const -> std::size_t { return m_entries.size(); }
+            [[nodiscard]] auto get_capacity() const -> std::size_t { return m_capacity; }
+        private:
+            struct Entry {
+                int watch;
+                std::shared_ptr<const CachedListing> listing; // nullptr while it is read, or if it is too big
+                ReadID read_id; // Of the last read started
+                bool too_big;
+                std::list<std::string>::iterator lru_position;
+            };
+            using EntryMap = std::unordered_map<std::string, Entry>;
+
+            // Drop the folders which changed since the last call
+            void process_events();
+            void erase(EntryMap::iterator entry);
+
+            std::size_t m_capacity;
+            ReadID m_next_read_id = 0;
+            std::optional<Utils::FileDescriptor> m_inotify;
+            EntryMap m_entries;
+            std::unordered_map<int, std::string> m_watches;
+            std::list<std::string> m_lru; // Most recently used first
+    };
+}
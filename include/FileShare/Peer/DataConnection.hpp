@@ -0,0 +1,60 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:09:14 2026 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
+**
+** DataConnection.hpp : Extra connection to a Peer, carrying the packets of its transfers
+*/
+
+#pragma once
+
+#include "FileShare/MessageQueue.hpp"
+#include "FileShare/Peer/PeerBase.hpp"
+#include "FileShare/Peer/PreAuthPeer.hpp"
+#include "FileShare/Protocol/Protocol.hpp"
+
+#include <memory>
+#include <vector>
+
+namespace FileShare {
+    // Extra connection to the device of a Peer, only used for the DATA_PACKETs of its transfers.
+    // Packets of a big file are spread over the Peer's connections, each having its own TLS stream
+    // and its own window of messages in flight.
+    class DataConnection : public PeerBase {
+        public:
+            // The peer must have negotiated its Protocol
+            DataConnection(PreAuthPeer &&peer);
+
+            DataConnection(const DataConnection &) = delete;
+            DataConnection(DataConnection &&) = default;
+            auto operator=(const DataConnection &) -> DataConnection & = delete;
+            auto operator=(DataConnection &&) -> DataConnection & = default;
+
+            ~DataConnection() override = default;
+
+            // Ask the peer to use this connection for the Peer of our device. Blocking.
+            auto attach() -> Protocol::StatusCode;
+
+            // Returns everything received since the last call, replies included
+            [[nodiscard]] auto pull_requests() -> std::vector<Protocol::Request>;
+
+            void respond_to_request(const Protocol::Request &request, const Protocol::ResponseData &response);
+            auto send_request(Protocol::CommandCode command, std::shared_ptr<Protocol::IRequestData> request_data) -> Protocol::MessageID;
+
+            [[nodiscard]] auto get_message_queue() -> MessageQueue & { return m_message_queue; }
+        protected:
+            auto parse_bytes(std::string_view raw_msg, Protocol::Request &out) -> std::size_t override;
+
+        private:
+            void authorize_request(Protocol::Request request) override;
+
+            Protocol::Protocol m_protocol;
+            MessageQueue m_message_queue;
+            std::vector<Protocol::Request> m_request_buffer;
+    };
+
+    using DataConnection_ptr = std::unique_ptr<DataConnection>;
+}
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Sun Aug 28 09:23:07 2022 Francois Michaut
-** Last update Sat Aug 23 00:08:01 2025 Francois Michaut
+** Last update Mon Oct 19 09:22:38 2026 Francois Michaut
 **
 ** Peer.hpp : Client to communicate with peers using the FileShareProtocol
 */
@@ -13,22 +13,42 @@
 
 #include "FileShare/Config/Config.hpp"
 #include "FileShare/MessageQueue.hpp"
+#include "FileShare/Peer/DataConnection.hpp"
 #include "FileShare/Peer/PeerBase.hpp"
 #include "FileShare/Peer/PreAuthPeer.hpp"
 #include "FileShare/TransferHandler.hpp"
+#include "FileShare/TransferJournal.hpp"
+#include "FileShare/TransferScheduler.hpp"
 
 #include <CppSockets/IPv4.hpp>
 #include <CppSockets/Tls/Socket.hpp>
 #include <CppSockets/Version.hpp>
 
 #include <functional>
+#include <future>
 #include <memory>
 
 // TODO handle UDP
 namespace FileShare {
-    class Peer : public PeerBase {
+    class Peer : public PeerBase, public std::enable_shared_from_this<Peer> {
         public:
             using ProgressCallback = std::function<void( const std::string &filepath, std::size_t current_size, std::size_t total_size)>;
+            using DataConnectionList = std::vector<DataConnection_ptr>;
+
+            // Files smaller than this are only sent on the main connection, even if there are data connections
+            static constexpr std::size_t MIN_STRIPED_FILE_SIZE = 0x4000000; // 64 MiB
+            // Smaller files are always sent whole, even with deduplication enabled
+            static constexpr std::size_t MIN_DEDUPLICATED_FILE_SIZE = 0x100000; // 1 MiB
+            // When sending a folder, smaller files are packed in a single bundle instead of one transfer each
+            static constexpr std::size_t MAX_BUNDLED_FILE_SIZE = 0x100000; // 1 MiB
+            // Files up to this size (and packet_size) are sent within their SEND_FILE, saving a round trip
+            static constexpr std::size_t MAX_INLINE_FILE_SIZE = 0x4000; // 16 KiB
+            // Holes are only looked for in bigger files
+            static constexpr std::size_t MIN_SPARSE_FILE_SIZE = 0x100000; // 1 MiB
+            // Smaller files are read as they are sent: starting the read ahead threads would cost more
+            static constexpr std::size_t MIN_READ_AHEAD_FILE_SIZE = 0x1000000; // 16 MiB
+            // FILE_LIST packets sent without waiting for the peer to acknowledge them
+            static constexpr std::size_t FILE_LIST_WINDOW = 8;
 
             Peer(PreAuthPeer &&peer, Config config = Peer::default_config());
 
@@ -38,16 +58,27 @@ namespace FileShare {
             auto operator=(const Peer &) -> Peer & = delete;
             auto operator=(Peer &&) -> Peer & = default;
 
-            ~Peer() override = default;
+            ~Peer() override;
 
             // Call respond_to_request to answer to a Request Event
             void respond_to_request(Protocol::Request request, Protocol::StatusCode status);
             [[nodiscard]] auto pull_requests() -> std::vector<Protocol::Request>;
+            // Same, for the requests received along with the handshake: doesn't read the socket
+            [[nodiscard]] auto pull_buffered_requests() -> std::vector<Protocol::Request>;
 
             // Blocking functions
+            // filepath can be a folder: its files are sent along with the ones of its sub-folders
             auto send_file(const std::string &filepath, const ProgressCallback &progress_callback = [](const std::string &, std::size_t, std::size_t) {}) -> Protocol::Response<void>;
             auto receive_file(std::string filepath, const ProgressCallback &progress_callback = [](const std::string &, std::size_t, std::size_t) {}) -> Protocol::Response<void>;
-            auto list_files(std::string folderpath = "") -> Protocol::Response<std::vector<Protocol::FileInfo>>;
+            // Only `range` of the file is received, and given to `sink` instead of being saved in the downloads
+            // folder. The peer hashes the range alone, so it is verified without the rest of the file.
+            auto receive_file(
+                std::string filepath, Utils::FileRange range, std::shared_ptr<Utils::IByteSink> sink,
+                const ProgressCallback &progress_callback = [](const std::string &, std::size_t, std::size_t) {}
+            ) -> Protocol::Response<void>;
+            // `fields` are the FileInfoField to get along with the paths, eg: to know what needs syncing without asking for each file.
+            // The content of the sub folders is listed as well, up to `max_depth` levels below `folderpath`.
+            auto list_files(std::string folderpath = "", std::uint8_t fields = 0, std::size_t max_depth = 0) -> Protocol::Response<std::vector<Protocol::FileInfo>>;
 
             // TODO: Async functions
             auto send_file_async(std::string filepath, const ProgressCallback &progress_callback = [](const std::string &, std::size_t, std::size_t) {}) -> Protocol::Response<void>;
@@ -62,16 +93,68 @@ namespace FileShare {
             [[nodiscard]] auto get_config() -> Config & { return m_config; }
             void set_config(Config config) { m_config = std::move(config); }
 
+            [[nodiscard]] auto get_protocol() const -> const Protocol::Protocol & { return m_protocol; }
+
+            // Extra connections to the same device: the packets of big files are spread over them
+            void add_data_connection(DataConnection_ptr connection);
+            [[nodiscard]] auto get_data_connections() const -> const DataConnectionList & { return m_data_connections; }
+            // Process what was received on the data connection using this socket.
+            // Returns false if it is not (or no longer) one of our data connections.
+            auto poll_data_connection(RawSocketType fd) -> bool;
+
+            // Share the scheduler of the other Peers, instead of having one of our own. It is then up to its owner to run it.
+            // Set by the Server before any transfer starts: the Peer must be owned by a Peer_ptr, the scheduler
+            // only holds weak references to it.
+            void set_scheduler(std::shared_ptr<TransferScheduler> scheduler) { m_scheduler = std::move(scheduler); m_shared_scheduler = true; }
+            // Downloads are recorded there until they are finished, so they are not lost if we are stopped
+            void set_journal(std::shared_ptr<TransferJournal> journal) { m_journal = std::move(journal); }
+            // Host folders listed for the peer are kept there until they change, and shared with the other peers
+            void set_listing_cache(std::shared_ptr<ListingCache> cache) { m_listing_cache = std::move(cache); }
+            // Ask the peer again for the downloads of the journal, resuming them where they stopped. Non-blocking.
+            void resume_downloads();
+            // Reply to the RECEIVE_FILEs whose upload finished being prepared on another thread. Non-blocking.
+            void poll_pending_uploads();
+            [[nodiscard]] auto has_pending_uploads() const -> bool { return !m_pending_uploads.empty(); }
+
         private:
             using UploadTransferMap = std::unordered_map<Protocol::MessageID, UploadTransferHandler>;
             using DownloadTransferMap = std::unordered_map<Protocol::MessageID, DownloadTransferHandler>;
             using ListFilesTransferMap = std::unordered_map<Protocol::MessageID, ListFilesTransferHandler>;
             using FileListTransferMap = std::unordered_map<Protocol::MessageID, FileListTransferHandler>;
 
+            struct RangeDownload {
+                Utils::FileRange range;
+                std::shared_ptr<Utils::IByteSink> sink;
+            };
+
+            // What a RECEIVE_FILE asks us to send. Working it out reads the whole file (to hash it, or make a
+            // delta), so it doesn't use the Peer: it can be done on another thread.
+            struct UploadContent {
+                Protocol::StatusCode status = Protocol::StatusCode::STATUS_OK;
+                // The file, or a delta against the peer's copy of it
+                std::filesystem::path path;
+                std::string file_hash;
+                std::filesystem::file_time_type updated_at;
+                std::size_t size = 0;
+                // Not 0 if path is a delta, made with this block size
+                std::size_t delta_block_size = 0;
+                // Part of the file sent, if the peer asked for one
+                std::optional<Utils::FileRange> range;
+            };
+            // A RECEIVE_FILE we reply to once its UploadContent is ready
+            struct PendingUpload {
+                std::string virtual_filepath;
+                std::size_t packet_size;
+                std::size_t packet_start;
+                Utils::CompressionAlgorithm compression;
+                std::future<UploadContent> content;
+            };
+
             // TODO: Remove
             [[deprecated]] auto wait_for_status(Protocol::MessageID message_id) -> Protocol::StatusCode;
 
             void send_reply(Protocol::MessageID message_id, Protocol::StatusCode status);
+            void send_reply(Protocol::MessageID message_id, const Protocol::ResponseData &response);
             auto send_request(Protocol::CommandCode command, std::shared_ptr<Protocol::IRequestData> request_data) -> std::uint8_t;
             auto send_request(Protocol::Request request) -> std::uint8_t;
 
@@ -79,17 +162,79 @@ namespace FileShare {
             auto parse_bytes(std::string_view raw_msg, Protocol::Request &out) -> std::size_t override;
 
             // TODO: Rename to handle_reply / process_reply / dispatch_reply ?
-            void receive_reply(Protocol::MessageID message_id, Protocol::StatusCode status);
+            void receive_reply(Protocol::MessageID message_id, const Protocol::ResponseData &reply);
 
-            auto prepare_upload(std::filesystem::path host_filepath, std::string virtual_filepath, std::size_t packet_size, std::size_t packet_start) -> std::pair<std::optional<UploadTransferHandler>, Protocol::StatusCode>;
+            // v0.0.0 peers don't know the optional fields of SEND_FILE / RECEIVE_FILE
+            [[nodiscard]] auto has_file_fields() const -> bool { return m_protocol.version() >= Protocol::Version(Protocol::Version::v0_1_0); }
+            auto prepare_upload(
+                std::filesystem::path host_filepath, std::string virtual_filepath, std::size_t packet_size,
+                std::size_t packet_start, Utils::CompressionAlgorithm compression, const Utils::FileSignature &signature = {},
+                const std::optional<Utils::FileRange> &range = std::nullopt
+            ) -> std::pair<std::optional<UploadTransferHandler>, Protocol::StatusCode>;
+            // The parts of prepare_upload reading the whole file
+            static auto prepare_content(
+                const std::filesystem::path &host_filepath, std::size_t packet_start, const Utils::FileSignature &signature,
+                const std::optional<Utils::FileRange> &range
+            ) -> UploadContent;
+            auto make_upload(
+                UploadContent content, std::string virtual_filepath, std::size_t packet_size, std::size_t packet_start,
+                Utils::CompressionAlgorithm compression
+            ) -> std::pair<std::optional<UploadTransferHandler>, Protocol::StatusCode>;
+            // Reply to a RECEIVE_FILE, then send the SEND_FILE of its upload if there is one
+            void answer_receive_file(Protocol::MessageID request_id, std::pair<std::optional<UploadTransferHandler>, Protocol::StatusCode> upload);
+
+            auto prepare_bundle(
+                const std::vector<Utils::BundleFile> &files, std::string virtual_dirpath,
+                std::filesystem::file_time_type updated_at, std::size_t packet_size
+            ) -> UploadTransferHandler;
+            // Send the next pages of a listing while there are free slots, up to `max_packets`.
+            // The handler is erased once it has nothing more to send.
+            void send_file_list(Protocol::MessageID request_id, std::size_t max_packets);
             auto create_host_upload(std::filesystem::path host_filepath) -> UploadTransferMap::iterator;
+            // The upload is left to the scheduler once the peer accepted it
             auto create_upload(UploadTransferHandler handler) -> UploadTransferMap::iterator;
-            auto create_download(Protocol::MessageID request_id, const std::shared_ptr<Protocol::SendFileData> &data) -> DownloadTransferMap::iterator;
+            void erase_upload(UploadTransferMap::iterator upload);
+            // `receive_file_id` is our RECEIVE_FILE the SEND_FILE answers, if any: a range goes to the sink it was asked for
+            auto create_download(
+                Protocol::MessageID request_id, const std::shared_ptr<Protocol::SendFileData> &data, std::size_t packet_start = 0,
+                std::optional<Protocol::MessageID> receive_file_id = std::nullopt
+            ) -> DownloadTransferMap::iterator;
+            // Leaves the download in the journal if it is not finished
+            void erase_download(DownloadTransferMap::iterator download);
+
+            // `connection` is the data connection to use, or nullptr for the main connection.
+            // Returns the size of the packet sent, 0 if none was.
+            auto send_data_packet(DataConnection *connection, Protocol::MessageID request_id, UploadTransferHandler &handler) -> std::size_t;
+            [[nodiscard]] auto is_striped(const UploadTransferHandler &handler) const -> bool;
+            // Send one packet of the upload, on the first connection with room for it. Returns its size, 0 if none was sent.
+            auto send_scheduled_packet(Protocol::MessageID request_id) -> std::size_t;
+            // Send packets until the windows of our connections are full, unless the scheduler is shared:
+            // its owner runs it then, across all its Peers
+            void run_scheduler();
+            void data_packet_acknowledged(Protocol::DataPacketData &packet, const Protocol::ResponseData &reply);
+            auto receive_data_packet(const Protocol::DataPacketData &data) -> Protocol::ResponseData;
+            void receive_data_request(DataConnection &connection, Protocol::Request request);
+            // Wait for data on any of our connections, and process it
+            void poll_connections();
+            // Send the packets of an upload created by create_upload() until the peer received all of them
+            auto wait_for_upload(UploadTransferMap::iterator upload, const std::string &filepath, const ProgressCallback &progress_callback) -> Protocol::Response<void>;
+            auto send_directory(const std::filesystem::path &host_dirpath, const ProgressCallback &progress_callback) -> Protocol::Response<void>;
+            // Wait for the SEND_FILE answering our RECEIVE_FILE, then for the download it started to finish.
+            // Returns nullopt if the download could not be started (eg: it could not be resumed).
+            auto wait_for_download(const std::string &filepath, Protocol::MessageID message_id, const ProgressCallback &progress_callback) -> std::optional<Protocol::Response<void>>;
+            auto download_path(const std::string &virtual_filepath) -> std::filesystem::path;
 
         protected:
             static auto default_config() -> Config;
 
         private:
+            struct ScheduledUpload {
+                // Set once the peer accepted the upload
+                std::optional<TransferScheduler::TransferID> id;
+                // A blocking call waits on it: it can't be queued behind transfers which only progress in between calls
+                bool start_now = false;
+            };
+
             Config m_config;
 
             Protocol::Protocol m_protocol;
@@ -100,6 +245,22 @@ namespace FileShare {
             UploadTransferMap m_upload_transfers;
             ListFilesTransferMap m_list_files_transfers;
             FileListTransferMap m_file_list_transfers;
+            // Ranges being received by receive_file(), by the message ID of their RECEIVE_FILE
+            std::unordered_map<Protocol::MessageID, RangeDownload> m_range_downloads;
+            // Downloads of the journal asked for again by resume_downloads() -> the packet_start we asked for
+            std::unordered_map<std::string, std::size_t> m_resumed_downloads;
+            // RECEIVE_FILEs from the peer whose upload is being prepared, by message ID
+            std::unordered_map<Protocol::MessageID, PendingUpload> m_pending_uploads;
+
+            DataConnectionList m_data_connections;
+
+            // No limit of active transfers by default: they would wait for ones which only progress in between calls
+            std::shared_ptr<TransferScheduler> m_scheduler = std::make_shared<TransferScheduler>(0);
+            bool m_shared_scheduler = false;
+            std::shared_ptr<TransferJournal> m_journal;
+            std::shared_ptr<ListingCache> m_listing_cache;
+            // Every upload, by message ID
+            std::unordered_map<Protocol::MessageID, ScheduledUpload> m_scheduled_uploads;
     };
 
     using Peer_ptr = std::shared_ptr<Peer>;
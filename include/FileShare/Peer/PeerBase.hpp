@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Mon Jul 28 19:12:40 2025 Francois Michaut
-** Last update Fri Aug 22 13:08:11 2025 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
 **
 ** PeerBase.hpp : Base of the Peer class
 */
@@ -40,6 +40,9 @@ namespace FileShare {
             [[nodiscard]] auto get_device_name() const -> std::string_view { return m_device_name; }
             [[nodiscard]] auto get_public_key() const -> std::string_view { return m_public_key; }
 
+            // Bytes TLS already read from the socket and decrypted, which poll() doesn't report
+            [[nodiscard]] auto has_buffered_data() const -> bool;
+
         protected:
             PeerBase(const CppSockets::IEndpoint &peer, CppSockets::TlsContext ctx = {});
             PeerBase(CppSockets::TlsSocket &&peer);
@@ -48,6 +51,8 @@ namespace FileShare {
             virtual auto parse_bytes(std::string_view raw_msg, Protocol::Request &out) -> std::size_t = 0;
 
             void poll_requests();
+            // Parse what is left in the buffer, without reading the socket
+            void parse_requests();
 
             auto get_buffer() -> std::string & { return m_buffer; }
 
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Tue Jul 29 15:23:09 2025 Francois Michaut
-** Last update Thu Aug 21 09:21:40 2025 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
 **
 ** PreAuthPeer.hpp : Class to represent a Peer before it has been sucesfully Authenticated
 */
@@ -35,6 +35,10 @@ namespace FileShare {
             [[nodiscard]] auto get_type() const -> Type { return m_type; }
             [[nodiscard]] auto get_protocol() const -> Protocol::Protocol;
             [[nodiscard]] auto has_protocol() const -> bool { return m_protocol.has_value(); }
+            // Set if its first request asked to be a data connection of the Peer of its device. The Server replies.
+            [[nodiscard]] auto get_data_connection_request() const -> const std::optional<Protocol::Request> & { return m_data_connection_request; }
+            // A request was received after the Protocol was negotiated (and left in the buffer, unless it is a DATA_CONNECTION)
+            [[nodiscard]] auto received_request() const -> bool { return !m_first_extra_request; }
         protected:
             auto parse_bytes(std::string_view raw_msg, Protocol::Request &out) -> std::size_t override;
 
@@ -44,6 +48,7 @@ namespace FileShare {
             Type m_type;
             std::optional<Protocol::Protocol> m_protocol;
             bool m_first_extra_request = true;
+            std::optional<Protocol::Request> m_data_connection_request;
     };
 
     using PreAuthPeer_ptr = std::shared_ptr<PreAuthPeer>;
@@ -4,15 +4,19 @@
 ** Author Francois Michaut
 **
 ** Started on  Sun Aug 28 09:28:47 2022 Francois Michaut
-** Last update Fri Aug 22 22:53:48 2025 Francois Michaut
+** Last update Mon Oct 19 09:16:53 2026 Francois Michaut
 **
 ** Definitions.hpp : General definitions and classes
 */
 
 #pragma once
 
+#include "FileShare/Utils/FileHash.hpp"
+
 #include <cstdint>
+#include <filesystem>
 #include <memory>
+#include <optional>
 #include <string>
 #include <vector>
 
@@ -37,6 +41,7 @@ namespace FileShare::Protocol {
 
         PING                = 0x30,
         DATA_PACKET         = 0x42,
+        DATA_CONNECTION     = 0x43, // First request on an extra connection, to carry DATA_PACKETs
 
         PAIR_REQUEST        = 0x50,
         ACCEPT_PAIR_REQUEST = 0x51,
@@ -58,7 +63,9 @@ namespace FileShare::Protocol {
         FORBIDDEN           = 0x43,
         FILE_NOT_FOUND      = 0x44,
         UNKNOWN_COMMAND     = 0x45,
-        TOO_MANY_REQUESTS   = 0x49,
+        CHUNK_MISMATCH      = 0x46, // DATA_PACKET completed a chunk that doesn't match its hash -> resend the chunk
+        UNSUPPORTED_COMPRESSION = 0x47, // SEND_FILE uses a compression we did not enable -> send it uncompressed
+        TOO_MANY_REQUESTS   = 0x49, // DATA_PACKET too far ahead of the one a stream expects -> send it again later
 
         INTERNAL_ERROR      = 0x50,
     };
@@ -68,6 +75,16 @@ namespace FileShare::Protocol {
         DIRECTORY  = 0x01,
     };
 
+    // LIST_FILES flags, selecting the optional fields of the FILE_LIST entries.
+    // Each entry has the fields it carries in the high bits of its FILE_TYPE, so they can't overlap with FileType.
+    enum FileInfoField : std::uint8_t {
+        FILE_INFO_SIZE       = 0x10,
+        FILE_INFO_UPDATED_AT = 0x20,
+        FILE_INFO_MODE       = 0x40,
+        FILE_INFO_HASH       = 0x80, // Only for files with a cached hash: the files are never read to list them
+    };
+    constexpr std::uint8_t FILE_INFO_FIELDS = FILE_INFO_SIZE | FILE_INFO_UPDATED_AT | FILE_INFO_MODE | FILE_INFO_HASH;
+
     auto str_to_command(std::string_view str) -> CommandCode;
     auto str_to_status(std::string_view str) -> StatusCode;
     auto str_to_file_type(std::string_view str) -> FileType;
@@ -78,6 +95,17 @@ namespace FileShare::Protocol {
 
     using MessageID = std::uint8_t;
 
+    // Bounds of the packet size negotiated for each transfer. Bigger packets
+    // amortize the per-packet overhead (header, reply) on bulk transfers.
+    constexpr std::size_t MIN_PACKET_SIZE = 0x1000;         // 4 KiB
+    constexpr std::size_t MAX_PACKET_SIZE = 0x100000;       // 1 MiB
+    constexpr std::size_t DEFAULT_PACKET_SIZE = 0x10000;    // 64 KiB
+
+    auto is_valid_packet_size(std::size_t packet_size) -> bool;
+    // Returns the packet size to use for a transfer requested with `requested` packet size.
+    // A `requested` size of 0 lets us choose, in which case `preferred` is used.
+    auto negotiate_packet_size(std::size_t requested, std::size_t preferred = DEFAULT_PACKET_SIZE) -> std::size_t;
+
     class IRequestData;
     struct Request {
         CommandCode code;
@@ -94,6 +122,12 @@ namespace FileShare::Protocol {
     struct FileInfo {
         std::string path;
         FileType file_type;
+        // Optional fields, only set if they were asked for and the peer knows them
+        std::optional<std::size_t> size = std::nullopt; // Files only
+        std::optional<std::filesystem::file_time_type> last_updated = std::nullopt;
+        std::optional<std::filesystem::perms> mode = std::nullopt;
+        Utils::HashAlgorithm hash_algorithm = Utils::HashAlgorithm::SHA512;
+        std::optional<std::string> hash = std::nullopt; // Files only
     };
 
     struct FileList { // TODO: remove
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Fri May  5 21:32:03 2023 Francois Michaut
-** Last update Fri Aug 15 13:48:49 2025 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
 **
 ** ProtocolHandler.hpp : ProtocolHandler for the v0.0.0 of the protocol
 */
@@ -26,23 +26,32 @@ namespace FileShare::Protocol::Handler::v0_0_0 { // NOLINT(readability-identifie
             auto format_file_list(std::uint8_t message_id, const FileListData &data) -> std::string override;
             auto format_data_packet(std::uint8_t message_id, const DataPacketData &data) -> std::string override;
             auto format_ping(std::uint8_t message_id, const PingData &data) -> std::string override;
+            auto format_data_connection(std::uint8_t message_id, const DataConnectionData &data) -> std::string override;
 
             auto format_response(std::uint8_t message_id, const ResponseData &data) -> std::string override;
 
             auto format_request(const Request &request) -> std::string override;
             auto parse_request(std::string_view raw_msg, Request &out) -> std::size_t override;
+        protected:
+            // SEND_FILE / RECEIVE_FILE with the fields of this version, followed by the `extensions` of a later one
+            auto format_extended_send_file(std::uint8_t message_id, const SendFileData &data, std::string_view extensions) -> std::string;
+            auto format_extended_receive_file(std::uint8_t message_id, const ReceiveFileData &data, std::string_view extensions) -> std::string;
+            // Parse the fields of this version, leaving the rest in `payload`
+            auto parse_send_file_fields(std::string_view &payload) -> std::shared_ptr<SendFileData>;
+            auto parse_receive_file_fields(std::string_view &payload) -> std::shared_ptr<ReceiveFileData>;
+
+            virtual auto parse_send_file(std::string_view payload) -> std::shared_ptr<IRequestData>;
+            virtual auto parse_receive_file(std::string_view payload) -> std::shared_ptr<IRequestData>;
         private:
-            constexpr static std::size_t PACKET_SIZE = 4096; // TODO experiment with this
             constexpr static std::size_t BASE_HEADER_SIZE = 6;
 
             auto get_request_data(CommandCode cmd, std::string_view payload) -> std::shared_ptr<IRequestData>;
 
             auto parse_response(std::string_view payload) -> std::shared_ptr<IRequestData>;
-            auto parse_send_file(std::string_view payload) -> std::shared_ptr<IRequestData>;
-            auto parse_receive_file(std::string_view payload) -> std::shared_ptr<IRequestData>;
             auto parse_list_files(std::string_view payload) -> std::shared_ptr<IRequestData>;
             auto parse_file_list(std::string_view payload) -> std::shared_ptr<IRequestData>;
             auto parse_data_packet(std::string_view payload) -> std::shared_ptr<IRequestData>;
             auto parse_ping(std::string_view payload) -> std::shared_ptr<IRequestData>;
+            auto parse_data_connection(std::string_view payload) -> std::shared_ptr<IRequestData>;
     };
 }
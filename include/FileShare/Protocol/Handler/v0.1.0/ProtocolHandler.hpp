@@ -0,0 +1,51 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 08:12:40 2026 Francois Michaut
+** Last update Mon Oct 19 09:10:48 2026 Francois Michaut
+**
+** ProtocolHandler.hpp : ProtocolHandler for the v0.1.0 of the protocol
+*/
+
+#pragma once
+
+#include "FileShare/Protocol/Handler/v0.0.0/ProtocolHandler.hpp"
+
+// v0.1.0 adds optional fields to SEND_FILE and RECEIVE_FILE, after the ones of v0.0.0.
+// A FIELDS byte tells which ones are sent, so a v0.0.0 peer never sees them.
+namespace FileShare::Protocol::Handler::v0_1_0 { // NOLINT(readability-identifier-naming)
+    // SEND_FILE flags. The fields are sent in this order.
+    enum SendFileField : std::uint8_t {
+        SEND_FILE_CHUNK_HASHES   = 0x01,
+        SEND_FILE_DELTA          = 0x02,
+        SEND_FILE_COMPRESSION    = 0x04,
+        SEND_FILE_CONTENT_CHUNKS = 0x08,
+        SEND_FILE_FILE_TYPE      = 0x10,
+        SEND_FILE_INLINE_CONTENT = 0x20,
+        SEND_FILE_HOLES          = 0x40,
+        SEND_FILE_RANGE          = 0x80,
+    };
+    constexpr std::uint8_t SEND_FILE_FIELDS = SEND_FILE_CHUNK_HASHES | SEND_FILE_DELTA | SEND_FILE_COMPRESSION |
+        SEND_FILE_CONTENT_CHUNKS | SEND_FILE_FILE_TYPE | SEND_FILE_INLINE_CONTENT | SEND_FILE_HOLES | SEND_FILE_RANGE;
+
+    // RECEIVE_FILE flags. The fields are sent in this order.
+    enum ReceiveFileField : std::uint8_t {
+        RECEIVE_FILE_SIGNATURE   = 0x01,
+        RECEIVE_FILE_COMPRESSION = 0x02,
+        RECEIVE_FILE_RANGE       = 0x04,
+    };
+    constexpr std::uint8_t RECEIVE_FILE_FIELDS = RECEIVE_FILE_SIGNATURE | RECEIVE_FILE_COMPRESSION | RECEIVE_FILE_RANGE;
+
+    class ProtocolHandler : public v0_0_0::ProtocolHandler {
+        public:
+            ~ProtocolHandler() override = default;
+
+            auto format_send_file(std::uint8_t message_id, const SendFileData &data) -> std::string override;
+            auto format_receive_file(std::uint8_t message_id, const ReceiveFileData &data) -> std::string override;
+        protected:
+            auto parse_send_file(std::string_view payload) -> std::shared_ptr<IRequestData> override;
+            auto parse_receive_file(std::string_view payload) -> std::shared_ptr<IRequestData> override;
+    };
+}
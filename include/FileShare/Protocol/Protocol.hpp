@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Thu Aug 25 22:59:37 2022 Francois Michaut
-** Last update Fri Aug 15 13:57:44 2025 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
 **
 ** Protocol.hpp : Main class to interract with the protocol
 */
@@ -38,6 +38,7 @@ namespace FileShare::Protocol {
             virtual auto format_file_list(std::uint8_t message_id, const FileListData &data) -> std::string = 0;
             virtual auto format_data_packet(std::uint8_t message_id, const DataPacketData &data) -> std::string = 0;
             virtual auto format_ping(std::uint8_t message_id, const PingData &data) -> std::string = 0;
+            virtual auto format_data_connection(std::uint8_t message_id, const DataConnectionData &data) -> std::string = 0;
 
             virtual auto format_response(std::uint8_t message_id, const ResponseData &data) -> std::string = 0;
 
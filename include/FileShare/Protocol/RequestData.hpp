@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Sun Jul 16 11:25:51 2023 Francois Michaut
-** Last update Thu Aug 14 19:36:01 2025 Francois Michaut
+** Last update Mon Oct 19 09:19:12 2026 Francois Michaut
 **
 ** RequestData.hpp : RequestData interface. Subclasses will represent every request payload
 */
@@ -13,7 +13,13 @@
 
 #include "FileShare/Protocol/Definitions.hpp"
 #include "FileShare/Protocol/Version.hpp"
+#include "FileShare/Utils/Compression.hpp"
+#include "FileShare/Utils/ContentChunker.hpp"
+#include "FileShare/Utils/Delta.hpp"
 #include "FileShare/Utils/FileHash.hpp"
+#include "FileShare/Utils/Sparse.hpp"
+
+#include <optional>
 
 namespace FileShare::Protocol {
     class IRequestData {
@@ -26,11 +32,16 @@ namespace FileShare::Protocol {
     class ResponseData : public IRequestData {
         public:
             ResponseData(StatusCode status);
+            ResponseData(StatusCode status, std::size_t chunk);
              ~ResponseData() override = default;
 
             [[nodiscard]] auto debug_str() const -> std::string override;
 
             StatusCode status;
+            // CHUNK_MISMATCH only: index of the chunk to send again
+            std::size_t chunk = 0;
+            // SEND_FILE with content chunks only: the ones we already have. Empty if we have none.
+            std::vector<bool> known_chunks;
     };
 
     class SupportedVersionsData : public IRequestData {
@@ -70,6 +81,51 @@ namespace FileShare::Protocol {
             std::filesystem::file_time_type last_updated;
             std::size_t packet_size;
             std::size_t total_packets;
+
+            // Optional hash tree, to verify the file chunk by chunk. Disabled if chunk_size is 0.
+            // chunk_size is a multiple of packet_size, and chunks start from the beginning of the file
+            // (not from the first packet sent). There is no root hash: the chunk hashes come with filehash,
+            // which verifies the whole file once complete.
+            std::size_t chunk_size = 0;
+            std::vector<std::string> chunk_hashes;
+
+            // If not 0, the packets are not the file content but a delta against the receiver's copy
+            // of the file, using the block size of the signature it sent in RECEIVE_FILE.
+            // total_packets and the hash tree then apply to the delta.
+            std::size_t delta_block_size = 0;
+
+            // Compression the sender may use on the DATA_PACKETs of this transfer. Each packet
+            // says if it is compressed, as the ones which don't shrink are sent as is. In reply to a
+            // RECEIVE_FILE, only the compression it accepts is used. Otherwise, the receiver can decline
+            // it with UNSUPPORTED_COMPRESSION.
+            Utils::CompressionAlgorithm compression = Utils::CompressionAlgorithm::NONE;
+
+            // Optional content-defined chunks of the file. The receiver replies which ones it already
+            // has (from any file), and only the missing ones are sent, back to back. total_packets
+            // is then updated by both sides to count these packets only. Not used with a hash tree
+            // or a delta.
+            std::vector<Utils::ContentChunk> content_chunks;
+
+            // DIRECTORY if the data is a bundle of files (see Utils/Bundle.hpp) to unpack in the
+            // filepath folder. filehash is then the hash of the whole bundle, and the transfer
+            // can't be resumed nor use a hash tree, a delta or content chunks.
+            FileType file_type = FileType::FILE;
+
+            // If not empty, the ranges of the file which only contain zeros, sorted. They are not sent: the
+            // packets only contain the rest of the file, back to back, and total_packets counts these packets
+            // only. file_size is then the size of the whole file. Not used with a hash tree, a delta, content
+            // chunks or a bundle.
+            std::vector<Utils::FileRange> holes;
+            std::size_t file_size = 0;
+
+            // The whole content of a small file, sent along with the request instead of in DATA_PACKETs.
+            // total_packets is then 0, and it can't be used with any of the fields above.
+            std::optional<std::string> inline_content;
+
+            // Set if only this part of the file is sent, as asked in RECEIVE_FILE. filehash is then the hash
+            // of this part only, so the receiver can verify it without the rest of the file. Not used with a
+            // hash tree, a delta, content chunks, a bundle or holes.
+            std::optional<Utils::FileRange> range;
     };
 
     class ReceiveFileData : public IRequestData {
@@ -82,16 +138,29 @@ namespace FileShare::Protocol {
             std::string filepath;
             std::size_t packet_size;
             std::size_t packet_start;
+
+            // Optional signature of our current copy of the file, to only receive what changed.
+            // Disabled if signature.block_size is 0.
+            Utils::FileSignature signature;
+
+            // Optional part of the file to receive: `size` bytes from `offset`, less if the file ends before.
+            // packet_start then counts from the start of the range. Not used with a signature.
+            std::optional<Utils::FileRange> range;
+
+            // Compression we accept on the DATA_PACKETs. The sender only uses it if it enabled it too.
+            Utils::CompressionAlgorithm compression = Utils::CompressionAlgorithm::NONE;
     };
 
     class ListFilesData : public IRequestData {
         public:
-            ListFilesData(std::string folderpath);
+            ListFilesData(std::string folderpath, std::uint8_t fields = 0, std::size_t max_depth = 0);
              ~ListFilesData() override = default;
 
             [[nodiscard]] auto debug_str() const -> std::string override;
 
             std::string folderpath;
+            std::uint8_t fields; // FileInfoField flags
+            std::size_t max_depth; // Levels of sub folders to list as well, 0 for the folder content only
     };
 
     class FileListData : public IRequestData {
@@ -116,6 +185,8 @@ namespace FileShare::Protocol {
             std::uint8_t request_id;
             std::size_t packet_id;
             std::string data;
+            // How data is compressed. Parsed packets are always decompressed.
+            Utils::CompressionAlgorithm compression = Utils::CompressionAlgorithm::NONE;
     };
 
     class PingData : public IRequestData {
@@ -126,6 +197,16 @@ namespace FileShare::Protocol {
             [[nodiscard]] auto debug_str() const -> std::string override;
     };
 
+    // The connection it is sent on joins the already connected Peer of the same device, to carry
+    // the DATA_PACKETs of its transfers alongside the main connection.
+    class DataConnectionData : public IRequestData {
+        public:
+            DataConnectionData() = default;
+             ~DataConnectionData() override = default;
+
+            [[nodiscard]] auto debug_str() const -> std::string override;
+    };
+
     // TODO: Currently unused
     class ApprovalStatusData : public IRequestData {
         public:
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Fri May  5 19:42:09 2023 Francois Michaut
-** Last update Sun Aug 24 11:20:56 2025 Francois Michaut
+** Last update Mon Oct 19 08:14:40 2026 Francois Michaut
 **
 ** Version.hpp : A class to represent a Protocol Version
 */
@@ -27,10 +27,10 @@ namespace FileShare::Protocol {
             enum VersionEnum : std::uint32_t {
                 v0_0_0 = 0x000000,
                 // v0_0_1 = 0x000001,
-                // v0_1_0 = 0x000100,
+                v0_1_0 = 0x000100,
 
                 MIN = v0_0_0,
-                MAX = v0_0_0
+                MAX = v0_1_0
             };
             Version(VersionEnum version);
 
@@ -47,7 +47,8 @@ namespace FileShare::Protocol {
             [[nodiscard]] auto to_string() const -> std::string_view;
 
             inline static constexpr auto NAMES = frozen::make_unordered_map<VersionEnum, std::string_view>({
-                {v0_0_0, "v0.0.0"}
+                {v0_0_0, "v0.0.0"},
+                {v0_1_0, "v0.1.0"}
             });
         private:
             VersionEnum m_version;
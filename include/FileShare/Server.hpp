@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Mon Aug 29 19:01:51 2022 Francois Michaut
-** Last update Fri Aug 22 00:39:26 2025 Francois Michaut
+** Last update Mon Oct 19 09:22:38 2026 Francois Michaut
 **
 ** Server.hpp : Server part used to receive qnd process requests of Peers
 */
@@ -14,9 +14,12 @@
 #include "FileShare/Config/Config.hpp"
 #include "FileShare/Config/KnownPeerStore.hpp"
 #include "FileShare/Config/ServerConfig.hpp"
+#include "FileShare/ListingCache.hpp"
 #include "FileShare/Peer/Peer.hpp"
 #include "FileShare/Peer/PreAuthPeer.hpp"
 #include "FileShare/Protocol/Definitions.hpp"
+#include "FileShare/TransferJournal.hpp"
+#include "FileShare/TransferScheduler.hpp"
 
 #include <CppSockets/Socket.hpp>
 #include <CppSockets/Tls/Context.hpp>
@@ -67,6 +70,8 @@ namespace FileShare {
 
             using PeerMap = std::unordered_map<RawSocketType, Peer_ptr>;
             using PreAuthPeerMap = std::unordered_map<RawSocketType, PreAuthPeer_ptr>;
+            // Socket of a data connection -> Peer using it
+            using DataConnectionMap = std::unordered_map<RawSocketType, Peer_ptr>;
 
             using FdVector = std::vector<struct pollfd>;
 
@@ -93,6 +98,7 @@ namespace FileShare {
             auto pull_event(Event &result) -> bool; // TODO: figure out how to accept commands here
 
             // TODO: Server will handle the ProtocolVersion negotiation + Peer verification
+            // Connecting to an endpoint also opens config.get_data_connections() extra connections to it
             auto connect(CppSockets::TlsSocket peer) -> Peer_ptr & { return connect(std::move(peer), this->m_peer_config); }
             auto connect(const CppSockets::IEndpoint &peer) -> Peer_ptr & { return connect(peer, this->m_peer_config); }
             auto connect(CppSockets::TlsSocket peer, const Config &config) -> Peer_ptr &;
@@ -122,16 +128,31 @@ namespace FileShare {
 
             auto get_poll_fds() const -> const FdVector & { return m_fds; }
 
+            // Shared by all the Peers: decides which of their uploads sends packets, see ServerConfig
+            auto get_scheduler() const -> const TransferScheduler & { return *m_scheduler; }
+
             void restart();
             auto disabled() const -> bool { return m_config.is_server_disabled(); }
             void set_disabled(bool disabled);
         private:
+            // Packets the scheduler sends at most between 2 polls, so incomming messages are not delayed
+            static constexpr std::size_t MAX_SCHEDULED_PACKETS = 64;
+            // Poll timeout while a Peer prepares an upload on another thread, to reply soon after it is ready
+            static constexpr long PENDING_UPLOADS_POLL_TIMEOUT_NS = 10'000'000; // 10 ms
+
             void initialize_private_key();
             void poll_events();
 
             auto handle_peer_events(FdVector::iterator iter) -> FdVector::iterator;
             auto delete_peer(FdVector::iterator iter) -> FdVector::iterator;
             auto delete_pre_auth_peer(FdVector::iterator iter, PreAuthPeerMap &map) -> FdVector::iterator;
+            auto delete_data_connection(FdVector::iterator iter) -> FdVector::iterator;
+            // The PreAuthPeer of `map` using this socket sent DATA_CONNECTION
+            auto attach_data_connection(FdVector::iterator iter, PreAuthPeerMap &map) -> FdVector::iterator;
+            // Opens up to `count`: stops at the first one which fails
+            void open_data_connections(const CppSockets::IEndpoint &endpoint, const Peer_ptr &peer, std::size_t count);
+            // A Peer of the same device as `peer`, if any
+            auto find_device_peer(const PeerBase &peer) -> PeerMap::iterator;
             auto insert_peer(PreAuthPeer_ptr &&peer) -> Peer_ptr &;
             auto insert_peer(Peer_ptr peer) -> Peer_ptr &;
 
@@ -148,6 +169,17 @@ namespace FileShare {
             PreAuthPeerMap m_handshake_peers;
             PreAuthPeerMap m_pending_authorization_peers;
             PeerMap m_peers;
+            DataConnectionMap m_data_connections;
+
+            std::shared_ptr<TransferScheduler> m_scheduler;
+            // The scheduler stopped at MAX_SCHEDULED_PACKETS: the next poll must not wait
+            bool m_scheduler_busy = false;
+            // Loaded when the Server starts: the downloads it lists are resumed as their peers reconnect
+            std::shared_ptr<TransferJournal> m_journal;
+            // Newly connected devices: their downloads are resumed by the next poll_events(), not while connecting
+            std::vector<std::weak_ptr<Peer>> m_resuming_peers;
+            // Shared by the peers, since they list the same folders
+            std::shared_ptr<ListingCache> m_listing_cache;
 
             FdVector m_fds;
             std::vector<Event> m_events;
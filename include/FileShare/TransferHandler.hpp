@@ -4,15 +4,27 @@
 ** Author Francois Michaut
 **
 ** Started on  Thu Aug 24 08:51:14 2023 Francois Michaut
-** Last update Sat Aug 23 11:26:19 2025 Francois Michaut
+** Last update Mon Oct 19 09:22:38 2026 Francois Michaut
 **
 ** TransferHandler.hpp : Classes to handle the file transfers
 */
 
 #include "FileShare/Config/FileMapping.hpp"
+#include "FileShare/ListingCache.hpp"
 #include "FileShare/Protocol/RequestData.hpp"
+#include "FileShare/Utils/BufferPool.hpp"
+#include "FileShare/Utils/Bundle.hpp"
+#include "FileShare/Utils/ByteStream.hpp"
+#include "FileShare/Utils/ChunkStore.hpp"
+#include "FileShare/Utils/FileDescriptor.hpp"
+#include "FileShare/Utils/IntervalSet.hpp"
+#include "FileShare/Utils/ReadAhead.hpp"
+#include "FileShare/Utils/Sparse.hpp"
 
-#include <fstream>
+#include <deque>
+#include <map>
+#include <memory>
+#include <optional>
 
 namespace FileShare {
     class ITransferHandler {
@@ -41,56 +53,241 @@ namespace FileShare {
 
     class DownloadTransferHandler : public IFileTransferHandler {
         public:
-            DownloadTransferHandler(std::string destination_filename, std::shared_ptr<Protocol::SendFileData> original_request);
-            ~DownloadTransferHandler() override = default;
+            static constexpr const char *TEMP_EXTENSION = ".fsdownload";
+            static constexpr const char *RESUME_EXTENSION = ".fsresume";
+            static constexpr const char *DELTA_EXTENSION = ".fsdelta";
+            static constexpr const char *MISSING_CHUNKS_EXTENSION = ".fsmissing";
+            // Save the resume state each time this many more bytes have been received
+            static constexpr std::size_t RESUME_CHECKPOINT_SIZE = 0x4000000; // 64 MiB
+            // Packets arriving at most this many bytes ahead of the expected one are held in memory
+            // instead of leaving a hole in the file
+            static constexpr std::size_t REORDER_BUFFER_SIZE = 0x800000; // 8 MiB
+            // Number of times in a row a chunk can fail its hash verification before giving up
+            static constexpr std::size_t MAX_CHUNK_RETRIES = 3;
 
-            void receive_packet(const Protocol::DataPacketData &data);
+            // packet_start is the packet the peer will start sending from, if we asked to resume the download.
+            // If the peer sent content chunks, the ones in chunk_store are not downloaded again, and the
+            // chunks of the file are added to it once the download is complete.
+            DownloadTransferHandler(
+                std::string destination_filename, std::shared_ptr<Protocol::SendFileData> original_request,
+                std::size_t packet_start = 0, std::optional<Utils::ChunkStore> chunk_store = std::nullopt
+            );
+            // The data is given to `sink` in order instead of being written to a file. Bundles and deltas
+            // need a folder or a file, they can't be received this way.
+            DownloadTransferHandler(std::shared_ptr<Utils::IByteSink> sink, std::shared_ptr<Protocol::SendFileData> original_request);
+            ~DownloadTransferHandler() override;
+
+            DownloadTransferHandler(const DownloadTransferHandler &) = delete;
+            DownloadTransferHandler(DownloadTransferHandler &&) = delete;
+            auto operator=(const DownloadTransferHandler &) -> DownloadTransferHandler & = delete;
+            auto operator=(DownloadTransferHandler &&) -> DownloadTransferHandler & = delete;
+
+            // Returns the packet to ask the peer to start from, to resume an interrupted download of
+            // destination_filename. Returns 0 if there is nothing to resume.
+            static auto resume_packet_start(const std::string &destination_filename, std::size_t packet_size) -> std::size_t;
+
+            // Returns CHUNK_MISMATCH if the packet completed a chunk which doesn't match its hash. The
+            // chunk then needs to be sent again.
+            // Returns an error if the download failed because of what the peer sent (eg: a packet the
+            // SEND_FILE doesn't have, or a chunk failing too many times). It is then over, see get_error().
+            auto receive_packet(const Protocol::DataPacketData &data) -> Protocol::StatusCode;
+            [[nodiscard]] auto get_error() const -> std::optional<Protocol::StatusCode> { return m_error; }
+            // Index of the last chunk receive_packet() returned CHUNK_MISMATCH for
+            [[nodiscard]] auto get_mismatched_chunk() const -> std::size_t { return m_mismatched_chunk; }
+            // Content chunks we already have, to reply to the SEND_FILE with. Empty if we have none.
+            [[nodiscard]] auto get_known_chunks() const -> const std::vector<bool> & { return m_known_chunks; }
 
             bool m_keep = false; // TODO HACK: find a REAL solution
 
             auto finished() const -> bool override;
         private:
+            auto resume() -> bool;
+            void write_packet(std::size_t packet_id, std::string_view data);
+            // Write the data received at `offset`, where it goes in the file
+            void write_content(std::string_view data, std::size_t offset);
+            void flush_reorder_buffer();
+            void update_prefix(std::size_t packet_id, std::string_view data);
+            void update_extents_prefix(std::size_t packet_id, std::string_view data);
+            void advance_prefix(std::string_view data);
+            auto verify_chunk() -> bool;
+            void save_resume_state();
             void finish_transfer();
+            // Drop what was received, after m_error was set. Returns m_error.
+            auto fail() -> Protocol::StatusCode;
+            void sink_packet(std::string_view data);
+            // Hash the data in order (and give it to the sink if there is one), with the holes before it
+            void hash_content(std::string_view data);
+            void hash_zeros(std::size_t file_offset);
+            void verify_sink_chunk();
+            auto apply_delta() -> std::string;
+            void find_known_chunks();
+            auto assemble_chunks() -> std::string;
+            void store_chunks() const;
+            [[nodiscard]] auto is_resumable() const -> bool;
 
             std::string m_filename;
 
             std::string m_temp_filename;
-            std::vector<std::size_t> m_missing_ids;
+            std::string m_resume_filename;
+            Utils::IntervalSet m_missing_ids;
             std::size_t m_expected_id = 0;
-            std::ofstream m_file;
+            std::map<std::size_t, std::string> m_reorder_buffer;
+            // Packets are written at their offset, so they can arrive in any order. Empty once finished.
+            std::optional<Utils::FileDescriptor> m_file;
+
+            // Offset in the file of the first packet of this transfer
+            std::size_t m_file_offset = 0;
+            // Hash of the data written contiguously from the start of the file, used to verify it when resuming
+            Utils::Hasher m_prefix_hasher;
+            std::size_t m_checkpoint_size = 0;
+
+            // Hash tree verification, if the peer sent chunk hashes
+            Utils::Hasher m_chunk_start_hasher; // m_prefix_hasher at the start of the current chunk
+            Utils::Hasher m_chunk_hasher;
+            std::size_t m_chunk_failures = 0;
+            std::size_t m_mismatched_chunk = 0;
+            bool m_chunk_mismatch = false;
+            std::optional<Protocol::StatusCode> m_error;
+
+            // Deduplication, if the peer sent content chunks
+            std::optional<Utils::ChunkStore> m_chunk_store;
+            std::vector<bool> m_known_chunks;
+
+            // If the peer sent a bundle, m_filename is the folder to unpack it in
+            std::optional<Utils::BundleReader> m_bundle;
+            // Where the data received goes in the file, if it has holes. Empty if the whole file is sent.
+            std::vector<Utils::Extent> m_extents;
+            // Data received hashed in order (and given to the sink), not counting the holes
+            std::size_t m_hashed_data_size = 0;
+
+            // Where the data goes instead of a file, if set. m_prefix_hasher is the hash of what it was given.
+            std::shared_ptr<Utils::IByteSink> m_sink;
+            // The current chunk, held until it is verified when using a hash tree
+            std::string m_sink_chunk;
     };
 
     class UploadTransferHandler : public IFileTransferHandler {
         public:
-            UploadTransferHandler(const std::string &filepath, std::shared_ptr<Protocol::SendFileData> original_request, std::size_t packet_start);
+            // Number of packets compressed before deciding if the file is worth compressing
+            static constexpr std::size_t COMPRESSION_SAMPLE_PACKETS = 8;
+            // Compression is turned off if the sampled packets did not shrink below this (in %)
+            static constexpr std::size_t MAX_COMPRESSION_RATIO = 90;
+
+            // If temporary_file is true, filepath is deleted once the handler is destroyed (eg: a delta)
+            UploadTransferHandler(const std::string &filepath, std::shared_ptr<Protocol::SendFileData> original_request, std::size_t packet_start, bool temporary_file = false);
+            // Sends the data read from `source`, which must match what original_request describes
+            UploadTransferHandler(std::shared_ptr<Utils::IByteSource> source, std::shared_ptr<Protocol::SendFileData> original_request, std::size_t packet_start = 0);
             UploadTransferHandler(UploadTransferHandler &&other) noexcept = default;
             ~UploadTransferHandler() override = default;
 
             auto operator=(UploadTransferHandler &&other) noexcept -> UploadTransferHandler & = default;
 
+            // Returns nullptr if there is nothing to send for now
             auto get_next_packet(Protocol::MessageID original_request_id) -> std::shared_ptr<Protocol::DataPacketData>;
+            // Peer replied to a DATA_PACKET. Its data buffer is reused for the next packets.
+            void packet_acknowledged(Protocol::DataPacketData &packet);
+            // Peer replied CHUNK_MISMATCH: queue all the packets of this chunk to be sent again
+            void resend_chunk(std::size_t chunk);
+            // Peer replied UNSUPPORTED_COMPRESSION: the request is sent again without compression
+            void disable_compression();
+            // Peer replied TOO_MANY_REQUESTS: it dropped the packet, which arrived too far ahead of the one it expects
+            void resend_packet(std::size_t packet_id);
+            // Peer replied to SEND_FILE with the content chunks it already has: only send the others
+            void skip_known_chunks(const std::vector<bool> &known_chunks);
+            // Read the next `depth` packets ahead on `threads` threads, from the first packet sent
+            void enable_read_ahead(std::size_t depth, std::size_t threads);
 
-            auto finished() const -> bool override;
+            [[nodiscard]] auto get_read_ahead_stats() const -> Utils::ReadAheadStats;
+            [[nodiscard]] auto has_next_packet() const -> bool;
+            // All the packets were sent, and acknowledged by the peer
+            [[nodiscard]] auto finished() const -> bool override;
         private:
+            struct TemporaryFileDeleter {
+                void operator()(std::filesystem::path *path) const;
+            };
+
+            void start_read_ahead();
+            void compress_packet(Protocol::DataPacketData &packet);
+
+            std::size_t m_packet_start;
             std::size_t m_packet_id = 0;
-            std::ifstream m_file;
+            std::size_t m_packets_in_flight = 0;
+            bool m_end_reached = false;
+            std::deque<std::size_t> m_resend_ids;
+            // Declared before m_source, so the file is closed before being deleted
+            std::unique_ptr<std::filesystem::path, TemporaryFileDeleter> m_temporary_file;
+            std::shared_ptr<Utils::IByteSource> m_source;
+            std::shared_ptr<Utils::BufferPool> m_buffer_pool;
+            // Parts of the file sent, when skipping holes or known chunks or sending a range. Empty if the whole file is sent.
+            std::vector<Utils::Extent> m_extents;
+            // Started with the first packet, as the extents can change until then
+            std::size_t m_read_ahead_depth = 0;
+            std::size_t m_read_ahead_threads = 0;
+            std::unique_ptr<Utils::ReadAhead> m_read_ahead;
+
+            bool m_compress;
+            std::size_t m_sampled_packets = 0;
+            std::size_t m_sampled_size = 0;
+            std::size_t m_sampled_compressed_size = 0;
     };
 
     class ListFilesTransferHandler : public ITransferHandler {
         public:
-            ListFilesTransferHandler(std::filesystem::path requested_path, FileMapping &file_mapping, std::size_t packet_size);
+            // Deeper levels are not listed, whatever the peer asks for: each of them keeps a folder open
+            static constexpr std::size_t MAX_DEPTH = 32;
+            // Bigger folders are not cached, they are read again each time they are listed
+            static constexpr std::size_t MAX_CACHED_ENTRIES = 0x10000;
+
+            // `fields` are the FileInfoField to fill in each entry.
+            // Sub folders are listed as well, up to `max_depth` levels below the requested path.
+            // The host folders are read from `cache` when it has them, and stored there as they are sent otherwise.
+            ListFilesTransferHandler(
+                std::filesystem::path requested_path, FileMapping &file_mapping, std::size_t packet_size,
+                std::uint8_t fields = 0, std::size_t max_depth = 0, std::shared_ptr<ListingCache> cache = nullptr
+            );
             ~ListFilesTransferHandler() override = default;
 
+            // Packs as many entries as fit in packet_size. Returns nullptr once the final empty packet was sent.
             auto get_next_packet(Protocol::MessageID original_request_id) -> std::shared_ptr<Protocol::FileListData>;
 
             [[nodiscard]] auto finished() const -> bool override;
         private:
+            // A folder being listed. The folders found in it are pushed on top of it, so the tree
+            // is walked depth first, keeping only one level per depth in memory.
+            struct Level {
+                std::filesystem::path virtual_path;
+                std::size_t depth;
+                bool is_virtual;
+                // Host folders only. The listing is used instead of the iterator when it came from the cache.
+                std::filesystem::path host_path;
+                std::filesystem::directory_iterator directory_iterator;
+                std::shared_ptr<const CachedListing> listing;
+                std::size_t listing_index;
+                // Host folders read from the disk for the cache: their entries are gathered as they are sent,
+                // and stored once the whole folder was read
+                ListingCache::ReadID read_id;
+                std::optional<CachedListing> read_listing;
+                // Virtual folders only. The requested node is nullptr: it moves with the handler, unlike its children.
+                const PathNode *node;
+                PathNode::NodeMap::const_iterator node_iterator;
+            };
+
+            // `node` is nullptr for folders inside a host folder
+            void push_level(std::filesystem::path virtual_path, std::size_t depth, const PathNode *node, const std::filesystem::path &host_path);
+            [[nodiscard]] auto level_finished(const Level &level) const -> bool;
+            // Gives the entries gathered to the cache, once the folder was read whole
+            void finish_level(Level &level);
+            // Fill the optional `fields` of `info` from the host file. The ones we fail to get are left empty.
+            static void fill_file_info(Protocol::FileInfo &info, const std::filesystem::path &host_path, std::uint8_t fields);
+
             std::filesystem::path m_requested_path;
             FileMapping &m_file_mapping;
+            std::uint8_t m_fields;
+            std::size_t m_max_depth;
+            std::shared_ptr<ListingCache> m_cache;
             std::optional<PathNode> m_path_node;
 
-            std::filesystem::directory_iterator m_directory_iterator;
-            PathNode::NodeMap::const_iterator m_node_iterator;
+            std::vector<Level> m_levels;
 
             std::size_t m_packet_size;
             std::size_t m_current_id = 0;
@@ -110,7 +307,7 @@ namespace FileShare {
             std::vector<Protocol::FileInfo> m_file_list;
 
             std::size_t m_current_id = 0;
-            std::vector<std::size_t> m_missing_ids;
-            bool m_finished;
+            Utils::IntervalSet m_missing_ids;
+            bool m_finished = false;
     };
 };
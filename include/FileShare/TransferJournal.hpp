@@ -0,0 +1,80 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:41:03 2026 Francois Michaut
+** Last update Mon Oct 19 08:59:53 2026 Francois Michaut
+**
+** TransferJournal.hpp : Downloads in progress, kept on disk to resume them after a restart
+*/
+
+#pragma once
+
+#include "FileShare/Utils/FileDescriptor.hpp"
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace FileShare {
+    // Downloads which were not finished, so the Server asks for them again once their peer reconnects,
+    // even if the program was killed. Their progress is in the resume state saved next to each file
+    // (see DownloadTransferHandler): the journal only tells which ones to ask for.
+    //
+    // Records are appended to the file, which is compacted each time it is loaded:
+    // | RECORD_SIZE | | TYPE | | UUID_SIZE | |   UUID    | | PATH_SIZE | |   PATH    | | CHECKSUM |
+    // |      -      | |  1   | |     -     | | UUID_SIZE | |     -     | | PATH_SIZE | |    8     |
+    // |    VARINT   | | CHAR | |   VARINT  | |  STRING   | |   VARINT  | |  STRING   | | UNSIGNED |
+    // RECORD_SIZE is the size from TYPE to PATH, and CHECKSUM their FNV-1a hash.
+    // A record cut by a crash is dropped, along with everything after it.
+    class TransferJournal {
+        public:
+            // The records are written at most this often, so the disk is not synced for each of them
+            static constexpr std::chrono::milliseconds FLUSH_INTERVAL = std::chrono::seconds(1);
+
+            // Nothing is saved if `filepath` is empty
+            TransferJournal(std::filesystem::path filepath);
+            ~TransferJournal();
+
+            TransferJournal(const TransferJournal &) = delete;
+            TransferJournal(TransferJournal &&) = delete;
+            auto operator=(const TransferJournal &) -> TransferJournal & = delete;
+            auto operator=(TransferJournal &&) -> TransferJournal & = delete;
+
+            // `filepath` is the virtual path of the file on the peer. Adding it twice does nothing.
+            void add(const std::string &device_uuid, const std::string &filepath);
+            void remove(const std::string &device_uuid, const std::string &filepath);
+
+            [[nodiscard]] auto contains(const std::string &device_uuid, const std::string &filepath) const -> bool;
+            // The files to download again from this device
+            [[nodiscard]] auto get_files(const std::string &device_uuid) const -> std::vector<std::string>;
+            [[nodiscard]] auto size() const -> std::size_t { return m_entries.size(); }
+
+            // Write the records added since the last flush, and sync them to the disk at once.
+            // Does nothing if the last flush was less than FLUSH_INTERVAL ago, unless `force` is true.
+            void flush(bool force = false);
+        private:
+            enum RecordType : char {
+                ADD = 'A',
+                REMOVE = 'R'
+            };
+
+            void load();
+            // Rewrite the file with only the entries left
+            void compact();
+            void append_record(RecordType type, const std::string &device_uuid, const std::string &filepath);
+
+            std::filesystem::path m_filepath;
+            std::optional<Utils::FileDescriptor> m_file;
+            std::size_t m_file_size = 0;
+            // Device UUID -> virtual path, ordered so all the files of a device are next to each other
+            std::set<std::pair<std::string, std::string>> m_entries;
+            // Records not written yet
+            std::string m_pending;
+            std::chrono::steady_clock::time_point m_last_flush;
+    };
+}
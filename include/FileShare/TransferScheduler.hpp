@@ -0,0 +1,100 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:32:30 2026 Francois Michaut
+** Last update Mon Oct 19 08:56:38 2026 Francois Michaut
+**
+** TransferScheduler.hpp : Decides which transfer sends the next packet, across all Peers
+*/
+
+#pragma once
+
+#include "FileShare/Config/Config.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+
+namespace FileShare {
+    // Shared by all the Peers of a Server, so their transfers share the bandwidth and the disk:
+    //  - At most max_active_transfers send packets at once, the others are queued until one finishes
+    //  - A higher priority class always goes first
+    //  - Within a class, each peer gets a share of the bytes sent proportional to its weight,
+    //    whatever its number of transfers. The transfers of a peer share its part equally.
+    //    Counting bytes instead of packets, transfers with bigger packets do not get more of it.
+    // A Peer without a Server has its own.
+    class TransferScheduler {
+        public:
+            using TransferID = std::uint64_t;
+            // Sends the next packet of the transfer, and returns its size. 0 if it could not (eg: its window is full).
+            using SendPacketCallback = std::function<std::size_t()>;
+
+            static constexpr std::size_t DEFAULT_MAX_ACTIVE_TRANSFERS = 8;
+
+            TransferScheduler(std::size_t max_active_transfers = DEFAULT_MAX_ACTIVE_TRANSFERS);
+
+            // `peer` identifies the device: all its transfers share the same part, and its latest weight is used.
+            // `start_now` makes it active right away, even above max_active_transfers: for the transfers a
+            // blocking call waits on, since the ones it would queue behind only progress in between calls.
+            auto add_transfer(
+                const std::string &peer, std::size_t weight, Config::TransferPriority priority, SendPacketCallback send_packet,
+                bool start_now = false
+            ) -> TransferID;
+            void remove_transfer(TransferID id);
+
+            // Send packets of the active transfers, in a fair order, until none of them can send more
+            // or `max_packets` were sent. Returns the number of packets sent.
+            auto run(std::size_t max_packets) -> std::size_t;
+
+            [[nodiscard]] auto is_active(TransferID id) const -> bool;
+            [[nodiscard]] auto get_active_count() const -> std::size_t { return m_active.size(); }
+            [[nodiscard]] auto get_queued_count() const -> std::size_t { return m_transfers.size() - m_active.size(); }
+
+            // 0 means no limit. Lowering it does not pause the transfers already active.
+            [[nodiscard]] auto get_max_active_transfers() const -> std::size_t { return m_max_active_transfers; }
+            void set_max_active_transfers(std::size_t max_active_transfers) { m_max_active_transfers = max_active_transfers; }
+        private:
+            struct Transfer {
+                std::string peer;
+                Config::TransferPriority priority;
+                SendPacketCallback send_packet;
+                bool active = false;
+                std::uint64_t virtual_time = 0; // Bytes sent, compared to the other transfers of the peer
+            };
+
+            struct PeerState {
+                std::size_t weight = 1;
+                std::size_t transfers = 0;
+                std::size_t active_transfers = 0;
+                // Grows by size * VIRTUAL_TIME_UNIT / weight for each packet sent: the lowest is the most behind
+                std::uint64_t virtual_time = 0;
+            };
+
+            // Ordered like the transfers send their packets: priority, then peer and transfer virtual times, then ID
+            using TurnKey = std::tuple<Config::TransferPriority, std::uint64_t, std::uint64_t, TransferID>;
+
+            // Keeps the weights precise for small packets. Overflows after 2^48 bytes sent to the same peer.
+            static constexpr std::uint64_t VIRTUAL_TIME_UNIT = 0x10000;
+
+            void admit_transfers();
+            void activate(std::map<TransferID, Transfer>::iterator transfer);
+            [[nodiscard]] auto get_turn_key(TransferID id, const Transfer &transfer) const -> TurnKey;
+            // Peers and transfers which were idle start at the lowest virtual time of the active ones,
+            // so they get their share from now on, instead of catching up on the time they were idle.
+            [[nodiscard]] auto min_peer_virtual_time() const -> std::uint64_t;
+            [[nodiscard]] auto min_transfer_virtual_time(const std::string &peer) const -> std::uint64_t;
+
+            std::size_t m_max_active_transfers;
+            TransferID m_next_id = 0;
+            // Ordered by ID, which is their arrival order
+            std::map<TransferID, Transfer> m_transfers;
+            std::set<TransferID> m_active;
+            std::unordered_map<std::string, PeerState> m_peers;
+    };
+}
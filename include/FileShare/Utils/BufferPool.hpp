@@ -0,0 +1,37 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:41:45 2026 Francois Michaut
+** Last update Mon Oct 19 01:44:52 2026 Francois Michaut
+**
+** BufferPool.hpp : Pool of reusable buffers, to avoid an allocation per packet
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace FileShare::Utils {
+    class BufferPool {
+        public:
+            static constexpr std::size_t DEFAULT_MAX_BUFFERS = 64;
+
+            BufferPool(std::size_t max_buffers = DEFAULT_MAX_BUFFERS);
+
+            // Returns a buffer of `size` bytes, reusing a released one if possible. Its content is unspecified.
+            auto acquire(std::size_t size) -> std::string;
+            // Give back a buffer which is no longer used. It is dropped if the pool is full.
+            void release(std::string buffer);
+
+            [[nodiscard]] auto size() const -> std::size_t;
+        private:
+            mutable std::mutex m_mutex;
+            std::size_t m_max_buffers;
+            std::vector<std::string> m_buffers;
+    };
+}
@@ -0,0 +1,114 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:35:12 2026 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
+**
+** Bundle.hpp : Many files packed in a single stream, to transfer them as one
+*/
+
+#pragma once
+
+#include "FileShare/Utils/ByteStream.hpp"
+#include "FileShare/Utils/FileDescriptor.hpp"
+#include "FileShare/Utils/FileHash.hpp"
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace FileShare::Utils {
+    // Records of the bundle, back to back:
+    // | PATH_SIZE | |    PATH   | | UPDATED_AT | | FILE_SIZE | |  CONTENT  | |   FILE_HASH    |
+    // |     -     | | PATH_SIZE | |      8     | |     -     | | FILE_SIZE | | HASH_TYPE_SIZE |
+    // |   VARINT  | |   STRING  | | SIGNED INT | |   VARINT  | |   STRING  | |     STRING     |
+    // PATH is relative to the bundled folder, using '/' as separator.
+    constexpr std::size_t MAX_BUNDLE_PATH_SIZE = 0x1000;
+
+    struct BundleFile {
+        std::filesystem::path host_path;
+        std::string path; // In the bundle
+    };
+
+    // The bundle of `files`, read from them as it is sent instead of being written somewhere first.
+    // Each file is read once when it is built, for both its hash and the hash of the whole bundle.
+    class BundleByteSource : public IByteSource {
+        public:
+            BundleByteSource(HashAlgorithm algo, const std::vector<BundleFile> &files);
+
+            // Throws if a file was truncated since the source was built
+            auto read(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t override;
+
+            [[nodiscard]] auto get_size() const -> std::size_t { return m_size; }
+            [[nodiscard]] auto get_hash() const -> const std::string & { return m_hash; }
+        private:
+            // The headers and hashes are kept in memory, the content is read from the file
+            struct Segment {
+                std::size_t offset; // In the bundle
+                std::size_t size;
+                std::string data;
+                std::filesystem::path host_path;
+            };
+
+            std::vector<Segment> m_segments;
+            std::size_t m_size = 0;
+            std::string m_hash;
+    };
+
+    // Unpacks the files of a bundle in `destination` as its data arrives, under a temporary name.
+    // They are only moved in place by commit(), once the hash of each file was checked.
+    class BundleReader {
+        public:
+            static constexpr const char *TEMP_EXTENSION = ".fsdownload";
+
+            BundleReader(std::filesystem::path destination, HashAlgorithm algo);
+            ~BundleReader();
+
+            BundleReader(const BundleReader &) = delete;
+            BundleReader(BundleReader &&) = delete;
+            auto operator=(const BundleReader &) -> BundleReader & = delete;
+            auto operator=(BundleReader &&) -> BundleReader & = delete;
+
+            // The next bytes of the bundle, in order
+            void feed(std::string_view data);
+            // Check the hash of every file, and move the valid ones in place. The others are removed, as
+            // well as the ones we already had. Returns the number of files which did not match their hash.
+            auto commit() -> std::size_t;
+
+            [[nodiscard]] auto get_file_count() const -> std::size_t { return m_entries.size(); }
+        private:
+            enum class State {
+                HEADER,
+                CONTENT,
+                HASH,
+            };
+
+            struct Entry {
+                std::filesystem::path path;
+                std::filesystem::file_time_type last_updated;
+                std::string hash; // Of the data received
+                std::string expected_hash;
+            };
+
+            // Both return the number of bytes used, 0 if input is not complete yet
+            auto parse_header(std::string_view input) -> std::size_t;
+            auto parse_hash(std::string_view input) -> std::size_t;
+            void remove_temp_files();
+
+            std::filesystem::path m_destination;
+            HashAlgorithm m_algo;
+            State m_state = State::HEADER;
+            // A header or hash split between 2 calls to feed()
+            std::string m_buffer;
+
+            std::vector<Entry> m_entries;
+            std::optional<FileDescriptor> m_file;
+            Hasher m_hasher;
+            std::size_t m_remaining_size = 0;
+            std::size_t m_file_offset = 0;
+    };
+}
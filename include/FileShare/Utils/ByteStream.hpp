@@ -0,0 +1,141 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:46:24 2026 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
+**
+** ByteStream.hpp : Where the data of a transfer comes from, and where it goes
+*/
+
+#pragma once
+
+#include "FileShare/Utils/FileDescriptor.hpp"
+
+#include <CppSockets/OSDetection.hpp>
+
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+namespace FileShare::Utils {
+    // Data of an upload. read() is called from several threads at once when reading ahead.
+    class IByteSource {
+        public:
+            virtual ~IByteSource() = default;
+
+            IByteSource() = default;
+
+            IByteSource(const IByteSource &) = delete;
+            IByteSource(IByteSource &&) = delete;
+            auto operator=(const IByteSource &) -> IByteSource & = delete;
+            auto operator=(IByteSource &&) -> IByteSource & = delete;
+
+            // Read up to `size` bytes at `offset`. Only returns less than `size` at the end of the data.
+            virtual auto read(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t = 0;
+    };
+
+    class FileByteSource : public IByteSource {
+        public:
+            FileByteSource(const std::filesystem::path &path);
+            FileByteSource(FileDescriptor file);
+
+            auto read(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t override;
+
+            [[nodiscard]] auto get_file() const -> const FileDescriptor & { return m_file; }
+        private:
+            FileDescriptor m_file;
+#ifdef OS_WINDOWS
+            // There is no pread: the seek and the read must not be interleaved with another thread's
+            mutable std::mutex m_mutex;
+#endif
+    };
+
+    class MemoryByteSource : public IByteSource {
+        public:
+            MemoryByteSource(std::string data) : m_data(std::move(data)) {}
+
+            auto read(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t override;
+
+            [[nodiscard]] auto get_data() const -> const std::string & { return m_data; }
+        private:
+            std::string m_data;
+    };
+
+    class CallbackByteSource : public IByteSource {
+        public:
+            // Same contract as IByteSource::read()
+            using ReadCallback = std::function<std::size_t(char *buffer, std::size_t size, std::size_t offset)>;
+
+            CallbackByteSource(ReadCallback callback) : m_callback(std::move(callback)) {}
+
+            auto read(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t override;
+        private:
+            ReadCallback m_callback;
+    };
+
+    // Data of a download, given in order. Only the data which passed the hash tree verification is
+    // written, if the peer sent one: it is never taken back.
+    class IByteSink {
+        public:
+            virtual ~IByteSink() = default;
+
+            IByteSink() = default;
+
+            IByteSink(const IByteSink &) = delete;
+            IByteSink(IByteSink &&) = delete;
+            auto operator=(const IByteSink &) -> IByteSink & = delete;
+            auto operator=(IByteSink &&) -> IByteSink & = delete;
+
+            // The next bytes of the file. `data` is only valid during the call.
+            virtual void write(std::string_view data) = 0;
+            // Called once at the end: `complete` is true if all the data was written and matched the
+            // hash of the file, false if the transfer failed or was cancelled.
+            virtual void finish(bool complete) = 0;
+    };
+
+    // Writes at the current position of the descriptor, so it can be a pipe or a socket
+    class FileByteSink : public IByteSink {
+        public:
+            FileByteSink(FileDescriptor file) : m_file(std::move(file)) {}
+
+            void write(std::string_view data) override;
+            void finish(bool /* complete */) override {}
+
+            [[nodiscard]] auto get_file() const -> const FileDescriptor & { return m_file; }
+        private:
+            FileDescriptor m_file;
+    };
+
+    class MemoryByteSink : public IByteSink {
+        public:
+            void write(std::string_view data) override { m_data.append(data); }
+            void finish(bool complete) override { m_complete = complete; }
+
+            // The data is only the whole file if is_complete() is true
+            [[nodiscard]] auto get_data() const -> const std::string & { return m_data; }
+            [[nodiscard]] auto take_data() -> std::string { return std::move(m_data); }
+            [[nodiscard]] auto is_complete() const -> bool { return m_complete; }
+        private:
+            std::string m_data;
+            bool m_complete = false;
+    };
+
+    class CallbackByteSink : public IByteSink {
+        public:
+            using WriteCallback = std::function<void(std::string_view data)>;
+            using FinishCallback = std::function<void(bool complete)>;
+
+            CallbackByteSink(WriteCallback write, FinishCallback finish = {}) :
+                m_write(std::move(write)), m_finish(std::move(finish))
+            {}
+
+            void write(std::string_view data) override { m_write(data); }
+            void finish(bool complete) override;
+        private:
+            WriteCallback m_write;
+            FinishCallback m_finish;
+    };
+}
@@ -0,0 +1,67 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:16:40 2026 Francois Michaut
+** Last update Mon Oct 19 08:34:58 2026 Francois Michaut
+**
+** ChunkStore.hpp : Content-addressed index of the chunks of downloaded files
+*/
+
+#pragma once
+
+#include "FileShare/Utils/ContentChunker.hpp"
+#include "FileShare/Utils/FileDescriptor.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+namespace FileShare::Utils {
+    // Chunks of the files we downloaded, so a peer doesn't need to send them again, even as part of
+    // another file. The data is not copied: each entry, a file named after the chunk hash, points
+    // to the chunk in the downloaded file, and is dropped once that file changes.
+    class ChunkStore {
+        public:
+            // Name of the store folder in the downloads folder
+            static constexpr const char *FOLDER_NAME = ".fschunks";
+            // Number of entries kept by trim(), the least recently used ones are dropped first
+            static constexpr std::size_t DEFAULT_CAPACITY = 0x10000;
+
+            ChunkStore(std::filesystem::path root, std::size_t capacity = DEFAULT_CAPACITY);
+
+            [[nodiscard]] auto contains(const std::string &hash) const -> bool;
+            [[nodiscard]] auto chunk_path(const std::string &hash) const -> std::filesystem::path;
+
+            // Remember the chunk at `offset` in `file`. Returns false if the data doesn't match its hash.
+            auto store(HashAlgorithm algo, const ContentChunk &chunk, const std::filesystem::path &file, std::size_t offset) const -> bool;
+            // Copy the stored chunk to `destination` at `offset`
+            void copy_to(const ContentChunk &chunk, const FileDescriptor &destination, std::size_t offset) const;
+            // Remove the chunk if it doesn't match its hash anymore. Returns true if it is valid.
+            auto verify(HashAlgorithm algo, const std::string &hash) const -> bool;
+            // Drop the least recently used entries above the capacity
+            void trim() const;
+
+            [[nodiscard]] auto get_root() const -> const std::filesystem::path & { return m_root; }
+            [[nodiscard]] auto get_capacity() const -> std::size_t { return m_capacity; }
+        private:
+            struct Location {
+                std::filesystem::path file;
+                std::size_t offset;
+                std::size_t chunk_size;
+                // Identity of the file when the chunk was stored (see HashCache::Key)
+                std::uint64_t device;
+                std::uint64_t inode;
+                std::uint64_t size;
+                std::int64_t mtime_ns;
+            };
+
+            // Where the chunk is, or nullopt (and the entry is removed) if its file changed since
+            auto find(const std::string &hash) const -> std::optional<Location>;
+
+            std::filesystem::path m_root;
+            std::size_t m_capacity;
+    };
+}
@@ -0,0 +1,33 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:57:49 2026 Francois Michaut
+** Last update Mon Oct 19 08:29:23 2026 Francois Michaut
+**
+** Compression.hpp : Compression of the packets data
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace FileShare::Utils {
+    enum class CompressionAlgorithm : std::uint8_t {
+        NONE    = 0x00,
+        ZSTD    = 0x01,
+    };
+
+    auto is_valid_compression(std::uint8_t value) -> bool;
+    auto compression_to_string(CompressionAlgorithm algo) -> const char *;
+
+    // Compress `data` into `output`, which is resized to the compressed size.
+    // Returns false if compressing did not make the data smaller: `output` is then unspecified.
+    auto compress(CompressionAlgorithm algo, std::string_view data, std::string &output) -> bool;
+    // Throws if the data is malformed, or would be bigger than `max_size` once decompressed
+    auto decompress(CompressionAlgorithm algo, std::string_view data, std::size_t max_size) -> std::string;
+}
@@ -0,0 +1,57 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:16:40 2026 Francois Michaut
+** Last update Mon Oct 19 08:34:58 2026 Francois Michaut
+**
+** ContentChunker.hpp : Content-defined chunking of files (FastCDC)
+*/
+
+#pragma once
+
+#include "FileShare/Utils/FileHash.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace FileShare::Utils {
+    // Chunks are cut where the content matches a pattern, not at fixed offsets: inserting data
+    // only changes the chunks around it, so the same content gives the same chunks across files.
+    constexpr std::size_t DEFAULT_CONTENT_CHUNK_SIZE = 0x10000; // 64 KiB
+    // The average chunk size is increased for big files, to keep the chunk list small
+    constexpr std::size_t MAX_CONTENT_CHUNKS = 0x4000;
+
+    struct ContentChunk {
+        std::size_t size;
+        std::string hash;
+    };
+
+    // FastCDC: a gear hash rolled over the data, with a stricter cut condition before the average
+    // size and a looser one after it, so the chunk sizes stay close to the average.
+    class ContentChunker {
+        public:
+            // average_size is rounded up to a power of 2. Chunks are between a quarter of it and 8 times it.
+            ContentChunker(std::size_t average_size);
+
+            // Size of the first chunk of data. Unless data is the end of the file, it should hold
+            // at least get_max_size() bytes.
+            [[nodiscard]] auto cut(std::string_view data) const -> std::size_t;
+
+            [[nodiscard]] auto get_average_size() const -> std::size_t { return m_average_size; }
+            [[nodiscard]] auto get_min_size() const -> std::size_t { return m_average_size / 4; }
+            [[nodiscard]] auto get_max_size() const -> std::size_t { return m_average_size * 8; }
+        private:
+            std::size_t m_average_size;
+            std::uint64_t m_small_mask;
+            std::uint64_t m_large_mask;
+    };
+
+    // Average chunk size to use for a file of this size
+    auto content_chunk_size(std::size_t file_size) -> std::size_t;
+    auto content_chunks(HashAlgorithm algo, const std::filesystem::path &path, std::size_t average_size) -> std::vector<ContentChunk>;
+}
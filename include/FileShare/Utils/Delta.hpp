@@ -0,0 +1,62 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:41:01 2026 Francois Michaut
+** Last update Mon Oct 19 01:41:01 2026 Francois Michaut
+**
+** Delta.hpp : rsync-like delta of a file against an older copy of it
+*/
+
+#pragma once
+
+#include "FileShare/Utils/FileHash.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace FileShare::Utils {
+    // Weak checksum of a block, which can be rolled over the data one byte at a time (same as rsync)
+    class RollingChecksum {
+        public:
+            RollingChecksum() = default;
+            RollingChecksum(std::string_view block);
+
+            // Slide the window by one byte: `removed` leaves it, `added` enters it
+            void roll(char removed, char added);
+
+            [[nodiscard]] auto digest() const -> std::uint32_t { return ((m_b & 0xFFFFU) << 16U) | (m_a & 0xFFFFU); }
+        private:
+            std::uint32_t m_a = 0;
+            std::uint32_t m_b = 0;
+            std::uint32_t m_size = 0;
+    };
+
+    // The block size is increased for big files, to keep the signature small
+    constexpr std::size_t MAX_SIGNATURE_BLOCKS = 0x10000;
+
+    struct BlockSignature {
+        std::uint32_t weak;
+        std::string strong;
+    };
+
+    // Checksums of each block_size bytes of a file. The last block can be smaller.
+    struct FileSignature {
+        std::size_t block_size = 0;
+        HashAlgorithm hash_algorithm = HashAlgorithm::MD5;
+        std::vector<BlockSignature> blocks;
+    };
+
+    auto file_signature(HashAlgorithm algo, const std::filesystem::path &path, std::size_t block_size) -> FileSignature;
+
+    // Write to `delta` the instructions to rebuild `source` from the file `signature` was made
+    // from: blocks to copy from it, and literal data for the rest.
+    // Returns the number of bytes of `source` which could not be copied from the old file.
+    auto make_delta(const FileSignature &signature, const std::filesystem::path &source, const std::filesystem::path &delta) -> std::size_t;
+    // Rebuild the new file in `output`, from the old file (`basis`) and the delta
+    void apply_delta(const std::filesystem::path &basis, const std::filesystem::path &delta, const std::filesystem::path &output, std::size_t block_size);
+}
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Tue May  9 11:03:44 2023 Francois Michaut
-** Last update Tue Jul 18 22:03:23 2023 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
 **
 ** FileDescriptor.hpp : Helper wrapper class to auto close file descriptor
 */
@@ -26,21 +26,46 @@ namespace FileShare::Utils {
             std::string m_filename;
     };
 
-#ifndef OS_WINDOWS
     class FileDescriptor : FileHandleBase {
         public:
+            static constexpr int DEFAULT_MODE = 0644;
+
             FileDescriptor(int fd, std::string filename = "");
-            FileDescriptor(const char *filename, int flags);
-            FileDescriptor(const std::filesystem::path &path, int flags);
-            FileDescriptor(std::string filename, int flags);
+            // `mode` is the permissions of the file, if it is created
+            FileDescriptor(const char *filename, int flags, int mode = DEFAULT_MODE);
+            FileDescriptor(const std::filesystem::path &path, int flags, int mode = DEFAULT_MODE);
+            FileDescriptor(std::string filename, int flags, int mode = DEFAULT_MODE);
             ~FileDescriptor();
 
+            FileDescriptor(const FileDescriptor &) = delete;
+            FileDescriptor(FileDescriptor &&other) noexcept;
+            auto operator=(const FileDescriptor &) -> FileDescriptor & = delete;
+            auto operator=(FileDescriptor &&other) noexcept -> FileDescriptor &;
+
             operator int() const { return m_fd; }
 
+            // Read up to `size` bytes at `offset`, without moving the file position. Only returns less
+            // than `size` when the end of the file is reached.
+            auto pread(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t;
+            // Write the whole buffer at `offset`, without moving the file position
+            void pwrite(const char *buffer, std::size_t size, std::size_t offset) const;
+            // Write the whole buffer at the file position. Unlike pwrite, works on pipes and sockets.
+            void write(const char *buffer, std::size_t size) const;
+            // Reserve disk space for `size` bytes at `offset`, without changing the file size, so the
+            // file is laid out in few extents. Best effort: does nothing if not supported.
+            void allocate(std::size_t offset, std::size_t size) const;
+            // Copy `size` bytes at `offset` to `destination` at `destination_offset`. The data does not
+            // go through user space, and filesystems supporting it share the extents (reflink).
+            // Returns the number of bytes copied, less than `size` if the end of the file was reached.
+            auto copy_to(const FileDescriptor &destination, std::size_t offset, std::size_t destination_offset, std::size_t size) const -> std::size_t;
+            // Another descriptor of the same open file, closed independently of this one
+            [[nodiscard]] auto duplicate() const -> FileDescriptor;
+            // Wait for the data written to reach the disk. Slow: batch the writes before calling it.
+            void sync() const;
+
         private:
             int m_fd;
     };
-#endif
 
     class FileHandle : FileHandleBase {
         public:
@@ -4,15 +4,21 @@
 ** Author Francois Michaut
 **
 ** Started on  Sat May  6 17:23:39 2023 Francois Michaut
-** Last update Sun May 14 19:58:25 2023 Francois Michaut
+** Last update Mon Oct 19 05:42:08 2026 Francois Michaut
 **
-** FileHash.hpp : Function to hash file contents
+** FileHash.hpp : Functions to hash file contents
 */
 
 #pragma once
 
 #include <filesystem>
+#include <limits>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <vector>
+
+struct evp_md_ctx_st; // OpenSSL's EVP_MD_CTX
 
 namespace FileShare::Utils {
     // TODO: add more
@@ -25,4 +31,41 @@ namespace FileShare::Utils {
     const char *algo_to_string(HashAlgorithm algo);
     std::size_t algo_hash_size(HashAlgorithm algo);
     std::string file_hash(HashAlgorithm algo, const std::filesystem::path &path);
+
+    // Hash of each `chunk_size` bytes of the file. Chunks are hashed in parallel on up to
+    // `max_threads` threads (0 = one per core).
+    auto chunk_hashes(HashAlgorithm algo, const std::filesystem::path &path, std::size_t chunk_size, std::size_t max_threads = 0) -> std::vector<std::string>;
+
+    // Incremental hash, for when the data is received piece by piece
+    class Hasher {
+        public:
+            static constexpr std::size_t END_OF_FILE = std::numeric_limits<std::size_t>::max();
+
+            Hasher(HashAlgorithm algo);
+            ~Hasher() = default;
+
+            Hasher(const Hasher &other);
+            Hasher(Hasher &&other) noexcept = default;
+            auto operator=(const Hasher &other) -> Hasher &;
+            auto operator=(Hasher &&other) noexcept -> Hasher & = default;
+
+            void update(std::string_view data);
+            // Hash `size` bytes of the file starting at `offset`. Returns the number of bytes hashed,
+            // which is smaller than `size` if the end of the file was reached.
+            auto update_file(const std::filesystem::path &path, std::size_t offset = 0, std::size_t size = END_OF_FILE) -> std::size_t;
+
+            // Hash of all the data received so far. Further updates can still be made afterward.
+            [[nodiscard]] auto digest() const -> std::string;
+
+            [[nodiscard]] auto get_algorithm() const -> HashAlgorithm { return m_algo; }
+            [[nodiscard]] auto get_size() const -> std::size_t { return m_size; }
+        private:
+            struct ContextDeleter {
+                void operator()(evp_md_ctx_st *ctx) const;
+            };
+
+            HashAlgorithm m_algo;
+            std::unique_ptr<evp_md_ctx_st, ContextDeleter> m_ctx;
+            std::size_t m_size = 0;
+    };
 }
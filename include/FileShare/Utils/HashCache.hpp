@@ -0,0 +1,102 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:10:26 2026 Francois Michaut
+** Last update Mon Oct 19 08:34:58 2026 Francois Michaut
+**
+** HashCache.hpp : Cache of file hashes, to avoid hashing unchanged files again
+*/
+
+#pragma once
+
+#include "FileShare/Utils/ContentChunker.hpp"
+#include "FileShare/Utils/FileHash.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace FileShare::Utils {
+    // LRU cache of file hashes. Entries are keyed by the file identity and its size/modification
+    // time, so a modified file is hashed again. Can optionally be persisted to disk.
+    class HashCache {
+        public:
+            static constexpr std::size_t DEFAULT_CAPACITY = 4096;
+
+            struct Key {
+                std::uint64_t device = 0;
+                std::uint64_t inode = 0;
+                std::uint64_t size = 0;
+                std::int64_t mtime_ns = 0;
+                HashAlgorithm algo = HashAlgorithm::SHA512;
+                // 0 for the hash of the whole file, the chunk size for the hashes of its chunks
+                std::uint64_t chunk_size = 0;
+                // The chunks are cut by a ContentChunker, chunk_size being their average size
+                bool content_defined = false;
+
+                auto operator==(const Key &other) const -> bool = default;
+
+                template <class Archive>
+                void serialize(Archive &archive, const std::uint32_t /* version */) {
+                    archive(device, inode, size, mtime_ns, algo, chunk_size, content_defined);
+                }
+            };
+
+            HashCache(std::size_t capacity = DEFAULT_CAPACITY);
+            ~HashCache();
+
+            HashCache(const HashCache &) = delete;
+            HashCache(HashCache &&) = delete;
+            auto operator=(const HashCache &) -> HashCache & = delete;
+            auto operator=(HashCache &&) -> HashCache & = delete;
+
+            // Cache shared by the whole process
+            static auto global() -> HashCache &;
+
+            // Returns the cached hash of the file if it didn't change, hash it otherwise
+            auto file_hash(HashAlgorithm algo, const std::filesystem::path &path) -> std::string;
+            // Let the cache know the hash of a file, when it was computed by other means
+            void store(HashAlgorithm algo, const std::filesystem::path &path, std::string hash);
+            // Same as file_hash, for the hash of each `chunk_size` bytes of the file (see Utils::chunk_hashes)
+            auto chunk_hashes(HashAlgorithm algo, const std::filesystem::path &path, std::size_t chunk_size) -> std::vector<std::string>;
+            // Same as file_hash, for the content defined chunks of the file (see Utils::content_chunks)
+            auto content_chunks(HashAlgorithm algo, const std::filesystem::path &path, std::size_t average_size) -> std::vector<ContentChunk>;
+
+            auto find(const Key &key) -> std::optional<std::string>;
+            void insert(const Key &key, std::string hash);
+            void clear();
+
+            static auto make_key(HashAlgorithm algo, const std::filesystem::path &path) -> Key;
+
+            // Load the cache from this file, and save it there when save() is called or on destruction.
+            // An empty path disables persistence.
+            void set_persistent_file(std::filesystem::path path);
+            void save();
+
+            [[nodiscard]] auto size() const -> std::size_t;
+            [[nodiscard]] auto get_capacity() const -> std::size_t { return m_capacity; }
+            void set_capacity(std::size_t capacity);
+
+        private:
+            struct KeyHash {
+                auto operator()(const Key &key) const noexcept -> std::size_t;
+            };
+            using Entry = std::pair<Key, std::string>;
+
+            void evict();
+
+            mutable std::mutex m_mutex;
+            std::size_t m_capacity;
+            std::list<Entry> m_entries; // Most recently used first
+            std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+            std::filesystem::path m_persistent_file;
+            bool m_dirty = false;
+    };
+}
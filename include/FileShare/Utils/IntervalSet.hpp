@@ -0,0 +1,51 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:50:14 2026 Francois Michaut
+** Last update Mon Oct 19 01:50:14 2026 Francois Michaut
+**
+** IntervalSet.hpp : Set of integers stored as ranges, to track packets efficiently
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+namespace FileShare::Utils {
+    // Set of integers stored as non-overlapping [begin, end) ranges: a gap of N missing packets
+    // is a single range, and adding / removing a value is O(log(number of ranges)).
+    class IntervalSet {
+        public:
+            using Intervals = std::map<std::size_t, std::size_t>; // begin -> end (excluded)
+
+            void insert(std::size_t value) { insert(value, value + 1); }
+            // Insert all the values of [begin, end)
+            void insert(std::size_t begin, std::size_t end);
+            // Returns false if value was not in the set
+            auto erase(std::size_t value) -> bool;
+            void clear();
+
+            [[nodiscard]] auto contains(std::size_t value) const -> bool;
+            [[nodiscard]] auto empty() const -> bool { return m_intervals.empty(); }
+            // Smallest value of the set. The set must not be empty.
+            [[nodiscard]] auto front() const -> std::size_t { return m_intervals.begin()->first; }
+            // Number of values in the set
+            [[nodiscard]] auto count() const -> std::size_t { return m_count; }
+            [[nodiscard]] auto get_intervals() const -> const Intervals & { return m_intervals; }
+
+            auto operator==(const IntervalSet &other) const -> bool = default;
+
+            // Requires <cereal/types/map.hpp>
+            template <class Archive>
+            void serialize(Archive &archive, const std::uint32_t /* version */) {
+                archive(m_intervals, m_count);
+            }
+        private:
+            Intervals m_intervals;
+            std::size_t m_count = 0;
+    };
+}
@@ -0,0 +1,86 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:14:34 2026 Francois Michaut
+** Last update Mon Oct 19 08:48:54 2026 Francois Michaut
+**
+** ReadAhead.hpp : Read the next blocks of a file in parallel, ahead of their use
+*/
+
+#pragma once
+
+#include "FileShare/Utils/BufferPool.hpp"
+
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace FileShare::Utils {
+    struct ReadAheadStats {
+        std::size_t depth = 0; // Maximum number of blocks read ahead
+        std::size_t threads = 0;
+        std::size_t queued = 0; // Blocks read, waiting to be used
+        std::size_t blocks_read = 0;
+        std::size_t stalls = 0; // Times a block was needed before it was read
+    };
+
+    // Reads up to `depth` blocks ahead on a few threads, so the disk latency is hidden behind what is
+    // done with the blocks (eg: sending them). The blocks are read in parallel, but returned in order.
+    class ReadAhead {
+        public:
+            // Read up to `size` bytes at `offset` in `buffer`, returns the number of bytes read.
+            // Called from several threads at once.
+            using ReadFunction = std::function<std::size_t(char *buffer, std::size_t size, std::size_t offset)>;
+
+            ReadAhead(
+                ReadFunction read, std::shared_ptr<BufferPool> buffer_pool, std::size_t block_size,
+                std::size_t first_offset, std::size_t block_count, std::size_t depth, std::size_t threads
+            );
+            ~ReadAhead();
+
+            ReadAhead(const ReadAhead &) = delete;
+            ReadAhead(ReadAhead &&) = delete;
+            auto operator=(const ReadAhead &) -> ReadAhead & = delete;
+            auto operator=(ReadAhead &&) -> ReadAhead & = delete;
+
+            // The next block, waiting for it if it is not read yet. Its buffer comes from the pool.
+            // Rethrows the error if reading it failed.
+            auto next() -> std::string;
+
+            [[nodiscard]] auto get_stats() const -> ReadAheadStats;
+        private:
+            struct Slot {
+                std::string data;
+                std::exception_ptr error;
+                bool ready = false;
+            };
+
+            void read_blocks();
+
+            ReadFunction m_read;
+            std::shared_ptr<BufferPool> m_buffer_pool;
+            std::size_t m_block_size;
+            std::size_t m_first_offset;
+            std::size_t m_block_count;
+
+            mutable std::mutex m_mutex;
+            std::condition_variable m_room_available;
+            std::condition_variable m_block_ready;
+            // Block i uses the slot i % depth
+            std::vector<Slot> m_slots;
+            std::size_t m_next_read = 0;
+            std::size_t m_next_block = 0;
+            std::size_t m_blocks_read = 0;
+            std::size_t m_stalls = 0;
+            bool m_stop = false;
+
+            // Started once everything else is initialized
+            std::vector<std::thread> m_threads;
+    };
+}
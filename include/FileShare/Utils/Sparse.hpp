@@ -0,0 +1,46 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:00:20 2026 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
+**
+** Sparse.hpp : Holes of sparse files, which are not sent
+*/
+
+#pragma once
+
+#include "FileShare/Utils/ByteStream.hpp"
+#include "FileShare/Utils/FileDescriptor.hpp"
+
+#include <vector>
+
+namespace FileShare::Utils {
+    // Smaller holes are sent as data: a descriptor costs more than what skipping them would save
+    constexpr std::size_t MIN_HOLE_SIZE = 0x10000; // 64 KiB
+    constexpr std::size_t MAX_HOLES = 0x4000;
+
+    struct FileRange {
+        std::size_t offset;
+        std::size_t size;
+    };
+
+    // Part of a file sent back to back with the other ones, when only some parts of it are sent
+    struct Extent {
+        std::size_t offset; // In the data sent
+        std::size_t file_offset;
+        std::size_t size;
+    };
+
+    // Ranges of at least MIN_HOLE_SIZE bytes of the first `file_size` bytes of the file which are not
+    // stored on disk, and read as zeros. Empty if the filesystem can't tell.
+    auto find_holes(const FileDescriptor &file, std::size_t file_size) -> std::vector<FileRange>;
+    // The rest of the file, what is actually sent. `holes` must be sorted and not overlap.
+    auto data_extents(const std::vector<FileRange> &holes, std::size_t file_size) -> std::vector<Extent>;
+    // Total size of the extents
+    auto extents_size(const std::vector<Extent> &extents) -> std::size_t;
+    // Read up to `size` bytes of the data sent, starting at `offset`. The data sent is the whole file if
+    // there are no extents. Returns the number of bytes read, less than `size` at the end of the data.
+    auto read_extents(const IByteSource &source, const std::vector<Extent> &extents, char *buffer, std::size_t size, std::size_t offset) -> std::size_t;
+}
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Tue Sep 13 11:29:35 2022 Francois Michaut
-** Last update Sun Aug 24 19:46:07 2025 Francois Michaut
+** Last update Mon Oct 19 05:27:50 2026 Francois Michaut
 **
 ** FileShareConfig.cpp : FileShareConfig implementation
 */
@@ -18,6 +18,7 @@
 #include <cstdio>
 #include <filesystem>
 #include <fstream>
+#include <stdexcept>
 
 const char * const DEFAULT_PATH = "~/.fsp/default_config";
 
@@ -35,6 +36,14 @@ namespace FileShare {
         return *this;
     }
 
+    auto Config::set_packet_size(std::size_t packet_size) -> Config & {
+        if (!Protocol::is_valid_packet_size(packet_size)) {
+            throw std::runtime_error("Packet size must be between " + std::to_string(Protocol::MIN_PACKET_SIZE) + " and " + std::to_string(Protocol::MAX_PACKET_SIZE) + " bytes");
+        }
+        m_packet_size = packet_size;
+        return *this;
+    }
+
     auto Config::load(std::filesystem::path config_file) -> Config {
         if (config_file.empty()) {
             config_file = DEFAULT_PATH;
@@ -46,7 +55,9 @@ namespace FileShare {
         cereal::BinaryInputArchive archive(file);
 
         archive(config);
-        // TODO: Need to validate config - if someone messes up the file, we could have problems
+        // Goes through the setter so a packet size out of bounds is rejected like when set by hand
+        config.set_packet_size(config.m_packet_size);
+        // TODO: Need to validate the rest of the config - if someone messes up the file, we could have problems
         return config;
     }
 
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Thu Nov 16 22:14:51 2023 Francois Michaut
-** Last update Sun Aug 24 11:31:51 2025 Francois Michaut
+** Last update Mon Oct 19 09:13:00 2026 Francois Michaut
 **
 ** FileMapping.cpp : Config's PathNode implementation
 */
@@ -408,18 +408,18 @@ namespace FileShare {
         return node->get_host_path(); // Virtual nodes will return ""
     }
 
-    auto FileMapping::find_virtual_node(std::filesystem::path virtual_path, std::filesystem::path::iterator &out, bool only_visible) const -> std::optional<PathNode> {
-        std::string str = trim_node_name(virtual_path.string());
+    auto FileMapping::find_virtual_node(const std::filesystem::path &virtual_path, std::filesystem::path::iterator &out, bool only_visible) const -> std::optional<PathNode> {
         const PathNode *result = &m_root_node;
-        // TODO: Instead of trimming, do smth else, cause right now `/fsp/aaa` will be considered a virtual path to /aaa -> What if /fsp is an actual host folder ??
+        // TODO: Instead of skipping it, do smth else, cause right now `/fsp/aaa` will be considered a virtual path to /aaa -> What if /fsp is an actual host folder ??
         const auto &root_name = trim_node_name(m_root_node.get_name());
 
-        // Root name is optional in the path
-        if (str.starts_with(root_name)) {
-            virtual_path = str.substr(root_name.size());
+        // Root name is optional in the path. It is skipped rather than trimmed, since `out` must point in virtual_path.
+        for (out = virtual_path.begin(); out != virtual_path.end() && *out == "/"; out++);
+        if (out != virtual_path.end() && *out == root_name) {
+            out++;
         }
-        for (out = virtual_path.begin(); out != virtual_path.end(); out++) {
-            if (*out == "/")
+        for (; out != virtual_path.end(); out++) {
+            if (*out == "/" || out->empty())
                 continue;
 
             const auto &child_nodes = result->get_child_nodes();
@@ -444,7 +444,7 @@ namespace FileShare {
     auto FileMapping::find_virtual_node(std::filesystem::path virtual_path, bool only_visible) const -> std::optional<PathNode> {
         std::filesystem::path::iterator iter;
 
-        return FileMapping::find_virtual_node(std::move(virtual_path), iter, only_visible);
+        return FileMapping::find_virtual_node(virtual_path, iter, only_visible);
     }
 
     auto FileMapping::is_forbidden(const std::filesystem::path &path) const -> bool {
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Wed Aug  6 15:19:24 2025 Francois Michaut
-** Last update Sun Aug 24 19:48:12 2025 Francois Michaut
+** Last update Mon Oct 19 08:59:53 2026 Francois Michaut
 **
 ** ServerConfig.cpp : Server Configuration Implementation
 */
@@ -36,6 +36,28 @@ namespace FileShare {
         return private_keys_dir;
     }
 
+    auto ServerConfig::default_transfer_journal() -> const std::filesystem::path & {
+        static const std::filesystem::path transfer_journal = FileShare::Utils::resolve_home_component("~/.fsp/transfers").generic_string();
+
+        return transfer_journal;
+    }
+
+    auto ServerConfig::set_transfer_journal(std::string_view path) -> ServerConfig & {
+        m_transfer_journal = path.empty() ? std::filesystem::path() : FileShare::Utils::resolve_home_component(path);
+        return *this;
+    }
+
+    auto ServerConfig::default_hash_cache() -> const std::filesystem::path & {
+        static const std::filesystem::path hash_cache = FileShare::Utils::resolve_home_component("~/.fsp/hash_cache").generic_string();
+
+        return hash_cache;
+    }
+
+    auto ServerConfig::set_hash_cache(std::string_view path) -> ServerConfig & {
+        m_hash_cache = path.empty() ? std::filesystem::path() : FileShare::Utils::resolve_home_component(path);
+        return *this;
+    }
+
     auto ServerConfig::set_private_keys_dir(std::string_view path) -> ServerConfig & {
         m_private_keys_dir = FileShare::Utils::resolve_home_component(path);
         return *this;
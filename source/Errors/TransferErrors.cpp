@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Sun Oct 22 13:51:24 2023 Francois Michaut
-** Last update Sat Dec  9 08:57:23 2023 Francois Michaut
+** Last update Mon Oct 19 08:43:01 2026 Francois Michaut
 **
 ** TransferErrors.cpp : Transfer related errors implementation
 */
@@ -19,4 +19,20 @@ namespace FileShare::Errors::Transfer {
     UpToDateError::UpToDateError(std::string filename) :
         Error("File '" + filename + "' is already up to date"), m_filename(std::move(filename))
     {}
+
+    ResumeError::ResumeError(const char *filename) :
+        ResumeError(std::string(filename))
+    {}
+
+    ResumeError::ResumeError(std::string filename) :
+        Error("Download of '" + filename + "' cannot be resumed"), m_filename(std::move(filename))
+    {}
+
+    HashMismatchError::HashMismatchError(const char *filename) :
+        HashMismatchError(std::string(filename))
+    {}
+
+    HashMismatchError::HashMismatchError(std::string filename) :
+        Error("Transferred file '" + filename + "' does not match its hash"), m_filename(std::move(filename))
+    {}
 }
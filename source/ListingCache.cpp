@@ -0,0 +1,198 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 04:59:02 2026 Francois Michaut
+** Last update Mon Oct 19 09:22:38 2026 Francois Michaut
+**
+** ListingCache.cpp : Content of the host folders listed, kept until they change
+*/
+
+#include "FileShare/ListingCache.hpp"
+
+#include <CppSockets/OSDetection.hpp>
+
+#if defined(OS_UNIX) && !defined(OS_APPLE)
+  #include <sys/inotify.h>
+  #include <unistd.h>
+#endif
+
+namespace FileShare {
+#if defined(OS_UNIX) && !defined(OS_APPLE)
+    namespace {
+        // Anything changing the files of the folder, their metadata, or the folder itself
+        constexpr std::uint32_t WATCH_EVENTS = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY |
+            IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+    }
+#endif
+
+    ListingCache::ListingCache(std::size_t capacity) :
+        m_capacity(capacity)
+    {
+#if defined(OS_UNIX) && !defined(OS_APPLE)
+        int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+        if (fd >= 0) {
+            m_inotify.emplace(fd, "inotify");
+        }
+#endif
+    }
+
+    // Closing the inotify descriptor removes all the watches
+    ListingCache::~ListingCache() = default;
+
+    auto ListingCache::find(const std::filesystem::path &host_path, std::uint8_t fields) -> std::shared_ptr<const CachedListing> {
+        if (!m_inotify.has_value() || m_capacity == 0) {
+            return nullptr;
+        }
+        process_events();
+
+        auto entry = m_entries.find(host_path.string());
+
+        if (entry == m_entries.end() || !entry->second.listing || (entry->second.listing->fields & fields) != fields) {
+            return nullptr;
+        }
+        m_lru.splice(m_lru.begin(), m_lru, entry->second.lru_position);
+        return entry->second.listing;
+    }
+
+    auto ListingCache::start_read(const std::filesystem::path &host_path) -> std::optional<ReadID> {
+        if (!m_inotify.has_value() || m_capacity == 0) {
+            return std::nullopt;
+        }
+        process_events();
+
+        std::string key = host_path.string();
+        auto entry = m_entries.find(key);
+
+        if (entry != m_entries.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, entry->second.lru_position);
+            if (entry->second.too_big) {
+                return std::nullopt;
+            }
+            // Read again, with missing fields or by another listing: only the last read is kept
+            entry->second.listing = nullptr;
+            entry->second.read_id = m_next_read_id++;
+            return entry->second.read_id;
+        }
+#if defined(OS_UNIX) && !defined(OS_APPLE)
+        int watch = inotify_add_watch(*m_inotify, key.c_str(), WATCH_EVENTS);
+
+        if (watch < 0) {
+            return std::nullopt; // Out of watches, or not a folder
+        }
+        if (m_watches.contains(watch)) {
+            return std::nullopt; // The same folder through another path, it is cached once
+        }
+        m_watches.emplace(watch, key);
+        m_lru.push_front(key);
+
+        ReadID read_id = m_next_read_id++;
+
+        m_entries.emplace(std::move(key), Entry{.watch=watch, .listing=nullptr, .read_id=read_id, .too_big=false, .lru_position=m_lru.begin()});
+        // Reads never finished (eg: the listing was cancelled) are dropped like the other entries
+        while (m_entries.size() > m_capacity) {
+            erase(m_entries.find(m_lru.back()));
+        }
+        return read_id;
+#else
+        return std::nullopt;
+#endif
+    }
+
+    void ListingCache::finish_read(const std::filesystem::path &host_path, ReadID id, std::shared_ptr<const CachedListing> listing) {
+        if (!m_inotify.has_value()) {
+            return;
+        }
+        process_events();
+
+        auto entry = m_entries.find(host_path.string());
+
+        if (entry == m_entries.end() || entry->second.listing || entry->second.too_big || entry->second.read_id != id) {
+            return; // Changed while it was read, dropped, or read again since
+        }
+        if (listing) {
+            entry->second.listing = std::move(listing);
+        } else {
+            entry->second.too_big = true;
+        }
+    }
+
+    auto ListingCache::get(const std::filesystem::path &host_path, std::uint8_t fields, const Reader &read) -> std::shared_ptr<const CachedListing> {
+        if (auto listing = find(host_path, fields)) {
+            return listing;
+        }
+
+        auto read_id = start_read(host_path);
+        auto listing = read();
+        std::shared_ptr<const CachedListing> result;
+
+        if (listing.has_value()) {
+            result = std::make_shared<const CachedListing>(std::move(listing.value()));
+        }
+        if (read_id.has_value()) {
+            finish_read(host_path, read_id.value(), result);
+        }
+        return result;
+    }
+
+    void ListingCache::invalidate(const std::filesystem::path &host_path) {
+        auto entry = m_entries.find(host_path.string());
+
+        if (entry != m_entries.end()) {
+            erase(entry);
+        }
+    }
+
+    void ListingCache::clear() {
+#if defined(OS_UNIX) && !defined(OS_APPLE)
+        for (const auto &[watch, path] : m_watches) {
+            inotify_rm_watch(*m_inotify, watch);
+        }
+#endif
+        m_entries.clear();
+        m_watches.clear();
+        m_lru.clear();
+    }
+
+    void ListingCache::process_events() {
+#if defined(OS_UNIX) && !defined(OS_APPLE)
+        alignas(struct inotify_event) char buffer[0x1000];
+
+        while (true) {
+            ssize_t size = ::read(*m_inotify, buffer, sizeof(buffer));
+
+            if (size <= 0) {
+                return; // No more events
+            }
+            for (char *ptr = buffer; ptr < buffer + size;) {
+                const auto *event = reinterpret_cast<const struct inotify_event *>(ptr);
+
+                ptr += sizeof(struct inotify_event) + event->len;
+                if ((event->mask & IN_Q_OVERFLOW) != 0) {
+                    clear(); // Events were lost: any folder could have changed
+                    continue;
+                }
+
+                auto watch = m_watches.find(event->wd);
+
+                if (watch == m_watches.end()) {
+                    continue; // Already dropped
+                }
+
+                erase(m_entries.find(watch->second));
+            }
+        }
+#endif
+    }
+
+    void ListingCache::erase(EntryMap::iterator entry) {
+#if defined(OS_UNIX) && !defined(OS_APPLE)
+        inotify_rm_watch(*m_inotify, entry->second.watch);
+#endif
+        m_watches.erase(entry->second.watch);
+        m_lru.erase(entry->second.lru_position);
+        m_entries.erase(entry);
+    }
+}
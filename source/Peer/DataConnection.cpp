@@ -0,0 +1,73 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:09:14 2026 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
+**
+** DataConnection.cpp : Extra connection to a Peer, carrying the packets of its transfers
+*/
+
+#include "FileShare/Peer/DataConnection.hpp"
+#include "FileShare/Protocol/RequestData.hpp"
+
+#include <stdexcept>
+#include <utility>
+
+namespace FileShare {
+    DataConnection::DataConnection(PreAuthPeer &&peer) :
+        PeerBase(std::move(peer)), m_protocol(peer.get_protocol())
+    {}
+
+    auto DataConnection::attach() -> Protocol::StatusCode {
+        Protocol::MessageID message_id = send_request(Protocol::CommandCode::DATA_CONNECTION, std::make_shared<Protocol::DataConnectionData>());
+
+        // Nothing else is sent on this connection until the peer replied
+        while (get_socket().connected()) {
+            for (const auto &request : pull_requests()) {
+                if (request.code == Protocol::CommandCode::RESPONSE && request.message_id == message_id) {
+                    auto data = std::dynamic_pointer_cast<Protocol::ResponseData>(request.request);
+
+                    m_message_queue.receive_reply(message_id, data->status);
+                    return data->status;
+                }
+            }
+        }
+        throw std::runtime_error("connection lost while waiting for status");
+    }
+
+    auto DataConnection::pull_requests() -> std::vector<Protocol::Request> {
+        std::vector<Protocol::Request> result;
+
+        poll_requests();
+        m_request_buffer.swap(result);
+        return result;
+    }
+
+    void DataConnection::respond_to_request(const Protocol::Request &request, const Protocol::ResponseData &response) {
+        std::string message = m_protocol.handler().format_response(request.message_id, response);
+
+        m_message_queue.receive_request(request);
+        m_message_queue.send_reply(request.message_id, response.status);
+        get_socket().write(message);
+    }
+
+    auto DataConnection::send_request(Protocol::CommandCode command, std::shared_ptr<Protocol::IRequestData> request_data) -> Protocol::MessageID {
+        Protocol::Request request{command, std::move(request_data), 0};
+        Protocol::MessageID message_id = m_message_queue.send_request(request);
+
+        request.message_id = message_id;
+        get_socket().write(m_protocol.handler().format_request(request));
+        return message_id;
+    }
+
+    auto DataConnection::parse_bytes(std::string_view raw_msg, Protocol::Request &out) -> std::size_t {
+        return m_protocol.handler().parse_request(raw_msg, out);
+    }
+
+    void DataConnection::authorize_request(Protocol::Request request) {
+        // The Peer owning this connection handles them
+        m_request_buffer.emplace_back(std::move(request));
+    }
+}
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Mon Aug 29 20:50:53 2022 Francois Michaut
-** Last update Sat Aug 23 12:59:50 2025 Francois Michaut
+** Last update Mon Oct 19 09:22:38 2026 Francois Michaut
 **
 ** Peer.cpp : Implementation of the FileShareProtocol Client
 */
@@ -28,9 +28,30 @@ namespace FileShare {
         m_config(std::move(config)), m_protocol(peer.get_protocol())
     {}
 
+    Peer::~Peer() {
+        for (auto &[message_id, pending] : m_pending_uploads) {
+            try {
+                // Waits for it to be ready
+                UploadContent content = pending.content.get();
+
+                if (content.delta_block_size != 0) {
+                    std::filesystem::remove(content.path);
+                }
+            } catch (std::exception &) {
+                // Nothing to clean up
+            }
+        }
+        for (const auto &[message_id, upload] : m_scheduled_uploads) {
+            if (upload.id) {
+                m_scheduler->remove_transfer(*upload.id);
+            }
+        }
+    }
+
     auto Peer::pull_requests() -> std::vector<Protocol::Request> {
         std::vector<Protocol::Request> result;
 
+        poll_pending_uploads();
         poll_requests();
         // Move the buffer in the result, and clears the buffer
         // Requests will be lost if callers discards them. TODO: improve ? Could clear when user call `respond_to_request()`
@@ -38,6 +59,14 @@ namespace FileShare {
         return result;
     }
 
+    auto Peer::pull_buffered_requests() -> std::vector<Protocol::Request> {
+        std::vector<Protocol::Request> result;
+
+        parse_requests();
+        m_request_buffer.swap(result);
+        return result;
+    }
+
     void Peer::respond_to_request(Protocol::Request request, Protocol::StatusCode status) {
         m_message_queue.receive_request(request);
 
@@ -49,24 +78,27 @@ namespace FileShare {
         switch (request.code) {
             case Protocol::CommandCode::DATA_PACKET: {
                 auto data = std::dynamic_pointer_cast<Protocol::DataPacketData>(request.request);
-                auto iter = m_download_transfers.find(data->request_id);
-
-                if (iter != m_download_transfers.end()) {
-                    auto &handler = iter->second;
 
-                    handler.receive_packet(*data);
-                    if (handler.finished() && !handler.m_keep) {
-                        m_download_transfers.erase(data->request_id);
-                    }
-                    break;
-                }
-                send_reply(request.message_id, Protocol::StatusCode::INVALID_REQUEST_ID);
+                send_reply(request.message_id, receive_data_packet(*data));
                 return;
             }
             case Protocol::CommandCode::SEND_FILE: {
                 std::shared_ptr<Protocol::SendFileData> data = std::dynamic_pointer_cast<Protocol::SendFileData>(request.request);
+                auto resumed = m_resumed_downloads.find(data->filepath);
+                std::size_t packet_start = 0;
+
+                // The peer starts from the packet_start of our RECEIVE_FILE, even if it was accepted manually
+                if (resumed != m_resumed_downloads.end()) {
+                    packet_start = resumed->second;
+                    m_resumed_downloads.erase(resumed);
+                }
 
-                create_download(request.message_id, data);
+                auto transfer = create_download(request.message_id, data, packet_start);
+
+                // Already complete if we had all its chunks
+                if (transfer != m_download_transfers.end() && transfer->second.finished()) {
+                    erase_download(transfer);
+                }
                 return; // create_download already sends reply to request
 
             }
@@ -74,26 +106,35 @@ namespace FileShare {
                 std::shared_ptr<Protocol::ReceiveFileData> data = std::dynamic_pointer_cast<Protocol::ReceiveFileData>(request.request);
                 auto virtual_path = data->filepath;
                 auto host_path = m_config.get_file_mapping().virtual_to_host(virtual_path);
-                auto [handler, status] = prepare_upload(host_path.string(), virtual_path, data->packet_size, data->packet_start);
-
-                // Send reply to original RECEIVE_FILE before we send SEND_FILE
-                send_reply(request.message_id, status);
-                if (status == Protocol::StatusCode::STATUS_OK) {
-                    // prepare_upload will always return a handler if status == OK
-                    create_upload(std::move(handler.value())); // NOLINT(bugprone-unchecked-optional-access)
+                auto packet_size = Protocol::negotiate_packet_size(data->packet_size, m_config.get_packet_size());
+                // Only compressed if we both enabled it
+                auto compression = data->compression == m_config.get_compression() ? data->compression : Utils::CompressionAlgorithm::NONE;
+
+                if (((data->signature.block_size != 0 && data->packet_start == 0) || data->range.has_value())
+                    && !host_path.empty() && !m_config.get_file_mapping().is_forbidden(host_path)
+                ) {
+                    // Making the delta reads the whole file, and a range is hashed: the other peers are served
+                    // meanwhile, and we reply once it is ready
+                    m_pending_uploads.emplace(request.message_id, PendingUpload{
+                        .virtual_filepath=virtual_path, .packet_size=packet_size, .packet_start=data->packet_start, .compression=compression,
+                        .content=std::async(std::launch::async, &Peer::prepare_content, host_path, data->packet_start, data->signature, data->range)
+                    });
+                    return;
                 }
+                answer_receive_file(request.message_id, prepare_upload(host_path.string(), virtual_path, packet_size, data->packet_start, compression, data->signature, data->range));
                 return;
             }
             case Protocol::CommandCode::LIST_FILES: {
                 auto data = std::dynamic_pointer_cast<Protocol::ListFilesData>(request.request);
-                constexpr std::size_t packet_size = 4096; // TODO: find a better place for this, duplicated from ProtocolHandler
-                ListFilesTransferHandler handler(data->folderpath, m_config.get_file_mapping(), packet_size);
-
-                auto result = m_list_files_transfers.emplace(std::piecewise_construct, std::forward_as_tuple(request.message_id), std::forward_as_tuple(std::move(handler)));
+                ListFilesTransferHandler handler(
+                    data->folderpath, m_config.get_file_mapping(), m_config.get_packet_size(), data->fields, data->max_depth,
+                    m_listing_cache
+                );
 
+                m_list_files_transfers.emplace(std::piecewise_construct, std::forward_as_tuple(request.message_id), std::forward_as_tuple(std::move(handler)));
                 send_reply(request.message_id, Protocol::StatusCode::STATUS_OK);
-                // TODO: Send more than one
-                send_request(Protocol::CommandCode::FILE_LIST, result.first->second.get_next_packet(request.message_id));
+                // Each acknowledged packet sends the next one, keeping the window full
+                send_file_list(request.message_id, FILE_LIST_WINDOW);
                 return;
             }
             case Protocol::CommandCode::FILE_LIST: {
@@ -118,42 +159,77 @@ namespace FileShare {
     }
 
     auto Peer::send_file(const std::string &filepath, const ProgressCallback &progress_callback) -> Protocol::Response<void> {
-        auto result = create_host_upload(filepath);
-        Protocol::MessageID message_id = result->first;
-        UploadTransferHandler &upload_handler = result->second;
-        Protocol::StatusCode status = wait_for_status(message_id);
+        std::error_code ec;
 
-        // TODO: handle APPROVAL_PENDING
-        if (status != Protocol::StatusCode::STATUS_OK) {
-            m_upload_transfers.erase(result);
-            return {.code=status, .response={}};
+        if (std::filesystem::is_directory(filepath, ec)) {
+            return send_directory(filepath, progress_callback);
         }
-        while (!upload_handler.finished()) {
-            if (m_message_queue.available_send_slots() > 0) {
-                auto packet = upload_handler.get_next_packet(message_id);
+        return wait_for_upload(create_host_upload(filepath), filepath, progress_callback);
+    }
 
-                // TODO: monitor responses of theses packets
-                send_request(Protocol::CommandCode::DATA_PACKET, packet);
-                progress_callback(filepath, upload_handler.get_current_size(), upload_handler.get_total_size());
-            } else {
-                // TODO: currently blocking, but if it changes, needs to add a poll() call to avoid spamming loop
-                poll_requests();
-            }
+    auto Peer::receive_file(std::string filepath, const ProgressCallback &progress_callback) -> Protocol::Response<void> {
+        std::size_t packet_size = m_config.get_packet_size();
+        std::filesystem::path destination = download_path(filepath);
+        std::size_t packet_start = DownloadTransferHandler::resume_packet_start(destination.string(), packet_size);
+        std::shared_ptr<Protocol::ReceiveFileData> receive_file_data = std::make_shared<Protocol::ReceiveFileData>(filepath, packet_size, packet_start);
+        std::error_code ec;
+
+        if (has_file_fields()) {
+            receive_file_data->compression = m_config.get_compression();
+        }
+        if (packet_start == 0 && m_config.get_delta_block_size() != 0 && has_file_fields() && std::filesystem::is_regular_file(destination, ec)) {
+            // We have an older copy: only ask for what changed
+            std::size_t file_size = std::filesystem::file_size(destination);
+            std::size_t block_size = std::max(m_config.get_delta_block_size(), (file_size / Utils::MAX_SIGNATURE_BLOCKS) + 1);
+
+            receive_file_data->signature = Utils::file_signature(Utils::HashAlgorithm::MD5, destination, block_size);
         }
 
-        return {.code=status, .response={}}; // TODO
+        auto response = wait_for_download(filepath, send_request(Protocol::CommandCode::RECEIVE_FILE, receive_file_data), progress_callback);
+
+        if (!response.has_value() && packet_start != 0) {
+            // We could not resume the download (eg: file changed on the peer's side), start over
+            return receive_file(std::move(filepath), progress_callback);
+        }
+        if (!response.has_value()) {
+            throw std::runtime_error("Failed to locate download transfer");
+        }
+        return response.value();
     }
 
-    auto Peer::receive_file(std::string filepath, const ProgressCallback &progress_callback) -> Protocol::Response<void> {
-        std::size_t packet_start = 0; // TODO
-        std::size_t packet_size = 0; // TODO
-        std::shared_ptr<Protocol::ReceiveFileData> receive_file_data = std::make_shared<Protocol::ReceiveFileData>(filepath, packet_size, packet_start);
+    auto Peer::receive_file(std::string filepath, Utils::FileRange range, std::shared_ptr<Utils::IByteSink> sink, const ProgressCallback &progress_callback) -> Protocol::Response<void> {
+        std::shared_ptr<Protocol::ReceiveFileData> receive_file_data = std::make_shared<Protocol::ReceiveFileData>(filepath, m_config.get_packet_size(), 0);
+
+        if (range.size == 0) {
+            throw std::runtime_error("Invalid range download");
+        }
+        receive_file_data->range = range;
+        receive_file_data->compression = m_config.get_compression();
+
+        // The reply can only be processed once we wait for it
         Protocol::MessageID message_id = send_request(Protocol::CommandCode::RECEIVE_FILE, receive_file_data);
+
+        m_range_downloads.emplace(message_id, RangeDownload{.range=range, .sink=std::move(sink)});
+        try {
+            auto response = wait_for_download(filepath, message_id, progress_callback);
+
+            m_range_downloads.erase(message_id);
+            if (!response.has_value()) {
+                throw std::runtime_error("Failed to locate download transfer");
+            }
+            return response.value();
+        } catch (...) {
+            m_range_downloads.erase(message_id);
+            throw;
+        }
+    }
+
+    auto Peer::wait_for_download(const std::string &filepath, Protocol::MessageID message_id, const ProgressCallback &progress_callback) -> std::optional<Protocol::Response<void>> {
         Protocol::StatusCode status = wait_for_status(message_id);
 
         // TODO: handle APPROVAL_PENDING
         if (status != Protocol::StatusCode::STATUS_OK) {
-            return {.code=status, .response={}};
+            return Protocol::Response<void>{.code=status, .response={}};
         }
 
         auto incomming_requests = m_message_queue.get_incomming_requests();
@@ -165,29 +241,66 @@ namespace FileShare {
             auto original_data = std::dynamic_pointer_cast<Protocol::SendFileData>(item.second.request.request);
             return filepath == original_data->filepath;
         });
+
+        if (request == incomming_requests.end()) {
+            throw std::runtime_error("Failed to locate download transfer"); // TODO: we got STATUS_OK but no incomming request ? Something is wrong
+        }
+
         auto transfer_iter = m_download_transfers.find(request->first);
-        if (request != incomming_requests.end() && request->second.status.has_value()
-            && request->second.status.value() == Protocol::StatusCode::UP_TO_DATE // NOLINT(bugprone-unchecked-optional-access)
-        ) {
-            return {.code = Protocol::StatusCode::UP_TO_DATE, .response = {}};
+
+        if (request->second.status.has_value() && request->second.status.value() == Protocol::StatusCode::UP_TO_DATE) { // NOLINT(bugprone-unchecked-optional-access)
+            return Protocol::Response<void>{.code = Protocol::StatusCode::UP_TO_DATE, .response = {}};
         }
-        if (request == incomming_requests.end() || transfer_iter == m_download_transfers.end()) {
-            throw std::runtime_error("Failed to locate download transfer"); // TODO: we got STATUS_OK but no incomming request ? Something is wrong
+        if (transfer_iter == m_download_transfers.end() && request->second.status == Protocol::StatusCode::STATUS_OK) {
+            return Protocol::Response<void>{.code=status, .response={}}; // Complete as soon as it started (eg: inline content)
+        }
+        if (transfer_iter == m_download_transfers.end()) {
+            return std::nullopt;
         }
         auto &transfer_handler = transfer_iter->second;
 
         transfer_handler.m_keep = true;
         while (!transfer_handler.finished()) {
             progress_callback(filepath, transfer_handler.get_current_size(), transfer_handler.get_total_size());
-            poll_requests(); // TODO: currently blocking, but if it changes, needs to add a poll() call to avoid spamming loop
+            poll_connections(); // TODO: currently blocking, but if it changes, needs to add a poll() call to avoid spamming loop
         }
 
-        m_download_transfers.erase(transfer_iter);
-        return {.code=status, .response={}}; // TODO
+        // The download failed because of what the peer sent
+        status = transfer_handler.get_error().value_or(status);
+        erase_download(transfer_iter);
+        return Protocol::Response<void>{.code=status, .response={}}; // TODO
+    }
+
+    void Peer::resume_downloads() {
+        if (!m_journal) {
+            return;
+        }
+        for (const auto &filepath : m_journal->get_files(std::string(get_device_uuid()))) {
+            bool in_progress = std::ranges::any_of(m_download_transfers, [&filepath](const auto &item) {
+                return item.second.get_original_request()->filepath == filepath;
+            });
+
+            // Already asked for, and not answered yet
+            if (in_progress || m_resumed_downloads.contains(filepath)) {
+                continue;
+            }
+
+            std::size_t packet_size = m_config.get_packet_size();
+            std::size_t packet_start = DownloadTransferHandler::resume_packet_start(download_path(filepath).string(), packet_size);
+
+            auto receive_file_data = std::make_shared<Protocol::ReceiveFileData>(filepath, packet_size, packet_start);
+
+            if (has_file_fields()) {
+                receive_file_data->compression = m_config.get_compression();
+            }
+            // The SEND_FILE in reply is accepted by authorize_request(), which resumes from packet_start
+            send_request(Protocol::CommandCode::RECEIVE_FILE, receive_file_data);
+            m_resumed_downloads[filepath] = packet_start;
+        }
     }
 
-    auto Peer::list_files(std::string folderpath) -> Protocol::Response<std::vector<Protocol::FileInfo>> {
-        std::shared_ptr<Protocol::ListFilesData> list_files_data = std::make_shared<Protocol::ListFilesData>(folderpath);
+    auto Peer::list_files(std::string folderpath, std::uint8_t fields, std::size_t max_depth) -> Protocol::Response<std::vector<Protocol::FileInfo>> {
+        std::shared_ptr<Protocol::ListFilesData> list_files_data = std::make_shared<Protocol::ListFilesData>(folderpath, fields, max_depth);
         Protocol::MessageID message_id = send_request(Protocol::CommandCode::LIST_FILES, list_files_data);
         Protocol::StatusCode status = wait_for_status(message_id);
 
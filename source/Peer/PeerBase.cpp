@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Mon Jul 28 19:24:26 2025 Francois Michaut
-** Last update Sat Aug 23 11:06:22 2025 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
 **
 ** PeerBase.cpp : Implementation of the shared Base for the Peer class
 */
@@ -18,6 +18,7 @@
 #include <cstdint>
 #include <memory>
 #include <openssl/asn1.h>
+#include <openssl/ssl.h>
 #include <stdexcept>
 #include <utility>
 
@@ -41,6 +42,10 @@ namespace FileShare {
         m_socket.close();
     }
 
+    auto PeerBase::has_buffered_data() const -> bool {
+        return m_socket.connected() && SSL_pending(m_socket.get_ssl().get()) > 0;
+    }
+
     void PeerBase::read_peer_certificate() {
         const auto &raw_cert = m_socket.get_peer_cert();
 
@@ -77,14 +82,18 @@ namespace FileShare {
     }
 
     void PeerBase::poll_requests() {
+        if (!m_socket.connected()) // TODO: Check if there is still buffered bytes
+            return;
+        m_buffer += m_socket.read(); // TODO: add a timeout
+        parse_requests();
+    }
+
+    void PeerBase::parse_requests() {
         std::size_t total = 0;
         std::string_view view;
         Protocol::Request request;
         std::size_t ret = 0;
 
-        if (!m_socket.connected()) // TODO: Check if there is still buffered bytes
-            return;
-        m_buffer += m_socket.read(); // TODO: add a timeout
         if (m_buffer.empty()) {
             return;
         }
@@ -100,6 +109,6 @@ namespace FileShare {
             total += ret;
             view = view.substr(ret);
         }
-        m_buffer = m_buffer.substr(total);
+        m_buffer.erase(0, total);
     }
 }
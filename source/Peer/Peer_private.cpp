@@ -4,27 +4,48 @@
 ** Author Francois Michaut
 **
 ** Started on  Mon Oct 23 21:33:10 2023 Francois Michaut
-** Last update Sat Aug 23 11:29:59 2025 Francois Michaut
+** Last update Mon Oct 19 09:13:00 2026 Francois Michaut
 **
 ** Peer_private.cpp : Private functions of Peer implementation
 */
 
 #include "FileShare/Peer/Peer.hpp"
 #include "FileShare/Errors/TransferErrors.hpp"
+#include "FileShare/Utils/Delta.hpp"
+#include "FileShare/Utils/HashCache.hpp"
 #include "FileShare/Utils/Poll.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <fcntl.h>
 #include <sys/poll.h>
 
 namespace FileShare {
+    namespace {
+        auto temporary_path(const char *extension) -> std::filesystem::path {
+            std::random_device random;
+            std::stringstream name;
+
+            name << "fsp-" << std::hex << random() << random() << extension;
+            return std::filesystem::temp_directory_path() / name.str();
+        }
+    }
+
     auto Peer::parse_bytes(std::string_view raw_msg, Protocol::Request &out) -> std::size_t {
         return m_protocol.handler().parse_request(raw_msg, out);
     }
 
     void Peer::send_reply(Protocol::MessageID message_id, Protocol::StatusCode status) {
-        std::string message = m_protocol.handler().format_response(message_id, status);
+        send_reply(message_id, Protocol::ResponseData(status));
+    }
+
+    void Peer::send_reply(Protocol::MessageID message_id, const Protocol::ResponseData &response) {
+        std::string message = m_protocol.handler().format_response(message_id, response);
 
-        m_message_queue.send_reply(message_id, status);
+        m_message_queue.send_reply(message_id, response.status);
         get_socket().write(message);
     }
 
@@ -50,7 +71,7 @@ namespace FileShare {
 
                 // TODO: use find() and pass the iterator to receive_reply
                 if (m_message_queue.get_outgoing_requests().contains(request.message_id)) {
-                    receive_reply(request.message_id, data->status);
+                    receive_reply(request.message_id, *data);
                 }
                 return;
             }
@@ -76,13 +97,20 @@ namespace FileShare {
                     }
 
                     auto original_data = std::dynamic_pointer_cast<Protocol::ReceiveFileData>(item.second.request.request);
-                    return data->filepath == original_data->filepath;
+                    // Several ranges of the same file can be asked for at once
+                    return data->filepath == original_data->filepath && data->range.has_value() == original_data->range.has_value()
+                        && (!data->range.has_value() || data->range->offset == original_data->range->offset);
                 });
 
                 if (original_request != outgoing_requests.end()) {
+                    auto original_data = std::dynamic_pointer_cast<Protocol::ReceiveFileData>(original_request->second.request.request);
+
                     // We received a SEND_FILE to our RECEIVE_FILE -> we can mark is as OK since we don't need to keep it anymore
                     m_message_queue.receive_reply(original_request->first, Protocol::StatusCode::STATUS_OK);
-                    respond_to_request(request, Protocol::StatusCode::STATUS_OK);
+                    m_message_queue.receive_request(request);
+                    m_resumed_downloads.erase(data->filepath);
+                    // The peer starts sending from the packet_start we asked for, if we are resuming a download
+                    create_download(request.message_id, data, original_data->packet_start, original_request->first);
                     return;
                 }
                 break; // fallthrough default (manual approval) if no matching requests where found
@@ -115,6 +143,11 @@ namespace FileShare {
                 return;
              }
 
+            case Protocol::CommandCode::DATA_CONNECTION: {
+                // Only the first request of a connection can make it a data connection (see PreAuthPeer)
+                return respond_to_request(request, Protocol::StatusCode::BAD_REQUEST);
+            }
+
             // TODO: Auto-Accept PING
             default:
                 break; // Exit the switch but continue with the default APPROVAL_PENDING code.
@@ -125,8 +158,9 @@ namespace FileShare {
         m_request_buffer.emplace_back(std::move(request));
     }
 
-    void Peer::receive_reply(Protocol::MessageID message_id, Protocol::StatusCode status) {
+    void Peer::receive_reply(Protocol::MessageID message_id, const Protocol::ResponseData &reply) {
         auto source_request = m_message_queue.get_outgoing_requests().at(message_id).request;
+        Protocol::StatusCode status = reply.status;
 
         if (status == Protocol::StatusCode::STATUS_OK && source_request.code == Protocol::CommandCode::RECEIVE_FILE) {
             // Peer accepted our request; but we will mark it as PENDING since we are waiting on the SEND_FILE packet
@@ -134,35 +168,51 @@ namespace FileShare {
         }
 
         m_message_queue.receive_reply(message_id, status);
+        if (source_request.code == Protocol::CommandCode::RECEIVE_FILE && m_journal
+            && reply.status != Protocol::StatusCode::STATUS_OK && reply.status != Protocol::StatusCode::APPROVAL_PENDING
+        ) {
+            // The peer will not send it (eg: it was deleted): no point in asking for it again
+            auto data = std::dynamic_pointer_cast<Protocol::ReceiveFileData>(source_request.request);
+
+            if (!data->range.has_value()) {
+                m_journal->remove(std::string(get_device_uuid()), data->filepath);
+                m_resumed_downloads.erase(data->filepath);
+            }
+        }
+        if (source_request.code == Protocol::CommandCode::DATA_PACKET) {
+            auto packet_data = std::dynamic_pointer_cast<Protocol::DataPacketData>(source_request.request);
+
+            data_packet_acknowledged(*packet_data, reply);
+            return;
+        }
         if (status != Protocol::StatusCode::STATUS_OK) {
             return;
         }
 
         switch (source_request.code) {
-            case Protocol::CommandCode::DATA_PACKET: {
-                auto packet_data = std::dynamic_pointer_cast<Protocol::DataPacketData>(source_request.request);
-                auto handler = m_upload_transfers.find(packet_data->request_id);
-
-                if (handler != m_upload_transfers.end()) {
-                    auto new_packet = handler->second.get_next_packet(packet_data->request_id);
-
-                    if (new_packet) {
-                        send_request(Protocol::CommandCode::DATA_PACKET, new_packet);
-                    } else {
-                        m_upload_transfers.erase(handler);
-                    }
-                }
-                break;
-            }
-
             case Protocol::CommandCode::SEND_FILE: {
-                auto &handler = m_upload_transfers.at(message_id);
+                auto handler = m_upload_transfers.find(message_id);
 
-                // TODO: do not rely on that hardcoded 5
-                for (int i = 0; i < 5 && !handler.finished() && m_message_queue.available_send_slots() > 0; i++) {
-                    std::shared_ptr<Protocol::DataPacketData> new_packet = handler.get_next_packet(message_id);
-
-                    send_request(Protocol::CommandCode::DATA_PACKET, new_packet);
+                if (handler == m_upload_transfers.end()) {
+                    break;
+                }
+                handler->second.skip_known_chunks(reply.known_chunks);
+                if (handler->second.finished()) {
+                    erase_upload(handler); // The peer had all the chunks, nothing to send
+                } else {
+                    ScheduledUpload &upload = m_scheduled_uploads.at(message_id);
+
+                    // Only a weak reference: the Peer may be destroyed, or moved, before the scheduler runs
+                    upload.id = m_scheduler->add_transfer(
+                        std::string(get_device_uuid()), m_config.get_transfer_weight(), m_config.get_transfer_priority(),
+                        [peer = weak_from_this(), message_id]() -> std::size_t {
+                            Peer_ptr self = peer.lock();
+
+                            return self ? self->send_scheduled_packet(message_id) : 0;
+                        },
+                        upload.start_now
+                    );
+                    run_scheduler();
                 }
                 break;
             }
@@ -175,17 +225,8 @@ namespace FileShare {
 
             case Protocol::CommandCode::FILE_LIST: {
                 auto data = std::dynamic_pointer_cast<Protocol::FileListData>(source_request.request);
-                auto handler = m_list_files_transfers.find(data->request_id);
-
-                if (handler != m_list_files_transfers.end()) {
-                    auto new_packet = handler->second.get_next_packet(data->request_id);
 
-                    if (new_packet) {
-                        send_request(Protocol::CommandCode::FILE_LIST, new_packet);
-                    } else {
-                        m_upload_transfers.erase(message_id);
-                    }
-                }
+                send_file_list(data->request_id, 1);
                 break;
             }
 
@@ -194,43 +235,215 @@ namespace FileShare {
         }
     }
 
+    void Peer::send_file_list(Protocol::MessageID request_id, std::size_t max_packets) {
+        auto handler = m_list_files_transfers.find(request_id);
+
+        if (handler == m_list_files_transfers.end()) {
+            return;
+        }
+        for (std::size_t i = 0; i < max_packets && m_message_queue.available_send_slots() != 0; i++) {
+            auto packet = handler->second.get_next_packet(request_id);
+
+            if (!packet) {
+                m_list_files_transfers.erase(handler);
+                return;
+            }
+            send_request(Protocol::CommandCode::FILE_LIST, packet);
+        }
+    }
+
     auto Peer::prepare_upload(
         std::filesystem::path host_filepath, std::string virtual_filepath, std::size_t packet_size,
-        std::size_t packet_start
+        std::size_t packet_start, Utils::CompressionAlgorithm compression, const Utils::FileSignature &signature,
+        const std::optional<Utils::FileRange> &range
     ) -> std::pair<std::optional<UploadTransferHandler>, Protocol::StatusCode> {
+        // host_filepath will be empty if file is not visible, or doesn't have a mapping
+        if (host_filepath.empty() || m_config.get_file_mapping().is_forbidden(host_filepath)) {
+            return std::make_pair(std::nullopt, Protocol::StatusCode::FILE_NOT_FOUND);
+        }
+        return make_upload(prepare_content(host_filepath, packet_start, signature, range), std::move(virtual_filepath), packet_size, packet_start, compression);
+    }
+
+    auto Peer::prepare_content(
+        const std::filesystem::path &host_filepath, std::size_t packet_start, const Utils::FileSignature &signature,
+        const std::optional<Utils::FileRange> &range
+    ) -> UploadContent {
         std::error_code ec;
-        std::optional<UploadTransferHandler> handler;
         std::filesystem::directory_entry entry(host_filepath, ec);
+        UploadContent content;
 
-        // host_filepath will be empty if file is not visible, or doesn't have a mapping
-        if (ec || host_filepath.empty() || m_config.get_file_mapping().is_forbidden(host_filepath)) {
-            return std::make_pair(std::move(handler), Protocol::StatusCode::FILE_NOT_FOUND);
+        content.path = host_filepath;
+        if (ec) {
+            content.status = Protocol::StatusCode::FILE_NOT_FOUND;
+            return content;
+        }
+        content.updated_at = entry.last_write_time();
+        content.size = entry.file_size();
+        if (range.has_value()) {
+            Utils::Hasher hasher(Utils::HashAlgorithm::SHA512);
+
+            if (range->offset > content.size) {
+                content.status = Protocol::StatusCode::BAD_REQUEST;
+                return content;
+            }
+            // Only the range is hashed: the peer can verify it, and we don't read the rest of the file
+            content.size = std::min(range->size, content.size - range->offset);
+            content.range = Utils::FileRange{.offset=range->offset, .size=content.size};
+            if (hasher.update_file(host_filepath, range->offset, content.size) != content.size) {
+                content.status = Protocol::StatusCode::FILE_NOT_FOUND; // The file got shorter
+                return content;
+            }
+            content.file_hash = hasher.digest();
+        } else {
+            content.file_hash = Utils::HashCache::global().file_hash(Utils::HashAlgorithm::SHA512, host_filepath);
+        }
+        if (signature.block_size != 0 && packet_start == 0 && !range.has_value()) {
+            std::filesystem::path delta_path = temporary_path(DownloadTransferHandler::DELTA_EXTENSION);
+
+            if (Utils::make_delta(signature, host_filepath, delta_path) < content.size) {
+                content.path = delta_path;
+                content.size = std::filesystem::file_size(delta_path);
+                content.delta_block_size = signature.block_size;
+            } else {
+                std::filesystem::remove(delta_path); // Nothing in common, send the file as usual
+            }
+        }
+        return content;
+    }
+
+    auto Peer::make_upload(
+        UploadContent content, std::string virtual_filepath, std::size_t packet_size, std::size_t packet_start,
+        Utils::CompressionAlgorithm compression
+    ) -> std::pair<std::optional<UploadTransferHandler>, Protocol::StatusCode> {
+        std::optional<UploadTransferHandler> handler;
+        bool is_delta = content.delta_block_size != 0;
+
+        if (content.status != Protocol::StatusCode::STATUS_OK) {
+            return std::make_pair(std::move(handler), content.status);
         }
 
-        std::filesystem::file_time_type file_updated_at = entry.last_write_time();
-        std::string file_hash = Utils::file_hash(Utils::HashAlgorithm::SHA512, host_filepath);
-        std::size_t file_size = entry.file_size();
-        std::size_t total_packets = (file_size / packet_size) + (file_size % packet_size == 0 ? 0 : 1);
+        std::vector<Utils::FileRange> holes;
+        std::size_t data_size = content.size;
+
+        if (!is_delta && packet_start == 0 && !content.range.has_value() && content.size >= MIN_SPARSE_FILE_SIZE && has_file_fields()) {
+            // The holes are not sent, the peer leaves them as holes too
+            holes = Utils::find_holes(Utils::FileDescriptor(content.path, O_RDONLY), content.size);
+            data_size = Utils::extents_size(Utils::data_extents(holes, content.size));
+        }
+
+        std::size_t total_packets = (data_size / packet_size) + (data_size % packet_size == 0 ? 0 : 1);
 
         if (packet_start > total_packets) {
+            if (is_delta) {
+                std::filesystem::remove(content.path);
+            }
             return std::make_pair(std::move(handler), Protocol::StatusCode::BAD_REQUEST);
         }
         total_packets -= packet_start;
 
-        std::shared_ptr<Protocol::SendFileData> send_file_data = std::make_shared<Protocol::SendFileData>(std::move(virtual_filepath), Utils::HashAlgorithm::SHA512, file_hash, file_updated_at, packet_size, total_packets);
+        std::optional<std::string> inline_content;
+
+        if (!is_delta && packet_start == 0 && content.size <= std::min(packet_size, MAX_INLINE_FILE_SIZE) && has_file_fields()) {
+            Utils::FileDescriptor file(content.path, O_RDONLY);
+            Utils::Hasher hasher(Utils::HashAlgorithm::SHA512);
+
+            inline_content.emplace(content.size, '\0');
+            inline_content->resize(file.pread(inline_content->data(), content.size, content.range.has_value() ? content.range->offset : 0));
+            // Hash what is actually sent, in case the file changed since it was hashed
+            hasher.update(inline_content.value());
+            content.file_hash = hasher.digest();
+            total_packets = 0;
+        }
+
+        std::shared_ptr<Protocol::SendFileData> send_file_data = std::make_shared<Protocol::SendFileData>(std::move(virtual_filepath), Utils::HashAlgorithm::SHA512, content.file_hash, content.updated_at, packet_size, total_packets);
 
-        handler = {host_filepath.string(), std::move(send_file_data), packet_start};
+        send_file_data->range = content.range;
+        if (inline_content.has_value()) {
+            send_file_data->inline_content = std::move(inline_content);
+            handler.emplace(content.path.string(), std::move(send_file_data), packet_start);
+            return std::make_pair(std::move(handler), Protocol::StatusCode::STATUS_OK);
+        }
+        send_file_data->delta_block_size = content.delta_block_size;
+        send_file_data->compression = compression;
+        if (!holes.empty()) {
+            // Mostly zeros: neither deduplication nor a hash tree would help
+            send_file_data->holes = std::move(holes);
+            send_file_data->file_size = content.size;
+        } else if (content.range.has_value() || !has_file_fields()) {
+            // Content chunks and hash trees describe the whole file: the range is only verified with filehash.
+            // v0.0.0 peers only know filehash too.
+        } else if (!is_delta && packet_start == 0 && m_config.get_deduplication() && content.size >= MIN_DEDUPLICATED_FILE_SIZE) {
+            // The peer replies which chunks it already has. The hash tree can't be used: we don't
+            // know yet what will be sent.
+            send_file_data->content_chunks = Utils::HashCache::global().content_chunks(Utils::HashAlgorithm::SHA512, content.path, Utils::content_chunk_size(content.size));
+        } else if (m_config.get_hash_chunk_size() != 0) {
+            std::size_t chunk_size = std::max(packet_size, (m_config.get_hash_chunk_size() / packet_size) * packet_size);
+
+            send_file_data->chunk_size = chunk_size;
+            if (is_delta) {
+                send_file_data->chunk_hashes = Utils::chunk_hashes(Utils::HashAlgorithm::SHA512, content.path, chunk_size);
+            } else {
+                send_file_data->chunk_hashes = Utils::HashCache::global().chunk_hashes(Utils::HashAlgorithm::SHA512, content.path, chunk_size);
+            }
+        }
+
+        handler.emplace(content.path.string(), std::move(send_file_data), packet_start, is_delta);
+        if (data_size >= MIN_READ_AHEAD_FILE_SIZE && m_config.get_read_ahead_depth() != 0) {
+            handler->enable_read_ahead(m_config.get_read_ahead_depth(), m_config.get_read_ahead_threads());
+        }
         return std::make_pair(std::move(handler), Protocol::StatusCode::STATUS_OK);
     }
 
+    void Peer::answer_receive_file(Protocol::MessageID request_id, std::pair<std::optional<UploadTransferHandler>, Protocol::StatusCode> upload) {
+        // Send reply to original RECEIVE_FILE before we send SEND_FILE
+        send_reply(request_id, upload.second);
+        if (upload.second == Protocol::StatusCode::STATUS_OK) {
+            // There is always a handler if status == OK
+            create_upload(std::move(upload.first.value())); // NOLINT(bugprone-unchecked-optional-access)
+        }
+    }
+
+    void Peer::poll_pending_uploads() {
+        for (auto iter = m_pending_uploads.begin(); iter != m_pending_uploads.end(); ) {
+            auto &pending = iter->second;
+
+            if (pending.content.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+                iter++;
+                continue;
+            }
+            try {
+                answer_receive_file(iter->first, make_upload(pending.content.get(), std::move(pending.virtual_filepath), pending.packet_size, pending.packet_start, pending.compression));
+            } catch (std::exception &) {
+                send_reply(iter->first, Protocol::StatusCode::INTERNAL_ERROR);
+            }
+            iter = m_pending_uploads.erase(iter);
+        }
+    }
+
+    auto Peer::prepare_bundle(
+        const std::vector<Utils::BundleFile> &files, std::string virtual_dirpath,
+        std::filesystem::file_time_type updated_at, std::size_t packet_size
+    ) -> UploadTransferHandler {
+        // Read from the files as it is sent, nothing is written to disk
+        auto source = std::make_shared<Utils::BundleByteSource>(Utils::HashAlgorithm::SHA512, files);
+        std::size_t bundle_size = source->get_size();
+        std::size_t total_packets = (bundle_size / packet_size) + (bundle_size % packet_size == 0 ? 0 : 1);
+        std::shared_ptr<Protocol::SendFileData> send_file_data = std::make_shared<Protocol::SendFileData>(std::move(virtual_dirpath), Utils::HashAlgorithm::SHA512, source->get_hash(), updated_at, packet_size, total_packets);
+
+        send_file_data->file_type = Protocol::FileType::DIRECTORY;
+        // Only v0.1.0 peers can receive a bundle: sending its SEND_FILE fails otherwise
+        send_file_data->compression = m_config.get_compression();
+        return {std::move(source), std::move(send_file_data)};
+    }
+
     auto Peer::create_host_upload(std::filesystem::path host_filepath) -> Peer::UploadTransferMap::iterator {
-        // TODO: QUICK uses 1200 bytes max for packets, for MTU optimization, maybe we should respect that as well ?
-        constexpr std::size_t packet_size = 4096; // TODO: find a better place for this, duplicated from ProtocolHandler
         auto virtual_path = m_config.get_file_mapping().host_to_virtual(host_filepath);
 
         if (virtual_path.empty())
             virtual_path = host_filepath.filename();
-        auto result = prepare_upload(host_filepath.string(), virtual_path.string(), packet_size, 0);
+        // The peer replies UNSUPPORTED_COMPRESSION if it did not enable it, wait_for_upload then sends it uncompressed
+        auto compression = has_file_fields() ? m_config.get_compression() : Utils::CompressionAlgorithm::NONE;
+        auto result = prepare_upload(host_filepath.string(), virtual_path.string(), m_config.get_packet_size(), 0, compression);
 
         if (result.second == Protocol::StatusCode::STATUS_OK) {
             return create_upload(std::move(result.first.value()));
@@ -246,22 +459,414 @@ namespace FileShare {
             std::forward_as_tuple(message_id),
             std::forward_as_tuple(std::move(handler))
         );
+        m_scheduled_uploads.try_emplace(message_id);
         return result.first;
     }
 
-    auto Peer::create_download(Protocol::MessageID request_id, const std::shared_ptr<Protocol::SendFileData> &data) -> Peer::DownloadTransferMap::iterator {
-        std::filesystem::path filepath(data->filepath);
+    void Peer::erase_upload(UploadTransferMap::iterator upload) {
+        auto scheduled = m_scheduled_uploads.find(upload->first);
+
+        if (scheduled != m_scheduled_uploads.end()) {
+            if (scheduled->second.id) {
+                m_scheduler->remove_transfer(*scheduled->second.id);
+            }
+            m_scheduled_uploads.erase(scheduled);
+        }
+        m_upload_transfers.erase(upload);
+    }
+
+    void Peer::erase_download(DownloadTransferMap::iterator download) {
+        if (m_journal && download->second.finished() && !download->second.get_original_request()->range.has_value()) {
+            m_journal->remove(std::string(get_device_uuid()), download->second.get_original_request()->filepath);
+        }
+        m_download_transfers.erase(download);
+    }
+
+    auto Peer::download_path(const std::string &virtual_filepath) -> std::filesystem::path {
+        return m_config.get_downloads_folder() / get_device_uuid() / std::filesystem::path(virtual_filepath).relative_path();
+    }
+
+    auto Peer::create_download(
+        Protocol::MessageID request_id, const std::shared_ptr<Protocol::SendFileData> &data, std::size_t packet_start,
+        std::optional<Protocol::MessageID> receive_file_id
+    ) -> Peer::DownloadTransferMap::iterator {
         auto result = m_download_transfers.end();
 
+        if (!Protocol::is_valid_packet_size(data->packet_size)) {
+            send_reply(request_id, Protocol::StatusCode::BAD_REQUEST);
+            return result;
+        }
+        if (data->chunk_size != 0) {
+            // The hash tree covers the whole file, from its first packet
+            bool too_big = data->total_packets > (std::numeric_limits<std::size_t>::max() / data->packet_size) - packet_start;
+            std::size_t data_size = too_big ? 0 : (packet_start + data->total_packets) * data->packet_size;
+            std::size_t chunk_count = std::max<std::size_t>(1, (data_size / data->chunk_size) + (data_size % data->chunk_size == 0 ? 0 : 1));
+
+            // Each chunk is verified once received, it needs its hash
+            if (too_big || data->chunk_hashes.size() != chunk_count) {
+                send_reply(request_id, Protocol::StatusCode::BAD_REQUEST);
+                return result;
+            }
+        }
+        if (data->compression != Utils::CompressionAlgorithm::NONE && data->compression != m_config.get_compression()) {
+            send_reply(request_id, Protocol::StatusCode::UNSUPPORTED_COMPRESSION);
+            return result;
+        }
+        if (data->delta_block_size != 0 && !std::filesystem::is_regular_file(download_path(data->filepath))) {
+            // A delta needs our copy of the file to be applied on
+            send_reply(request_id, Protocol::StatusCode::BAD_REQUEST);
+            return result;
+        }
+        if (!data->content_chunks.empty() && (data->chunk_size != 0 || data->delta_block_size != 0)) {
+            send_reply(request_id, Protocol::StatusCode::BAD_REQUEST);
+            return result;
+        }
+        if (data->file_type == Protocol::FileType::DIRECTORY && (data->chunk_size != 0 || data->delta_block_size != 0 || !data->content_chunks.empty())) {
+            send_reply(request_id, Protocol::StatusCode::BAD_REQUEST);
+            return result;
+        }
+        if (!data->holes.empty()) {
+            std::size_t data_size = Utils::extents_size(Utils::data_extents(data->holes, data->file_size));
+            std::error_code err;
+
+            // The holes take no space, but a file bigger than the disk it goes on can't be real
+            if (data->file_size > std::filesystem::space(m_config.get_downloads_folder(), err).capacity) {
+                send_reply(request_id, Protocol::StatusCode::BAD_REQUEST);
+                return result;
+            }
+            if (data->chunk_size != 0 || data->delta_block_size != 0 || !data->content_chunks.empty() || data->file_type != Protocol::FileType::FILE
+                || data->total_packets != (data_size / data->packet_size) + (data_size % data->packet_size == 0 ? 0 : 1)
+            ) {
+                send_reply(request_id, Protocol::StatusCode::BAD_REQUEST);
+                return result;
+            }
+        }
+
+        auto range_download = receive_file_id.has_value() ? m_range_downloads.find(*receive_file_id) : m_range_downloads.end();
+
+        if (data->range.has_value() != (range_download != m_range_downloads.end())
+            || (data->range.has_value() && data->range->offset != range_download->second.range.offset)
+        ) {
+            // We did not ask for this range, or we asked for a range and the peer sent something else
+            send_reply(request_id, Protocol::StatusCode::BAD_REQUEST);
+            return result;
+        }
+
+        std::optional<Utils::ChunkStore> chunk_store;
+
+        if (m_config.get_deduplication()) {
+            chunk_store.emplace(m_config.get_downloads_folder() / Utils::ChunkStore::FOLDER_NAME);
+        }
         try {
-            result = m_download_transfers.emplace(
-                std::piecewise_construct,
-                std::forward_as_tuple(request_id),
-                std::forward_as_tuple((m_config.get_downloads_folder() / get_device_uuid() / filepath.relative_path()).string(), data)
-            ).first;
-            send_reply(request_id, Protocol::StatusCode::STATUS_OK);
+            if (data->range.has_value()) {
+                result = m_download_transfers.emplace(
+                    std::piecewise_construct,
+                    std::forward_as_tuple(request_id),
+                    std::forward_as_tuple(range_download->second.sink, data)
+                ).first;
+            } else {
+                result = m_download_transfers.emplace(
+                    std::piecewise_construct,
+                    std::forward_as_tuple(request_id),
+                    std::forward_as_tuple(download_path(data->filepath).string(), data, packet_start, std::move(chunk_store))
+                ).first;
+            }
+
+            Protocol::ResponseData reply(Protocol::StatusCode::STATUS_OK);
+
+            // Only the chunks we don't have will be sent
+            reply.known_chunks = result->second.get_known_chunks();
+            send_reply(request_id, reply);
+            if (m_journal && !result->second.finished() && data->file_type == Protocol::FileType::FILE && !data->range.has_value()) {
+                // Bundles are not journaled: a folder cannot be asked for with RECEIVE_FILE. Nor are ranges: their
+                // sink is gone once we are stopped.
+                m_journal->add(std::string(get_device_uuid()), data->filepath);
+            }
         } catch (Errors::Transfer::UpToDateError &) {
+            if (m_journal) {
+                m_journal->remove(std::string(get_device_uuid()), data->filepath);
+            }
             send_reply(request_id, Protocol::StatusCode::UP_TO_DATE);
+        } catch (Errors::Transfer::ResumeError &) {
+            send_reply(request_id, Protocol::StatusCode::INTERNAL_ERROR);
+        } catch (Errors::Transfer::HashMismatchError &) {
+            // The content sent with the request (or the chunks we had) did not match the hash
+            send_reply(request_id, Protocol::StatusCode::BAD_REQUEST);
+        } catch (std::exception &) {
+            send_reply(request_id, Protocol::StatusCode::INTERNAL_ERROR);
+        }
+        return result;
+    }
+
+    auto Peer::send_data_packet(DataConnection *connection, Protocol::MessageID request_id, UploadTransferHandler &handler) -> std::size_t {
+        MessageQueue &message_queue = connection ? connection->get_message_queue() : m_message_queue;
+
+        if (!handler.has_next_packet() || message_queue.available_send_slots() == 0) {
+            return 0;
+        }
+
+        auto packet = handler.get_next_packet(request_id);
+
+        if (!packet) {
+            return 0;
+        }
+        if (connection) {
+            connection->send_request(Protocol::CommandCode::DATA_PACKET, packet);
+        } else {
+            send_request(Protocol::CommandCode::DATA_PACKET, packet);
+        }
+        return packet->data.size();
+    }
+
+    auto Peer::is_striped(const UploadTransferHandler &handler) const -> bool {
+        return !m_data_connections.empty() && handler.get_total_size() >= MIN_STRIPED_FILE_SIZE;
+    }
+
+    auto Peer::send_scheduled_packet(Protocol::MessageID request_id) -> std::size_t {
+        auto handler = m_upload_transfers.find(request_id);
+
+        if (handler == m_upload_transfers.end()) {
+            return 0;
+        }
+        if (std::size_t size = send_data_packet(nullptr, request_id, handler->second); size != 0) {
+            return size;
+        }
+        if (is_striped(handler->second)) {
+            // Each data connection has its own window
+            for (auto &connection : m_data_connections) {
+                if (std::size_t size = send_data_packet(connection.get(), request_id, handler->second); size != 0) {
+                    return size;
+                }
+            }
+        }
+        return 0;
+    }
+
+    void Peer::run_scheduler() {
+        if (!m_shared_scheduler) {
+            m_scheduler->run(std::numeric_limits<std::size_t>::max());
+        }
+    }
+
+    void Peer::data_packet_acknowledged(Protocol::DataPacketData &packet, const Protocol::ResponseData &reply) {
+        // Every reply is tracked, since the upload is only over once all packets are acknowledged
+        auto handler = m_upload_transfers.find(packet.request_id);
+
+        if (handler == m_upload_transfers.end()) {
+            return;
+        }
+        handler->second.packet_acknowledged(packet);
+        if (reply.status == Protocol::StatusCode::BAD_REQUEST || reply.status == Protocol::StatusCode::INTERNAL_ERROR) {
+            // The peer gave up on the download, the rest would be sent for nothing
+            erase_upload(handler);
+            return;
+        }
+        if (reply.status == Protocol::StatusCode::CHUNK_MISMATCH) {
+            handler->second.resend_chunk(reply.chunk);
+        } else if (reply.status == Protocol::StatusCode::TOO_MANY_REQUESTS) {
+            handler->second.resend_packet(packet.packet_id);
+        }
+        if (handler->second.finished()) {
+            erase_upload(handler);
+        }
+        // The connection now has room for another packet, of whichever upload's turn it is
+        run_scheduler();
+    }
+
+    auto Peer::receive_data_packet(const Protocol::DataPacketData &data) -> Protocol::ResponseData {
+        auto iter = m_download_transfers.find(data.request_id);
+
+        if (iter == m_download_transfers.end()) {
+            return {Protocol::StatusCode::INVALID_REQUEST_ID};
+        }
+
+        auto &handler = iter->second;
+        Protocol::ResponseData reply(handler.receive_packet(data), handler.get_mismatched_chunk());
+
+        if (handler.finished() && !handler.m_keep) {
+            erase_download(iter);
+        }
+        return reply;
+    }
+
+    void Peer::add_data_connection(DataConnection_ptr connection) {
+        m_data_connections.emplace_back(std::move(connection));
+    }
+
+    auto Peer::poll_data_connection(RawSocketType fd) -> bool {
+        auto iter = std::ranges::find_if(m_data_connections, [fd](const auto &connection) {
+            return connection->get_socket().get_fd() == fd;
+        });
+
+        if (iter == m_data_connections.end()) {
+            return false;
+        }
+        // Requests are handled one by one: handling one can send packets on this connection
+        DataConnection &connection = **iter;
+
+        for (auto &request : connection.pull_requests()) {
+            receive_data_request(connection, std::move(request));
+        }
+        if (!connection.get_socket().connected()) {
+            m_data_connections.erase(iter);
+            return false;
+        }
+        return true;
+    }
+
+    void Peer::receive_data_request(DataConnection &connection, Protocol::Request request) {
+        switch (request.code) {
+            case Protocol::CommandCode::RESPONSE: {
+                auto data = std::dynamic_pointer_cast<Protocol::ResponseData>(request.request);
+                MessageQueue &message_queue = connection.get_message_queue();
+                auto source_request = message_queue.get_outgoing_requests().find(request.message_id);
+
+                if (source_request == message_queue.get_outgoing_requests().end()) {
+                    return;
+                }
+
+                auto packet_data = std::dynamic_pointer_cast<Protocol::DataPacketData>(source_request->second.request.request);
+
+                message_queue.receive_reply(request.message_id, data->status);
+                if (packet_data) {
+                    data_packet_acknowledged(*packet_data, *data);
+                }
+                return;
+            }
+            case Protocol::CommandCode::DATA_PACKET: {
+                auto data = std::dynamic_pointer_cast<Protocol::DataPacketData>(request.request);
+
+                connection.respond_to_request(request, receive_data_packet(*data));
+                return;
+            }
+            default:
+                // Data connections only carry DATA_PACKETs
+                connection.respond_to_request(request, Protocol::ResponseData(Protocol::StatusCode::BAD_REQUEST));
+                return;
+        }
+    }
+
+    void Peer::poll_connections() {
+        poll_pending_uploads();
+        if (m_data_connections.empty()) {
+            poll_requests();
+            return;
+        }
+
+        std::vector<struct pollfd> fds;
+        // Decrypted data left by the last reads: poll() would not report it
+        std::vector<bool> buffered;
+        struct timespec no_wait = {.tv_sec = 0, .tv_nsec = 0};
+
+        fds.reserve(m_data_connections.size() + 1);
+        buffered.reserve(m_data_connections.size() + 1);
+        fds.emplace_back(pollfd{.fd = get_socket().get_fd(), .events = POLLIN, .revents = 0});
+        buffered.push_back(has_buffered_data());
+        for (const auto &connection : m_data_connections) {
+            fds.emplace_back(pollfd{.fd = connection->get_socket().get_fd(), .events = POLLIN, .revents = 0});
+            buffered.push_back(connection->has_buffered_data());
+        }
+
+        bool any_buffered = std::ranges::find(buffered, true) != buffered.end();
+
+        if (Utils::poll(fds, any_buffered ? &no_wait : nullptr) < 0) // TODO: handle signals
+            throw std::runtime_error("Failed to poll the connections");
+        for (std::size_t i = 0; i < fds.size(); i++) {
+            if (!buffered[i] && !(fds[i].revents & (POLLIN | POLLHUP))) { // NOLINT(hicpp-signed-bitwise)
+                continue;
+            }
+            if (fds[i].fd == get_socket().get_fd()) {
+                poll_requests();
+            } else {
+                poll_data_connection(fds[i].fd);
+            }
+        }
+    }
+
+    auto Peer::wait_for_upload(UploadTransferMap::iterator upload, const std::string &filepath, const ProgressCallback &progress_callback) -> Protocol::Response<void> {
+        Protocol::MessageID message_id = upload->first;
+        UploadTransferHandler &upload_handler = upload->second;
+        auto scheduled = m_scheduled_uploads.find(message_id);
+
+        if (scheduled != m_scheduled_uploads.end()) {
+            // Set before the peer accepts it, so the scheduler starts it right away
+            scheduled->second.start_now = true;
+        }
+
+        Protocol::StatusCode status = wait_for_status(message_id);
+
+        if (status == Protocol::StatusCode::UNSUPPORTED_COMPRESSION && upload_handler.get_original_request()->compression != Utils::CompressionAlgorithm::NONE) {
+            // The peer did not enable compression: send it again without
+            UploadTransferHandler handler = std::move(upload_handler);
+
+            erase_upload(upload);
+            handler.disable_compression();
+            return wait_for_upload(create_upload(std::move(handler)), filepath, progress_callback);
+        }
+        // TODO: handle APPROVAL_PENDING
+        if (status != Protocol::StatusCode::STATUS_OK) {
+            erase_upload(upload);
+            return {.code=status, .response={}};
+        }
+        // The handler is erased by receive_reply() once every packet has been acknowledged
+        while (m_upload_transfers.contains(message_id)) {
+            // The other uploads in progress get their turn too, so none of them waits for this one
+            // Including the ones of the other Peers of the Server
+            bool sent = m_scheduler->run(1) != 0;
+
+            if (sent) {
+                progress_callback(filepath, upload_handler.get_current_size(), upload_handler.get_total_size());
+            } else {
+                // TODO: currently blocking, but if it changes, needs to add a poll() call to avoid spamming loop
+                poll_connections();
+            }
+        }
+
+        return {.code=status, .response={}}; // TODO
+    }
+
+    auto Peer::send_directory(const std::filesystem::path &host_dirpath, const ProgressCallback &progress_callback) -> Protocol::Response<void> {
+        const FileMapping &file_mapping = m_config.get_file_mapping();
+        std::filesystem::path virtual_dirpath = file_mapping.host_to_virtual(host_dirpath);
+        std::vector<Utils::BundleFile> bundled_files;
+        std::vector<std::filesystem::path> other_files;
+        Protocol::Response<void> result = {.code=Protocol::StatusCode::STATUS_OK, .response={}};
+
+        if (virtual_dirpath.empty())
+            virtual_dirpath = host_dirpath.filename();
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(host_dirpath)) {
+            if (!entry.is_regular_file() || file_mapping.is_forbidden(entry.path())) {
+                continue;
+            }
+            if (entry.file_size() < MAX_BUNDLED_FILE_SIZE) {
+                bundled_files.emplace_back(Utils::BundleFile{
+                    .host_path=entry.path(), .path=entry.path().lexically_relative(host_dirpath).generic_string()
+                });
+            } else {
+                other_files.emplace_back(entry.path());
+            }
+        }
+
+        // The small files would spend more time waiting for their replies than being sent: they all go in one transfer
+        if (!bundled_files.empty()) {
+            auto upload = create_upload(prepare_bundle(bundled_files, virtual_dirpath.generic_string(), std::filesystem::last_write_time(host_dirpath), m_config.get_packet_size()));
+
+            result = wait_for_upload(upload, host_dirpath.string(), progress_callback);
+        }
+        for (const auto &host_filepath : other_files) {
+            if (result.code != Protocol::StatusCode::STATUS_OK && result.code != Protocol::StatusCode::UP_TO_DATE) {
+                break;
+            }
+
+            std::string virtual_filepath = (virtual_dirpath / host_filepath.lexically_relative(host_dirpath)).generic_string();
+            auto compression = has_file_fields() ? m_config.get_compression() : Utils::CompressionAlgorithm::NONE;
+            auto [handler, status] = prepare_upload(host_filepath, std::move(virtual_filepath), m_config.get_packet_size(), 0, compression);
+
+            if (status != Protocol::StatusCode::STATUS_OK) {
+                return {.code=status, .response={}};
+            }
+            // prepare_upload will always return a handler if status == OK
+            result = wait_for_upload(create_upload(std::move(handler.value())), host_filepath.string(), progress_callback); // NOLINT(bugprone-unchecked-optional-access)
         }
         return result;
     }
@@ -275,7 +880,8 @@ namespace FileShare {
         // Implement async model instead
         while ((!message.status.has_value() || message.status.value() == Protocol::StatusCode::APPROVAL_PENDING)) {
             std::array<struct pollfd, 1> fds = {pollfd{.fd = get_socket().get_fd(), .events = POLLIN, .revents = 0}};
-            int nb_ready = Utils::poll(fds.data(), fds.size(), nullptr); // TODO: add timeout
+            // poll() doesn't report what TLS already decrypted
+            int nb_ready = has_buffered_data() ? 1 : Utils::poll(fds.data(), fds.size(), nullptr); // TODO: add timeout
 
             if (nb_ready < 0) // TODO: handle signals
                 throw std::runtime_error("Failed to poll for status");
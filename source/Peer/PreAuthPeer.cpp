@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Thu Aug 14 12:00:55 2025 Francois Michaut
-** Last update Thu Aug 21 09:21:57 2025 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
 **
 ** PreAuthPeer.cpp : Implementation of the class to represent a Peer before it has been Authenticated
 */
@@ -48,9 +48,20 @@ namespace FileShare {
             // poll_requests() loop. This should allow known peers or CLIENT peers to be promoted
             // before we reject the first requests as unauthorized. However, we give only 1 chance,
             // after that if the peer is still in PreAuth, we will reject the requests.
+            // A DATA_CONNECTION is the exception: such a connection never becomes a Peer.
             if (m_first_extra_request) {
+                Protocol::Request request;
+                std::size_t size = m_protocol.value().handler().parse_request(raw_msg, request);
+
+                if (size == 0) {
+                    return 0; // Not fully received yet
+                }
                 m_first_extra_request = false;
-                return 0;
+                if (request.code != Protocol::CommandCode::DATA_CONNECTION) {
+                    return 0;
+                }
+                out = std::move(request);
+                return size;
             }
 
             return m_protocol.value().handler().parse_request(raw_msg, out);
@@ -71,6 +82,10 @@ namespace FileShare {
 
     void PreAuthPeer::authorize_request(Protocol::Request request) {
         if (m_protocol.has_value()) {
+            if (request.code == Protocol::CommandCode::DATA_CONNECTION && !m_data_connection_request.has_value()) {
+                m_data_connection_request = std::move(request);
+                return;
+            }
             // If Peer is sending requests while still in PreAuth, deny them
             std::string message = m_protocol.value().handler().format_response(request.message_id, Protocol::StatusCode::UNAUTHORIZED);
 
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Fri May  5 21:35:06 2023 Francois Michaut
-** Last update Fri Aug 15 13:48:30 2025 Francois Michaut
+** Last update Mon Oct 19 09:19:12 2026 Francois Michaut
 **
 ** ProtocolHandler.cpp : ProtocolHandler for the v0.0.0 of the protocol
 */
@@ -16,6 +16,7 @@
 #include "FileShare/Utils/Time.hpp"
 #include "FileShare/Utils/VarInt.hpp"
 
+#include <algorithm>
 #include <chrono>
 
 // TODO: enfore 8bytes limits on VARINTs
@@ -60,6 +61,11 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
 
                 return format_data_packet(request.message_id, *data);
             }
+            case CommandCode::DATA_CONNECTION: {
+                auto data = std::dynamic_pointer_cast<DataConnectionData>(request.request);
+
+                return format_data_connection(request.message_id, *data);
+            }
             case CommandCode::PAIR_REQUEST:
             case CommandCode::ACCEPT_PAIR_REQUEST:
                 throw std::runtime_error("TODO: NOT IMPLEMENTED");
@@ -79,8 +85,11 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
         std::size_t header_size;
         Utils::VarInt payload_size;
 
-        if (!payload_size.parse(raw_msg.substr(6, 8)))
+        if (!payload_size.parse(raw_msg.substr(6, 8))) {
+            if (raw_msg.size() < BASE_HEADER_SIZE + 8)
+                return 0; // PAYLOAD_SIZE is not complete
             throw std::runtime_error("MESSAGE_TOO_LONG");
+        }
         header_size = BASE_HEADER_SIZE + payload_size.byte_size();
         if (raw_msg.size() < header_size + payload_size.to_number()) {
             return 0; // Payload is not complete, 0 bytes parsed
@@ -110,6 +119,8 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
                 return parse_ping(payload);
             case CommandCode::DATA_PACKET:
                 return parse_data_packet(payload);
+            case CommandCode::DATA_CONNECTION:
+                return parse_data_connection(payload);
             case CommandCode::PAIR_REQUEST:
             case CommandCode::ACCEPT_PAIR_REQUEST:
                 throw std::runtime_error("TODO: NOT IMPLEMENTED");
@@ -123,13 +134,25 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
     // |      4      | |        1       | |       1      | |    MAX(8)    |
     // |    STRING   | |      ENUM      | |       -      | |    VARINT    |
     // --------------------------------------------------------------------
-    // |    STATUS   |
-    // |      1      |
-    // |     ENUM    |
-    // ---------------
+    // |    STATUS   | |     CHUNK      |
+    // |      1      | |       -        |
+    // |     ENUM    | |     VARINT     |
+    // ----------------------------------
+    // CHUNK is only present if STATUS is CHUNK_MISMATCH
+    // Optional, only present if STATUS is STATUS_OK and some KNOWN_CHUNKS are set :
+    // ---------------------------------------------
+    // | KNOWN_COUNT | |       KNOWN_CHUNKS        |
+    // |      -      | |   (KNOWN_COUNT + 7) / 8   |
+    // |    VARINT   | | BITMAP (LOWEST BIT FIRST) |
+    // ---------------------------------------------
     auto ProtocolHandler::format_response(std::uint8_t message_id, const ResponseData &data) -> std::string {
         std::string result;
-        Utils::VarInt payload_size = 1;
+        Utils::VarInt chunk = data.chunk;
+        bool has_chunk = data.status == StatusCode::CHUNK_MISMATCH;
+        Utils::VarInt known_count = data.known_chunks.size();
+        bool has_known_chunks = data.status == StatusCode::STATUS_OK && std::ranges::find(data.known_chunks, true) != data.known_chunks.end();
+        std::size_t bitmap_size = (known_count.to_number() + 7) / 8;
+        Utils::VarInt payload_size = 1 + (has_chunk ? chunk.byte_size() : 0) + (has_known_chunks ? known_count.byte_size() + bitmap_size : 0);
 
         result.reserve(4 + 1 + 1 + payload_size.byte_size() + payload_size.to_number());
         result += MAGIC_BYTES;
@@ -137,6 +160,20 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
         result += static_cast<char>(message_id);
         result += payload_size.to_string();
         result += static_cast<char>(data.status);
+        if (has_chunk) {
+            result += chunk.to_string();
+        }
+        if (has_known_chunks) {
+            std::string bitmap(bitmap_size, '\0');
+
+            for (std::size_t i = 0; i < data.known_chunks.size(); i++) {
+                if (data.known_chunks[i]) {
+                    bitmap[i / 8] = static_cast<char>(bitmap[i / 8] | (1U << (i % 8)));
+                }
+            }
+            result += known_count.to_string();
+            result += bitmap;
+        }
         return result;
     }
 
@@ -147,7 +184,27 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
             throw std::runtime_error("BAD_REQUEST");
         auto status = static_cast<StatusCode>(payload[0]);
 
-        return std::make_shared<ResponseData>(status);
+        if (status == StatusCode::CHUNK_MISMATCH) {
+            if (!varint.parse(payload.substr(1)))
+                throw std::runtime_error("BAD_REQUEST");
+            return std::make_shared<ResponseData>(status, varint.to_number());
+        }
+
+        auto result = std::make_shared<ResponseData>(status);
+
+        payload = payload.substr(1);
+        if (status != StatusCode::STATUS_OK || payload.empty()) {
+            return result;
+        }
+        if (!varint.parse(payload, payload))
+            throw std::runtime_error("BAD_REQUEST");
+        if (varint.to_number() > payload.size() * 8)
+            throw std::runtime_error("BAD_REQUEST");
+        result->known_chunks.resize(varint.to_number());
+        for (std::size_t i = 0; i < result->known_chunks.size(); i++) {
+            result->known_chunks[i] = (static_cast<std::uint8_t>(payload[i / 8]) >> (i % 8)) & 1U;
+        }
+        return result;
     }
 
     // --------------------------------------------------------------------
@@ -164,6 +221,15 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
     // |  SIGNED INT | |     VARINT     | |     VARINT     |
     // -----------------------------------------------------
     auto ProtocolHandler::format_send_file(std::uint8_t message_id, const SendFileData &data) -> std::string {
+        if (data.chunk_size != 0 || data.delta_block_size != 0 || data.compression != Utils::CompressionAlgorithm::NONE
+            || !data.content_chunks.empty() || data.file_type != FileType::FILE || data.inline_content.has_value()
+            || !data.holes.empty() || data.range.has_value()
+        )
+            throw std::runtime_error("SEND_FILE fields not supported by this protocol version");
+        return format_extended_send_file(message_id, data, "");
+    }
+
+    auto ProtocolHandler::format_extended_send_file(std::uint8_t message_id, const SendFileData &data, std::string_view extensions) -> std::string {
         std::string result;
         std::uint64_t updated_at = Utils::to_epoch(data.last_updated);
         Utils::VarInt filepath_size = data.filepath.size();
@@ -174,7 +240,7 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
             throw std::runtime_error("Wrong hash size");
 
         Utils::VarInt payload_size = filepath_size.byte_size() + filepath_size.to_number() +
-            1 + data.filehash.size() + 8 + packet_size.byte_size() + total_packets.byte_size();
+            1 + data.filehash.size() + 8 + packet_size.byte_size() + total_packets.byte_size() + extensions.size();
 
         result.reserve(4 + 1 + 1 + payload_size.byte_size() + payload_size.to_number());
         result += MAGIC_BYTES;
@@ -188,10 +254,15 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
         result += Utils::serialize(updated_at);
         result += packet_size.to_string();
         result += total_packets.to_string();
+        result += extensions;
         return result;
     }
 
     auto ProtocolHandler::parse_send_file(std::string_view payload) -> std::shared_ptr<IRequestData> {
+        return parse_send_file_fields(payload);
+    }
+
+    auto ProtocolHandler::parse_send_file_fields(std::string_view &payload) -> std::shared_ptr<SendFileData> {
         Utils::VarInt varint;
         std::size_t algo_size;
         std::uint64_t updated_at;
@@ -240,13 +311,19 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
     // |   VARINT    | |        -       | |    VARINT    | |     VARINT     |
     // ----------------------------------------------------------------------
     auto ProtocolHandler::format_receive_file(std::uint8_t message_id, const ReceiveFileData &data) -> std::string {
+        if (data.signature.block_size != 0 || data.range.has_value() || data.compression != Utils::CompressionAlgorithm::NONE)
+            throw std::runtime_error("RECEIVE_FILE fields not supported by this protocol version");
+        return format_extended_receive_file(message_id, data, "");
+    }
+
+    auto ProtocolHandler::format_extended_receive_file(std::uint8_t message_id, const ReceiveFileData &data, std::string_view extensions) -> std::string {
         std::string result;
         Utils::VarInt filepath_size = data.filepath.size();
-        Utils::VarInt v_packet_size = PACKET_SIZE;
+        Utils::VarInt v_packet_size = data.packet_size;
         Utils::VarInt v_packet_start = data.packet_start;
 
         Utils::VarInt payload_size = filepath_size.byte_size() + filepath_size.to_number() +
-            v_packet_size.byte_size() + v_packet_start.byte_size();
+            v_packet_size.byte_size() + v_packet_start.byte_size() + extensions.size();
         result.reserve(4 + 1 + 1 + payload_size.byte_size() + payload_size.to_number());
         result += MAGIC_BYTES;
         result += static_cast<char>(CommandCode::RECEIVE_FILE);
@@ -256,10 +333,15 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
         result += data.filepath;
         result += v_packet_size.to_string();
         result += v_packet_start.to_string();
+        result += extensions;
         return result;
     }
 
     auto ProtocolHandler::parse_receive_file(std::string_view payload) -> std::shared_ptr<IRequestData> {
+        return parse_receive_file_fields(payload);
+    }
+
+    auto ProtocolHandler::parse_receive_file_fields(std::string_view &payload) -> std::shared_ptr<ReceiveFileData> {
         Utils::VarInt varint;
 
         std::string filepath;
@@ -290,11 +372,34 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
     // |       -       | | FOLDERPATH_SIZE |
     // |    VARINT     | |     STRING      |
     // -------------------------------------
+    // Optional, only present if FIELDS != 0 or MAX_DEPTH != 0 :
+    // ---------------
+    // |    FIELDS   |
+    // |      1      |
+    // |    FLAGS    |
+    // ---------------
+    // Optional, only present if MAX_DEPTH != 0 :
+    // ---------------
+    // |  MAX_DEPTH  |
+    // |      -      |
+    // |    VARINT   |
+    // ---------------
     auto ProtocolHandler::format_list_files(std::uint8_t message_id, const ListFilesData &data) -> std::string {
         std::string result;
         Utils::VarInt folderpath_size = data.folderpath.size();
+        Utils::VarInt max_depth = data.max_depth;
+
+        if ((data.fields & ~FILE_INFO_FIELDS) != 0)
+            throw std::runtime_error("Unknown FileInfo fields");
 
         Utils::VarInt payload_size = folderpath_size.byte_size() + folderpath_size.to_number();
+
+        if (data.fields != 0 || data.max_depth != 0) {
+            payload_size = payload_size.to_number() + 1;
+        }
+        if (data.max_depth != 0) {
+            payload_size = payload_size.to_number() + max_depth.byte_size();
+        }
         result.reserve(4 + 1 + 1 + payload_size.byte_size() + payload_size.to_number());
         result += MAGIC_BYTES;
         result += static_cast<char>(CommandCode::LIST_FILES);
@@ -302,6 +407,12 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
         result += payload_size.to_string();
         result += folderpath_size.to_string();
         result += data.folderpath;
+        if (data.fields != 0 || data.max_depth != 0) {
+            result += static_cast<char>(data.fields);
+        }
+        if (data.max_depth != 0) {
+            result += max_depth.to_string();
+        }
         return result;
     }
 
@@ -315,7 +426,21 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
         if (payload.size() < varint.to_number())
             throw std::runtime_error("BAD_REQUEST");
         folderpath = payload.substr(0, varint.to_number());
-        return std::make_shared<ListFilesData>(std::move(folderpath));
+        payload = payload.substr(varint.to_number());
+        if (payload.empty()) {
+            return std::make_shared<ListFilesData>(std::move(folderpath));
+        }
+
+        // Unknown fields are ignored, the peer may be more recent than us
+        auto fields = static_cast<std::uint8_t>(payload[0] & FILE_INFO_FIELDS);
+
+        payload = payload.substr(1);
+        if (payload.empty()) {
+            return std::make_shared<ListFilesData>(std::move(folderpath), fields);
+        }
+        if (!varint.parse(payload, payload))
+            throw std::runtime_error("BAD_REQUEST");
+        return std::make_shared<ListFilesData>(std::move(folderpath), fields, varint.to_number());
     }
 
     // ------------------------------------------------------------------
@@ -331,6 +456,13 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
     // |  ITEM_COUNT [      -      ,    STRING    ,     1    ] |
     // |      -      [    VARINT   , FILEPATH_SIZE,    ENUM  ] |
     // ---------------------------------------------------------
+    // The high bits of FILE_TYPE are the FileInfoField of the entry. Each of them adds a field,
+    // right after FILE_TYPE and in this order :
+    // ------------------------------------------------------------------------------------
+    // |     SIZE     | |  UPDATED_AT  | |     MODE     | | HASH_TYPE  | |      HASH      |
+    // |       -      | |       8      | |       -      | |     1      | | HASH_TYPE_SIZE |
+    // |    VARINT    | |  SIGNED INT  | |    VARINT    | |    ENUM    | |     STRING     |
+    // ------------------------------------------------------------------------------------
     auto ProtocolHandler::format_file_list(std::uint8_t message_id, const FileListData &data) -> std::string {
         std::string result;
         std::size_t array_total_size = 0;
@@ -342,6 +474,17 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
             Utils::VarInt varint = file.path.size();
 
             array_total_size += varint.byte_size() + varint.to_number() + 1;
+            if (file.size.has_value())
+                array_total_size += Utils::VarInt(file.size.value()).byte_size();
+            if (file.last_updated.has_value())
+                array_total_size += 8;
+            if (file.mode.has_value())
+                array_total_size += Utils::VarInt(static_cast<std::size_t>(file.mode.value())).byte_size();
+            if (file.hash.has_value()) {
+                if (file.hash->size() != Utils::algo_hash_size(file.hash_algorithm))
+                    throw std::runtime_error("Wrong hash size");
+                array_total_size += 1 + file.hash->size();
+            }
         }
         payload_size = 1 + v_packet_id.byte_size() + item_count.byte_size() + array_total_size;
 
@@ -356,10 +499,22 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
 
         for (const auto &file : data.files) {
             Utils::VarInt varint = file.path.size();
+            std::uint8_t fields = (file.size.has_value() ? FILE_INFO_SIZE : 0) | (file.last_updated.has_value() ? FILE_INFO_UPDATED_AT : 0) |
+                (file.mode.has_value() ? FILE_INFO_MODE : 0) | (file.hash.has_value() ? FILE_INFO_HASH : 0);
 
             result += varint.to_string();
             result += file.path;
-            result += static_cast<char>(file.file_type);
+            result += static_cast<char>(static_cast<std::uint8_t>(file.file_type) | fields);
+            if (file.size.has_value())
+                result += Utils::VarInt(file.size.value()).to_string();
+            if (file.last_updated.has_value())
+                result += Utils::serialize(Utils::to_epoch(file.last_updated.value()));
+            if (file.mode.has_value())
+                result += Utils::VarInt(static_cast<std::size_t>(file.mode.value())).to_string();
+            if (file.hash.has_value()) {
+                result += static_cast<char>(file.hash_algorithm);
+                result += file.hash.value();
+            }
         }
         return result;
     }
@@ -390,9 +545,43 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
                 throw std::runtime_error("BAD_REQUEST");
             file_info.path = payload.substr(0, varint.to_number());
             payload = payload.substr(varint.to_number());
-            file_info.file_type = static_cast<FileType>(payload[0]);
-            files.emplace_back(file_info);
+
+            auto type = static_cast<std::uint8_t>(payload[0]);
+
+            file_info.file_type = static_cast<FileType>(type & ~FILE_INFO_FIELDS);
             payload = payload.substr(1);
+            if ((type & FILE_INFO_SIZE) != 0) {
+                if (!varint.parse(payload, payload))
+                    throw std::runtime_error("BAD_REQUEST");
+                file_info.size = varint.to_number();
+            }
+            if ((type & FILE_INFO_UPDATED_AT) != 0) {
+                std::uint64_t updated_at;
+
+                if (payload.size() < 8)
+                    throw std::runtime_error("BAD_REQUEST");
+                Utils::parse(payload.substr(0, 8), updated_at);
+                file_info.last_updated = Utils::from_epoch<std::chrono::file_clock>(updated_at);
+                payload = payload.substr(8);
+            }
+            if ((type & FILE_INFO_MODE) != 0) {
+                if (!varint.parse(payload, payload))
+                    throw std::runtime_error("BAD_REQUEST");
+                file_info.mode = static_cast<std::filesystem::perms>(varint.to_number()) & std::filesystem::perms::mask;
+            }
+            if ((type & FILE_INFO_HASH) != 0) {
+                if (payload.empty())
+                    throw std::runtime_error("BAD_REQUEST");
+                file_info.hash_algorithm = static_cast<Utils::HashAlgorithm>(payload[0]);
+
+                std::size_t hash_size = Utils::algo_hash_size(file_info.hash_algorithm);
+
+                if (payload.size() < 1 + hash_size)
+                    throw std::runtime_error("BAD_REQUEST");
+                file_info.hash = payload.substr(1, hash_size);
+                payload = payload.substr(1 + hash_size);
+            }
+            files.emplace_back(std::move(file_info));
         }
         return std::make_shared<FileListData>(request_id, packet_id, std::move(files));
     }
@@ -406,14 +595,22 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
     // |       1       | |       -      | |      -       | |  PACKET_SIZE  |
     // |       -       | |     VARINT   | |    VARINT    | |     STRING    |
     // ---------------------------------------------------------------------
+    // Optional, only present if the packet is compressed. PACKET_DATA is then the compressed
+    // data, which can't be bigger than MAX_PACKET_SIZE once decompressed :
+    // ---------------
+    // | COMPRESSION |
+    // |      1      |
+    // |     ENUM    |
+    // ---------------
     auto ProtocolHandler::format_data_packet(std::uint8_t message_id, const DataPacketData &data) -> std::string {
         std::string result;
         Utils::VarInt packet_id = data.packet_id;
         Utils::VarInt packet_size = data.data.size();
+        bool compressed = data.compression != Utils::CompressionAlgorithm::NONE;
 
         Utils::VarInt payload_size = 1 + packet_id.byte_size() + packet_size.byte_size() +
-            packet_size.to_number();
-        result.reserve(4 + 1 + 1 + payload_size.byte_size());
+            packet_size.to_number() + (compressed ? 1 : 0);
+        result.reserve(4 + 1 + 1 + payload_size.byte_size() + payload_size.to_number());
         result += MAGIC_BYTES;
         result += static_cast<char>(CommandCode::DATA_PACKET);
         result += static_cast<char>(message_id);
@@ -422,6 +619,9 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
         result += packet_id.to_string();
         result += packet_size.to_string();
         result += data.data;
+        if (compressed) {
+            result += static_cast<char>(data.compression);
+        }
         return result;
     }
 
@@ -442,6 +642,16 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
         if (payload.size() < varint.to_number())
             throw std::runtime_error("BAD_REQUEST");
         data = payload.substr(0, varint.to_number());
+        payload = payload.substr(varint.to_number());
+        if (!payload.empty()) {
+            if (!Utils::is_valid_compression(payload[0]))
+                throw std::runtime_error("BAD_REQUEST");
+            try {
+                data = Utils::decompress(static_cast<Utils::CompressionAlgorithm>(payload[0]), data, MAX_PACKET_SIZE);
+            } catch (std::runtime_error &) {
+                throw std::runtime_error("BAD_REQUEST");
+            }
+        }
         return std::make_shared<DataPacketData>(request_id, packet_id, std::move(data));
     }
 
@@ -464,4 +674,24 @@ namespace FileShare::Protocol::Handler::v0_0_0 {
     auto ProtocolHandler::parse_ping([[maybe_unused]] std::string_view payload) -> std::shared_ptr<IRequestData> {
         return std::make_shared<PingData>();
     }
+
+    // ------------------------------------------------------------------
+    // |MAGIC_BYTES| |  COMMAND_CODE  | |  MESSAGE_ID  | | PAYLOAD_SIZE |
+    // |     4     | |        1       | |       1      | |    MAX(8)    |
+    // |   STRING  | |      ENUM      | |       -      | |    VARINT    |
+    // ------------------------------------------------------------------
+    auto ProtocolHandler::format_data_connection(std::uint8_t message_id, [[maybe_unused]] const DataConnectionData &data) -> std::string {
+        std::string result;
+
+        result.reserve(4 + 1 + 1 + zero_varint.byte_size());
+        result += MAGIC_BYTES;
+        result += static_cast<char>(CommandCode::DATA_CONNECTION);
+        result += static_cast<char>(message_id);
+        result += zero_varint.to_string();
+        return result;
+    }
+
+    auto ProtocolHandler::parse_data_connection([[maybe_unused]] std::string_view payload) -> std::shared_ptr<IRequestData> {
+        return std::make_shared<DataConnectionData>();
+    }
 }
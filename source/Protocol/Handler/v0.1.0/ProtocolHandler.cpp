@@ -0,0 +1,390 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 08:12:40 2026 Francois Michaut
+** Last update Mon Oct 19 09:16:53 2026 Francois Michaut
+**
+** ProtocolHandler.cpp : ProtocolHandler for the v0.1.0 of the protocol
+*/
+
+#include "FileShare/Protocol/Definitions.hpp"
+#include "FileShare/Protocol/Handler/v0.1.0/ProtocolHandler.hpp"
+#include "FileShare/Protocol/RequestData.hpp"
+#include "FileShare/Utils/Serialize.hpp"
+#include "FileShare/Utils/VarInt.hpp"
+
+#include <algorithm>
+
+namespace FileShare::Protocol::Handler::v0_1_0 {
+    constexpr std::size_t WEAK_CHECKSUM_SIZE = 4;
+
+    // v0.0.0 SEND_FILE, followed by :
+    // Optional, only present if FIELDS != 0 :
+    // ---------------
+    // |    FIELDS   |
+    // |      1      |
+    // |    FLAGS    |
+    // ---------------
+    // Only present if FIELDS has SEND_FILE_CHUNK_HASHES :
+    // ----------------------------------------------------------------
+    // |  CHUNK_SIZE | | CHUNK_COUNT | |         CHUNK_HASHES         |
+    // |      -      | |      -      | | CHUNK_COUNT * HASH_TYPE_SIZE |
+    // |    VARINT   | |    VARINT   | |            STRING            |
+    // ----------------------------------------------------------------
+    // Only present if FIELDS has SEND_FILE_DELTA :
+    // --------------------
+    // | DELTA_BLOCK_SIZE |
+    // |        -         |
+    // |      VARINT      |
+    // --------------------
+    // Only present if FIELDS has SEND_FILE_COMPRESSION :
+    // ---------------
+    // | COMPRESSION |
+    // |      1      |
+    // |     ENUM    |
+    // ---------------
+    // Only present if FIELDS has SEND_FILE_CONTENT_CHUNKS :
+    // --------------------------------------------------------------------
+    // | CONTENT_CHUNK_COUNT | |             CONTENT_CHUNKS               |
+    // |          -          | | CONTENT_CHUNK_COUNT * (SIZE | CHUNK_HASH)|
+    // |        VARINT       | |    VARINT | STRING (HASH_TYPE_SIZE)      |
+    // --------------------------------------------------------------------
+    // Only present if FIELDS has SEND_FILE_FILE_TYPE :
+    // -------------
+    // | FILE_TYPE |
+    // |     1     |
+    // |    ENUM   |
+    // -------------
+    // Only present if FIELDS has SEND_FILE_INLINE_CONTENT (TOTAL_PACKETS is then 0) :
+    // ----------------------------------
+    // | INLINE_SIZE | | INLINE_CONTENT |
+    // |      -      | |   INLINE_SIZE  |
+    // |    VARINT   | |     STRING     |
+    // ----------------------------------
+    // Only present if FIELDS has SEND_FILE_HOLES :
+    // --------------------------------------------------------------
+    // | FILE_SIZE | | HOLE_COUNT | |            HOLES             |
+    // |     -     | |     -      | | HOLE_COUNT * (OFFSET | SIZE) |
+    // |   VARINT  | |   VARINT   | |        VARINT | VARINT       |
+    // --------------------------------------------------------------
+    // Only present if FIELDS has SEND_FILE_RANGE :
+    // --------------------------------
+    // | RANGE_OFFSET | | RANGE_SIZE  |
+    // |       -      | |      -      |
+    // |    VARINT    | |   VARINT    |
+    // --------------------------------
+    auto ProtocolHandler::format_send_file(std::uint8_t message_id, const SendFileData &data) -> std::string {
+        std::string fields(1, '\0');
+        std::uint8_t flags = 0;
+        std::size_t hash_size = Utils::algo_hash_size(data.hash_algorithm);
+
+        if (data.chunk_size != 0) {
+            if (std::ranges::any_of(data.chunk_hashes, [hash_size](const auto &hash) { return hash.size() != hash_size; }))
+                throw std::runtime_error("Wrong hash size");
+            flags |= SEND_FILE_CHUNK_HASHES;
+            fields += Utils::VarInt(data.chunk_size).to_string();
+            fields += Utils::VarInt(data.chunk_hashes.size()).to_string();
+            for (const auto &hash : data.chunk_hashes) {
+                fields += hash;
+            }
+        }
+        if (data.delta_block_size != 0) {
+            flags |= SEND_FILE_DELTA;
+            fields += Utils::VarInt(data.delta_block_size).to_string();
+        }
+        if (data.compression != Utils::CompressionAlgorithm::NONE) {
+            flags |= SEND_FILE_COMPRESSION;
+            fields += static_cast<char>(data.compression);
+        }
+        if (!data.content_chunks.empty()) {
+            if (std::ranges::any_of(data.content_chunks, [hash_size](const auto &chunk) { return chunk.hash.size() != hash_size; }))
+                throw std::runtime_error("Wrong hash size");
+            flags |= SEND_FILE_CONTENT_CHUNKS;
+            fields += Utils::VarInt(data.content_chunks.size()).to_string();
+            for (const auto &chunk : data.content_chunks) {
+                fields += Utils::VarInt(chunk.size).to_string();
+                fields += chunk.hash;
+            }
+        }
+        if (data.file_type != FileType::FILE) {
+            flags |= SEND_FILE_FILE_TYPE;
+            fields += static_cast<char>(data.file_type);
+        }
+        if (data.inline_content.has_value()) {
+            if (data.total_packets != 0 || !data.holes.empty())
+                throw std::runtime_error("Inline content can't be sent with packets");
+            flags |= SEND_FILE_INLINE_CONTENT;
+            fields += Utils::VarInt(data.inline_content->size()).to_string();
+            fields += data.inline_content.value();
+        }
+        if (!data.holes.empty()) {
+            flags |= SEND_FILE_HOLES;
+            fields += Utils::VarInt(data.file_size).to_string();
+            fields += Utils::VarInt(data.holes.size()).to_string();
+            for (const auto &hole : data.holes) {
+                fields += Utils::VarInt(hole.offset).to_string();
+                fields += Utils::VarInt(hole.size).to_string();
+            }
+        }
+        if (data.range.has_value()) {
+            flags |= SEND_FILE_RANGE;
+            fields += Utils::VarInt(data.range->offset).to_string();
+            fields += Utils::VarInt(data.range->size).to_string();
+        }
+        if (flags == 0) {
+            return format_extended_send_file(message_id, data, "");
+        }
+        fields[0] = static_cast<char>(flags);
+        return format_extended_send_file(message_id, data, fields);
+    }
+
+    auto ProtocolHandler::parse_send_file(std::string_view payload) -> std::shared_ptr<IRequestData> {
+        Utils::VarInt varint;
+        auto result = parse_send_file_fields(payload);
+        std::size_t algo_size = Utils::algo_hash_size(result->hash_algorithm);
+
+        if (payload.empty()) {
+            return result; // No optional fields
+        }
+
+        auto fields = static_cast<std::uint8_t>(payload[0]);
+
+        // Unlike LIST_FILES fields, we can't skip the ones we don't know
+        if ((fields & ~SEND_FILE_FIELDS) != 0)
+            throw std::runtime_error("BAD_REQUEST");
+        payload = payload.substr(1);
+        if ((fields & SEND_FILE_CHUNK_HASHES) != 0) {
+            if (!varint.parse(payload, payload))
+                throw std::runtime_error("BAD_REQUEST");
+            result->chunk_size = varint.to_number();
+            if (result->chunk_size == 0 || result->packet_size == 0 || result->chunk_size % result->packet_size != 0)
+                throw std::runtime_error("BAD_REQUEST");
+            if (!varint.parse(payload, payload))
+                throw std::runtime_error("BAD_REQUEST");
+            if (payload.size() / algo_size < varint.to_number())
+                throw std::runtime_error("BAD_REQUEST");
+            result->chunk_hashes.reserve(varint.to_number());
+            for (std::size_t i = 0; i < varint.to_number(); i++) {
+                result->chunk_hashes.emplace_back(payload.substr(i * algo_size, algo_size));
+            }
+            payload = payload.substr(varint.to_number() * algo_size);
+        }
+        if ((fields & SEND_FILE_DELTA) != 0) {
+            if (!varint.parse(payload, payload) || varint.to_number() == 0)
+                throw std::runtime_error("BAD_REQUEST");
+            result->delta_block_size = varint.to_number();
+        }
+        if ((fields & SEND_FILE_COMPRESSION) != 0) {
+            if (payload.empty() || !Utils::is_valid_compression(payload[0]))
+                throw std::runtime_error("BAD_REQUEST");
+            result->compression = static_cast<Utils::CompressionAlgorithm>(payload[0]);
+            payload = payload.substr(1);
+        }
+        if ((fields & SEND_FILE_CONTENT_CHUNKS) != 0) {
+            if (!varint.parse(payload, payload))
+                throw std::runtime_error("BAD_REQUEST");
+
+            std::size_t content_chunk_count = varint.to_number();
+
+            // Each chunk takes at least a byte for its size, and its hash
+            if (content_chunk_count == 0 || payload.size() / (algo_size + 1) < content_chunk_count)
+                throw std::runtime_error("BAD_REQUEST");
+            result->content_chunks.reserve(content_chunk_count);
+            for (std::size_t i = 0; i < content_chunk_count; i++) {
+                if (!varint.parse(payload, payload) || varint.to_number() == 0 || payload.size() < algo_size)
+                    throw std::runtime_error("BAD_REQUEST");
+                result->content_chunks.emplace_back(Utils::ContentChunk{.size=varint.to_number(), .hash=std::string(payload.substr(0, algo_size))});
+                payload = payload.substr(algo_size);
+            }
+        }
+        if ((fields & SEND_FILE_FILE_TYPE) != 0) {
+            if (payload.empty() || payload[0] != static_cast<char>(FileType::DIRECTORY))
+                throw std::runtime_error("BAD_REQUEST");
+            result->file_type = static_cast<FileType>(payload[0]);
+            payload = payload.substr(1);
+        }
+        if ((fields & SEND_FILE_INLINE_CONTENT) != 0) {
+            if (!varint.parse(payload, payload) || payload.size() < varint.to_number())
+                throw std::runtime_error("BAD_REQUEST");
+            // The whole file is here: nothing else can be sent for it
+            if (result->total_packets != 0 || (fields & (SEND_FILE_CHUNK_HASHES | SEND_FILE_DELTA | SEND_FILE_CONTENT_CHUNKS | SEND_FILE_FILE_TYPE | SEND_FILE_HOLES)) != 0)
+                throw std::runtime_error("BAD_REQUEST");
+            result->inline_content = payload.substr(0, varint.to_number());
+            payload = payload.substr(varint.to_number());
+        }
+        if ((fields & SEND_FILE_HOLES) != 0) {
+            if (!varint.parse(payload, payload))
+                throw std::runtime_error("BAD_REQUEST");
+            result->file_size = varint.to_number();
+            if (!varint.parse(payload, payload))
+                throw std::runtime_error("BAD_REQUEST");
+
+            std::size_t hole_count = varint.to_number();
+            std::size_t holes_end = 0;
+
+            // Each hole takes at least 2 bytes
+            if (hole_count == 0 || payload.size() / 2 < hole_count)
+                throw std::runtime_error("BAD_REQUEST");
+            result->holes.reserve(hole_count);
+            for (std::size_t i = 0; i < hole_count; i++) {
+                Utils::FileRange hole{};
+
+                if (!varint.parse(payload, payload))
+                    throw std::runtime_error("BAD_REQUEST");
+                hole.offset = varint.to_number();
+                if (!varint.parse(payload, payload))
+                    throw std::runtime_error("BAD_REQUEST");
+                hole.size = varint.to_number();
+                // Sorted, not overlapping and in the file
+                if (hole.size == 0 || hole.offset < holes_end || hole.size > result->file_size || hole.offset > result->file_size - hole.size)
+                    throw std::runtime_error("BAD_REQUEST");
+                holes_end = hole.offset + hole.size;
+                result->holes.emplace_back(hole);
+            }
+        }
+        if ((fields & SEND_FILE_RANGE) != 0) {
+            Utils::FileRange range{};
+
+            if (!varint.parse(payload, payload))
+                throw std::runtime_error("BAD_REQUEST");
+            range.offset = varint.to_number();
+            if (!varint.parse(payload, payload))
+                throw std::runtime_error("BAD_REQUEST");
+            range.size = varint.to_number();
+            if (range.size == 0 || (fields & (SEND_FILE_CHUNK_HASHES | SEND_FILE_DELTA | SEND_FILE_CONTENT_CHUNKS | SEND_FILE_FILE_TYPE | SEND_FILE_HOLES)) != 0)
+                throw std::runtime_error("BAD_REQUEST");
+            result->range = range;
+        }
+        if (!payload.empty())
+            throw std::runtime_error("BAD_REQUEST");
+        return result;
+    }
+
+    // v0.0.0 RECEIVE_FILE, followed by :
+    // Optional, only present if FIELDS != 0 :
+    // ---------------
+    // |    FIELDS   |
+    // |      1      |
+    // |    FLAGS    |
+    // ---------------
+    // Only present if FIELDS has RECEIVE_FILE_SIGNATURE :
+    // ------------------------------------------------------
+    // |  BLOCK_SIZE | |   HASH_TYPE    | | BLOCK_COUNT  |
+    // |      -      | |       1        | |      -       |
+    // |   VARINT    | |      ENUM      | |    VARINT    |
+    // ------------------------------------------------------
+    // Repeated BLOCK_COUNT times :
+    // -----------------------------------
+    // | WEAK_CHECKSUM | |  STRONG_HASH   |
+    // |       4       | | HASH_TYPE_SIZE |
+    // |  UNSIGNED INT | |     STRING     |
+    // -----------------------------------
+    // Only present if FIELDS has RECEIVE_FILE_COMPRESSION :
+    // ---------------
+    // | COMPRESSION |
+    // |      1      |
+    // |     ENUM    |
+    // ---------------
+    // Only present if FIELDS has RECEIVE_FILE_RANGE :
+    // --------------------------------
+    // | RANGE_OFFSET | | RANGE_SIZE  |
+    // |       -      | |      -      |
+    // |    VARINT    | |   VARINT    |
+    // --------------------------------
+    auto ProtocolHandler::format_receive_file(std::uint8_t message_id, const ReceiveFileData &data) -> std::string {
+        std::string fields(1, '\0');
+        std::uint8_t flags = 0;
+
+        if (data.signature.block_size != 0) {
+            std::size_t hash_size = Utils::algo_hash_size(data.signature.hash_algorithm);
+
+            if (std::ranges::any_of(data.signature.blocks, [hash_size](const auto &block) { return block.strong.size() != hash_size; }))
+                throw std::runtime_error("Wrong hash size");
+            flags |= RECEIVE_FILE_SIGNATURE;
+            fields += Utils::VarInt(data.signature.block_size).to_string();
+            fields += static_cast<char>(data.signature.hash_algorithm);
+            fields += Utils::VarInt(data.signature.blocks.size()).to_string();
+            for (const auto &block : data.signature.blocks) {
+                fields += Utils::serialize(static_cast<std::uint64_t>(block.weak)).substr(0, WEAK_CHECKSUM_SIZE);
+                fields += block.strong;
+            }
+        }
+        if (data.compression != Utils::CompressionAlgorithm::NONE) {
+            flags |= RECEIVE_FILE_COMPRESSION;
+            fields += static_cast<char>(data.compression);
+        }
+        if (data.range.has_value()) {
+            flags |= RECEIVE_FILE_RANGE;
+            fields += Utils::VarInt(data.range->offset).to_string();
+            fields += Utils::VarInt(data.range->size).to_string();
+        }
+        if (flags == 0) {
+            return format_extended_receive_file(message_id, data, "");
+        }
+        fields[0] = static_cast<char>(flags);
+        return format_extended_receive_file(message_id, data, fields);
+    }
+
+    auto ProtocolHandler::parse_receive_file(std::string_view payload) -> std::shared_ptr<IRequestData> {
+        Utils::VarInt varint;
+        auto result = parse_receive_file_fields(payload);
+        auto &signature = result->signature;
+
+        if (payload.empty()) {
+            return result; // No optional fields
+        }
+
+        auto fields = static_cast<std::uint8_t>(payload[0]);
+
+        // Unlike LIST_FILES fields, we can't skip the ones we don't know
+        if ((fields & ~RECEIVE_FILE_FIELDS) != 0)
+            throw std::runtime_error("BAD_REQUEST");
+        payload = payload.substr(1);
+        if ((fields & RECEIVE_FILE_SIGNATURE) != 0) {
+            if (!varint.parse(payload, payload) || varint.to_number() == 0 || payload.empty())
+                throw std::runtime_error("BAD_REQUEST");
+            signature.block_size = varint.to_number();
+            signature.hash_algorithm = static_cast<Utils::HashAlgorithm>(payload[0]);
+
+            std::size_t hash_size = Utils::algo_hash_size(signature.hash_algorithm);
+
+            payload = payload.substr(1);
+            if (!varint.parse(payload, payload))
+                throw std::runtime_error("BAD_REQUEST");
+            if (payload.size() / (WEAK_CHECKSUM_SIZE + hash_size) < varint.to_number())
+                throw std::runtime_error("BAD_REQUEST");
+            signature.blocks.reserve(varint.to_number());
+            for (std::size_t i = 0; i < varint.to_number(); i++) {
+                std::uint64_t weak;
+
+                Utils::parse(payload.substr(0, WEAK_CHECKSUM_SIZE), weak);
+                signature.blocks.emplace_back(Utils::BlockSignature{
+                    .weak=static_cast<std::uint32_t>(weak), .strong=std::string(payload.substr(WEAK_CHECKSUM_SIZE, hash_size))
+                });
+                payload = payload.substr(WEAK_CHECKSUM_SIZE + hash_size);
+            }
+        }
+        if ((fields & RECEIVE_FILE_COMPRESSION) != 0) {
+            if (payload.empty() || !Utils::is_valid_compression(payload[0]))
+                throw std::runtime_error("BAD_REQUEST");
+            result->compression = static_cast<Utils::CompressionAlgorithm>(payload[0]);
+            payload = payload.substr(1);
+        }
+        if ((fields & RECEIVE_FILE_RANGE) != 0) {
+            Utils::FileRange range{};
+
+            if (!varint.parse(payload, payload))
+                throw std::runtime_error("BAD_REQUEST");
+            range.offset = varint.to_number();
+            if (!varint.parse(payload, payload) || varint.to_number() == 0)
+                throw std::runtime_error("BAD_REQUEST");
+            range.size = varint.to_number();
+            result->range = range;
+        }
+        if (!payload.empty())
+            throw std::runtime_error("BAD_REQUEST");
+        return result;
+    }
+}
@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Thu Aug 25 23:16:42 2022 Francois Michaut
-** Last update Fri Aug 22 23:17:35 2025 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
 **
 ** Protocol.cpp : Implementation of the main Protocol class
 */
@@ -12,14 +12,17 @@
 #include "FileShare/Protocol/Protocol.hpp"
 #include "FileShare/Protocol/Definitions.hpp"
 #include "FileShare/Protocol/Handler/v0.0.0/ProtocolHandler.hpp"
+#include "FileShare/Protocol/Handler/v0.1.0/ProtocolHandler.hpp"
 #include "FileShare/Utils/Strings.hpp"
 
+#include <algorithm>
 #include <string_view>
 #include <unordered_map>
 
 namespace FileShare::Protocol {
     const std::map<Version, std::shared_ptr<IProtocolHandler>> Protocol::PROTOCOL_LIST = {
-        {Version::v0_0_0, std::make_shared<Handler::v0_0_0::ProtocolHandler>()}
+        {Version::v0_0_0, std::make_shared<Handler::v0_0_0::ProtocolHandler>()},
+        {Version::v0_1_0, std::make_shared<Handler::v0_1_0::ProtocolHandler>()}
     };
 
     Protocol::Protocol(Version version) :
@@ -41,6 +44,17 @@ namespace FileShare::Protocol {
         m_handler = iter->second;
     }
 
+    auto is_valid_packet_size(std::size_t packet_size) -> bool {
+        return packet_size >= MIN_PACKET_SIZE && packet_size <= MAX_PACKET_SIZE;
+    }
+
+    auto negotiate_packet_size(std::size_t requested, std::size_t preferred) -> std::size_t {
+        if (requested == 0) {
+            requested = preferred;
+        }
+        return std::clamp(requested, MIN_PACKET_SIZE, MAX_PACKET_SIZE);
+    }
+
     auto str_to_command(std::string_view str) -> CommandCode {
         const static std::unordered_map<std::string, CommandCode, FileShare::Utils::string_hash, std::equal_to<>> str_to_command = {
             {"RESPONSE", CommandCode::RESPONSE},
@@ -53,6 +67,7 @@ namespace FileShare::Protocol {
 
             {"PING", CommandCode::PING},
             {"DATA_PACKET", CommandCode::DATA_PACKET},
+            {"DATA_CONNECTION", CommandCode::DATA_CONNECTION},
 
             {"PAIR_REQUEST", CommandCode::PAIR_REQUEST},
             {"ACCEPT_PAIR_REQUEST", CommandCode::ACCEPT_PAIR_REQUEST},
@@ -78,6 +93,8 @@ namespace FileShare::Protocol {
             {"FORBIDDEN", StatusCode::FORBIDDEN},
             {"FILE_NOT_FOUND", StatusCode::FILE_NOT_FOUND},
             {"UNKNOWN_COMMAND", StatusCode::UNKNOWN_COMMAND},
+            {"CHUNK_MISMATCH", StatusCode::CHUNK_MISMATCH},
+            {"UNSUPPORTED_COMPRESSION", StatusCode::UNSUPPORTED_COMPRESSION},
             {"TOO_MANY_REQUESTS", StatusCode::TOO_MANY_REQUESTS},
 
             {"INTERNAL_ERROR", StatusCode::INTERNAL_ERROR},
@@ -116,6 +133,7 @@ namespace FileShare::Protocol {
 
             {CommandCode::PING, "PING"},
             {CommandCode::DATA_PACKET, "DATA_PACKET"},
+            {CommandCode::DATA_CONNECTION, "DATA_CONNECTION"},
 
             {CommandCode::PAIR_REQUEST, "PAIR_REQUEST"},
             {CommandCode::ACCEPT_PAIR_REQUEST, "ACCEPT_PAIR_REQUEST"},
@@ -143,6 +161,8 @@ namespace FileShare::Protocol {
             {StatusCode::FORBIDDEN, "FORBIDDEN"},
             {StatusCode::FILE_NOT_FOUND, "FILE_NOT_FOUND"},
             {StatusCode::UNKNOWN_COMMAND, "UNKNOWN_COMMAND"},
+            {StatusCode::CHUNK_MISMATCH, "CHUNK_MISMATCH"},
+            {StatusCode::UNSUPPORTED_COMPRESSION, "UNSUPPORTED_COMPRESSION"},
             {StatusCode::TOO_MANY_REQUESTS, "TOO_MANY_REQUESTS"},
 
             {StatusCode::INTERNAL_ERROR, "INTERNAL_ERROR"},
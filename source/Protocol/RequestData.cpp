@@ -4,7 +4,7 @@
 ** Author Francois Michaut
 **
 ** Started on  Tue Jul 18 22:04:57 2023 Francois Michaut
-** Last update Fri Aug 15 21:04:29 2025 Francois Michaut
+** Last update Mon Oct 19 09:19:12 2026 Francois Michaut
 **
 ** RequestData.cpp : RequestData implementation for the requests payloads
 */
@@ -13,6 +13,7 @@
 #include "FileShare/Protocol/Version.hpp"
 #include "FileShare/Utils/Time.hpp"
 
+#include <algorithm>
 #include <sstream>
 #include <utility>
 
@@ -21,6 +22,10 @@ namespace FileShare::Protocol {
         status(status)
     {}
 
+    ResponseData::ResponseData(StatusCode status, std::size_t chunk) :
+        status(status), chunk(chunk)
+    {}
+
     SupportedVersionsData::SupportedVersionsData(std::vector<Version> versions) :
         versions(std::move(versions))
     {}
@@ -41,8 +46,8 @@ namespace FileShare::Protocol {
         filepath(std::move(filepath)), packet_size(packet_size), packet_start(packet_start)
     {}
 
-    ListFilesData::ListFilesData(std::string folderpath) :
-        folderpath(std::move(folderpath))
+    ListFilesData::ListFilesData(std::string folderpath, std::uint8_t fields, std::size_t max_depth) :
+        folderpath(std::move(folderpath)), fields(fields), max_depth(max_depth)
     {}
 
     FileListData::FileListData(std::uint8_t request_id, std::size_t packet_id, std::vector<FileInfo> files) :
@@ -62,6 +67,8 @@ namespace FileShare::Protocol {
 
         ss << "ResponseData{"
            << "status = " << status
+           << ", chunk = " << chunk
+           << ", known_chunks = " << std::ranges::count(known_chunks, true) << "/" << known_chunks.size()
            << "}";
         return ss.str();
     }
@@ -94,6 +101,7 @@ namespace FileShare::Protocol {
            << "request_id = " << static_cast<int>(request_id)
            << ", packed_id = " << packet_id
            << ", data_size = " << data.size()
+           << ", compression = " << Utils::compression_to_string(compression)
            << "}";
         return ss.str();
     }
@@ -106,7 +114,16 @@ namespace FileShare::Protocol {
            << ", packet_id = " << packet_id
            << ", files (count = " << files.size() << ") = [";
         for (const auto &file : files) {
-            ss << "{ path = " << file.path << ", file_type = " << static_cast<int>(file.file_type) << " }, ";
+            ss << "{ path = " << file.path << ", file_type = " << static_cast<int>(file.file_type);
+            if (file.size.has_value())
+                ss << ", size = " << file.size.value();
+            if (file.last_updated.has_value())
+                ss << ", last_updated = " << file.last_updated->time_since_epoch().count();
+            if (file.mode.has_value())
+                ss << ", mode = " << std::oct << static_cast<unsigned int>(file.mode.value()) << std::dec;
+            if (file.hash.has_value())
+                ss << ", hash_algo = " << Utils::algo_to_string(file.hash_algorithm) << ", hash = " << file.hash.value();
+            ss << " }, ";
         }
         ss   << "]}";
         return ss.str();
@@ -117,6 +134,8 @@ namespace FileShare::Protocol {
 
         ss << "ListFilesData{"
            << "folderpath = " << folderpath
+           << ", fields = " << static_cast<int>(fields)
+           << ", max_depth = " << max_depth
            << "}";
         return ss.str();
     }
@@ -128,6 +147,10 @@ namespace FileShare::Protocol {
            << "filepath = " << filepath
            << ", packet_size = " << packet_size
            << ", packet_start = " << packet_start
+           << ", signature_block_size = " << signature.block_size
+           << ", signature_blocks = " << signature.blocks.size()
+           << ", range = " << (range.has_value() ? std::to_string(range->offset) + "+" + std::to_string(range->size) : "none")
+           << ", compression = " << Utils::compression_to_string(compression)
            << "}";
         return ss.str();
     }
@@ -142,6 +165,16 @@ namespace FileShare::Protocol {
            << ", last_updated = " << Utils::to_epoch(last_updated)
            << ", packet_size = " << packet_size
            << ", total_packets = " << total_packets
+           << ", chunk_size = " << chunk_size
+           << ", chunk_count = " << chunk_hashes.size()
+           << ", delta_block_size = " << delta_block_size
+           << ", content_chunks = " << content_chunks.size()
+           << ", compression = " << Utils::compression_to_string(compression)
+           << ", file_type = " << file_type_to_str(file_type)
+           << ", holes = " << holes.size()
+           << ", file_size = " << file_size
+           << ", inline_size = " << (inline_content.has_value() ? std::to_string(inline_content->size()) : "none")
+           << ", range = " << (range.has_value() ? std::to_string(range->offset) + "+" + std::to_string(range->size) : "none")
            << "}";
         return ss.str();
     }
@@ -153,6 +186,13 @@ namespace FileShare::Protocol {
         return ss.str();
     }
 
+    auto DataConnectionData::debug_str() const -> std::string {
+        std::stringstream ss;
+
+        ss << "DataConnectionData{}";
+        return ss.str();
+    }
+
     auto ApprovalStatusData::debug_str() const -> std::string {
         std::stringstream ss;
 
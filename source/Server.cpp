@@ -4,19 +4,21 @@
 ** Author Francois Michaut
 **
 ** Started on  Sun Nov  6 21:06:10 2022 Francois Michaut
-** Last update Sun Aug 24 20:16:50 2025 Francois Michaut
+** Last update Mon Oct 19 09:22:38 2026 Francois Michaut
 **
 ** Server.cpp : Server implementation
 */
 
 #include "FileShare/Server.hpp"
 #include "CppSockets/Tls/Socket.hpp"
+#include "FileShare/Utils/HashCache.hpp"
 #include "FileShare/Utils/Poll.hpp"
 #include "FileShare/Utils/Vector.hpp"
 
 #include <CppSockets/Tls/Certificate.hpp>
 #include <CppSockets/Tls/Utils.hpp>
 
+#include <algorithm>
 #include <cstddef>
 #include <memory>
 #include <openssl/bio.h>
@@ -37,6 +39,14 @@ constexpr const auto ORG_UNIT_NAME = u8"FileShare Self-Signed Device Certificate
 constexpr const auto ORG_UNIT_NAME_SIZE = std::char_traits<char8_t>::length(ORG_UNIT_NAME);
 
 namespace {
+    void client_handshake(FileShare::PreAuthPeer &peer) {
+        // TODO: Bad. Change it
+        peer.do_client_hello();
+        while (!peer.has_protocol() && peer.get_socket().connected()) {
+            peer.poll_requests();
+        }
+    }
+
     // TODO: Once we have a central server, make that server sign certificates so we dont have
     // to rely on self-signed ones. Self-Signed will only be used on Offline networks.
     auto verify_callback(int preverify_ok, X509_STORE_CTX *ctx) -> int {
@@ -121,10 +131,15 @@ namespace FileShare {
 
     Server::Server(std::shared_ptr<CppSockets::IEndpoint> server_endpoint, ServerConfig config, Config peer_config) :
         m_server_endpoint(std::move(server_endpoint)), m_ctx(SSL_CTX_new(TLS_method())),
-        m_config(std::move(config)), m_peer_config(std::move(peer_config))
+        m_config(std::move(config)), m_peer_config(std::move(peer_config)),
+        m_scheduler(std::make_shared<TransferScheduler>(m_config.get_max_active_transfers())),
+        m_journal(std::make_shared<TransferJournal>(m_config.get_transfer_journal())),
+        m_listing_cache(std::make_shared<ListingCache>())
     {
         // Request for client certificate + verify it
         m_ctx.set_verify(VERIFY_MODE, verify_callback);
+        // Saved when the process exits
+        Utils::HashCache::global().set_persistent_file(m_config.get_hash_cache());
         restart();
     }
 
@@ -166,11 +181,7 @@ namespace FileShare {
     auto Server::connect(CppSockets::TlsSocket peer, const Config &config) -> std::shared_ptr<Peer> & {
         PreAuthPeer pre_auth(std::move(peer), PreAuthPeer::CLIENT);
 
-        // TODO: Bad. Change it
-        pre_auth.do_client_hello();
-        while (!pre_auth.has_protocol() && pre_auth.get_socket().connected()) {
-            pre_auth.poll_requests();
-        }
+        client_handshake(pre_auth);
 
         std::shared_ptr<Peer> client = std::make_shared<Peer>(std::move(pre_auth), config);
 
@@ -182,7 +193,40 @@ namespace FileShare {
         CppSockets::TlsSocket socket(AF_INET, SOCK_STREAM, 0, m_ctx);
 
         socket.connect(peer);
-        return connect(std::move(socket), config);
+
+        auto &result = connect(std::move(socket), config);
+
+        open_data_connections(peer, result, config.get_data_connections());
+        return result;
+    }
+
+    void Server::open_data_connections(const CppSockets::IEndpoint &endpoint, const Peer_ptr &peer, std::size_t count) {
+        for (std::size_t i = 0; i < count; i++) {
+            DataConnection_ptr connection;
+
+            // The Peer is already connected: failing here only means fewer connections to spread the packets over
+            try {
+                CppSockets::TlsSocket socket(AF_INET, SOCK_STREAM, 0, m_ctx);
+
+                socket.connect(endpoint);
+
+                PreAuthPeer pre_auth(std::move(socket), PreAuthPeer::CLIENT);
+
+                client_handshake(pre_auth);
+                if (!pre_auth.has_protocol()) {
+                    return;
+                }
+                connection = std::make_unique<DataConnection>(std::move(pre_auth));
+                if (connection->attach() != Protocol::StatusCode::STATUS_OK) {
+                    return; // The peer does not accept data connections, the transfers only use the main one
+                }
+            } catch (std::exception &) {
+                return;
+            }
+            m_fds.emplace_back(pollfd({.fd = connection->get_socket().get_fd(), .events = POLLIN, .revents = 0}));
+            m_data_connections.emplace(connection->get_socket().get_fd(), peer);
+            peer->add_data_connection(std::move(connection));
+        }
     }
 
     void Server::process_events(const PeerAcceptCallback &accept_cb, const PeerRequestCallback &request_cb) {
@@ -254,14 +298,78 @@ namespace FileShare {
         if (!result.second) {
             throw std::runtime_error("Peer already connected");
         }
+        iter->second->set_scheduler(m_scheduler);
+        iter->second->set_journal(m_journal);
+        iter->second->set_listing_cache(m_listing_cache);
+
+        const Peer_ptr &new_peer = iter->second;
+        bool first_connection = std::ranges::none_of(m_peers, [&new_peer](const auto &item) {
+            return item.second != new_peer && item.second->get_device_uuid() == new_peer->get_device_uuid();
+        });
+
+        // Data connections are attached to their Peer instead: another Peer of the device already resumed them
+        if (first_connection) {
+            m_resuming_peers.emplace_back(new_peer);
+        }
         return iter->second;
     }
 
     auto Server::delete_peer(FdVector::iterator iter) -> FdVector::iterator {
-        m_peers.erase(iter->fd);
+        auto peer = m_peers.find(iter->fd);
+
+        if (peer != m_peers.end()) {
+            auto position = std::distance(m_fds.begin(), iter);
+
+            // Its data connections are closed along with it
+            for (const auto &connection : peer->second->get_data_connections()) {
+                RawSocketType fd = connection->get_socket().get_fd();
+                auto fd_iter = std::ranges::find(m_fds, fd, &pollfd::fd);
+
+                if (fd_iter != m_fds.end()) {
+                    if (std::distance(m_fds.begin(), fd_iter) < position) {
+                        position--;
+                    }
+                    m_fds.erase(fd_iter);
+                }
+                m_data_connections.erase(fd);
+            }
+            iter = m_fds.begin() + position;
+            m_peers.erase(peer);
+        }
         return delete_move(m_fds, iter);
     }
 
+    auto Server::delete_data_connection(FdVector::iterator iter) -> FdVector::iterator {
+        m_data_connections.erase(iter->fd);
+        return delete_move(m_fds, iter);
+    }
+
+    auto Server::find_device_peer(const PeerBase &peer) -> PeerMap::iterator {
+        // If there are several, any of them will do
+        return std::ranges::find_if(m_peers, [&peer](const auto &item) {
+            return item.second->get_device_uuid() == peer.get_device_uuid() && item.second->get_public_key() == peer.get_public_key();
+        });
+    }
+
+    auto Server::attach_data_connection(FdVector::iterator iter, PreAuthPeerMap &map) -> FdVector::iterator {
+        auto pre_auth = map.find(iter->fd);
+        PreAuthPeer_ptr peer = std::move(pre_auth->second);
+        Protocol::Request request = peer->get_data_connection_request().value(); // NOLINT(bugprone-unchecked-optional-access)
+        auto owner = find_device_peer(*peer);
+        auto connection = std::make_unique<DataConnection>(std::move(*peer));
+
+        map.erase(pre_auth);
+        if (owner == m_peers.end()) {
+            // We are not connected to its device: nothing to attach it to
+            connection->respond_to_request(request, Protocol::ResponseData(Protocol::StatusCode::BAD_REQUEST));
+            return delete_move(m_fds, iter);
+        }
+        connection->respond_to_request(request, Protocol::ResponseData(Protocol::StatusCode::STATUS_OK));
+        m_data_connections.emplace(iter->fd, owner->second);
+        owner->second->add_data_connection(std::move(connection));
+        return ++iter;
+    }
+
     auto Server::delete_pre_auth_peer(FdVector::iterator iter, PreAuthPeerMap &map) -> FdVector::iterator {
         map.erase(iter->fd);
         return delete_move(m_fds, iter);
@@ -269,7 +377,13 @@ namespace FileShare {
 
     void Server::poll_events() {
         // TODO: configurable wait (currently 1s)
-        struct timespec timeout = {.tv_sec = 1, .tv_nsec = 0};
+        bool pending_uploads = std::ranges::any_of(m_peers, [](const auto &item) { return item.second->has_pending_uploads(); });
+        struct timespec timeout = {.tv_sec = m_scheduler_busy || pending_uploads ? 0 : 1, .tv_nsec = 0};
+
+        if (pending_uploads && !m_scheduler_busy) {
+            timeout.tv_nsec = PENDING_UPLOADS_POLL_TIMEOUT_NS;
+        }
+
         int nb_ready = Utils::poll(m_fds, &timeout);
 
         // if (nb_ready < 0) // TODO: handle signals
@@ -298,6 +412,19 @@ namespace FileShare {
                 iter++;
             }
         }
+        for (const auto &resuming_peer : m_resuming_peers) {
+            if (Peer_ptr peer = resuming_peer.lock()) {
+                peer->resume_downloads();
+            }
+        }
+        m_resuming_peers.clear();
+        for (auto &[fd, peer] : m_peers) {
+            peer->poll_pending_uploads();
+        }
+        // The acknowledgements just received made room for the next packets
+        m_scheduler->set_max_active_transfers(m_config.get_max_active_transfers());
+        m_scheduler_busy = m_scheduler->run(MAX_SCHEDULED_PACKETS) == MAX_SCHEDULED_PACKETS;
+        m_journal->flush();
     }
 
     auto Server::handle_peer_events(FdVector::iterator iter) -> FdVector::iterator {
@@ -307,8 +434,8 @@ namespace FileShare {
             std::shared_ptr<Peer> peer = peer_iter->second;
             std::vector<Protocol::Request> requests = peer->pull_requests();
 
-            for (auto &iter : requests) {
-                m_events.emplace_back(Event::REQUEST, peer, iter);
+            for (auto &request : requests) {
+                m_events.emplace_back(Event::REQUEST, peer, request);
             }
             if (!peer->get_socket().connected()) {
                 return delete_peer(iter);
@@ -316,6 +443,17 @@ namespace FileShare {
             return ++iter;
         }
 
+        auto data_connection_iter = m_data_connections.find(iter->fd);
+
+        if (data_connection_iter != m_data_connections.end()) {
+            Peer_ptr peer = data_connection_iter->second;
+
+            if (!peer->poll_data_connection(iter->fd)) {
+                return delete_data_connection(iter);
+            }
+            return ++iter;
+        }
+
         auto pending_peer_iter = m_pending_authorization_peers.find(iter->fd);
 
         if (pending_peer_iter != m_pending_authorization_peers.end()) {
@@ -325,6 +463,9 @@ namespace FileShare {
             if (!peer->get_socket().connected()) {
                 return delete_pre_auth_peer(iter, m_pending_authorization_peers);
             }
+            if (peer->get_data_connection_request().has_value()) {
+                return attach_data_connection(iter, m_pending_authorization_peers);
+            }
             return ++iter;
         }
 
@@ -337,10 +478,23 @@ namespace FileShare {
             if (!peer->get_socket().connected()) {
                 return delete_pre_auth_peer(iter, m_handshake_peers);
             }
+            if (peer->get_data_connection_request().has_value()) {
+                return attach_data_connection(iter, m_handshake_peers);
+            }
             if (peer->has_protocol()) {
+                if (!peer->received_request() && find_device_peer(*peer) != m_peers.end()) {
+                    // Its first request tells if it is a data connection of this Peer: it must not become a Peer
+                    // before, as the transfers would start using it
+                    return ++iter;
+                }
                 if (m_known_peers.contains(*peer)) {
                     // Already trusted peer
-                    insert_peer(std::move(peer));
+                    Peer_ptr &new_peer = insert_peer(std::move(peer));
+
+                    // The requests it sent right after the handshake are already read: poll() won't report them
+                    for (auto &request : new_peer->pull_buffered_requests()) {
+                        m_events.emplace_back(Event::REQUEST, new_peer, request);
+                    }
                 } else {
                     // Not yet trusted peer, going through authorization step
                     auto inserted = m_pending_authorization_peers.emplace(iter->fd, std::move(peer));
@@ -4,95 +4,789 @@
 ** Author Francois Michaut
 **
 ** Started on  Thu Aug 24 19:36:36 2023 Francois Michaut
-** Last update Sat Aug 23 11:16:50 2025 Francois Michaut
+** Last update Mon Oct 19 09:22:38 2026 Francois Michaut
 **
 ** TransferHandler.cpp : Implementation of classes to handle the file transfers
 */
 
 #include "FileShare/Errors/TransferErrors.hpp"
 #include "FileShare/TransferHandler.hpp"
+#include "FileShare/Utils/Delta.hpp"
+#include "FileShare/Utils/HashCache.hpp"
+#include "FileShare/Utils/VarInt.hpp"
+
+#include <CppSockets/OSDetection.hpp>
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/string.hpp>
 
 #include <algorithm>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <utility>
+
+#ifdef OS_UNIX
+  #include <fcntl.h>
+#elif defined(OS_WINDOWS)
+  #include <fcntl.h> // The CRT one, which also has the O_* names of its _O_* flags
+#endif
+
+namespace FileShare {
+    namespace {
+        constexpr std::uint32_t RESUME_STATE_VERSION = 0;
+
+        // Saved next to the .fsdownload file, so an interrupted download can be resumed
+        struct ResumeState {
+            Utils::HashAlgorithm hash_algorithm;
+            std::string filehash;
+            // Size and hash of the data written contiguously from the start of the temp file
+            std::size_t prefix_size = 0;
+            std::string prefix_hash;
+
+            template <class Archive>
+            void serialize(Archive &archive, const std::uint32_t version) {
+                if (version != RESUME_STATE_VERSION) {
+                    throw std::runtime_error("Resume state format is unsupported");
+                }
+                archive(hash_algorithm, filehash, prefix_size, prefix_hash);
+            }
+        };
+    }
+}
+
+CEREAL_CLASS_VERSION(FileShare::ResumeState, FileShare::RESUME_STATE_VERSION); // NOLINT
 
 namespace FileShare {
+    namespace {
+        auto load_resume_state(const std::string &filename) -> std::optional<ResumeState> {
+            std::ifstream file(filename, std::ios_base::binary | std::ios_base::in);
+            ResumeState state;
+
+            if (!file.is_open()) {
+                return std::nullopt;
+            }
+            try {
+                cereal::BinaryInputArchive archive(file);
+
+                archive(state);
+            } catch (std::exception &) {
+                return std::nullopt; // Corrupted state, we will have to start over
+            }
+            return state;
+        }
+
+        // Remove the optional fields of `info` which are not in `fields`
+        void keep_fields(Protocol::FileInfo &info, std::uint8_t fields) {
+            if ((fields & Protocol::FILE_INFO_SIZE) == 0)
+                info.size.reset();
+            if ((fields & Protocol::FILE_INFO_UPDATED_AT) == 0)
+                info.last_updated.reset();
+            if ((fields & Protocol::FILE_INFO_MODE) == 0)
+                info.mode.reset();
+            if ((fields & Protocol::FILE_INFO_HASH) == 0)
+                info.hash.reset();
+        }
+
+        // Bytes taken by an entry in a FILE_LIST packet: PATH_SIZE, PATH, FILE_TYPE and the optional fields
+        auto file_list_entry_size(const Protocol::FileInfo &info) -> std::size_t {
+            std::size_t size = Utils::VarInt(info.path.size()).byte_size() + info.path.size() + 1;
+
+            if (info.size.has_value())
+                size += Utils::VarInt(info.size.value()).byte_size();
+            if (info.last_updated.has_value())
+                size += 8;
+            if (info.mode.has_value())
+                size += Utils::VarInt(static_cast<std::size_t>(info.mode.value())).byte_size();
+            if (info.hash.has_value())
+                size += 1 + info.hash->size();
+            return size;
+        }
+    }
+
     // TODO: make download transfer handler return a STATUS instead.
     // Can return status::up_to_date for instance, avoid handling this with exceptions
-    DownloadTransferHandler::DownloadTransferHandler(std::string destination_filename, std::shared_ptr<Protocol::SendFileData> original_request) :
-        m_filename(std::move(destination_filename)), m_temp_filename(m_filename + ".fsdownload")
+    DownloadTransferHandler::DownloadTransferHandler(
+        std::string destination_filename, std::shared_ptr<Protocol::SendFileData> original_request,
+        std::size_t packet_start, std::optional<Utils::ChunkStore> chunk_store
+    ) :
+        m_filename(std::move(destination_filename)), m_temp_filename(m_filename + TEMP_EXTENSION),
+        m_resume_filename(m_filename + RESUME_EXTENSION), m_prefix_hasher(original_request->hash_algorithm),
+        m_chunk_start_hasher(original_request->hash_algorithm), m_chunk_hasher(original_request->hash_algorithm),
+        m_chunk_store(std::move(chunk_store))
     {
         m_original_request = std::move(original_request);
-        if (std::filesystem::exists(m_temp_filename)) {
-            // TODO: read from it and restart from where we left off
-            throw Errors::Transfer::UpToDateError(m_temp_filename);
-        }
-        if(std::filesystem::exists(m_filename) && Utils::file_hash(m_original_request->hash_algorithm, m_filename) == m_original_request->filehash) {
+        m_file_offset = packet_start * m_original_request->packet_size;
+        if (m_original_request->file_type == Protocol::FileType::DIRECTORY) {
+            // The files are unpacked as the bundle arrives, and only moved in place once all are received
+            m_bundle.emplace(m_filename, m_original_request->hash_algorithm);
+        } else if (std::filesystem::exists(m_filename) && Utils::HashCache::global().file_hash(m_original_request->hash_algorithm, m_filename) == m_original_request->filehash) {
             // file is already up to date, don't need to download it again
             throw Errors::Transfer::UpToDateError(m_filename);
         }
+        if ((m_original_request->delta_block_size != 0 || !m_original_request->content_chunks.empty() || m_bundle || !m_original_request->holes.empty()) && packet_start != 0) {
+            // The delta / the missing chunks depend on what we have now, and a bundle or a sparse file is
+            // not written contiguously: it cannot be resumed
+            throw Errors::Transfer::ResumeError(m_filename);
+        }
 
         std::filesystem::create_directories(std::filesystem::path(m_temp_filename).parent_path());
-        m_file.open(m_temp_filename, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        if (resume()) {
+            return;
+        }
+        std::filesystem::remove(m_resume_filename);
+        if (packet_start != 0) {
+            // Peer will start sending from packet_start, but we don't have the data before it
+            std::filesystem::remove(m_temp_filename);
+            throw Errors::Transfer::ResumeError(m_filename);
+        }
+        try {
+            find_known_chunks();
+            m_file.emplace(m_temp_filename, O_WRONLY | O_CREAT | O_TRUNC);
+            if (!m_original_request->holes.empty()) {
+                m_extents = Utils::data_extents(m_original_request->holes, m_original_request->file_size);
+                // The holes are never written to, so they stay holes
+                std::filesystem::resize_file(m_temp_filename, m_original_request->file_size);
+                for (const auto &extent : m_extents) {
+                    m_file->allocate(extent.file_offset, extent.size);
+                }
+            } else {
+                m_file->allocate(0, m_original_request->total_packets * m_original_request->packet_size);
+            }
+            if (m_original_request->inline_content.has_value()) {
+                // The content came with the request, no DATA_PACKET will follow
+                const std::string &content = m_original_request->inline_content.value();
+
+                m_file->pwrite(content.data(), content.size(), 0);
+                m_prefix_hasher.update(content);
+                m_transferred_size = content.size();
+                finish_transfer();
+            } else if ((!m_known_chunks.empty() || !m_original_request->holes.empty()) && m_original_request->total_packets == 0) {
+                finish_transfer(); // We already have every chunk, or the file is a single hole
+            }
+        } catch (std::exception &) {
+            std::error_code err;
+
+            // The destructor won't run: the temporary file would be left behind
+            m_file.reset();
+            std::filesystem::remove(m_temp_filename, err);
+            throw;
+        }
     }
 
-    void DownloadTransferHandler::receive_packet(const Protocol::DataPacketData &data) {
-        auto missing = std::ranges::find(m_missing_ids, data.packet_id);
+    DownloadTransferHandler::DownloadTransferHandler(std::shared_ptr<Utils::IByteSink> sink, std::shared_ptr<Protocol::SendFileData> original_request) :
+        m_prefix_hasher(original_request->hash_algorithm), m_chunk_start_hasher(original_request->hash_algorithm),
+        m_chunk_hasher(original_request->hash_algorithm), m_sink(std::move(sink))
+    {
+        m_original_request = std::move(original_request);
+        if (m_original_request->file_type == Protocol::FileType::DIRECTORY || m_original_request->delta_block_size != 0) {
+            throw std::runtime_error("Bundles and deltas cannot be received in a sink");
+        }
+        if (!m_original_request->holes.empty()) {
+            m_extents = Utils::data_extents(m_original_request->holes, m_original_request->file_size);
+        }
+        try {
+            if (m_original_request->inline_content.has_value()) {
+                const std::string &content = m_original_request->inline_content.value();
 
-        if (missing != m_missing_ids.end())
-            m_missing_ids.erase(missing);
+                m_transferred_size = content.size();
+                hash_content(content);
+                finish_transfer();
+            } else if (!m_original_request->holes.empty() && m_original_request->total_packets == 0) {
+                finish_transfer(); // The file is a single hole
+            }
+        } catch (std::exception &) {
+            // The destructor won't run: the sink must still learn the transfer is over
+            if (m_sink) {
+                try {
+                    std::exchange(m_sink, nullptr)->finish(false);
+                } catch (std::exception &) {
+                    // The first error is the one that matters
+                }
+            }
+            throw;
+        }
+    }
 
-        m_transferred_size += data.data.size();
-        if (data.packet_id > m_expected_id) {
-            std::size_t diff = data.packet_id - m_expected_id;
+    DownloadTransferHandler::~DownloadTransferHandler() {
+        if (m_sink) {
+            try {
+                m_sink->finish(false);
+            } catch (std::exception &) {
+                // Nothing we can do, the transfer is cancelled anyway
+            }
+            return;
+        }
+        if (!m_file.has_value()) {
+            return;
+        }
+        if (!is_resumable()) {
+            std::error_code err;
+
+            m_file.reset();
+            std::filesystem::remove(m_temp_filename, err);
+            return;
+        }
+        try {
+            save_resume_state();
+        } catch (std::exception &) {
+            // Nothing we can do, the download will start over next time
+        }
+    }
+
+    auto DownloadTransferHandler::resume_packet_start(const std::string &destination_filename, std::size_t packet_size) -> std::size_t {
+        auto state = load_resume_state(destination_filename + RESUME_EXTENSION);
+        std::error_code err;
+
+        if (!state.has_value() || packet_size == 0 || !std::filesystem::exists(destination_filename + TEMP_EXTENSION, err)) {
+            return 0;
+        }
+        return state->prefix_size / packet_size;
+    }
+
+    auto DownloadTransferHandler::resume() -> bool {
+        auto state = load_resume_state(m_resume_filename);
+        std::error_code err;
+
+        if (m_file_offset == 0 || !state.has_value()) {
+            return false;
+        }
+        // The file changed on the peer's side, or we asked to resume from further than what we have
+        if (state->hash_algorithm != m_original_request->hash_algorithm || state->filehash != m_original_request->filehash
+            || state->prefix_size < m_file_offset || std::filesystem::file_size(m_temp_filename, err) < state->prefix_size || err
+        ) {
+            return false;
+        }
+
+        // Make sure the data we kept is the one we wrote before, then drop everything after m_file_offset
+        std::size_t chunk_size = m_original_request->chunk_size;
+        std::size_t chunk_start = chunk_size == 0 ? m_file_offset : m_file_offset - (m_file_offset % chunk_size);
 
-            m_missing_ids.reserve(m_missing_ids.size() + diff);
-            for (std::size_t i = 0; i < diff; i++) {
-                // Fill file with temporary 0s
-                std::string str = std::string(m_original_request->packet_size, '\0');
+        if (m_prefix_hasher.update_file(m_temp_filename, 0, chunk_start) != chunk_start) {
+            return false;
+        }
+        m_chunk_start_hasher = m_prefix_hasher;
+        // The chunk the transfer resumes in will be verified once complete
+        if (m_prefix_hasher.update_file(m_temp_filename, chunk_start, m_file_offset - chunk_start) != m_file_offset - chunk_start) {
+            return false;
+        }
+        m_chunk_hasher.update_file(m_temp_filename, chunk_start, m_file_offset - chunk_start);
+        Utils::Hasher verify = m_prefix_hasher;
 
-                m_missing_ids.push_back(m_expected_id + i);
-                m_file.write(str.data(), str.size());
+        verify.update_file(m_temp_filename, m_file_offset, state->prefix_size - m_file_offset);
+        if (verify.digest() != state->prefix_hash) {
+            m_prefix_hasher = Utils::Hasher(m_original_request->hash_algorithm);
+            m_chunk_start_hasher = m_prefix_hasher;
+            m_chunk_hasher = m_prefix_hasher;
+            return false;
+        }
+        std::filesystem::resize_file(m_temp_filename, m_file_offset);
+        m_file.emplace(m_temp_filename, O_WRONLY);
+        m_file->allocate(m_file_offset, m_original_request->total_packets * m_original_request->packet_size);
+        m_checkpoint_size = m_file_offset;
+        return true;
+    }
+
+    auto DownloadTransferHandler::receive_packet(const Protocol::DataPacketData &data) -> Protocol::StatusCode {
+        std::size_t packet_size = m_original_request->packet_size;
+        std::size_t window = std::max<std::size_t>(1, REORDER_BUFFER_SIZE / packet_size);
+
+        // Only the last packet can be smaller, and the data can't go past the end of the file
+        if (data.packet_id >= m_original_request->total_packets || data.data.size() > packet_size
+            || (data.data.size() != packet_size && data.packet_id + 1 != m_original_request->total_packets)
+            || (!m_extents.empty() && (data.packet_id * packet_size) + data.data.size() > m_extents.back().offset + m_extents.back().size)
+        ) {
+            m_error = Protocol::StatusCode::BAD_REQUEST;
+            return fail();
+        }
+        if (m_sink && data.packet_id < m_expected_id) {
+            return Protocol::StatusCode::STATUS_OK; // Already given to the sink
+        }
+        if (m_sink && data.packet_id > m_expected_id + window) {
+            // A sink can't be written out of order, nor hold it in memory: the peer sends it again later
+            return Protocol::StatusCode::TOO_MANY_REQUESTS;
+        }
+        if (data.packet_id > m_expected_id && data.packet_id - m_expected_id <= window) {
+            // Slightly early packet: keep it in memory until the expected one arrives, so the file
+            // is written (and hashed) in order without leaving a gap to fill in later.
+            if (m_reorder_buffer.try_emplace(data.packet_id, data.data).second) {
+                m_transferred_size += data.data.size();
             }
-            m_expected_id = data.packet_id + 1;
-        } else if (data.packet_id < m_expected_id) {
-            auto original_pos = m_file.tellp();
+            return Protocol::StatusCode::STATUS_OK;
+        }
+        if (data.packet_id >= m_expected_id || m_missing_ids.contains(data.packet_id)) {
+            m_transferred_size += data.data.size(); // Not a duplicate
+        }
+        if (data.packet_id > m_expected_id) {
+            // Too far ahead, give up on the buffered packets being completed in order
+            flush_reorder_buffer();
+        }
+        write_packet(data.packet_id, data.data);
 
-            // Go back to the skipped position, write the data, and go back to the current position
-            m_file.seekp(m_original_request->packet_size * data.packet_id);
-            m_file.write(data.data.data(), data.data.size());
-            m_file.seekp(original_pos);
-            if (m_missing_ids.empty() && (m_expected_id + 1) == m_original_request->total_packets) {
+        auto next = m_reorder_buffer.find(m_expected_id);
+
+        while (next != m_reorder_buffer.end() && !m_error.has_value()) {
+            write_packet(next->first, next->second);
+            m_reorder_buffer.erase(next);
+            next = m_reorder_buffer.find(m_expected_id);
+        }
+
+        if (m_error.has_value()) {
+            return fail();
+        }
+        if (m_missing_ids.empty() && m_reorder_buffer.empty() && m_expected_id == m_original_request->total_packets) {
+            // The last chunk is usually smaller than chunk_size, it couldn't be verified yet
+            if (!m_sink && m_original_request->chunk_size != 0 && m_prefix_hasher.get_size() % m_original_request->chunk_size != 0) {
+                verify_chunk();
+            }
+            if (m_error.has_value()) {
+                return fail();
+            }
+            if (m_missing_ids.empty()) {
                 finish_transfer();
             }
-        } else { // data.packet_id == m_expected_id
-            bool last_packet;
+        } else if (is_resumable() && m_prefix_hasher.get_size() >= m_checkpoint_size + RESUME_CHECKPOINT_SIZE) {
+            save_resume_state();
+        }
+        if (m_chunk_mismatch) {
+            m_chunk_mismatch = false;
+            return Protocol::StatusCode::CHUNK_MISMATCH;
+        }
+        return Protocol::StatusCode::STATUS_OK;
+    }
+
+    void DownloadTransferHandler::flush_reorder_buffer() {
+        for (const auto &[packet_id, packet] : m_reorder_buffer) {
+            write_packet(packet_id, packet);
+        }
+        m_reorder_buffer.clear();
+    }
+
+    void DownloadTransferHandler::write_packet(std::size_t packet_id, std::string_view data) {
+        m_missing_ids.erase(packet_id);
+
+        // Skipped packets are left as a hole in the file, until they arrive
+        m_missing_ids.insert(m_expected_id, packet_id);
+        if (packet_id >= m_expected_id) {
+            m_expected_id = packet_id + 1;
+        }
+        if (m_sink) {
+            sink_packet(data);
+            return;
+        }
+        write_content(data, m_file_offset + (m_original_request->packet_size * packet_id));
+        if (m_extents.empty()) {
+            update_prefix(packet_id, data);
+        } else {
+            update_extents_prefix(packet_id, data);
+        }
+    }
+
+    void DownloadTransferHandler::write_content(std::string_view data, std::size_t offset) {
+        if (m_extents.empty()) {
+            m_file->pwrite(data.data(), data.size(), offset);
+            return;
+        }
+
+        auto extent = std::ranges::upper_bound(m_extents, offset, {}, &Utils::Extent::offset);
+
+        // Extents are contiguous in the data received, a packet continues in the next one after the hole.
+        // receive_packet() made sure the data ends in the last one.
+        for (extent--; !data.empty(); extent++) {
+            std::size_t start = offset - extent->offset;
+            std::string_view part = data.substr(0, extent->size - start);
+
+            m_file->pwrite(part.data(), part.size(), extent->file_offset + start);
+            data.remove_prefix(part.size());
+            offset += part.size();
+        }
+    }
+
+    void DownloadTransferHandler::update_prefix(std::size_t packet_id, std::string_view data) {
+        std::size_t packet_size = m_original_request->packet_size;
+        std::size_t contiguous_end = m_file_offset + (m_expected_id * packet_size);
+
+        if (m_file_offset + (packet_id * packet_size) == m_prefix_hasher.get_size()) {
+            advance_prefix(data);
+            if (data.size() < packet_size) {
+                return; // Last packet, nothing after it
+            }
+        }
+        if (!m_missing_ids.empty()) {
+            contiguous_end = m_file_offset + (m_missing_ids.front() * packet_size);
+        }
+        if (m_prefix_hasher.get_size() < contiguous_end) {
+            // A missing packet arrived, the packets received after it are already on disk
+            std::ifstream file(m_temp_filename, std::ios_base::in | std::ios_base::binary);
+            std::vector<char> buffer(std::min(contiguous_end - m_prefix_hasher.get_size(), REORDER_BUFFER_SIZE));
 
-            // TODO FIXME: this breaks with files of size 0
-            m_expected_id++; // Increment before comparaison, cause if we need 2 total packets, we will receive ids 0 and 1.
-            last_packet = m_expected_id == m_original_request->total_packets;
+            file.seekg(static_cast<std::streamoff>(m_prefix_hasher.get_size()));
+            while (m_prefix_hasher.get_size() < contiguous_end && file) {
+                std::size_t prefix_size = m_prefix_hasher.get_size();
 
-            m_file.write(data.data.data(), data.data.size());
-            if (data.data.size() != m_original_request->packet_size && !last_packet) {
-                // TODO: something is wrong if this happens -> figure out what to do.
-                throw std::runtime_error("Transfert size invalid");
+                file.read(buffer.data(), static_cast<std::streamsize>(std::min(buffer.size(), contiguous_end - prefix_size)));
+                advance_prefix({buffer.data(), static_cast<std::size_t>(file.gcount())});
+                if (m_prefix_hasher.get_size() != prefix_size + file.gcount()) {
+                    break; // A chunk was rejected and the prefix went back to its start
+                }
             }
-            if (last_packet && m_missing_ids.empty()) {
-                finish_transfer();
+        }
+    }
+
+    void DownloadTransferHandler::update_extents_prefix(std::size_t packet_id, std::string_view data) {
+        std::size_t packet_size = m_original_request->packet_size;
+        std::size_t contiguous_end = (m_missing_ids.empty() ? m_expected_id : m_missing_ids.front()) * packet_size;
+
+        // Same as update_prefix, except the data is hashed with zeros for the holes in between
+        if (packet_id * packet_size == m_hashed_data_size) {
+            hash_content(data);
+            if (data.size() < packet_size) {
+                return; // Last packet, nothing after it
+            }
+        }
+        if (m_hashed_data_size < contiguous_end) {
+            // A missing packet arrived, the packets received after it are already on disk
+            Utils::FileByteSource file(m_temp_filename);
+            std::string buffer(std::min(contiguous_end - m_hashed_data_size, REORDER_BUFFER_SIZE), '\0');
+
+            while (m_hashed_data_size < contiguous_end) {
+                std::size_t size = std::min(buffer.size(), contiguous_end - m_hashed_data_size);
+
+                size = Utils::read_extents(file, m_extents, buffer.data(), size, m_hashed_data_size);
+                if (size == 0) {
+                    break; // End of the data
+                }
+                hash_content({buffer.data(), size});
+            }
+        }
+    }
+
+    void DownloadTransferHandler::advance_prefix(std::string_view data) {
+        std::size_t chunk_size = m_original_request->chunk_size;
+
+        if (chunk_size == 0) {
+            m_prefix_hasher.update(data);
+            if (m_bundle) {
+                m_bundle->feed(data);
+            }
+            return;
+        }
+        while (!data.empty()) {
+            std::string_view part = data.substr(0, chunk_size - (m_prefix_hasher.get_size() % chunk_size));
+
+            m_prefix_hasher.update(part);
+            m_chunk_hasher.update(part);
+            data = data.substr(part.size());
+            if (m_prefix_hasher.get_size() % chunk_size == 0 && !verify_chunk()) {
+                return; // The rest of data will be received again
+            }
+        }
+    }
+
+    auto DownloadTransferHandler::verify_chunk() -> bool {
+        std::size_t chunk_size = m_original_request->chunk_size;
+        std::size_t packet_size = m_original_request->packet_size;
+        std::size_t chunk = (m_prefix_hasher.get_size() - 1) / chunk_size;
+
+        if (chunk >= m_original_request->chunk_hashes.size()) {
+            m_error = Protocol::StatusCode::BAD_REQUEST;
+            return false;
+        }
+        if (m_chunk_hasher.digest() == m_original_request->chunk_hashes[chunk]) {
+            m_chunk_start_hasher = m_prefix_hasher;
+            m_chunk_hasher = Utils::Hasher(m_original_request->hash_algorithm);
+            m_chunk_failures = 0;
+            return true;
+        }
+        if (++m_chunk_failures > MAX_CHUNK_RETRIES) {
+            m_error = Protocol::StatusCode::INTERNAL_ERROR;
+            return false;
+        }
+
+        // Forget the chunk and wait for the peer to send it again
+        std::size_t chunk_start = std::max(chunk * chunk_size, m_file_offset);
+        std::size_t first_id = (chunk_start - m_file_offset) / packet_size;
+        std::size_t end_id = std::min(((chunk + 1) * chunk_size - m_file_offset) / packet_size, m_expected_id);
+
+        m_missing_ids.insert(first_id, end_id);
+        m_transferred_size -= m_prefix_hasher.get_size() - chunk_start; // Counted again once resent
+        m_prefix_hasher = m_chunk_start_hasher;
+        m_chunk_hasher = Utils::Hasher(m_original_request->hash_algorithm);
+        if (m_prefix_hasher.get_size() < m_checkpoint_size) {
+            m_checkpoint_size = m_prefix_hasher.get_size();
+        }
+        m_mismatched_chunk = chunk;
+        m_chunk_mismatch = true;
+        return false;
+    }
+
+    auto DownloadTransferHandler::fail() -> Protocol::StatusCode {
+        std::error_code err;
+
+        m_reorder_buffer.clear();
+        m_missing_ids.clear();
+        if (m_sink) {
+            try {
+                std::exchange(m_sink, nullptr)->finish(false);
+            } catch (std::exception &) {
+                // Nothing we can do, the transfer failed anyway
+            }
+            return m_error.value(); // NOLINT(bugprone-unchecked-optional-access)
+        }
+        // The data can't be trusted: the download starts over next time
+        m_file.reset();
+        m_bundle.reset(); // Removes the files it unpacked
+        std::filesystem::remove(m_temp_filename, err);
+        std::filesystem::remove(m_resume_filename, err);
+        return m_error.value(); // NOLINT(bugprone-unchecked-optional-access)
+    }
+
+    void DownloadTransferHandler::sink_packet(std::string_view data) {
+        std::size_t chunk_size = m_original_request->chunk_size;
+
+        if (chunk_size == 0) {
+            hash_content(data);
+            return;
+        }
+        // The sink can't take data back: it only gets a chunk once verified. Chunks are made of whole packets.
+        m_sink_chunk.append(data);
+        if (m_sink_chunk.size() >= chunk_size || m_expected_id == m_original_request->total_packets) {
+            verify_sink_chunk();
+        }
+    }
+
+    void DownloadTransferHandler::hash_content(std::string_view data) {
+        if (m_extents.empty()) {
+            m_prefix_hasher.update(data);
+            m_sink->write(data);
+            return;
+        }
+        while (!data.empty()) {
+            auto extent = std::ranges::upper_bound(m_extents, m_hashed_data_size, {}, &Utils::Extent::offset);
+
+            // receive_packet() made sure the data ends in the last extent
+            extent--;
+
+            std::size_t start = m_hashed_data_size - extent->offset;
+            std::string_view part = data.substr(0, extent->size - start);
+
+            hash_zeros(extent->file_offset + start);
+            m_prefix_hasher.update(part);
+            if (m_sink) {
+                m_sink->write(part);
+            }
+            m_hashed_data_size += part.size();
+            data.remove_prefix(part.size());
+        }
+    }
+
+    void DownloadTransferHandler::hash_zeros(std::size_t file_offset) {
+        static const std::string zeros(0x10000, '\0');
+
+        // The holes are not sent, but they are part of the file hash, and the sink gets the whole file
+        while (m_prefix_hasher.get_size() < file_offset) {
+            std::string_view part = std::string_view(zeros).substr(0, file_offset - m_prefix_hasher.get_size());
+
+            m_prefix_hasher.update(part);
+            if (m_sink) {
+                m_sink->write(part);
             }
         }
     }
 
+    void DownloadTransferHandler::verify_sink_chunk() {
+        std::size_t chunk = m_prefix_hasher.get_size() / m_original_request->chunk_size;
+        Utils::Hasher hasher(m_original_request->hash_algorithm);
+
+        if (chunk >= m_original_request->chunk_hashes.size()) {
+            m_error = Protocol::StatusCode::BAD_REQUEST;
+            return;
+        }
+        hasher.update(m_sink_chunk);
+        if (hasher.digest() == m_original_request->chunk_hashes[chunk]) {
+            hash_content(m_sink_chunk);
+            m_sink_chunk.clear();
+            m_chunk_failures = 0;
+            return;
+        }
+        if (++m_chunk_failures > MAX_CHUNK_RETRIES) {
+            m_error = Protocol::StatusCode::INTERNAL_ERROR;
+            return;
+        }
+        // Wait for the peer to send the chunk again, the packets after it stay in the reorder buffer
+        m_transferred_size -= m_sink_chunk.size(); // Counted again once resent
+        m_sink_chunk.clear();
+        m_expected_id = m_prefix_hasher.get_size() / m_original_request->packet_size;
+        m_mismatched_chunk = chunk;
+        m_chunk_mismatch = true;
+    }
+
+    void DownloadTransferHandler::save_resume_state() {
+        ResumeState state{
+            .hash_algorithm=m_original_request->hash_algorithm, .filehash=m_original_request->filehash,
+            .prefix_size=m_prefix_hasher.get_size(), .prefix_hash=m_prefix_hasher.digest()
+        };
+        std::string tmp_file = m_resume_filename + ".tmp";
+
+        {
+            std::ofstream file(tmp_file, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+            cereal::BinaryOutputArchive archive(file);
+
+            archive(state);
+        }
+        std::filesystem::rename(tmp_file, m_resume_filename);
+        m_checkpoint_size = state.prefix_size;
+    }
+
     void DownloadTransferHandler::finish_transfer() {
-        m_file.close();
-        if (Utils::file_hash(m_original_request->hash_algorithm, m_temp_filename) == m_original_request->filehash) {
+        std::string filehash;
+
+        if (!m_extents.empty()) {
+            hash_zeros(m_original_request->file_size); // The file can end with a hole
+        }
+        if (m_sink) {
+            bool valid = m_prefix_hasher.digest() == m_original_request->filehash;
+
+            std::exchange(m_sink, nullptr)->finish(valid);
+            if (!valid)
+                throw Errors::Transfer::HashMismatchError(m_original_request->filepath);
+            return;
+        }
+        m_file.reset();
+        std::filesystem::remove(m_resume_filename);
+        if (m_original_request->delta_block_size != 0) {
+            filehash = apply_delta();
+        } else if (!m_known_chunks.empty()) {
+            filehash = assemble_chunks();
+        } else if (m_bundle) {
+            filehash = m_prefix_hasher.digest();
+        } else if (m_prefix_hasher.get_size() == std::filesystem::file_size(m_temp_filename)) {
+            // Every byte went through the hasher while being written, no need to read the file again
+            filehash = m_prefix_hasher.digest();
+        } else {
+            filehash = Utils::file_hash(m_original_request->hash_algorithm, m_temp_filename);
+        }
+        if (filehash == m_original_request->filehash && m_bundle) {
+            std::size_t failures = m_bundle->commit();
+
+            std::filesystem::remove(m_temp_filename);
+            if (failures != 0)
+                throw Errors::Transfer::HashMismatchError(m_filename);
+        } else if (filehash == m_original_request->filehash) {
             std::filesystem::rename(m_temp_filename, m_filename);
+            Utils::HashCache::global().store(m_original_request->hash_algorithm, m_filename, std::move(filehash));
+            store_chunks();
         } else {
             // TODO: figure out what to do
-            throw std::runtime_error("transferred file hash missmatch");
+            std::filesystem::remove(m_temp_filename);
+            m_bundle.reset(); // Removes the files it unpacked
+            for (std::size_t i = 0; i < m_known_chunks.size(); i++) {
+                if (m_known_chunks[i]) {
+                    // Drop the corrupted chunks from the store, so the next try gets them from the peer
+                    m_chunk_store->verify(m_original_request->hash_algorithm, m_original_request->content_chunks[i].hash);
+                }
+            }
+            throw Errors::Transfer::HashMismatchError(m_filename);
+        }
+    }
+
+    auto DownloadTransferHandler::apply_delta() -> std::string {
+        std::string delta_filename = m_temp_filename + DELTA_EXTENSION;
+
+        // We received the delta: rebuild the new file from it and our current copy
+        std::filesystem::rename(m_temp_filename, delta_filename);
+        try {
+            Utils::apply_delta(m_filename, delta_filename, m_temp_filename, m_original_request->delta_block_size);
+        } catch (std::exception &) {
+            std::filesystem::remove(delta_filename);
+            std::filesystem::remove(m_temp_filename);
+            throw;
+        }
+        std::filesystem::remove(delta_filename);
+        return Utils::file_hash(m_original_request->hash_algorithm, m_temp_filename);
+    }
+
+    void DownloadTransferHandler::find_known_chunks() {
+        const auto &chunks = m_original_request->content_chunks;
+        std::size_t missing_size = 0;
+
+        if (!m_chunk_store.has_value() || chunks.empty()) {
+            return; // The peer sends the whole file
+        }
+        m_known_chunks.resize(chunks.size());
+        for (std::size_t i = 0; i < chunks.size(); i++) {
+            m_known_chunks[i] = m_chunk_store->contains(chunks[i].hash);
+            if (!m_known_chunks[i]) {
+                missing_size += chunks[i].size;
+            }
+        }
+        if (std::ranges::find(m_known_chunks, true) == m_known_chunks.end()) {
+            m_known_chunks.clear();
+            return;
+        }
+        // The peer only sends the missing chunks
+        std::size_t packet_size = m_original_request->packet_size;
+
+        m_original_request->total_packets = (missing_size / packet_size) + (missing_size % packet_size == 0 ? 0 : 1);
+    }
+
+    auto DownloadTransferHandler::assemble_chunks() -> std::string {
+        std::string missing_filename = m_temp_filename + MISSING_CHUNKS_EXTENSION;
+        const auto &chunks = m_original_request->content_chunks;
+        std::size_t offset = 0;
+        std::size_t missing_offset = 0;
+
+        // We received the missing chunks back to back: put them in place, between the ones we have
+        std::filesystem::rename(m_temp_filename, missing_filename);
+        try {
+            Utils::FileDescriptor missing(missing_filename, O_RDONLY);
+            Utils::FileDescriptor output(m_temp_filename, O_WRONLY | O_CREAT | O_TRUNC);
+
+            for (std::size_t i = 0; i < chunks.size(); i++) {
+                if (m_known_chunks[i]) {
+                    m_chunk_store->copy_to(chunks[i], output, offset);
+                } else {
+                    if (missing.copy_to(output, missing_offset, offset, chunks[i].size) != chunks[i].size)
+                        throw std::runtime_error("Received chunks are truncated");
+                    missing_offset += chunks[i].size;
+                }
+                offset += chunks[i].size;
+            }
+        } catch (std::exception &) {
+            std::filesystem::remove(missing_filename);
+            std::filesystem::remove(m_temp_filename);
+            throw;
         }
+        std::filesystem::remove(missing_filename);
+        return Utils::file_hash(m_original_request->hash_algorithm, m_temp_filename);
+    }
+
+    void DownloadTransferHandler::store_chunks() const {
+        const auto &chunks = m_original_request->content_chunks;
+        std::size_t offset = 0;
+
+        if (!m_chunk_store.has_value() || chunks.empty()) {
+            return;
+        }
+        try {
+            // Including the known ones: they may have been in the previous version of this file
+            for (const auto &chunk : chunks) {
+                m_chunk_store->store(m_original_request->hash_algorithm, chunk, m_filename, offset);
+                offset += chunk.size;
+            }
+            m_chunk_store->trim();
+        } catch (std::exception &) {
+            // The file is complete, only the next transfers won't be able to skip these chunks
+        }
+    }
+
+    auto DownloadTransferHandler::is_resumable() const -> bool {
+        // Otherwise the temp file is not the beginning of the file
+        return m_original_request->delta_block_size == 0 && m_known_chunks.empty() && !m_bundle && m_original_request->holes.empty() && !m_sink;
     }
 
     auto DownloadTransferHandler::finished() const -> bool {
-        return !m_file.is_open();
+        return !m_file.has_value() && !m_sink;
     }
 
     auto IFileTransferHandler::get_current_size() const -> std::size_t {
@@ -110,41 +804,202 @@ namespace FileShare {
         return m_original_request;
     }
 
-    UploadTransferHandler::UploadTransferHandler(const std::string &filepath, std::shared_ptr<Protocol::SendFileData> original_request, std::size_t packet_start) {
+    UploadTransferHandler::UploadTransferHandler(const std::string &filepath, std::shared_ptr<Protocol::SendFileData> original_request, std::size_t packet_start, bool temporary_file) :
+        UploadTransferHandler(std::make_shared<Utils::FileByteSource>(filepath), std::move(original_request), packet_start)
+    {
+        if (temporary_file) {
+            m_temporary_file.reset(new std::filesystem::path(filepath));
+        }
+    }
+
+    UploadTransferHandler::UploadTransferHandler(std::shared_ptr<Utils::IByteSource> source, std::shared_ptr<Protocol::SendFileData> original_request, std::size_t packet_start) :
+        m_packet_start(packet_start), m_source(std::move(source)), m_buffer_pool(std::make_shared<Utils::BufferPool>()),
+        m_compress(original_request->compression != Utils::CompressionAlgorithm::NONE)
+    {
         m_original_request = std::move(original_request);
-        m_file.open(filepath);
-        // TODO: this won't raise on fail to open / fail to seek (need failibt, but failbit would raise if EOF while reading...)
-        m_file.exceptions(std::ifstream::badbit); // Enable exceptions on IO operations
-        m_file.seekg(m_original_request->packet_size * packet_start);
+        if (!m_original_request->holes.empty() && packet_start == 0) {
+            // Only the data around the holes is sent
+            m_extents = Utils::data_extents(m_original_request->holes, m_original_request->file_size);
+            m_end_reached = m_original_request->total_packets == 0;
+        } else if (m_original_request->range.has_value()) {
+            const auto &range = m_original_request->range.value();
+
+            // Nothing past the range is read, even if the file grew since it was hashed
+            m_extents.emplace_back(Utils::Extent{.offset=0, .file_offset=range.offset, .size=range.size});
+            m_end_reached = m_original_request->total_packets == 0;
+        }
+    }
+
+    void UploadTransferHandler::TemporaryFileDeleter::operator()(std::filesystem::path *path) const {
+        std::error_code err;
+
+        std::filesystem::remove(*path, err); // Ignoring errors - nothing we can do about it
+        delete path;
     }
 
-    // TODO: Do we really need shared_ptrs for the transfer packets ?
     auto UploadTransferHandler::get_next_packet(Protocol::MessageID original_request_id) -> std::shared_ptr<Protocol::DataPacketData> {
-        std::vector<char> buffer;
-        std::string data;
-        std::shared_ptr<Protocol::DataPacketData> data_packet_data;
+        std::size_t packet_size = m_original_request->packet_size;
+        std::size_t packet_id = m_packet_id;
+        bool resend = !m_resend_ids.empty();
 
-        if (finished())
+        if (resend) {
+            packet_id = m_resend_ids.front();
+            m_resend_ids.pop_front();
+        } else if (m_end_reached) {
             return nullptr;
+        }
+
+        std::string data;
+
+        if (!resend && m_read_ahead_depth != 0 && !m_read_ahead && m_packet_id < m_original_request->total_packets) {
+            start_read_ahead();
+        }
+        if (!resend && m_read_ahead) {
+            data = m_read_ahead->next();
+        } else {
+            // Read straight into the packet, in a buffer coming from a packet the peer already acknowledged
+            data = m_buffer_pool->acquire(packet_size);
+            data.resize(Utils::read_extents(*m_source, m_extents, data.data(), packet_size, packet_size * (m_packet_start + packet_id)));
+        }
+
+        if (!resend) {
+            m_transferred_size += data.size();
+            m_packet_id++;
+            if (data.size() < packet_size || m_packet_id >= m_original_request->total_packets) {
+                m_end_reached = true;
+            }
+        }
+        m_packets_in_flight++;
+
+        auto packet = std::make_shared<Protocol::DataPacketData>(original_request_id, packet_id, std::move(data));
+
+        compress_packet(*packet);
+        return packet;
+    }
+
+    void UploadTransferHandler::enable_read_ahead(std::size_t depth, std::size_t threads) {
+        m_read_ahead_depth = depth;
+        m_read_ahead_threads = threads;
+    }
+
+    void UploadTransferHandler::start_read_ahead() {
+        // The threads share the source and copy the extents, so they don't depend on this handler being moved
+        auto read = [source = m_source, extents = m_extents](char *buffer, std::size_t size, std::size_t offset) {
+            return Utils::read_extents(*source, extents, buffer, size, offset);
+        };
+        std::size_t packet_size = m_original_request->packet_size;
+
+        m_read_ahead = std::make_unique<Utils::ReadAhead>(
+            std::move(read), m_buffer_pool, packet_size, packet_size * (m_packet_start + m_packet_id),
+            m_original_request->total_packets - m_packet_id, m_read_ahead_depth, m_read_ahead_threads
+        );
+    }
+
+    auto UploadTransferHandler::get_read_ahead_stats() const -> Utils::ReadAheadStats {
+        if (m_read_ahead) {
+            return m_read_ahead->get_stats();
+        }
+        return {.depth=m_read_ahead_depth, .threads=m_read_ahead_threads};
+    }
+
+    void UploadTransferHandler::compress_packet(Protocol::DataPacketData &packet) {
+        if (!m_compress || packet.data.empty())
+            return;
+
+        std::string compressed = m_buffer_pool->acquire(packet.data.size());
+        bool smaller = Utils::compress(m_original_request->compression, packet.data, compressed);
+
+        if (m_sampled_packets < COMPRESSION_SAMPLE_PACKETS) {
+            m_sampled_packets++;
+            m_sampled_size += packet.data.size();
+            m_sampled_compressed_size += smaller ? compressed.size() : packet.data.size();
+            if (m_sampled_packets == COMPRESSION_SAMPLE_PACKETS && m_sampled_compressed_size * 100 > m_sampled_size * MAX_COMPRESSION_RATIO) {
+                m_compress = false; // Already compressed data, not worth the CPU
+            }
+        }
+        // Packets which did not shrink are sent as is
+        if (smaller) {
+            std::swap(packet.data, compressed);
+            packet.compression = m_original_request->compression;
+        }
+        m_buffer_pool->release(std::move(compressed));
+    }
+
+    void UploadTransferHandler::packet_acknowledged(Protocol::DataPacketData &packet) {
+        if (m_packets_in_flight > 0)
+            m_packets_in_flight--;
+        m_buffer_pool->release(std::move(packet.data));
+    }
+
+    void UploadTransferHandler::resend_chunk(std::size_t chunk) {
+        std::size_t packets_per_chunk = m_original_request->chunk_size / m_original_request->packet_size;
+        std::size_t chunk_first = chunk * packets_per_chunk;
+
+        if (packets_per_chunk == 0 || chunk_first + packets_per_chunk <= m_packet_start) {
+            return; // Not using a hash tree, or the chunk is before what we were asked to send
+        }
+        std::size_t first_id = std::max(chunk_first, m_packet_start) - m_packet_start;
+        std::size_t end_id = std::min(chunk_first + packets_per_chunk - m_packet_start, m_packet_id);
+
+        for (std::size_t id = first_id; id < end_id; id++) {
+            if (std::ranges::find(m_resend_ids, id) == m_resend_ids.end()) {
+                m_resend_ids.push_back(id);
+            }
+        }
+    }
+
+    void UploadTransferHandler::resend_packet(std::size_t packet_id) {
+        if (std::ranges::find(m_resend_ids, packet_id) == m_resend_ids.end()) {
+            m_resend_ids.push_back(packet_id);
+        }
+    }
 
-        buffer.reserve(m_original_request->packet_size);
-        m_file.read(buffer.data(), m_original_request->packet_size);
-        data = std::string(buffer.data(), m_file.gcount());
-        data_packet_data = std::make_shared<Protocol::DataPacketData>(original_request_id, m_packet_id++, data);
+    void UploadTransferHandler::disable_compression() {
+        // A copy, as the declined request is still referenced by the message queue
+        m_original_request = std::make_shared<Protocol::SendFileData>(*m_original_request);
+        m_original_request->compression = Utils::CompressionAlgorithm::NONE;
+        m_compress = false;
+    }
+
+    void UploadTransferHandler::skip_known_chunks(const std::vector<bool> &known_chunks) {
+        const auto &chunks = m_original_request->content_chunks;
+        std::size_t packet_size = m_original_request->packet_size;
+        std::size_t file_offset = 0;
+        std::size_t size = 0;
 
-        m_transferred_size += data.size();
-        if (data.size() < m_original_request->packet_size) {
-            m_file.close();
+        if (chunks.empty() || known_chunks.size() != chunks.size() || std::ranges::find(known_chunks, true) == known_chunks.end()) {
+            return; // The peer needs the whole file
+        }
+        m_extents.clear();
+        for (std::size_t i = 0; i < chunks.size(); i++) {
+            if (!known_chunks[i]) {
+                if (!m_extents.empty() && m_extents.back().file_offset + m_extents.back().size == file_offset) {
+                    m_extents.back().size += chunks[i].size;
+                } else {
+                    m_extents.emplace_back(Utils::Extent{.offset=size, .file_offset=file_offset, .size=chunks[i].size});
+                }
+                size += chunks[i].size;
+            }
+            file_offset += chunks[i].size;
         }
-        return data_packet_data;
+        m_original_request->total_packets = (size / packet_size) + (size % packet_size == 0 ? 0 : 1);
+        m_end_reached = m_original_request->total_packets == 0;
+    }
+
+    auto UploadTransferHandler::has_next_packet() const -> bool {
+        return !m_end_reached || !m_resend_ids.empty();
     }
 
     auto UploadTransferHandler::finished() const -> bool {
-        return !m_file.is_open();
+        return !has_next_packet() && m_packets_in_flight == 0;
     }
 
-    ListFilesTransferHandler::ListFilesTransferHandler(std::filesystem::path requested_path, FileMapping &file_mapping, std::size_t packet_size) :
-        m_requested_path(std::move(requested_path)), m_file_mapping(file_mapping), m_packet_size(packet_size)
+    ListFilesTransferHandler::ListFilesTransferHandler(
+        std::filesystem::path requested_path, FileMapping &file_mapping, std::size_t packet_size, std::uint8_t fields, std::size_t max_depth,
+        std::shared_ptr<ListingCache> cache
+    ) :
+        m_requested_path(std::move(requested_path)), m_file_mapping(file_mapping), m_fields(fields),
+        m_max_depth(std::min(max_depth, MAX_DEPTH)), m_cache(std::move(cache)), m_packet_size(packet_size)
     {
         std::filesystem::path::iterator out;
 
@@ -158,31 +1013,185 @@ namespace FileShare {
             std::filesystem::path host_path = FileShare::FileMapping::virtual_to_host(m_requested_path, m_path_node, out);
 
             if (!host_path.empty()) {
-                m_directory_iterator = std::filesystem::directory_iterator(host_path);
+                push_level(m_requested_path, 0, nullptr, host_path);
             }
         } else if (m_path_node->is_virtual()) {
-            m_node_iterator = m_path_node->get_child_nodes().begin();
+            m_levels.emplace_back(Level{
+                .virtual_path=m_requested_path, .depth=0, .is_virtual=true, .host_path={}, .directory_iterator={},
+                .listing=nullptr, .listing_index=0, .read_id=0, .read_listing=std::nullopt, .node=nullptr,
+                .node_iterator=m_path_node->get_child_nodes().begin()
+            });
+        }
+    }
+
+    void ListFilesTransferHandler::push_level(std::filesystem::path virtual_path, std::size_t depth, const PathNode *node, const std::filesystem::path &host_path) {
+        if (node != nullptr && node->is_virtual()) {
+            m_levels.emplace_back(Level{
+                .virtual_path=std::move(virtual_path), .depth=depth, .is_virtual=true, .host_path={}, .directory_iterator={},
+                .listing=nullptr, .listing_index=0, .read_id=0, .read_listing=std::nullopt, .node=node,
+                .node_iterator=node->get_child_nodes().begin()
+            });
+            return;
+        }
+        // The hash is not cached, the HashCache checks the file did not change
+        auto cached_fields = static_cast<std::uint8_t>(m_fields & ~Protocol::FILE_INFO_HASH);
+        std::optional<ListingCache::ReadID> read_id;
+
+        if (m_cache) {
+            auto listing = m_cache->find(host_path, cached_fields);
+
+            if (listing) {
+                m_levels.emplace_back(Level{
+                    .virtual_path=std::move(virtual_path), .depth=depth, .is_virtual=false, .host_path=host_path, .directory_iterator={},
+                    .listing=std::move(listing), .listing_index=0, .read_id=0, .read_listing=std::nullopt, .node=nullptr, .node_iterator={}
+                });
+                return;
+            }
+            read_id = m_cache->start_read(host_path);
+        }
+
+        std::error_code err;
+        std::filesystem::directory_iterator iterator(host_path, std::filesystem::directory_options::skip_permission_denied, err);
+
+        if (!err) { // The folder is still listed, but not its content
+            m_levels.emplace_back(Level{
+                .virtual_path=std::move(virtual_path), .depth=depth, .is_virtual=false, .host_path=host_path,
+                .directory_iterator=std::move(iterator), .listing=nullptr, .listing_index=0, .read_id=read_id.value_or(0),
+                .read_listing=read_id.has_value() ? std::make_optional(CachedListing{.fields=cached_fields, .entries={}}) : std::nullopt,
+                .node=nullptr, .node_iterator={}
+            });
+        }
+    }
+
+    void ListFilesTransferHandler::finish_level(Level &level) {
+        if (level.read_listing.has_value()) {
+            m_cache->finish_read(level.host_path, level.read_id, std::make_shared<const CachedListing>(std::move(level.read_listing.value())));
+            level.read_listing.reset();
         }
     }
 
+    auto ListFilesTransferHandler::level_finished(const Level &level) const -> bool {
+        if (level.is_virtual) {
+            const PathNode &node = level.node == nullptr ? m_path_node.value() : *level.node;
+
+            return level.node_iterator == node.get_child_nodes().end();
+        }
+        if (level.listing) {
+            return level.listing_index == level.listing->entries.size();
+        }
+        return level.directory_iterator == std::filesystem::directory_iterator();
+    }
+
     auto ListFilesTransferHandler::get_next_packet(Protocol::MessageID original_request_id) -> std::shared_ptr<Protocol::FileListData> {
         if (m_extra_packet_sent || !m_path_node.has_value()) {
             return nullptr;
         }
 
         std::vector<Protocol::FileInfo> vector;
-        const std::size_t max_count = 255; // TODO: determine that dynamically from packet_size
+        // REQUEST_ID, PACKET_ID and ITEM_COUNT (which is at most the packet size) come before the entries
+        std::size_t header_size = 1 + Utils::VarInt(m_current_id).byte_size() + Utils::VarInt(m_packet_size).byte_size();
+        std::size_t remaining_size = m_packet_size - std::min(m_packet_size, header_size);
+
+        // Entries are added as long as they fit in the packet, but there is always at least one
+        auto add_entry = [&vector, &remaining_size](Protocol::FileInfo info, const std::filesystem::path &host_path, std::uint8_t fields) {
+            std::size_t size;
+
+            if (!host_path.empty()) {
+                fill_file_info(info, host_path, fields);
+            }
+            size = file_list_entry_size(info);
+
+            if (!vector.empty() && size > remaining_size) {
+                return false;
+            }
+            remaining_size -= std::min(remaining_size, size);
+            vector.emplace_back(std::move(info));
+            return true;
+        };
 
         switch (m_path_node->get_type()) {
-            case PathNode::HOST_FOLDER: {
-                const auto end = std::filesystem::directory_iterator();
+            case PathNode::HOST_FOLDER:
+            case PathNode::VIRTUAL: {
+                while (!m_levels.empty()) {
+                    Level &level = m_levels.back();
+                    std::filesystem::path filepath;
+                    std::filesystem::path host_path;
+                    const PathNode *node = nullptr;
+                    Protocol::FileInfo info;
+                    std::uint8_t missing_fields = m_fields;
+                    std::optional<CachedListing::Entry> cache_entry;
+                    bool recurse;
+
+                    if (level_finished(level)) {
+                        finish_level(level);
+                        m_levels.pop_back();
+                        continue;
+                    }
+                    if (level.is_virtual) {
+                        node = &level.node_iterator->second;
+                        filepath = level.virtual_path / node->get_name();
+                        host_path = node->get_host_path();
+                        info.file_type = node->is_host_file() ? Protocol::FileType::FILE : Protocol::FileType::DIRECTORY;
+                        recurse = !node->is_host_file();
+                    } else if (level.listing) {
+                        const auto &entry = level.listing->entries[level.listing_index];
+
+                        info = entry.info;
+                        filepath = level.virtual_path / entry.info.path;
+                        host_path = level.host_path / entry.info.path;
+                        keep_fields(info, m_fields);
+                        // Folders are updated without their parent being notified, so their time is read again
+                        missing_fields &= info.file_type == Protocol::FileType::DIRECTORY ?
+                            Protocol::FILE_INFO_HASH | Protocol::FILE_INFO_UPDATED_AT : Protocol::FILE_INFO_HASH;
+                        recurse = info.file_type == Protocol::FileType::DIRECTORY && !entry.is_symlink;
+                    } else {
+                        const auto &entry = *level.directory_iterator;
+                        std::error_code err;
+                        bool is_symlink = entry.is_symlink(err);
 
-                for (std::size_t i = 0; m_directory_iterator != end && i < max_count; i++) {
-                    auto filepath = m_requested_path / m_directory_iterator->path().filename();
-                    auto file_type = m_directory_iterator->is_directory() ? Protocol::FileType::DIRECTORY : Protocol::FileType::FILE;
+                        filepath = level.virtual_path / entry.path().filename();
+                        host_path = entry.path();
+                        info.file_type = entry.is_directory(err) ? Protocol::FileType::DIRECTORY : Protocol::FileType::FILE;
+                        // Linked folders are not walked, they could loop back to their parent
+                        recurse = info.file_type == Protocol::FileType::DIRECTORY && !is_symlink;
+                        if (level.read_listing.has_value()) {
+                            // Read once for the peer and the cache: only the hash is left to fill
+                            info.path = entry.path().filename().string();
+                            fill_file_info(info, host_path, level.read_listing->fields);
+                            missing_fields &= Protocol::FILE_INFO_HASH;
+                            cache_entry = CachedListing::Entry{.info=info, .is_symlink=is_symlink};
+                        }
+                    }
+                    info.path = filepath.string();
 
-                    vector.emplace_back(Protocol::FileInfo{.path=filepath.string(), .file_type=file_type});
-                    m_directory_iterator++;
+                    // The level is only advanced once its entry was added, so the next packet starts with it otherwise
+                    if (!add_entry(std::move(info), host_path, missing_fields)) {
+                        break;
+                    }
+                    if (level.is_virtual) {
+                        level.node_iterator++;
+                    } else if (level.listing) {
+                        level.listing_index++;
+                    } else {
+                        std::error_code err;
+
+                        if (cache_entry.has_value() && level.read_listing->entries.size() == MAX_CACHED_ENTRIES) {
+                            // Too big to be kept: the cache remembers it, so it is not gathered again until it changes
+                            m_cache->finish_read(level.host_path, level.read_id, nullptr);
+                            level.read_listing.reset();
+                        } else if (cache_entry.has_value()) {
+                            level.read_listing->entries.emplace_back(std::move(cache_entry.value()));
+                        }
+                        level.directory_iterator.increment(err);
+                        if (err) {
+                            // Only partly read: nothing is given to the cache
+                            level.directory_iterator = std::filesystem::directory_iterator();
+                            level.read_listing.reset();
+                        }
+                    }
+                    if (recurse && level.depth < m_max_depth) {
+                        push_level(std::move(filepath), level.depth + 1, node, host_path); // Invalidates level
+                    }
                 }
                 break;
             }
@@ -195,19 +1204,7 @@ namespace FileShare {
                 if (entry.is_directory()) {
                     break; // It's supposed to be a file, abort
                 }
-                vector.emplace_back(Protocol::FileInfo{.path=m_requested_path.string(), .file_type=Protocol::FileType::FILE});
-                break;
-            }
-            case PathNode::VIRTUAL: {
-                const auto &nodes = m_path_node->get_child_nodes();
-
-                for (std::size_t i = 0; i < max_count && m_node_iterator != nodes.end(); i++) {
-                    const PathNode &node = m_node_iterator->second;
-                    auto file_type = node.is_host_file() ? Protocol::FileType::FILE : Protocol::FileType::DIRECTORY;
-
-                    vector.emplace_back(Protocol::FileInfo{.path=(m_requested_path / node.get_name()).string(), .file_type=file_type});
-                    m_node_iterator++;
-                }
+                add_entry(Protocol::FileInfo{.path=m_requested_path.string(), .file_type=Protocol::FileType::FILE}, entry.path(), m_fields);
                 break;
             }
         }
@@ -220,30 +1217,60 @@ namespace FileShare {
         return request;
     }
 
+    void ListFilesTransferHandler::fill_file_info(Protocol::FileInfo &info, const std::filesystem::path &host_path, std::uint8_t fields) {
+        std::error_code err;
+        bool is_file = info.file_type == Protocol::FileType::FILE;
+
+        if ((fields & Protocol::FILE_INFO_SIZE) != 0 && is_file) {
+            auto size = std::filesystem::file_size(host_path, err);
+
+            if (!err) {
+                info.size = size;
+            }
+        }
+        if ((fields & Protocol::FILE_INFO_UPDATED_AT) != 0) {
+            auto last_updated = std::filesystem::last_write_time(host_path, err);
+
+            if (!err) {
+                info.last_updated = last_updated;
+            }
+        }
+        if ((fields & Protocol::FILE_INFO_MODE) != 0) {
+            auto status = std::filesystem::status(host_path, err);
+
+            if (!err) {
+                info.mode = status.permissions();
+            }
+        }
+        if ((fields & Protocol::FILE_INFO_HASH) != 0 && is_file) {
+            try {
+                // Same algorithm as SEND_FILE, so it can be compared with the hash of a download
+                info.hash = Utils::HashCache::global().find(Utils::HashCache::make_key(info.hash_algorithm, host_path));
+            } catch (std::runtime_error &) {
+                // The file disappeared, the other fields were left empty as well
+            }
+        }
+    }
+
     auto ListFilesTransferHandler::finished() const -> bool {
         if (!m_path_node.has_value())
             return true;
         switch (m_path_node->get_type()) {
             case PathNode::HOST_FOLDER:
-                return m_directory_iterator == std::filesystem::directory_iterator();
+            case PathNode::VIRTUAL:
+                return std::ranges::all_of(m_levels, [this](const Level &level) { return level_finished(level); });
             case PathNode::HOST_FILE:
                 return m_current_id == 1;
-            case PathNode::VIRTUAL:
-                return m_node_iterator == m_path_node->get_child_nodes().end();
         }
+        return true;
     }
 
     void FileListTransferHandler::receive_packet(Protocol::FileListData data) {
         if (data.packet_id > m_current_id) {
-            while (m_current_id < data.packet_id) {
-                m_missing_ids.push_back(m_current_id++);
-            }
+            m_missing_ids.insert(m_current_id, data.packet_id);
+            m_current_id = data.packet_id + 1;
         } else if (data.packet_id < m_current_id) {
-            auto iter = std::ranges::find(m_missing_ids, data.packet_id);
-
-            if (iter != m_missing_ids.end()) {
-                m_missing_ids.erase(iter);
-            } else {
+            if (!m_missing_ids.erase(data.packet_id)) {
                 return; // Don't receive twice the same packet
             }
         } else {
@@ -0,0 +1,190 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:41:03 2026 Francois Michaut
+** Last update Mon Oct 19 08:59:53 2026 Francois Michaut
+**
+** TransferJournal.cpp : Downloads in progress, kept on disk to resume them after a restart
+*/
+
+#include "FileShare/TransferJournal.hpp"
+#include "FileShare/Utils/Serialize.hpp"
+#include "FileShare/Utils/VarInt.hpp"
+
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+
+namespace FileShare {
+    namespace {
+        constexpr std::size_t CHECKSUM_SIZE = 8;
+        // Bigger records are not something we wrote: the rest of the file is garbage
+        constexpr std::size_t MAX_RECORD_SIZE = 0x10000;
+
+        auto checksum(std::string_view data) -> std::uint64_t {
+            std::uint64_t hash = 0xcbf29ce484222325; // FNV-1a
+
+            for (char c : data) {
+                hash ^= static_cast<std::uint8_t>(c);
+                hash *= 0x100000001b3;
+            }
+            return hash;
+        }
+
+        auto parse_string(std::string_view &input, std::string &output) -> bool {
+            Utils::VarInt size;
+            std::string_view rest;
+
+            if (!size.parse(input, rest) || rest.size() < size.to_number()) {
+                return false;
+            }
+            output = rest.substr(0, size.to_number());
+            input = rest.substr(size.to_number());
+            return true;
+        }
+    }
+
+    TransferJournal::TransferJournal(std::filesystem::path filepath) :
+        m_filepath(std::move(filepath)), m_last_flush(std::chrono::steady_clock::now())
+    {
+        if (m_filepath.empty()) {
+            return;
+        }
+        std::filesystem::create_directories(m_filepath.parent_path());
+        load();
+        compact();
+    }
+
+    TransferJournal::~TransferJournal() {
+        try {
+            flush(true);
+        } catch (std::exception &) {
+            // Nothing we can do, the last changes are lost
+        }
+    }
+
+    void TransferJournal::add(const std::string &device_uuid, const std::string &filepath) {
+        if (m_entries.emplace(device_uuid, filepath).second) {
+            append_record(ADD, device_uuid, filepath);
+        }
+    }
+
+    void TransferJournal::remove(const std::string &device_uuid, const std::string &filepath) {
+        if (m_entries.erase({device_uuid, filepath}) != 0) {
+            append_record(REMOVE, device_uuid, filepath);
+        }
+    }
+
+    auto TransferJournal::contains(const std::string &device_uuid, const std::string &filepath) const -> bool {
+        return m_entries.contains({device_uuid, filepath});
+    }
+
+    auto TransferJournal::get_files(const std::string &device_uuid) const -> std::vector<std::string> {
+        std::vector<std::string> result;
+
+        for (auto iter = m_entries.lower_bound({device_uuid, ""}); iter != m_entries.end() && iter->first == device_uuid; iter++) {
+            result.push_back(iter->second);
+        }
+        return result;
+    }
+
+    void TransferJournal::append_record(RecordType type, const std::string &device_uuid, const std::string &filepath) {
+        if (m_filepath.empty()) {
+            return;
+        }
+
+        std::string record(1, type);
+
+        record += Utils::VarInt(device_uuid.size()).to_string();
+        record += device_uuid;
+        record += Utils::VarInt(filepath.size()).to_string();
+        record += filepath;
+        m_pending += Utils::VarInt(record.size()).to_string();
+        m_pending += record;
+        m_pending += Utils::serialize(checksum(record));
+    }
+
+    void TransferJournal::flush(bool force) {
+        auto now = std::chrono::steady_clock::now();
+
+        if (m_pending.empty() || !m_file || (!force && now - m_last_flush < FLUSH_INTERVAL)) {
+            return;
+        }
+        m_file->pwrite(m_pending.data(), m_pending.size(), m_file_size);
+        m_file->sync();
+        m_file_size += m_pending.size();
+        m_pending.clear();
+        m_last_flush = now;
+    }
+
+    void TransferJournal::load() {
+        std::ifstream file(m_filepath, std::ios_base::binary | std::ios_base::in);
+        std::stringstream ss;
+
+        if (!file.is_open()) {
+            return;
+        }
+        ss << file.rdbuf();
+
+        std::string content = ss.str();
+        std::string_view input = content;
+
+        while (!input.empty()) {
+            Utils::VarInt record_size;
+            std::string_view rest;
+            std::uint64_t expected_checksum = 0;
+
+            if (!record_size.parse(input, rest) || record_size.to_number() > MAX_RECORD_SIZE || rest.size() < record_size.to_number() + CHECKSUM_SIZE) {
+                return;
+            }
+
+            std::string_view record = rest.substr(0, record_size.to_number());
+            std::string device_uuid;
+            std::string filepath;
+
+            Utils::parse(rest.substr(record.size(), CHECKSUM_SIZE), expected_checksum);
+            if (record.empty() || checksum(record) != expected_checksum) {
+                return;
+            }
+
+            char type = record[0];
+
+            record.remove_prefix(1);
+            if (!parse_string(record, device_uuid) || !parse_string(record, filepath) || !record.empty()) {
+                return;
+            }
+            if (type == ADD) {
+                m_entries.emplace(std::move(device_uuid), std::move(filepath));
+            } else if (type == REMOVE) {
+                m_entries.erase({device_uuid, filepath});
+            } else {
+                return;
+            }
+            input = rest.substr(record_size.to_number() + CHECKSUM_SIZE);
+        }
+    }
+
+    void TransferJournal::compact() {
+        std::filesystem::path tmp_path = m_filepath.string() + ".tmp";
+
+        m_file.reset();
+        m_pending.clear();
+        for (const auto &[device_uuid, filepath] : m_entries) {
+            append_record(ADD, device_uuid, filepath);
+        }
+        {
+            Utils::FileDescriptor file(tmp_path, O_WRONLY | O_CREAT | O_TRUNC);
+
+            file.pwrite(m_pending.data(), m_pending.size(), 0);
+            file.sync();
+        }
+        // Either the old or the new journal is there if we crash in between
+        std::filesystem::rename(tmp_path, m_filepath);
+        m_file.emplace(m_filepath, O_WRONLY);
+        m_file_size = m_pending.size();
+        m_pending.clear();
+    }
+}
@@ -0,0 +1,180 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:32:51 2026 Francois Michaut
+** Last update Mon Oct 19 08:56:38 2026 Francois Michaut
+**
+** TransferScheduler.cpp : Decides which transfer sends the next packet, across all Peers
+*/
+
+#include "FileShare/TransferScheduler.hpp"
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <vector>
+
+namespace FileShare {
+    TransferScheduler::TransferScheduler(std::size_t max_active_transfers) :
+        m_max_active_transfers(max_active_transfers)
+    {}
+
+    auto TransferScheduler::add_transfer(
+        const std::string &peer, std::size_t weight, Config::TransferPriority priority, SendPacketCallback send_packet,
+        bool start_now
+    ) -> TransferID {
+        TransferID id = m_next_id++;
+        PeerState &state = m_peers[peer];
+
+        state.weight = std::max<std::size_t>(weight, 1);
+        state.transfers++;
+
+        auto transfer = m_transfers.emplace(id, Transfer{.peer=peer, .priority=priority, .send_packet=std::move(send_packet)}).first;
+
+        if (start_now) {
+            activate(transfer);
+        }
+        admit_transfers();
+        return id;
+    }
+
+    void TransferScheduler::remove_transfer(TransferID id) {
+        auto iter = m_transfers.find(id);
+
+        if (iter == m_transfers.end()) {
+            return;
+        }
+
+        auto peer = m_peers.find(iter->second.peer);
+
+        if (iter->second.active) {
+            peer->second.active_transfers--;
+            m_active.erase(id);
+        }
+        if (--peer->second.transfers == 0) {
+            m_peers.erase(peer);
+        }
+        m_transfers.erase(iter);
+        admit_transfers();
+    }
+
+    auto TransferScheduler::is_active(TransferID id) const -> bool {
+        auto iter = m_transfers.find(id);
+
+        return iter != m_transfers.end() && iter->second.active;
+    }
+
+    void TransferScheduler::admit_transfers() {
+        while (m_max_active_transfers == 0 || m_active.size() < m_max_active_transfers) {
+            // Highest priority first, then the peer with the fewest active transfers, then the oldest
+            auto best = m_transfers.end();
+            auto best_key = std::make_tuple(Config::TransferPriority::BACKGROUND, std::numeric_limits<std::size_t>::max());
+
+            for (auto iter = m_transfers.begin(); iter != m_transfers.end(); iter++) {
+                if (iter->second.active) {
+                    continue;
+                }
+
+                auto key = std::make_tuple(iter->second.priority, m_peers.at(iter->second.peer).active_transfers);
+
+                if (best == m_transfers.end() || key < best_key) {
+                    best = iter;
+                    best_key = key;
+                }
+            }
+            if (best == m_transfers.end()) {
+                return;
+            }
+            activate(best);
+        }
+    }
+
+    void TransferScheduler::activate(std::map<TransferID, Transfer>::iterator transfer) {
+        PeerState &peer = m_peers.at(transfer->second.peer);
+
+        if (peer.active_transfers == 0) {
+            peer.virtual_time = std::max(peer.virtual_time, min_peer_virtual_time());
+        }
+        transfer->second.virtual_time = min_transfer_virtual_time(transfer->second.peer);
+        transfer->second.active = true;
+        peer.active_transfers++;
+        m_active.insert(transfer->first);
+    }
+
+    auto TransferScheduler::get_turn_key(TransferID id, const Transfer &transfer) const -> TurnKey {
+        return {transfer.priority, m_peers.at(transfer.peer).virtual_time, transfer.virtual_time, id};
+    }
+
+    auto TransferScheduler::min_peer_virtual_time() const -> std::uint64_t {
+        std::uint64_t result = 0;
+        bool found = false;
+
+        for (const auto &[name, peer] : m_peers) {
+            if (peer.active_transfers != 0 && (!found || peer.virtual_time < result)) {
+                result = peer.virtual_time;
+                found = true;
+            }
+        }
+        return result;
+    }
+
+    auto TransferScheduler::min_transfer_virtual_time(const std::string &peer) const -> std::uint64_t {
+        std::uint64_t result = 0;
+        bool found = false;
+
+        for (TransferID id : m_active) {
+            const Transfer &transfer = m_transfers.at(id);
+
+            if (transfer.peer == peer && (!found || transfer.virtual_time < result)) {
+                result = transfer.virtual_time;
+                found = true;
+            }
+        }
+        return result;
+    }
+
+    auto TransferScheduler::run(std::size_t max_packets) -> std::size_t {
+        // Each active transfer is queued once per run. Transfers which could not send are not queued back:
+        // they wait for acknowledgements until the next run.
+        std::priority_queue<TurnKey, std::vector<TurnKey>, std::greater<>> turns;
+        std::size_t sent = 0;
+
+        for (TransferID id : m_active) {
+            turns.push(get_turn_key(id, m_transfers.at(id)));
+        }
+        while (sent < max_packets && !turns.empty()) {
+            TurnKey turn = turns.top();
+            TransferID id = std::get<3>(turn);
+            auto transfer = m_transfers.find(id);
+
+            turns.pop();
+            if (transfer == m_transfers.end() || !transfer->second.active) {
+                continue; // Removed by a callback
+            }
+            // Virtual times only grow: if its peer sent since it was queued, it goes back at its new place
+            if (TurnKey key = get_turn_key(id, transfer->second); key != turn) {
+                turns.push(key);
+                continue;
+            }
+            // The callback may add or remove transfers: nothing is kept across it
+            std::size_t size = transfer->second.send_packet();
+
+            if (size == 0) {
+                continue;
+            }
+            sent++;
+            transfer = m_transfers.find(id);
+            if (transfer != m_transfers.end()) {
+                PeerState &peer = m_peers.at(transfer->second.peer);
+
+                transfer->second.virtual_time += size;
+                peer.virtual_time += std::max<std::uint64_t>(size * VIRTUAL_TIME_UNIT / peer.weight, 1);
+                turns.push(get_turn_key(id, transfer->second));
+            }
+        }
+        return sent;
+    }
+}
@@ -0,0 +1,49 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:41:45 2026 Francois Michaut
+** Last update Mon Oct 19 06:04:11 2026 Francois Michaut
+**
+** BufferPool.cpp : Pool of reusable buffers, to avoid an allocation per packet
+*/
+
+#include "FileShare/Utils/BufferPool.hpp"
+
+namespace FileShare::Utils {
+    BufferPool::BufferPool(std::size_t max_buffers) :
+        m_max_buffers(max_buffers)
+    {}
+
+    auto BufferPool::acquire(std::size_t size) -> std::string {
+        std::string buffer;
+
+        {
+            std::lock_guard lock(m_mutex);
+
+            if (!m_buffers.empty()) {
+                buffer = std::move(m_buffers.back());
+                m_buffers.pop_back();
+            }
+        }
+        // Only allocates if the buffer was never that big
+        buffer.resize(size);
+        return buffer;
+    }
+
+    void BufferPool::release(std::string buffer) {
+        std::lock_guard lock(m_mutex);
+
+        // Strings always have some inline capacity, only keep heap allocated ones
+        if (buffer.capacity() > std::string().capacity() && m_buffers.size() < m_max_buffers) {
+            m_buffers.emplace_back(std::move(buffer));
+        }
+    }
+
+    auto BufferPool::size() const -> std::size_t {
+        std::lock_guard lock(m_mutex);
+
+        return m_buffers.size();
+    }
+}
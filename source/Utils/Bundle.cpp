@@ -0,0 +1,267 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:35:12 2026 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
+**
+** Bundle.cpp : Many files packed in a single stream, to transfer them as one
+*/
+
+#include "FileShare/Utils/Bundle.hpp"
+#include "FileShare/Utils/DebugPerf.hpp"
+#include "FileShare/Utils/HashCache.hpp"
+#include "FileShare/Utils/Serialize.hpp"
+#include "FileShare/Utils/Time.hpp"
+#include "FileShare/Utils/VarInt.hpp"
+
+#include <CppSockets/OSDetection.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef OS_UNIX
+  #include <fcntl.h>
+#elif defined(OS_WINDOWS)
+  #include <fcntl.h> // The CRT one, which also has the O_* names of its _O_* flags
+#endif
+
+namespace FileShare::Utils {
+    namespace {
+        constexpr std::size_t READ_SIZE = 0x100000; // 1 MiB
+        // PATH_SIZE and FILE_SIZE are at most 10 bytes each, UPDATED_AT is 8
+        constexpr std::size_t MAX_HEADER_SIZE = MAX_BUNDLE_PATH_SIZE + 10 + 8 + 10;
+
+        // The path must stay in the destination folder
+        auto is_valid_path(const std::filesystem::path &path) -> bool {
+            if (path.empty() || path.has_root_path()) {
+                return false;
+            }
+            return std::ranges::none_of(path, [](const std::filesystem::path &part) { return part == ".." || part == "."; });
+        }
+    }
+
+    BundleByteSource::BundleByteSource(HashAlgorithm algo, const std::vector<BundleFile> &files) {
+        DebugPerf debug("BundleByteSource");
+        Hasher bundle_hasher(algo);
+        std::string buffer;
+        // The hash of a file and the header of the next one are in the same segment
+        std::string data;
+
+        auto add_data = [this, &bundle_hasher, &data]() {
+            if (!data.empty()) {
+                bundle_hasher.update(data);
+                m_segments.emplace_back(Segment{.offset=m_size, .size=data.size(), .data=std::move(data), .host_path={}});
+                m_size += m_segments.back().size;
+                data.clear();
+            }
+        };
+
+        for (const auto &file : files) {
+            FileDescriptor input(file.host_path, O_RDONLY);
+            std::size_t file_size = std::filesystem::file_size(file.host_path);
+            std::uint64_t updated_at = to_epoch(std::filesystem::last_write_time(file.host_path));
+            Hasher hasher(algo);
+
+            if (file.path.size() > MAX_BUNDLE_PATH_SIZE)
+                throw std::runtime_error("Path is too long to be bundled");
+            data += VarInt(file.path.size()).to_string();
+            data += file.path;
+            data += serialize(updated_at);
+            data += VarInt(file_size).to_string();
+            add_data();
+            // Only the size we announced is sent, even if the file is being written to
+            for (std::size_t offset = 0; offset < file_size;) {
+                buffer.resize(std::min(READ_SIZE, file_size - offset));
+                buffer.resize(input.pread(buffer.data(), buffer.size(), offset));
+                if (buffer.empty())
+                    throw std::runtime_error("File was truncated while being bundled");
+                hasher.update(buffer);
+                bundle_hasher.update(buffer);
+                offset += buffer.size();
+            }
+            if (file_size != 0) {
+                m_segments.emplace_back(Segment{.offset=m_size, .size=file_size, .data={}, .host_path=file.host_path});
+                m_size += file_size;
+            }
+            data += hasher.digest();
+        }
+        add_data();
+        m_hash = bundle_hasher.digest();
+    }
+
+    auto BundleByteSource::read(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t {
+        // The last segment starting at or before offset
+        auto segment = std::ranges::upper_bound(m_segments, offset, {}, &Segment::offset);
+        std::size_t total = 0;
+
+        if (offset >= m_size) {
+            return 0;
+        }
+        for (segment--; segment != m_segments.end() && total < size; segment++) {
+            std::size_t segment_offset = offset + total - segment->offset;
+            std::size_t part = std::min(size - total, segment->size - segment_offset);
+
+            if (segment->host_path.empty()) {
+                std::memcpy(buffer + total, segment->data.data() + segment_offset, part);
+            } else {
+                // Opened on each read, so a big folder doesn't use a file descriptor per file
+                FileDescriptor input(segment->host_path, O_RDONLY);
+
+                for (std::size_t done = 0; done < part;) {
+                    std::size_t result = input.pread(buffer + total + done, part - done, segment_offset + done);
+
+                    if (result == 0)
+                        throw std::runtime_error("File was truncated while being bundled");
+                    done += result;
+                }
+            }
+            total += part;
+        }
+        return total;
+    }
+
+    BundleReader::BundleReader(std::filesystem::path destination, HashAlgorithm algo) :
+        m_destination(std::move(destination)), m_algo(algo), m_hasher(algo)
+    {}
+
+    BundleReader::~BundleReader() {
+        remove_temp_files();
+    }
+
+    void BundleReader::feed(std::string_view data) {
+        while (!data.empty()) {
+            if (m_state == State::CONTENT) {
+                std::string_view part = data.substr(0, m_remaining_size);
+
+                m_file->pwrite(part.data(), part.size(), m_file_offset);
+                m_hasher.update(part);
+                m_file_offset += part.size();
+                m_remaining_size -= part.size();
+                data.remove_prefix(part.size());
+                if (m_remaining_size == 0) {
+                    m_file.reset();
+                    m_state = State::HASH;
+                }
+                continue;
+            }
+
+            // Headers and hashes are parsed straight from data, unless they are split between 2 calls
+            std::string_view input = data;
+            std::size_t buffered = m_buffer.size();
+
+            if (buffered != 0) {
+                m_buffer.append(data.substr(0, MAX_HEADER_SIZE));
+                input = m_buffer;
+            }
+
+            std::size_t used = m_state == State::HEADER ? parse_header(input) : parse_hash(input);
+
+            if (used == 0) {
+                if (buffered == 0) {
+                    m_buffer = data;
+                }
+                if (m_buffer.size() >= MAX_HEADER_SIZE)
+                    throw std::runtime_error("Malformed bundle");
+                return;
+            }
+            data.remove_prefix(used - buffered);
+            m_buffer.clear();
+        }
+    }
+
+    auto BundleReader::parse_header(std::string_view input) -> std::size_t {
+        VarInt path_size;
+        VarInt file_size;
+        std::uint64_t updated_at;
+        std::string_view rest;
+
+        if (!path_size.parse(input, rest) || rest.size() < path_size.to_number() + 8) {
+            if (path_size.to_number() > MAX_BUNDLE_PATH_SIZE)
+                throw std::runtime_error("Malformed bundle");
+            return 0;
+        }
+
+        std::filesystem::path path(rest.substr(0, path_size.to_number()));
+
+        parse(rest.substr(path_size.to_number(), 8), updated_at);
+        if (!file_size.parse(rest.substr(path_size.to_number() + 8), rest)) {
+            return 0;
+        }
+        if (!is_valid_path(path))
+            throw std::runtime_error("Invalid path in bundle");
+
+        std::filesystem::path temp_path = m_destination / (path.string() + TEMP_EXTENSION);
+
+        std::filesystem::create_directories(temp_path.parent_path());
+        m_entries.emplace_back(Entry{
+            .path=m_destination / path, .last_updated=std::chrono::file_clock::from_sys(from_epoch<std::chrono::system_clock>(updated_at)),
+            .hash={}, .expected_hash={}
+        });
+        m_file.emplace(temp_path, O_WRONLY | O_CREAT | O_TRUNC);
+        m_file->allocate(0, file_size.to_number());
+        m_hasher = Hasher(m_algo);
+        m_file_offset = 0;
+        m_remaining_size = file_size.to_number();
+        if (m_remaining_size == 0) {
+            m_file.reset();
+            m_state = State::HASH;
+        } else {
+            m_state = State::CONTENT;
+        }
+        return input.size() - rest.size();
+    }
+
+    auto BundleReader::parse_hash(std::string_view input) -> std::size_t {
+        std::size_t hash_size = algo_hash_size(m_algo);
+
+        if (input.size() < hash_size) {
+            return 0;
+        }
+        m_entries.back().hash = m_hasher.digest();
+        m_entries.back().expected_hash = input.substr(0, hash_size);
+        m_state = State::HEADER;
+        return hash_size;
+    }
+
+    auto BundleReader::commit() -> std::size_t {
+        std::size_t failures = 0;
+
+        if (m_state != State::HEADER || !m_buffer.empty()) {
+            remove_temp_files();
+            throw std::runtime_error("Bundle is truncated");
+        }
+        for (const auto &entry : m_entries) {
+            std::filesystem::path temp_path = entry.path.string() + TEMP_EXTENSION;
+            std::error_code err;
+
+            if (entry.hash != entry.expected_hash) {
+                std::filesystem::remove(temp_path, err);
+                failures++;
+                continue;
+            }
+            if (std::filesystem::exists(entry.path, err) && HashCache::global().file_hash(m_algo, entry.path) == entry.hash) {
+                // Already up to date: the file is left untouched
+                std::filesystem::remove(temp_path, err);
+                continue;
+            }
+            std::filesystem::rename(temp_path, entry.path);
+            std::filesystem::last_write_time(entry.path, entry.last_updated, err); // Ignoring errors - this is optional
+            HashCache::global().store(m_algo, entry.path, entry.hash);
+        }
+        m_entries.clear();
+        return failures;
+    }
+
+    void BundleReader::remove_temp_files() {
+        std::error_code err;
+
+        m_file.reset();
+        for (const auto &entry : m_entries) {
+            std::filesystem::remove(entry.path.string() + TEMP_EXTENSION, err); // Ignoring errors - nothing we can do about it
+        }
+        m_entries.clear();
+    }
+}
@@ -0,0 +1,67 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:46:24 2026 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
+**
+** ByteStream.cpp : Where the data of a transfer comes from, and where it goes
+*/
+
+#include "FileShare/Utils/ByteStream.hpp"
+
+#include <CppSockets/OSDetection.hpp>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef OS_UNIX
+  #include <fcntl.h>
+#elif defined(OS_WINDOWS)
+  #include <fcntl.h> // The CRT one, which also has the O_* names of its _O_* flags
+#endif
+
+namespace FileShare::Utils {
+    FileByteSource::FileByteSource(const std::filesystem::path &path) :
+        FileByteSource(FileDescriptor(path, O_RDONLY))
+    {}
+
+    FileByteSource::FileByteSource(FileDescriptor file) :
+        m_file(std::move(file))
+    {
+#if defined(OS_UNIX) && !defined(OS_APPLE)
+        posix_fadvise(m_file, 0, 0, POSIX_FADV_SEQUENTIAL); // Ignoring return - this is optional
+#endif
+    }
+
+    auto FileByteSource::read(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t {
+#ifdef OS_WINDOWS
+        std::lock_guard lock(m_mutex);
+#endif
+        return m_file.pread(buffer, size, offset);
+    }
+
+    auto MemoryByteSource::read(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t {
+        if (offset >= m_data.size()) {
+            return 0;
+        }
+        size = std::min(size, m_data.size() - offset);
+        std::memcpy(buffer, m_data.data() + offset, size);
+        return size;
+    }
+
+    auto CallbackByteSource::read(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t {
+        return m_callback(buffer, size, offset);
+    }
+
+    void FileByteSink::write(std::string_view data) {
+        m_file.write(data.data(), data.size());
+    }
+
+    void CallbackByteSink::finish(bool complete) {
+        if (m_finish) {
+            m_finish(complete);
+        }
+    }
+}
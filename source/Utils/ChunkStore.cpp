@@ -0,0 +1,178 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:16:40 2026 Francois Michaut
+** Last update Mon Oct 19 08:34:58 2026 Francois Michaut
+**
+** ChunkStore.cpp : Content-addressed index of the chunks of downloaded files
+*/
+
+#include "FileShare/Utils/ChunkStore.hpp"
+#include "FileShare/Utils/HashCache.hpp"
+
+#include <CppSockets/OSDetection.hpp>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#ifdef OS_UNIX
+  #include <fcntl.h>
+#elif defined(OS_WINDOWS)
+  #include <fcntl.h> // The CRT one, which also has the O_* names of its _O_* flags
+#endif
+
+namespace FileShare::Utils {
+    namespace {
+        auto to_hex(const std::string &hash) -> std::string {
+            constexpr std::string_view digits = "0123456789abcdef";
+            std::string result;
+
+            result.reserve(hash.size() * 2);
+            for (char c : hash) {
+                result += digits[static_cast<std::uint8_t>(c) >> 4U];
+                result += digits[static_cast<std::uint8_t>(c) & 0xFU];
+            }
+            return result;
+        }
+    }
+
+    ChunkStore::ChunkStore(std::filesystem::path root, std::size_t capacity) :
+        m_root(std::move(root)), m_capacity(capacity)
+    {}
+
+    auto ChunkStore::chunk_path(const std::string &hash) const -> std::filesystem::path {
+        std::string name = to_hex(hash);
+
+        if (name.size() < 2)
+            throw std::runtime_error("Invalid chunk hash");
+        // Split by the first byte, to keep the folders small
+        return m_root / name.substr(0, 2) / name;
+    }
+
+    auto ChunkStore::find(const std::string &hash) const -> std::optional<Location> {
+        std::filesystem::path path = chunk_path(hash);
+        std::ifstream entry(path);
+        Location location = {};
+        std::string file;
+        std::error_code err;
+
+        if (!entry) {
+            return std::nullopt;
+        }
+        // Written by store(): the numbers on the first line, the file path on the second one
+        entry >> location.offset >> location.chunk_size >> location.device >> location.inode >> location.size >> location.mtime_ns;
+        entry.ignore(1);
+        if (entry && std::getline(entry, file) && !file.empty()) {
+            location.file = file;
+            try {
+                HashCache::Key key = HashCache::make_key(HashAlgorithm::SHA512, location.file);
+
+                if (key.device == location.device && key.inode == location.inode && key.size == location.size && key.mtime_ns == location.mtime_ns) {
+                    return location;
+                }
+            } catch (std::exception &) {
+                // The file was removed
+            }
+        }
+        entry.close();
+        std::filesystem::remove(path, err);
+        return std::nullopt;
+    }
+
+    auto ChunkStore::contains(const std::string &hash) const -> bool {
+        return find(hash).has_value();
+    }
+
+    auto ChunkStore::store(HashAlgorithm algo, const ContentChunk &chunk, const std::filesystem::path &file, std::size_t offset) const -> bool {
+        std::filesystem::path path = chunk_path(chunk.hash);
+        std::filesystem::path absolute = std::filesystem::absolute(file);
+        std::random_device random;
+        std::stringstream temp_name;
+        Hasher hasher(algo);
+
+        if (contains(chunk.hash)) {
+            return true;
+        }
+
+        HashCache::Key key = HashCache::make_key(algo, absolute);
+
+        if (hasher.update_file(absolute, offset, chunk.size) != chunk.size || hasher.digest() != chunk.hash) {
+            return false;
+        }
+        temp_name << path.filename().string() << '.' << std::hex << random();
+
+        // Written to a temporary file first, so an entry is always complete
+        std::filesystem::path temp_path = path.parent_path() / temp_name.str();
+
+        std::filesystem::create_directories(path.parent_path());
+        {
+            std::ofstream entry(temp_path, std::ios_base::out | std::ios_base::trunc);
+
+            entry << offset << ' ' << chunk.size << ' ' << key.device << ' ' << key.inode << ' ' << key.size << ' ' << key.mtime_ns << '\n';
+            entry << absolute.string() << '\n';
+            if (!entry.flush()) {
+                std::error_code err;
+
+                entry.close();
+                std::filesystem::remove(temp_path, err);
+                throw std::runtime_error("Failed to write the chunk entry");
+            }
+        }
+        std::filesystem::rename(temp_path, path);
+        return true;
+    }
+
+    void ChunkStore::copy_to(const ContentChunk &chunk, const FileDescriptor &destination, std::size_t offset) const {
+        auto location = find(chunk.hash);
+        std::error_code err;
+
+        if (!location.has_value() || location->chunk_size != chunk.size)
+            throw std::runtime_error("Stored chunk is outdated");
+
+        FileDescriptor file(location->file, O_RDONLY);
+
+        if (file.copy_to(destination, location->offset, offset, chunk.size) != chunk.size)
+            throw std::runtime_error("Stored chunk is truncated");
+        // Most recently used: the last one trim() drops
+        std::filesystem::last_write_time(chunk_path(chunk.hash), std::filesystem::file_time_type::clock::now(), err);
+    }
+
+    auto ChunkStore::verify(HashAlgorithm algo, const std::string &hash) const -> bool {
+        auto location = find(hash);
+        Hasher hasher(algo);
+        std::error_code err;
+
+        if (!location.has_value()) {
+            return false;
+        }
+        if (hasher.update_file(location->file, location->offset, location->chunk_size) == location->chunk_size && hasher.digest() == hash) {
+            return true;
+        }
+        std::filesystem::remove(chunk_path(hash), err);
+        return false;
+    }
+
+    void ChunkStore::trim() const {
+        std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> entries;
+        std::error_code err;
+
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(m_root, err)) {
+            if (entry.is_regular_file(err)) {
+                entries.emplace_back(entry.last_write_time(err), entry.path());
+            }
+        }
+        if (entries.size() <= m_capacity) {
+            return;
+        }
+        std::ranges::sort(entries, [](const auto &lhs, const auto &rhs) { return lhs.first < rhs.first; });
+        for (std::size_t i = 0; i < entries.size() - m_capacity; i++) {
+            std::filesystem::remove(entries[i].second, err);
+        }
+    }
+}
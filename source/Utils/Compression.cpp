@@ -0,0 +1,115 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:57:49 2026 Francois Michaut
+** Last update Mon Oct 19 08:29:23 2026 Francois Michaut
+**
+** Compression.cpp : Compression of the packets data
+*/
+
+#include "FileShare/Utils/Compression.hpp"
+
+#include <memory>
+#include <stdexcept>
+
+#include <zstd.h>
+
+namespace FileShare::Utils {
+    namespace {
+        // Favor speed: the data is compressed on the fly, it should not slow down the transfer
+        constexpr int ZSTD_LEVEL = 1;
+
+        struct ZstdCCtxDeleter {
+            void operator()(ZSTD_CCtx *ctx) const { ZSTD_freeCCtx(ctx); }
+        };
+        struct ZstdDCtxDeleter {
+            void operator()(ZSTD_DCtx *ctx) const { ZSTD_freeDCtx(ctx); }
+        };
+
+        // Contexts are expensive to create, reuse one per thread
+        auto zstd_cctx() -> ZSTD_CCtx * {
+            thread_local std::unique_ptr<ZSTD_CCtx, ZstdCCtxDeleter> ctx(ZSTD_createCCtx());
+
+            if (!ctx)
+                throw std::runtime_error("Failed to create the compression context");
+            return ctx.get();
+        }
+
+        auto zstd_dctx() -> ZSTD_DCtx * {
+            thread_local std::unique_ptr<ZSTD_DCtx, ZstdDCtxDeleter> ctx(ZSTD_createDCtx());
+
+            if (!ctx)
+                throw std::runtime_error("Failed to create the decompression context");
+            return ctx.get();
+        }
+    }
+
+    auto is_valid_compression(std::uint8_t value) -> bool {
+        switch (static_cast<CompressionAlgorithm>(value)) {
+            case CompressionAlgorithm::NONE:
+            case CompressionAlgorithm::ZSTD:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    auto compression_to_string(CompressionAlgorithm algo) -> const char * {
+        switch (algo) {
+            case CompressionAlgorithm::NONE:
+                return "none";
+            case CompressionAlgorithm::ZSTD:
+                return "zstd";
+            default:
+                throw std::runtime_error("Unknown compression algorithm value");
+        }
+    }
+
+    auto compress(CompressionAlgorithm algo, std::string_view data, std::string &output) -> bool {
+        switch (algo) {
+            case CompressionAlgorithm::NONE:
+                return false;
+            case CompressionAlgorithm::ZSTD: {
+                // Only the sizes smaller than the input are worth it
+                output.resize(data.size());
+
+                std::size_t size = ZSTD_compressCCtx(zstd_cctx(), output.data(), output.size(), data.data(), data.size(), ZSTD_LEVEL);
+
+                if (ZSTD_isError(size) || size >= data.size())
+                    return false;
+                output.resize(size);
+                return true;
+            }
+            default:
+                throw std::runtime_error("Unknown compression algorithm value");
+        }
+    }
+
+    auto decompress(CompressionAlgorithm algo, std::string_view data, std::size_t max_size) -> std::string {
+        switch (algo) {
+            case CompressionAlgorithm::NONE:
+                if (data.size() > max_size)
+                    throw std::runtime_error("Decompressed data is too big");
+                return std::string(data);
+            case CompressionAlgorithm::ZSTD: {
+                unsigned long long size = ZSTD_getFrameContentSize(data.data(), data.size());
+
+                if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+                    throw std::runtime_error("Malformed compressed data");
+                if (size > max_size)
+                    throw std::runtime_error("Decompressed data is too big");
+
+                std::string result(size, '\0');
+                std::size_t result_size = ZSTD_decompressDCtx(zstd_dctx(), result.data(), result.size(), data.data(), data.size());
+
+                if (ZSTD_isError(result_size) || result_size != size)
+                    throw std::runtime_error("Malformed compressed data");
+                return result;
+            }
+            default:
+                throw std::runtime_error("Unknown compression algorithm value");
+        }
+    }
+}
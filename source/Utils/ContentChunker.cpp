@@ -0,0 +1,130 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:16:40 2026 Francois Michaut
+** Last update Mon Oct 19 08:34:58 2026 Francois Michaut
+**
+** ContentChunker.cpp : Content-defined chunking of files (FastCDC)
+*/
+
+#include "FileShare/Utils/ContentChunker.hpp"
+#include "FileShare/Utils/DebugPerf.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <fstream>
+#include <stdexcept>
+
+namespace FileShare::Utils {
+    namespace {
+        constexpr std::size_t READ_SIZE = 0x100000; // 1 MiB
+        constexpr std::size_t MIN_AVERAGE_SIZE = 0x40;
+        // The cut condition checks 2 more bits before the average size, and 2 less after it
+        constexpr int NORMALIZATION_LEVEL = 2;
+
+        // Random value for each byte. It must never change: peers would cut the same content differently.
+        constexpr auto GEAR_TABLE = []() {
+            std::array<std::uint64_t, 256> table{};
+            std::uint64_t state = 0x46696C6553686172; // splitmix64
+
+            for (auto &value : table) {
+                state += 0x9E3779B97F4A7C15;
+                value = state;
+                value = (value ^ (value >> 30U)) * 0xBF58476D1CE4E5B9;
+                value = (value ^ (value >> 27U)) * 0x94D049BB133111EB;
+                value ^= value >> 31U;
+            }
+            return table;
+        }();
+
+        // The hash is shifted left for each byte, so its highest bits depend on the most bytes
+        constexpr auto high_bits_mask(int bits) -> std::uint64_t {
+            return ~std::uint64_t(0) << static_cast<unsigned>(64 - bits);
+        }
+    }
+
+    ContentChunker::ContentChunker(std::size_t average_size) :
+        m_average_size(std::bit_ceil(average_size))
+    {
+        if (average_size < MIN_AVERAGE_SIZE)
+            throw std::runtime_error("Content chunk size is too small");
+
+        int bits = std::countr_zero(m_average_size);
+
+        m_small_mask = high_bits_mask(bits + NORMALIZATION_LEVEL);
+        m_large_mask = high_bits_mask(bits - NORMALIZATION_LEVEL);
+    }
+
+    auto ContentChunker::cut(std::string_view data) const -> std::size_t {
+        std::size_t size = std::min(data.size(), get_max_size());
+        std::size_t normal_size = std::min(size, m_average_size);
+        std::uint64_t hash = 0;
+        std::size_t i = get_min_size();
+
+        if (size <= i) {
+            return size;
+        }
+        // Nothing is cut before the min size, no need to hash it
+        for (; i < normal_size; i++) {
+            hash = (hash << 1U) + GEAR_TABLE[static_cast<std::uint8_t>(data[i])];
+            if ((hash & m_small_mask) == 0) {
+                return i + 1;
+            }
+        }
+        for (; i < size; i++) {
+            hash = (hash << 1U) + GEAR_TABLE[static_cast<std::uint8_t>(data[i])];
+            if ((hash & m_large_mask) == 0) {
+                return i + 1;
+            }
+        }
+        return size;
+    }
+
+    auto content_chunk_size(std::size_t file_size) -> std::size_t {
+        return std::bit_ceil(std::max(DEFAULT_CONTENT_CHUNK_SIZE, file_size / MAX_CONTENT_CHUNKS));
+    }
+
+    auto content_chunks(HashAlgorithm algo, const std::filesystem::path &path, std::size_t average_size) -> std::vector<ContentChunk> {
+        DebugPerf debug("content_chunks");
+        ContentChunker chunker(average_size);
+        std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+        std::vector<ContentChunk> result;
+        std::string buffer;
+        std::size_t pos = 0; // Start of the next chunk in buffer
+
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file");
+        while (true) {
+            // Keep at least a max size chunk in the buffer, so it isn't cut short
+            if (buffer.size() - pos < chunker.get_max_size() && file) {
+                std::size_t read_size = std::max(READ_SIZE, chunker.get_max_size());
+
+                buffer.erase(0, pos);
+                pos = 0;
+
+                std::size_t size = buffer.size();
+
+                buffer.resize(size + read_size);
+                file.read(buffer.data() + size, static_cast<std::streamsize>(read_size));
+                buffer.resize(size + file.gcount());
+                if (file.bad())
+                    throw std::runtime_error("File read failed");
+            }
+            if (pos == buffer.size()) {
+                break;
+            }
+
+            std::string_view chunk = std::string_view(buffer).substr(pos);
+            Hasher hasher(algo);
+
+            chunk = chunk.substr(0, chunker.cut(chunk));
+            hasher.update(chunk);
+            result.emplace_back(ContentChunk{.size=chunk.size(), .hash=hasher.digest()});
+            pos += chunk.size();
+        }
+        return result;
+    }
+}
@@ -0,0 +1,320 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:41:01 2026 Francois Michaut
+** Last update Mon Oct 19 06:00:15 2026 Francois Michaut
+**
+** Delta.cpp : rsync-like delta of a file against an older copy of it
+*/
+
+#include "FileShare/Utils/DebugPerf.hpp"
+#include "FileShare/Utils/Delta.hpp"
+#include "FileShare/Utils/VarInt.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace FileShare::Utils {
+    namespace {
+        // Instructions of the delta file:
+        // COPY:    TAG | FIRST_BLOCK (VARINT) | BLOCK_COUNT (VARINT)
+        // LITERAL: TAG | SIZE (VARINT)        | DATA (SIZE bytes)
+        enum class DeltaTag : char {
+            COPY    = 0x01,
+            LITERAL = 0x02,
+        };
+
+        constexpr std::size_t READ_SIZE = 0x100000; // 1 MiB
+        constexpr std::size_t MAX_LITERAL_SIZE = 0x100000; // 1 MiB
+        constexpr std::size_t WEAK_TAG_BITS = 20;
+        constexpr std::size_t WEAK_TAG_COUNT = std::size_t(1) << WEAK_TAG_BITS; // Fits in the CPU cache
+
+        auto weak_tag(std::uint32_t weak) -> std::size_t {
+            // Fibonacci hashing: the low bits of the weak checksum alone are not evenly spread
+            return static_cast<std::uint32_t>(weak * 0x9E3779B1U) >> (32 - WEAK_TAG_BITS);
+        }
+
+        class DeltaWriter {
+            public:
+                DeltaWriter(const std::filesystem::path &path) :
+                    m_file(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc)
+                {
+                    if (!m_file.is_open())
+                        throw std::runtime_error("Failed to open delta file");
+                }
+
+                void copy(std::size_t block) {
+                    if (m_copy_count != 0 && m_copy_first + m_copy_count == block) {
+                        m_copy_count++;
+                        return;
+                    }
+                    flush();
+                    m_copy_first = block;
+                    m_copy_count = 1;
+                }
+
+                void literal(std::string_view data) {
+                    if (data.empty())
+                        return;
+                    if (m_copy_count != 0)
+                        flush();
+                    while (!data.empty()) {
+                        if (m_literal.size() >= MAX_LITERAL_SIZE)
+                            flush();
+
+                        std::string_view part = data.substr(0, MAX_LITERAL_SIZE - m_literal.size());
+
+                        m_literal += part;
+                        m_literal_size += part.size();
+                        data.remove_prefix(part.size());
+                    }
+                }
+
+                void flush() {
+                    if (m_copy_count != 0) {
+                        m_file.put(static_cast<char>(DeltaTag::COPY));
+                        m_file << VarInt(m_copy_first).to_string() << VarInt(m_copy_count).to_string();
+                        m_copy_count = 0;
+                    }
+                    if (!m_literal.empty()) {
+                        m_file.put(static_cast<char>(DeltaTag::LITERAL));
+                        m_file << VarInt(m_literal.size()).to_string() << m_literal;
+                        m_literal.clear();
+                    }
+                    if (!m_file.good())
+                        throw std::runtime_error("Failed to write delta file");
+                }
+
+                [[nodiscard]] auto get_literal_size() const -> std::size_t { return m_literal_size; }
+            private:
+                std::ofstream m_file;
+                std::size_t m_copy_first = 0;
+                std::size_t m_copy_count = 0;
+                std::string m_literal;
+                std::size_t m_literal_size = 0;
+        };
+
+        auto read_varint(std::istream &input) -> std::size_t {
+            std::string bytes;
+            VarInt varint;
+
+            // A std::size_t fits in 10 bytes
+            for (int byte = input.get(); byte != EOF && bytes.size() < 10; byte = input.get()) {
+                bytes += static_cast<char>(byte);
+                if (varint.parse(bytes)) {
+                    return varint.to_number();
+                }
+            }
+            throw std::runtime_error("Malformed delta file");
+        }
+
+        auto strong_hash(HashAlgorithm algo, std::string_view data) -> std::string {
+            Hasher hasher(algo);
+
+            hasher.update(data);
+            return hasher.digest();
+        }
+    }
+
+    RollingChecksum::RollingChecksum(std::string_view block) :
+        m_size(block.size())
+    {
+        std::uint32_t weight = m_size;
+
+        for (char c : block) {
+            m_a += static_cast<std::uint8_t>(c);
+            m_b += weight-- * static_cast<std::uint8_t>(c);
+        }
+    }
+
+    void RollingChecksum::roll(char removed, char added) {
+        m_a += static_cast<std::uint8_t>(added) - static_cast<std::uint8_t>(removed);
+        m_b += m_a - (m_size * static_cast<std::uint8_t>(removed));
+    }
+
+    auto file_signature(HashAlgorithm algo, const std::filesystem::path &path, std::size_t block_size) -> FileSignature {
+        DebugPerf debug("file_signature");
+        std::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+        FileSignature result{.block_size=block_size, .hash_algorithm=algo, .blocks={}};
+        std::string buffer(block_size, '\0');
+
+        if (block_size == 0)
+            throw std::runtime_error("Block size cannot be 0");
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file");
+        while (file.read(buffer.data(), static_cast<std::streamsize>(block_size)) || file.gcount() > 0) {
+            std::string_view block(buffer.data(), file.gcount());
+
+            result.blocks.emplace_back(BlockSignature{.weak=RollingChecksum(block).digest(), .strong=strong_hash(algo, block)});
+        }
+        if (file.bad())
+            throw std::runtime_error("File read failed");
+        return result;
+    }
+
+    auto make_delta(const FileSignature &signature, const std::filesystem::path &source, const std::filesystem::path &delta) -> std::size_t {
+        DebugPerf debug("make_delta");
+        const std::size_t block_size = signature.block_size;
+        std::ifstream file(source, std::ios_base::in | std::ios_base::binary);
+        std::unordered_map<std::uint32_t, std::vector<std::size_t>> weak_index;
+        // Most windows match no block: this rules them out without looking up weak_index (same as rsync)
+        std::vector<bool> weak_tags(WEAK_TAG_COUNT);
+        DeltaWriter writer(delta);
+        std::string buffer;
+        std::size_t pos = 0; // Start of the window in buffer
+        std::size_t literal_start = 0; // Bytes of buffer from here to pos matched no block
+        std::size_t next_block = 0; // Block following the last match, most likely to match again
+        std::optional<RollingChecksum> checksum;
+
+        if (block_size == 0)
+            throw std::runtime_error("Block size cannot be 0");
+        if (!file.is_open())
+            throw std::runtime_error("Failed to open file");
+        for (std::size_t i = 0; i < signature.blocks.size(); i++) {
+            weak_index[signature.blocks[i].weak].push_back(i);
+            weak_tags[weak_tag(signature.blocks[i].weak)] = true;
+        }
+
+        // The bytes which matched no block are written as a single literal, up to the next match
+        auto write_literal = [&]() {
+            writer.literal(std::string_view(buffer).substr(literal_start, pos - literal_start));
+            literal_start = pos;
+        };
+        auto fill = [&]() {
+            // Keep at least one byte after the window, to be able to roll it
+            if (buffer.size() - pos > block_size || !file)
+                return;
+            write_literal();
+            buffer.erase(0, pos);
+            pos = 0;
+            literal_start = 0;
+
+            std::size_t size = buffer.size();
+
+            buffer.resize(size + READ_SIZE);
+            file.read(buffer.data() + size, static_cast<std::streamsize>(READ_SIZE));
+            buffer.resize(size + file.gcount());
+            if (file.bad())
+                throw std::runtime_error("File read failed");
+        };
+        auto find_block = [&](std::string_view window) -> std::optional<std::size_t> {
+            if (!weak_tags[weak_tag(checksum->digest())])
+                return std::nullopt;
+
+            auto iter = weak_index.find(checksum->digest());
+
+            if (iter == weak_index.end())
+                return std::nullopt;
+
+            std::string strong = strong_hash(signature.hash_algorithm, window);
+            const auto &candidates = iter->second;
+
+            // Try the block following the previous match first
+            if (std::ranges::find(candidates, next_block) != candidates.end() && signature.blocks[next_block].strong == strong)
+                return next_block;
+            for (std::size_t block : candidates) {
+                if (signature.blocks[block].strong == strong) {
+                    return block;
+                }
+            }
+            return std::nullopt;
+        };
+
+        fill();
+        while (pos < buffer.size()) {
+            std::string_view window = std::string_view(buffer).substr(pos, block_size);
+
+            if (window.size() < block_size) {
+                // End of the file, it can only match the last block as a whole
+                checksum = RollingChecksum(window);
+                auto block = find_block(window);
+
+                write_literal();
+                if (block.has_value()) {
+                    writer.copy(*block);
+                } else {
+                    writer.literal(window);
+                }
+                pos = buffer.size();
+                literal_start = pos;
+                break;
+            }
+            if (!checksum.has_value())
+                checksum = RollingChecksum(window);
+
+            auto block = find_block(window);
+
+            if (block.has_value()) {
+                write_literal();
+                writer.copy(*block);
+                next_block = *block + 1;
+                pos += block_size;
+                literal_start = pos;
+                checksum.reset();
+            } else {
+                if (pos + block_size < buffer.size()) {
+                    checksum->roll(buffer[pos], buffer[pos + block_size]);
+                } else {
+                    checksum.reset(); // End of the file, the window is getting smaller
+                }
+                pos++;
+            }
+            fill();
+        }
+        write_literal();
+        writer.flush();
+        return writer.get_literal_size();
+    }
+
+    void apply_delta(const std::filesystem::path &basis, const std::filesystem::path &delta, const std::filesystem::path &output, std::size_t block_size) {
+        DebugPerf debug("apply_delta");
+        std::ifstream basis_file(basis, std::ios_base::in | std::ios_base::binary);
+        std::ifstream delta_file(delta, std::ios_base::in | std::ios_base::binary);
+        std::ofstream output_file(output, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        std::string buffer;
+
+        if (block_size == 0)
+            throw std::runtime_error("Block size cannot be 0");
+        if (!basis_file.is_open() || !delta_file.is_open() || !output_file.is_open())
+            throw std::runtime_error("Failed to open file");
+        for (int tag = delta_file.get(); tag != EOF; tag = delta_file.get()) {
+            switch (static_cast<DeltaTag>(tag)) {
+                case DeltaTag::COPY: {
+                    std::size_t first = read_varint(delta_file);
+                    std::size_t count = read_varint(delta_file);
+
+                    basis_file.clear();
+                    basis_file.seekg(static_cast<std::streamoff>(first * block_size));
+                    for (std::size_t i = 0; i < count; i++) {
+                        buffer.resize(block_size);
+                        basis_file.read(buffer.data(), static_cast<std::streamsize>(block_size));
+                        if (basis_file.gcount() == 0)
+                            throw std::runtime_error("Delta refers to data past the end of the file");
+                        output_file.write(buffer.data(), basis_file.gcount());
+                    }
+                    break;
+                }
+                case DeltaTag::LITERAL: {
+                    std::size_t size = read_varint(delta_file);
+
+                    if (size > MAX_LITERAL_SIZE)
+                        throw std::runtime_error("Malformed delta file");
+                    buffer.resize(size);
+                    if (!delta_file.read(buffer.data(), static_cast<std::streamsize>(size)))
+                        throw std::runtime_error("Malformed delta file");
+                    output_file.write(buffer.data(), static_cast<std::streamsize>(size));
+                    break;
+                }
+                default:
+                    throw std::runtime_error("Malformed delta file");
+            }
+            if (!output_file.good())
+                throw std::runtime_error("Failed to write file");
+        }
+    }
+}
@@ -4,13 +4,17 @@
 ** Author Francois Michaut
 **
 ** Started on  Tue May  9 11:13:37 2023 Francois Michaut
-** Last update Fri Aug 22 23:19:33 2025 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
 **
 ** FileDescriptor.cpp : Helper wrapper class to auto close file descriptor
 */
 
 #include "FileShare/Utils/FileDescriptor.hpp"
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
 #include <iostream>
 #include <sstream>
 #include <utility>
@@ -18,11 +22,55 @@
 #include <fcntl.h>
 #include <string.h>
 
-#ifndef OS_WINDOWS
+#ifdef OS_WINDOWS
+  #include <io.h>
+#else
   #include <unistd.h>
 #endif
 
 namespace FileShare::Utils {
+    namespace {
+        constexpr std::size_t COPY_BUFFER_SIZE = 0x100000; // 1 MiB
+
+        auto open_file(const char *filename, int flags, int mode) -> int {
+#ifdef OS_WINDOWS
+            return _open(filename, flags | _O_BINARY, mode);
+#else
+            return open(filename, flags, mode);
+#endif
+        }
+
+        // Windows has no pread/pwrite: seek then read/write, which is fine since a
+        // FileDescriptor is not shared between threads
+        auto pread_at(int fd, char *buffer, std::size_t size, std::size_t offset) -> std::int64_t {
+#ifdef OS_WINDOWS
+            if (_lseeki64(fd, static_cast<std::int64_t>(offset), SEEK_SET) < 0)
+                return -1;
+            return _read(fd, buffer, static_cast<unsigned int>(std::min<std::size_t>(size, INT_MAX)));
+#else
+            return ::pread(fd, buffer, size, static_cast<off_t>(offset));
+#endif
+        }
+
+        auto pwrite_at(int fd, const char *buffer, std::size_t size, std::size_t offset) -> std::int64_t {
+#ifdef OS_WINDOWS
+            if (_lseeki64(fd, static_cast<std::int64_t>(offset), SEEK_SET) < 0)
+                return -1;
+            return _write(fd, buffer, static_cast<unsigned int>(std::min<std::size_t>(size, INT_MAX)));
+#else
+            return ::pwrite(fd, buffer, size, static_cast<off_t>(offset));
+#endif
+        }
+
+        auto write_some(int fd, const char *buffer, std::size_t size) -> std::int64_t {
+#ifdef OS_WINDOWS
+            return _write(fd, buffer, static_cast<unsigned int>(std::min<std::size_t>(size, INT_MAX)));
+#else
+            return ::write(fd, buffer, size);
+#endif
+        }
+    }
+
     FileHandleBase::FileHandleBase(std::string filename) :
         m_filename(std::move(filename))
     {}
@@ -41,7 +89,6 @@ namespace FileShare::Utils {
         std::cerr << oss.str() << std::endl;
     }
 
-#ifndef OS_WINDOWS
     FileDescriptor::FileDescriptor(int fd, std::string filename)
         : FileHandleBase(std::move(filename)), m_fd(fd)
     {
@@ -50,16 +97,16 @@ namespace FileShare::Utils {
         }
     }
 
-    FileDescriptor::FileDescriptor(const char *filename, int flags)
-        : FileDescriptor(open(filename, flags), filename)
+    FileDescriptor::FileDescriptor(const char *filename, int flags, int mode)
+        : FileDescriptor(open_file(filename, flags, mode), filename)
     {}
 
-    FileDescriptor::FileDescriptor(std::string filename, int flags)
-        : FileDescriptor(open(filename.c_str(), flags), filename)
+    FileDescriptor::FileDescriptor(std::string filename, int flags, int mode)
+        : FileDescriptor(open_file(filename.c_str(), flags, mode), filename)
     {}
 
-    FileDescriptor::FileDescriptor(const std::filesystem::path &path, int flags)
-        : FileDescriptor(open(path.c_str(), flags), path.string())
+    FileDescriptor::FileDescriptor(const std::filesystem::path &path, int flags, int mode)
+        : FileDescriptor(open_file(path.string().c_str(), flags, mode), path.string())
     {}
 
     FileDescriptor::~FileDescriptor()
@@ -68,7 +115,141 @@ namespace FileShare::Utils {
             report_error("close", false);
         }
     }
+
+    FileDescriptor::FileDescriptor(FileDescriptor &&other) noexcept
+        : FileHandleBase(std::move(other.m_filename)), m_fd(std::exchange(other.m_fd, -1))
+    {}
+
+    auto FileDescriptor::operator=(FileDescriptor &&other) noexcept -> FileDescriptor & {
+        if (this != &other) {
+            if (m_fd != -1 && close(m_fd) == -1) {
+                report_error("close", false);
+            }
+            m_filename = std::move(other.m_filename);
+            m_fd = std::exchange(other.m_fd, -1);
+        }
+        return *this;
+    }
+
+    auto FileDescriptor::pread(char *buffer, std::size_t size, std::size_t offset) const -> std::size_t {
+        std::size_t total = 0;
+
+        while (total < size) {
+            auto ret = pread_at(m_fd, buffer + total, size - total, offset + total);
+
+            if (ret == 0) {
+                break; // End of file
+            }
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                report_error("read");
+            }
+            total += ret;
+        }
+        return total;
+    }
+
+    void FileDescriptor::pwrite(const char *buffer, std::size_t size, std::size_t offset) const {
+        std::size_t total = 0;
+
+        while (total < size) {
+            auto ret = pwrite_at(m_fd, buffer + total, size - total, offset + total);
+
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                report_error("write");
+            }
+            total += ret;
+        }
+    }
+
+    void FileDescriptor::write(const char *buffer, std::size_t size) const {
+        std::size_t total = 0;
+
+        while (total < size) {
+            auto ret = write_some(m_fd, buffer + total, size - total);
+
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                report_error("write");
+            }
+            total += ret;
+        }
+    }
+
+    void FileDescriptor::allocate([[maybe_unused]] std::size_t offset, [[maybe_unused]] std::size_t size) const {
+#ifdef OS_LINUX
+        // Ignoring return - this is optional, and not supported by every filesystem
+        fallocate(m_fd, FALLOC_FL_KEEP_SIZE, static_cast<off_t>(offset), static_cast<off_t>(size));
 #endif
+    }
+
+    auto FileDescriptor::copy_to(const FileDescriptor &destination, std::size_t offset, std::size_t destination_offset, std::size_t size) const -> std::size_t {
+        std::size_t total = 0;
+
+#ifdef OS_LINUX
+        while (total < size) {
+            auto in = static_cast<off_t>(offset + total);
+            auto out = static_cast<off_t>(destination_offset + total);
+            auto ret = copy_file_range(m_fd, &in, destination.m_fd, &out, size - total, 0);
+
+            if (ret == 0) {
+                return total; // End of file
+            }
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+                    break; // Not supported between these files, copy through a buffer instead
+                }
+                report_error("copy");
+            }
+            total += ret;
+        }
+#endif
+        std::string buffer;
+
+        while (total < size) {
+            buffer.resize(std::min<std::size_t>(size - total, COPY_BUFFER_SIZE));
+            std::size_t read = pread(buffer.data(), buffer.size(), offset + total);
+
+            destination.pwrite(buffer.data(), read, destination_offset + total);
+            total += read;
+            if (read < buffer.size()) {
+                break;
+            }
+        }
+        return total;
+    }
+
+    auto FileDescriptor::duplicate() const -> FileDescriptor {
+#ifdef OS_WINDOWS
+        return {_dup(m_fd), m_filename};
+#else
+        return {dup(m_fd), m_filename};
+#endif
+    }
+
+    void FileDescriptor::sync() const {
+#if defined(OS_WINDOWS)
+        int ret = _commit(m_fd);
+#elif defined(OS_LINUX)
+        int ret = fdatasync(m_fd); // The metadata which is not needed to read the data back can wait
+#else
+        int ret = fsync(m_fd);
+#endif
+
+        if (ret < 0) {
+            report_error("sync");
+        }
+    }
 
     FileHandle::FileHandle(FILE *file, std::string filename)
         : FileHandleBase(std::move(filename)), m_file(file)
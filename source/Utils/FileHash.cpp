@@ -4,9 +4,9 @@
 ** Author Francois Michaut
 **
 ** Started on  Sat May  6 22:13:15 2023 Francois Michaut
-** Last update Wed Aug 20 16:40:49 2025 Francois Michaut
+** Last update Mon Oct 19 08:14:40 2026 Francois Michaut
 **
-** FileHash.cpp : Function to hash file contents
+** FileHash.cpp : Functions to hash file contents
 */
 
 #include "FileShare/Utils/DebugPerf.hpp"
@@ -20,7 +20,13 @@
 #include <openssl/md5.h>
 #include <openssl/sha.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstdio>
+#include <exception>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #ifdef OS_UNIX
@@ -33,43 +39,142 @@ constexpr auto READ_SIZE = 0x8000; // = 32_768 bytes
 namespace FileShare::Utils {
     auto file_hash(HashAlgorithm algo, const std::filesystem::path &path) -> std::string {
         DebugPerf debug("file_hash");
+        Hasher hasher(algo);
 
-        CppSockets::EVP_MD_ptr digest {EVP_MD_fetch(nullptr, algo_to_string(algo), nullptr)};
-        CppSockets::EVP_MD_CTX_ptr ctx {EVP_MD_CTX_new()};
-        std::array<unsigned char, EVP_MAX_MD_SIZE> digest_buff = {0};
-        unsigned int output_size;
+        hasher.update_file(path);
+        return hasher.digest();
+    }
+
+    auto chunk_hashes(HashAlgorithm algo, const std::filesystem::path &path, std::size_t chunk_size, std::size_t max_threads) -> std::vector<std::string> {
+        DebugPerf debug("chunk_hashes");
+
+        if (chunk_size == 0)
+            throw std::runtime_error("Chunk size cannot be 0");
+
+        std::size_t file_size = std::filesystem::file_size(path);
+        // An empty file still has one (empty) chunk
+        std::size_t nb_chunks = std::max<std::size_t>(1, (file_size / chunk_size) + (file_size % chunk_size == 0 ? 0 : 1));
+        std::vector<std::string> result(nb_chunks);
+        std::atomic<std::size_t> next_chunk = 0;
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        std::vector<std::thread> threads;
+
+        if (max_threads == 0)
+            max_threads = std::max(1U, std::thread::hardware_concurrency());
+
+        auto worker = [&]() {
+            try {
+                for (std::size_t i = next_chunk++; i < nb_chunks; i = next_chunk++) {
+                    Hasher hasher(algo);
+
+                    hasher.update_file(path, i * chunk_size, chunk_size);
+                    result[i] = hasher.digest();
+                }
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+
+                error = std::current_exception();
+                next_chunk = nb_chunks; // Stop the other threads
+            }
+        };
+
+        for (std::size_t i = 1; i < std::min(max_threads, nb_chunks); i++) {
+            threads.emplace_back(worker);
+        }
+        worker();
+        for (auto &thread : threads) {
+            thread.join();
+        }
+        if (error)
+            std::rethrow_exception(error);
+        return result;
+    }
+
+    void Hasher::ContextDeleter::operator()(EVP_MD_CTX *ctx) const {
+        EVP_MD_CTX_free(ctx);
+    }
+
+    Hasher::Hasher(HashAlgorithm algo) :
+        m_algo(algo), m_ctx(EVP_MD_CTX_new())
+    {
+        // The context keeps a reference to the digest once initialized
+        CppSockets::EVP_MD_ptr digest(EVP_MD_fetch(nullptr, algo_to_string(algo), nullptr));
+
+        if (!digest || !m_ctx)
+            throw std::runtime_error("Failed to intialize the hash context");
+        if (EVP_DigestInit_ex(m_ctx.get(), digest.get(), nullptr) <= 0)
+            throw std::runtime_error("Failed to init the digest context");
+    }
+
+    Hasher::Hasher(const Hasher &other) :
+        m_algo(other.m_algo), m_ctx(EVP_MD_CTX_new())
+    {
+        if (!m_ctx)
+            throw std::runtime_error("Failed to intialize the hash context");
+        if (EVP_MD_CTX_copy_ex(m_ctx.get(), other.m_ctx.get()) <= 0)
+            throw std::runtime_error("Failed to copy the digest context");
+        m_size = other.m_size;
+    }
+
+    auto Hasher::operator=(const Hasher &other) -> Hasher & {
+        if (this != &other) {
+            *this = Hasher(other);
+        }
+        return *this;
+    }
+
+    void Hasher::update(std::string_view data) {
+        if (EVP_DigestUpdate(m_ctx.get(), data.data(), data.size()) <= 0)
+            throw std::runtime_error("Failed to hash data");
+        m_size += data.size();
+    }
+
+    auto Hasher::update_file(const std::filesystem::path &path, std::size_t offset, std::size_t size) -> std::size_t {
         FileHandle file(path, "r");
-        std::size_t ret = READ_SIZE;
+        std::size_t total = 0;
+        std::size_t ret;
         std::vector<char> buff(READ_SIZE);
 
 #if defined(OS_UNIX) && !defined(OS_APPLE)
         posix_fadvise(file.fd(false), 0, 0, POSIX_FADV_SEQUENTIAL); // Ignoring return - this is optional
 #endif
-        if (!digest || !ctx)
-            throw std::runtime_error("Failed to intialize the hash context");
+#ifdef OS_WINDOWS
+        if (offset != 0 && _fseeki64(file, static_cast<std::int64_t>(offset), SEEK_SET) != 0)
+#else
+        if (offset != 0 && fseeko(file, static_cast<off_t>(offset), SEEK_SET) != 0)
+#endif
+            throw std::runtime_error("File seek failed");
 
-        EVP_MD_CTX_set_flags(ctx.get(), EVP_MD_CTX_FLAG_FINALISE);
-        if (EVP_DigestInit(ctx.get(), digest.get()) <= 0)
-            throw std::runtime_error("Failed to init the digest context");
+        while (total < size) {
+            std::size_t to_read = std::min<std::size_t>(READ_SIZE, size - total);
 
-        while (ret == READ_SIZE) {
 #if defined (OS_UNIX) && !defined (OS_APPLE)
-            ret = fread_unlocked(buff.data(), 1, READ_SIZE, file);
+            ret = fread_unlocked(buff.data(), 1, to_read, file);
 #else
-            ret = fread(buff.data(), 1, READ_SIZE, file);
+            ret = fread(buff.data(), 1, to_read, file);
 #endif
+            update({buff.data(), ret});
+            total += ret;
+            if (ret != to_read)
+                break; // End of file (or error, checked below)
+        }
+        if (ferror(file))
+            throw std::runtime_error("File read failed");
+        return total;
+    }
 
-            if (ret == 0)
-                break;
+    auto Hasher::digest() const -> std::string {
+        CppSockets::EVP_MD_CTX_ptr ctx {EVP_MD_CTX_new()};
+        std::array<unsigned char, EVP_MAX_MD_SIZE> digest_buff = {0};
+        unsigned int output_size;
 
-            if (ret < 0)
-                throw std::runtime_error("File read failed");
-            if (EVP_DigestUpdate(ctx.get(), buff.data(), ret) <= 0)
-                throw std::runtime_error("Failed to hash file data");
-        }
-        if (EVP_DigestFinal(ctx.get(), digest_buff.data(), &output_size) <= 0)
-            throw std::runtime_error("Failed to compute the file hash");
-        if (output_size != algo_hash_size(algo))
+        // Finalize a copy, so we can keep updating this one
+        if (!ctx || EVP_MD_CTX_copy_ex(ctx.get(), m_ctx.get()) <= 0)
+            throw std::runtime_error("Failed to copy the digest context");
+        if (EVP_DigestFinal_ex(ctx.get(), digest_buff.data(), &output_size) <= 0)
+            throw std::runtime_error("Failed to compute the hash");
+        if (output_size != algo_hash_size(m_algo))
             throw std::runtime_error("Hash size is not what was expected");
         return {reinterpret_cast<char *>(digest_buff.data()), output_size};
     }
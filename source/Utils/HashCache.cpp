@@ -0,0 +1,292 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:10:26 2026 Francois Michaut
+** Last update Mon Oct 19 08:34:58 2026 Francois Michaut
+**
+** HashCache.cpp : Cache of file hashes, to avoid hashing unchanged files again
+*/
+
+#include "FileShare/Utils/HashCache.hpp"
+
+#include <CppSockets/OSDetection.hpp>
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/string.hpp>
+#include <cereal/types/utility.hpp>
+#include <cereal/types/vector.hpp>
+
+#include <fstream>
+#include <vector>
+
+#ifdef OS_UNIX
+  #include <sys/stat.h>
+#endif
+
+static constexpr std::uint32_t HASH_CACHE_VERSION = 2;
+
+namespace FileShare::Utils {
+    HashCache::HashCache(std::size_t capacity) :
+        m_capacity(capacity)
+    {}
+
+    HashCache::~HashCache() {
+        try {
+            save();
+        } catch (std::exception &) {
+            // Losing the cache only means files will be hashed again
+        }
+    }
+
+    auto HashCache::global() -> HashCache & {
+        static HashCache cache;
+
+        return cache;
+    }
+
+    auto HashCache::file_hash(HashAlgorithm algo, const std::filesystem::path &path) -> std::string {
+        Key key = make_key(algo, path);
+        auto cached = find(key);
+
+        if (cached.has_value()) {
+            return cached.value();
+        }
+
+        std::string hash = Utils::file_hash(algo, path);
+
+        // Don't cache the result if the file was modified while we were reading it
+        if (make_key(algo, path) == key) {
+            insert(key, hash);
+        }
+        return hash;
+    }
+
+    void HashCache::store(HashAlgorithm algo, const std::filesystem::path &path, std::string hash) {
+        insert(make_key(algo, path), std::move(hash));
+    }
+
+    auto HashCache::chunk_hashes(HashAlgorithm algo, const std::filesystem::path &path, std::size_t chunk_size) -> std::vector<std::string> {
+        Key key = make_key(algo, path);
+        std::size_t hash_size = algo_hash_size(algo);
+        std::vector<std::string> hashes;
+
+        key.chunk_size = chunk_size;
+        // Cached back to back, as a single entry
+        if (auto cached = find(key); cached.has_value() && cached->size() % hash_size == 0) {
+            for (std::size_t offset = 0; offset < cached->size(); offset += hash_size) {
+                hashes.emplace_back(cached->substr(offset, hash_size));
+            }
+            return hashes;
+        }
+
+        hashes = Utils::chunk_hashes(algo, path, chunk_size);
+
+        Key after = make_key(algo, path);
+
+        after.chunk_size = chunk_size;
+        // Don't cache the result if the file was modified while we were reading it
+        if (after == key) {
+            std::string concatenated;
+
+            concatenated.reserve(hashes.size() * hash_size);
+            for (const auto &hash : hashes) {
+                concatenated += hash;
+            }
+            insert(key, std::move(concatenated));
+        }
+        return hashes;
+    }
+
+    auto HashCache::content_chunks(HashAlgorithm algo, const std::filesystem::path &path, std::size_t average_size) -> std::vector<ContentChunk> {
+        Key key = make_key(algo, path);
+        std::size_t entry_size = sizeof(std::uint64_t) + algo_hash_size(algo);
+        std::vector<ContentChunk> chunks;
+
+        key.chunk_size = average_size;
+        key.content_defined = true;
+        // Cached back to back as a single entry, each hash after the chunk size (little endian)
+        if (auto cached = find(key); cached.has_value() && cached->size() % entry_size == 0) {
+            for (std::size_t offset = 0; offset < cached->size(); offset += entry_size) {
+                std::uint64_t size = 0;
+
+                for (std::size_t i = 0; i < sizeof(size); i++) {
+                    size |= static_cast<std::uint64_t>(static_cast<std::uint8_t>((*cached)[offset + i])) << (i * 8);
+                }
+                chunks.push_back({.size=size, .hash=cached->substr(offset + sizeof(size), entry_size - sizeof(size))});
+            }
+            return chunks;
+        }
+
+        chunks = Utils::content_chunks(algo, path, average_size);
+
+        Key after = make_key(algo, path);
+
+        after.chunk_size = average_size;
+        after.content_defined = true;
+        // Don't cache the result if the file was modified while we were reading it
+        if (after == key) {
+            std::string concatenated;
+
+            concatenated.reserve(chunks.size() * entry_size);
+            for (const auto &chunk : chunks) {
+                for (std::size_t i = 0; i < sizeof(std::uint64_t); i++) {
+                    concatenated += static_cast<char>((static_cast<std::uint64_t>(chunk.size) >> (i * 8)) & 0xFFU);
+                }
+                concatenated += chunk.hash;
+            }
+            insert(key, std::move(concatenated));
+        }
+        return chunks;
+    }
+
+    auto HashCache::find(const Key &key) -> std::optional<std::string> {
+        std::lock_guard lock(m_mutex);
+        auto iter = m_index.find(key);
+
+        if (iter == m_index.end()) {
+            return std::nullopt;
+        }
+        m_entries.splice(m_entries.begin(), m_entries, iter->second);
+        return iter->second->second;
+    }
+
+    void HashCache::insert(const Key &key, std::string hash) {
+        std::lock_guard lock(m_mutex);
+        auto iter = m_index.find(key);
+
+        m_dirty = true;
+        if (iter != m_index.end()) {
+            iter->second->second = std::move(hash);
+            m_entries.splice(m_entries.begin(), m_entries, iter->second);
+            return;
+        }
+        m_entries.emplace_front(key, std::move(hash));
+        m_index.emplace(key, m_entries.begin());
+        evict();
+    }
+
+    void HashCache::clear() {
+        std::lock_guard lock(m_mutex);
+
+        m_dirty = m_dirty || !m_entries.empty();
+        m_index.clear();
+        m_entries.clear();
+    }
+
+    auto HashCache::make_key(HashAlgorithm algo, const std::filesystem::path &path) -> Key {
+#ifdef OS_UNIX
+        struct stat info = {};
+
+        if (::stat(path.c_str(), &info) != 0) {
+            throw std::runtime_error("Failed to stat '" + path.string() + "'");
+        }
+  #ifdef OS_APPLE
+        std::int64_t mtime_ns = (static_cast<std::int64_t>(info.st_mtimespec.tv_sec) * 1'000'000'000) + info.st_mtimespec.tv_nsec;
+  #else
+        std::int64_t mtime_ns = (static_cast<std::int64_t>(info.st_mtim.tv_sec) * 1'000'000'000) + info.st_mtim.tv_nsec;
+  #endif
+
+        return {
+            .device=static_cast<std::uint64_t>(info.st_dev), .inode=static_cast<std::uint64_t>(info.st_ino),
+            .size=static_cast<std::uint64_t>(info.st_size), .mtime_ns=mtime_ns, .algo=algo
+        };
+#else
+        // No inode number available: identify the file by its absolute path instead
+        auto mtime = std::filesystem::last_write_time(path).time_since_epoch();
+
+        return {
+            .device=0, .inode=std::hash<std::string>()(std::filesystem::absolute(path).string()),
+            .size=std::filesystem::file_size(path),
+            .mtime_ns=std::chrono::duration_cast<std::chrono::nanoseconds>(mtime).count(), .algo=algo
+        };
+#endif
+    }
+
+    void HashCache::set_persistent_file(std::filesystem::path path) {
+        std::lock_guard lock(m_mutex);
+
+        m_persistent_file = std::move(path);
+        if (m_persistent_file.empty() || !std::filesystem::exists(m_persistent_file)) {
+            return;
+        }
+
+        std::ifstream file(m_persistent_file, std::ios_base::binary | std::ios_base::in);
+        std::vector<Entry> entries;
+        std::uint32_t version = 0;
+
+        try {
+            cereal::BinaryInputArchive archive(file);
+
+            archive(version);
+            if (version != HASH_CACHE_VERSION) {
+                return; // Unknown format, start with an empty cache
+            }
+            archive(entries);
+        } catch (std::exception &) {
+            return; // Corrupted cache, start with an empty cache
+        }
+        // Saved most recent first: insert them in reverse to keep the same order
+        for (auto iter = entries.rbegin(); iter != entries.rend(); iter++) {
+            if (m_index.contains(iter->first)) {
+                continue;
+            }
+            m_entries.emplace_front(std::move(*iter));
+            m_index.emplace(m_entries.front().first, m_entries.begin());
+        }
+        evict();
+    }
+
+    void HashCache::save() {
+        std::lock_guard lock(m_mutex);
+
+        if (m_persistent_file.empty() || !m_dirty) {
+            return;
+        }
+
+        std::vector<Entry> entries(m_entries.begin(), m_entries.end());
+        if (m_persistent_file.has_parent_path()) {
+            std::filesystem::create_directories(m_persistent_file.parent_path());
+        }
+        std::filesystem::path tmp_file = m_persistent_file.string() + ".tmp";
+        std::ofstream file(tmp_file, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+        cereal::BinaryOutputArchive archive(file);
+
+        archive(HASH_CACHE_VERSION, entries);
+        file.close();
+
+        std::filesystem::rename(tmp_file, m_persistent_file);
+        m_dirty = false;
+    }
+
+    auto HashCache::size() const -> std::size_t {
+        std::lock_guard lock(m_mutex);
+
+        return m_entries.size();
+    }
+
+    void HashCache::set_capacity(std::size_t capacity) {
+        std::lock_guard lock(m_mutex);
+
+        m_capacity = capacity;
+        evict();
+    }
+
+    void HashCache::evict() {
+        while (m_entries.size() > m_capacity) {
+            m_index.erase(m_entries.back().first);
+            m_entries.pop_back();
+        }
+    }
+
+    auto HashCache::KeyHash::operator()(const Key &key) const noexcept -> std::size_t {
+        std::size_t result = std::hash<std::uint64_t>()(key.inode);
+
+        // boost::hash_combine
+        for (std::size_t value : {key.device, key.size, static_cast<std::uint64_t>(key.mtime_ns), static_cast<std::uint64_t>(key.algo), key.chunk_size, static_cast<std::uint64_t>(key.content_defined)}) {
+            result ^= value + 0x9e3779b9 + (result << 6) + (result >> 2);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,71 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:50:14 2026 Francois Michaut
+** Last update Mon Oct 19 01:50:14 2026 Francois Michaut
+**
+** IntervalSet.cpp : Set of integers stored as ranges, to track packets efficiently
+*/
+
+#include "FileShare/Utils/IntervalSet.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+namespace FileShare::Utils {
+    void IntervalSet::insert(std::size_t begin, std::size_t end) {
+        if (begin >= end) {
+            return;
+        }
+
+        auto iter = m_intervals.upper_bound(begin);
+
+        // The previous range might overlap or touch the new one
+        if (iter != m_intervals.begin() && std::prev(iter)->second >= begin) {
+            iter--;
+        }
+        // Merge every range overlapping or touching [begin, end)
+        while (iter != m_intervals.end() && iter->first <= end) {
+            begin = std::min(begin, iter->first);
+            end = std::max(end, iter->second);
+            m_count -= iter->second - iter->first;
+            iter = m_intervals.erase(iter);
+        }
+        m_intervals.emplace_hint(iter, begin, end);
+        m_count += end - begin;
+    }
+
+    auto IntervalSet::erase(std::size_t value) -> bool {
+        auto iter = m_intervals.upper_bound(value);
+
+        if (iter == m_intervals.begin() || std::prev(iter)->second <= value) {
+            return false;
+        }
+        iter--;
+
+        auto [begin, end] = *iter;
+
+        iter = m_intervals.erase(iter);
+        if (value + 1 < end) {
+            iter = m_intervals.emplace_hint(iter, value + 1, end);
+        }
+        if (begin < value) {
+            m_intervals.emplace_hint(iter, begin, value);
+        }
+        m_count--;
+        return true;
+    }
+
+    void IntervalSet::clear() {
+        m_intervals.clear();
+        m_count = 0;
+    }
+
+    auto IntervalSet::contains(std::size_t value) const -> bool {
+        auto iter = m_intervals.upper_bound(value);
+
+        return iter != m_intervals.begin() && std::prev(iter)->second > value;
+    }
+}
@@ -0,0 +1,111 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:14:34 2026 Francois Michaut
+** Last update Mon Oct 19 08:48:54 2026 Francois Michaut
+**
+** ReadAhead.cpp : Read the next blocks of a file in parallel, ahead of their use
+*/
+
+#include "FileShare/Utils/ReadAhead.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace FileShare::Utils {
+    ReadAhead::ReadAhead(
+        ReadFunction read, std::shared_ptr<BufferPool> buffer_pool, std::size_t block_size,
+        std::size_t first_offset, std::size_t block_count, std::size_t depth, std::size_t threads
+    ) :
+        m_read(std::move(read)), m_buffer_pool(std::move(buffer_pool)), m_block_size(block_size),
+        m_first_offset(first_offset), m_block_count(block_count), m_slots(std::max<std::size_t>(depth, 1))
+    {
+        // No point in having more threads than blocks to read at once
+        threads = std::clamp<std::size_t>(threads, 1, m_slots.size());
+        m_threads.reserve(threads);
+        for (std::size_t i = 0; i < threads; i++) {
+            m_threads.emplace_back(&ReadAhead::read_blocks, this);
+        }
+    }
+
+    ReadAhead::~ReadAhead() {
+        {
+            std::lock_guard lock(m_mutex);
+
+            m_stop = true;
+        }
+        m_room_available.notify_all();
+        for (auto &thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    void ReadAhead::read_blocks() {
+        std::unique_lock lock(m_mutex);
+
+        while (true) {
+            m_room_available.wait(lock, [this]() {
+                return m_stop || m_next_read >= m_block_count || m_next_read < m_next_block + m_slots.size();
+            });
+            if (m_stop || m_next_read >= m_block_count) {
+                return;
+            }
+
+            std::size_t block = m_next_read++;
+            Slot result;
+
+            lock.unlock();
+            try {
+                result.data = m_buffer_pool->acquire(m_block_size);
+                result.data.resize(m_read(result.data.data(), m_block_size, m_first_offset + (block * m_block_size)));
+            } catch (...) {
+                result.error = std::current_exception();
+            }
+            result.ready = true;
+            lock.lock();
+
+            // The slot is free: the block using it before this one was already returned by next()
+            m_slots[block % m_slots.size()] = std::move(result);
+            m_blocks_read++;
+            if (block == m_next_block) {
+                m_block_ready.notify_one();
+            }
+        }
+    }
+
+    auto ReadAhead::next() -> std::string {
+        std::unique_lock lock(m_mutex);
+
+        if (m_next_block >= m_block_count)
+            throw std::runtime_error("No more blocks to read");
+
+        Slot &slot = m_slots[m_next_block % m_slots.size()];
+
+        if (!slot.ready) {
+            m_stalls++;
+            m_block_ready.wait(lock, [&slot]() { return slot.ready; });
+        }
+
+        Slot result = std::move(slot);
+
+        slot = Slot{};
+        m_next_block++;
+        lock.unlock();
+        m_room_available.notify_one();
+        if (result.error) {
+            std::rethrow_exception(result.error);
+        }
+        return std::move(result.data);
+    }
+
+    auto ReadAhead::get_stats() const -> ReadAheadStats {
+        std::lock_guard lock(m_mutex);
+
+        return {
+            .depth=m_slots.size(), .threads=m_threads.size(), .queued=m_blocks_read - m_next_block,
+            .blocks_read=m_blocks_read, .stalls=m_stalls
+        };
+    }
+}
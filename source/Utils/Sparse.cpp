@@ -0,0 +1,101 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:00:20 2026 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
+**
+** Sparse.cpp : Holes of sparse files, which are not sent
+*/
+
+#include "FileShare/Utils/Sparse.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#ifndef OS_WINDOWS
+  #include <unistd.h>
+#endif
+
+namespace FileShare::Utils {
+    auto find_holes([[maybe_unused]] const FileDescriptor &file, [[maybe_unused]] std::size_t file_size) -> std::vector<FileRange> {
+        std::vector<FileRange> holes;
+
+#ifdef SEEK_HOLE
+        std::size_t offset = 0;
+
+        while (offset < file_size && holes.size() < MAX_HOLES) {
+            off_t hole = lseek(file, static_cast<off_t>(offset), SEEK_HOLE);
+
+            if (hole < 0 || static_cast<std::size_t>(hole) >= file_size) {
+                break; // Not supported, or no hole before the end of the file
+            }
+
+            off_t data = lseek(file, hole, SEEK_DATA);
+            std::size_t end = file_size;
+
+            if (data >= 0) {
+                end = std::min(static_cast<std::size_t>(data), file_size);
+            } else if (errno != ENXIO) {
+                break; // ENXIO means the file ends with this hole
+            }
+            if (end - hole >= MIN_HOLE_SIZE) {
+                holes.emplace_back(FileRange{.offset=static_cast<std::size_t>(hole), .size=end - hole});
+            }
+            offset = end;
+        }
+#endif
+        return holes;
+    }
+
+    auto data_extents(const std::vector<FileRange> &holes, std::size_t file_size) -> std::vector<Extent> {
+        std::vector<Extent> extents;
+        std::size_t file_offset = 0;
+        std::size_t offset = 0;
+
+        extents.reserve(holes.size() + 1);
+        for (const auto &hole : holes) {
+            if (hole.offset > file_offset) {
+                extents.emplace_back(Extent{.offset=offset, .file_offset=file_offset, .size=hole.offset - file_offset});
+                offset += hole.offset - file_offset;
+            }
+            file_offset = hole.offset + hole.size;
+        }
+        if (file_size > file_offset) {
+            extents.emplace_back(Extent{.offset=offset, .file_offset=file_offset, .size=file_size - file_offset});
+        }
+        return extents;
+    }
+
+    auto extents_size(const std::vector<Extent> &extents) -> std::size_t {
+        return extents.empty() ? 0 : extents.back().offset + extents.back().size;
+    }
+
+    auto read_extents(const IByteSource &source, const std::vector<Extent> &extents, char *buffer, std::size_t size, std::size_t offset) -> std::size_t {
+        if (extents.empty()) {
+            return source.read(buffer, size, offset);
+        }
+
+        auto extent = std::ranges::upper_bound(extents, offset, {}, &Extent::offset);
+        std::size_t total = 0;
+
+        // Extents are contiguous in the data sent, a packet continues in the next one
+        for (extent--; total < size && extent != extents.end(); extent++) {
+            std::size_t start = offset + total - extent->offset;
+
+            if (start >= extent->size) {
+                break; // Past the end of the data
+            }
+
+            std::size_t to_read = std::min(size - total, extent->size - start);
+            std::size_t read = source.read(buffer + total, to_read, extent->file_offset + start);
+
+            total += read;
+            if (read < to_read) {
+                break; // The data got shorter
+            }
+        }
+        return total;
+    }
+}
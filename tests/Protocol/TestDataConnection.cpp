@@ -0,0 +1,55 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 06:17:01 2026 Francois Michaut
+** Last update Mon Oct 19 08:31:51 2026 Francois Michaut
+**
+** TestDataConnection.cpp : DATA_CONNECTION wire format tests
+*/
+
+#include "FileShare/Protocol/Handler/v0.0.0/ProtocolHandler.hpp"
+
+#include <cassert>
+
+using namespace FileShare;
+
+// A connection is only made a data connection by its first request: it must be told apart from
+// the requests which may follow it in the same read, and from a request not fully received yet
+static void test_first_request() {
+    Protocol::Handler::v0_0_0::ProtocolHandler protocol;
+    std::string data_connection = protocol.format_request(Protocol::Request{
+        .code=Protocol::CommandCode::DATA_CONNECTION, .request=std::make_shared<Protocol::DataConnectionData>(), .message_id=0
+    });
+    std::string next = protocol.format_request(Protocol::Request{
+        .code=Protocol::CommandCode::PING, .request=std::make_shared<Protocol::PingData>(), .message_id=1
+    });
+    std::string raw = data_connection + next;
+    Protocol::Request parsed;
+
+    assert(protocol.parse_request(raw, parsed) == data_connection.size());
+    assert(parsed.code == Protocol::CommandCode::DATA_CONNECTION && parsed.message_id == 0);
+    assert(protocol.parse_request(std::string_view(raw).substr(data_connection.size()), parsed) == next.size());
+    assert(parsed.code == Protocol::CommandCode::PING && parsed.message_id == 1);
+
+    for (std::size_t size = 0; size < data_connection.size(); size++) {
+        assert(protocol.parse_request(std::string_view(data_connection).substr(0, size), parsed) == 0);
+    }
+}
+
+static void test_reply() {
+    Protocol::Handler::v0_0_0::ProtocolHandler protocol;
+    std::string raw = protocol.format_response(3, Protocol::ResponseData(Protocol::StatusCode::BAD_REQUEST));
+    Protocol::Request parsed;
+
+    assert(protocol.parse_request(raw, parsed) == raw.size());
+    assert(parsed.code == Protocol::CommandCode::RESPONSE && parsed.message_id == 3);
+    assert(std::dynamic_pointer_cast<Protocol::ResponseData>(parsed.request)->status == Protocol::StatusCode::BAD_REQUEST);
+}
+
+int Protocol_TestDataConnection(int /* ac */, char ** const /* av */) {
+    test_first_request();
+    test_reply();
+    return 0;
+}
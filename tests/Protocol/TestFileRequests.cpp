@@ -0,0 +1,223 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 06:10:46 2026 Francois Michaut
+** Last update Mon Oct 19 09:10:48 2026 Francois Michaut
+**
+** TestFileRequests.cpp : SEND_FILE and RECEIVE_FILE wire format tests
+*/
+
+#include "FileShare/Protocol/Handler/v0.0.0/ProtocolHandler.hpp"
+#include "FileShare/Protocol/Handler/v0.1.0/ProtocolHandler.hpp"
+
+#include <cassert>
+#include <stdexcept>
+
+using namespace FileShare;
+
+static auto round_trip(Protocol::CommandCode code, const std::shared_ptr<Protocol::IRequestData> &data) -> Protocol::Request {
+    Protocol::Handler::v0_1_0::ProtocolHandler protocol;
+    std::string raw = protocol.format_request(Protocol::Request{.code=code, .request=data, .message_id=1});
+    Protocol::Request parsed;
+
+    assert(protocol.parse_request(raw, parsed) == raw.size());
+    assert(parsed.code == code && parsed.message_id == 1);
+    return parsed;
+}
+
+static auto round_trip(const Protocol::ReceiveFileData &data) -> std::shared_ptr<Protocol::ReceiveFileData> {
+    auto parsed = round_trip(Protocol::CommandCode::RECEIVE_FILE, std::make_shared<Protocol::ReceiveFileData>(data)).request;
+
+    return std::dynamic_pointer_cast<Protocol::ReceiveFileData>(parsed);
+}
+
+static void test_receive_file_compression() {
+    Protocol::ReceiveFileData data("//fsp/file", 0x1000, 3);
+    auto parsed = round_trip(data);
+
+    assert(parsed->filepath == "//fsp/file" && parsed->packet_size == 0x1000 && parsed->packet_start == 3);
+    assert(parsed->compression == Utils::CompressionAlgorithm::NONE);
+    assert(!parsed->range.has_value() && parsed->signature.block_size == 0);
+
+    data.compression = Utils::CompressionAlgorithm::ZSTD;
+    parsed = round_trip(data);
+    assert(parsed->compression == Utils::CompressionAlgorithm::ZSTD);
+    assert(!parsed->range.has_value() && parsed->signature.block_size == 0 && parsed->packet_start == 3);
+
+    data.range = Utils::FileRange{.offset=0x100, .size=0x2000};
+    parsed = round_trip(data);
+    assert(parsed->compression == Utils::CompressionAlgorithm::ZSTD);
+    assert(parsed->range.has_value() && parsed->range->offset == 0x100 && parsed->range->size == 0x2000);
+}
+
+static void test_receive_file_range() {
+    Protocol::ReceiveFileData data("//fsp/file", 0x1000, 0);
+
+    data.range = Utils::FileRange{.offset=0x12345, .size=0x6789};
+
+    auto parsed = round_trip(data);
+
+    assert(parsed->range.has_value() && parsed->range->offset == 0x12345 && parsed->range->size == 0x6789);
+    assert(parsed->signature.block_size == 0 && parsed->compression == Utils::CompressionAlgorithm::NONE);
+
+    // With a signature too, the range comes after its blocks
+    data.signature.block_size = 0x800;
+    data.signature.hash_algorithm = Utils::HashAlgorithm::SHA256;
+    data.signature.blocks = {{.weak=0x01020304, .strong=std::string(32, 's')}};
+    parsed = round_trip(data);
+    assert(parsed->signature.block_size == 0x800 && parsed->signature.blocks.size() == 1);
+    assert(parsed->signature.blocks[0].weak == 0x01020304 && parsed->signature.blocks[0].strong == std::string(32, 's'));
+    assert(parsed->range.has_value() && parsed->range->offset == 0x12345 && parsed->range->size == 0x6789);
+}
+
+static void test_receive_file_no_signature() {
+    Protocol::Handler::v0_1_0::ProtocolHandler protocol;
+    auto data = std::make_shared<Protocol::ReceiveFileData>("f", 0x10, 0);
+
+    data->range = Utils::FileRange{.offset=5, .size=7};
+
+    std::string raw = protocol.format_request(Protocol::Request{.code=Protocol::CommandCode::RECEIVE_FILE, .request=data, .message_id=1});
+    // FILEPATH_SIZE, FILEPATH, PACKET_SIZE, PACKET_START, FIELDS with only the range, RANGE_OFFSET, RANGE_SIZE
+    std::string payload("\x01" "f" "\x10" "\x00" "\x04" "\x05" "\x07", 7);
+
+    assert(raw.ends_with(std::string(1, static_cast<char>(payload.size())) + payload));
+
+    Protocol::Request parsed;
+
+    assert(protocol.parse_request(raw, parsed) == raw.size());
+
+    auto parsed_data = std::dynamic_pointer_cast<Protocol::ReceiveFileData>(parsed.request);
+
+    assert(parsed_data->signature.block_size == 0 && parsed_data->signature.blocks.empty());
+    assert(parsed_data->range.has_value() && parsed_data->range->offset == 5 && parsed_data->range->size == 7);
+}
+
+static void test_send_file_compression() {
+    auto data = std::make_shared<Protocol::SendFileData>("//fsp/file", Utils::HashAlgorithm::SHA512, std::string(64, 'h'), std::filesystem::file_time_type(), 0x1000, 4);
+
+    data->compression = Utils::CompressionAlgorithm::ZSTD;
+
+    auto parsed = std::dynamic_pointer_cast<Protocol::SendFileData>(round_trip(Protocol::CommandCode::SEND_FILE, data).request);
+
+    assert(parsed->compression == Utils::CompressionAlgorithm::ZSTD);
+    assert(parsed->total_packets == 4 && parsed->delta_block_size == 0 && parsed->chunk_size == 0);
+}
+
+static auto round_trip(const std::shared_ptr<Protocol::SendFileData> &data) -> std::shared_ptr<Protocol::SendFileData> {
+    return std::dynamic_pointer_cast<Protocol::SendFileData>(round_trip(Protocol::CommandCode::SEND_FILE, data).request);
+}
+
+static void test_send_file_inline() {
+    auto data = std::make_shared<Protocol::SendFileData>("//fsp/file", Utils::HashAlgorithm::SHA512, std::string(64, 'h'), std::filesystem::file_time_type(), 0x1000, 0);
+
+    data->inline_content = "inline content";
+
+    auto parsed = round_trip(data);
+
+    assert(parsed->inline_content == "inline content" && parsed->total_packets == 0);
+
+    // An empty file is still sent inline
+    data->inline_content = "";
+    parsed = round_trip(data);
+    assert(parsed->inline_content.has_value() && parsed->inline_content->empty());
+
+    data->inline_content.reset();
+    data->total_packets = 2;
+    data->range = Utils::FileRange{.offset=0x10, .size=0x2000};
+    parsed = round_trip(data);
+    assert(!parsed->inline_content.has_value() && parsed->total_packets == 2);
+
+    data->inline_content = "inline content";
+    try {
+        round_trip(data);
+        assert(false);
+    } catch (std::runtime_error &) {} // Inline content can't be sent with packets
+}
+
+static void test_send_file_range() {
+    auto data = std::make_shared<Protocol::SendFileData>("//fsp/file", Utils::HashAlgorithm::SHA512, std::string(64, 'h'), std::filesystem::file_time_type(), 0x1000, 3);
+
+    data->range = Utils::FileRange{.offset=0x12345, .size=0x2800};
+
+    auto parsed = round_trip(data);
+
+    assert(parsed->range.has_value() && parsed->range->offset == 0x12345 && parsed->range->size == 0x2800);
+    assert(parsed->total_packets == 3 && parsed->holes.empty() && !parsed->inline_content.has_value());
+
+    data->range.reset();
+    parsed = round_trip(data);
+    assert(!parsed->range.has_value() && parsed->total_packets == 3);
+}
+
+static void test_send_file_holes() {
+    auto data = std::make_shared<Protocol::SendFileData>("//fsp/file", Utils::HashAlgorithm::SHA512, std::string(64, 'h'), std::filesystem::file_time_type(), 0x1000, 1);
+
+    data->file_size = 0x3000;
+    data->holes = {{.offset=0, .size=0x1000}, {.offset=0x2000, .size=0x1000}};
+
+    auto parsed = round_trip(data);
+
+    assert(parsed->file_size == 0x3000 && parsed->holes.size() == 2 && parsed->holes[1].offset == 0x2000);
+    assert(!parsed->inline_content.has_value() && parsed->total_packets == 1);
+
+    // A single hole: no packets, but no inline content either
+    data->holes = {{.offset=0, .size=0x3000}};
+    data->total_packets = 0;
+    parsed = round_trip(data);
+    assert(parsed->holes.size() == 1 && parsed->total_packets == 0 && !parsed->inline_content.has_value());
+
+    data->inline_content = "";
+    try {
+        round_trip(data);
+        assert(false);
+    } catch (std::runtime_error &) {} // Inline content can't be sent with holes
+}
+
+static void test_versions() {
+    Protocol::Handler::v0_0_0::ProtocolHandler v0_0_0;
+    Protocol::Handler::v0_1_0::ProtocolHandler v0_1_0;
+    auto send_file = std::make_shared<Protocol::SendFileData>("//fsp/file", Utils::HashAlgorithm::SHA512, std::string(64, 'h'), std::filesystem::file_time_type(), 0x1000, 4);
+    auto receive_file = std::make_shared<Protocol::ReceiveFileData>("//fsp/file", 0x1000, 2);
+    Protocol::Request send_request{.code=Protocol::CommandCode::SEND_FILE, .request=send_file, .message_id=1};
+    Protocol::Request receive_request{.code=Protocol::CommandCode::RECEIVE_FILE, .request=receive_file, .message_id=2};
+
+    // Without optional fields, both versions send the same thing
+    assert(v0_0_0.format_request(send_request) == v0_1_0.format_request(send_request));
+    assert(v0_0_0.format_request(receive_request) == v0_1_0.format_request(receive_request));
+
+    // v0.0.0 can't send them
+    send_file->compression = Utils::CompressionAlgorithm::ZSTD;
+    receive_file->range = Utils::FileRange{.offset=0, .size=0x10};
+    try {
+        v0_0_0.format_request(send_request);
+        assert(false);
+    } catch (std::runtime_error &) {}
+    try {
+        v0_0_0.format_request(receive_request);
+        assert(false);
+    } catch (std::runtime_error &) {}
+
+    // Fields we don't know can't be skipped
+    std::string raw = v0_1_0.format_request(receive_request);
+    Protocol::Request parsed;
+
+    raw[raw.size() - 3] = static_cast<char>(Protocol::Handler::v0_1_0::RECEIVE_FILE_RANGE | 0x80);
+    try {
+        v0_1_0.parse_request(raw, parsed);
+        assert(false);
+    } catch (std::runtime_error &) {}
+}
+
+int Protocol_TestFileRequests(int /* ac */, char ** const /* av */) {
+    test_receive_file_compression();
+    test_receive_file_range();
+    test_receive_file_no_signature();
+    test_send_file_compression();
+    test_send_file_inline();
+    test_send_file_range();
+    test_send_file_holes();
+    test_versions();
+    return 0;
+}
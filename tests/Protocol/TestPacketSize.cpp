@@ -0,0 +1,70 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 05:24:54 2026 Francois Michaut
+** Last update Mon Oct 19 05:24:54 2026 Francois Michaut
+**
+** TestPacketSize.cpp : Packet size bounds and negotiation tests
+*/
+
+#include "FileShare/Config/Config.hpp"
+#include "FileShare/Protocol/Definitions.hpp"
+
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+
+using namespace FileShare::Protocol;
+
+static void test_bounds() {
+    assert(is_valid_packet_size(MIN_PACKET_SIZE));
+    assert(is_valid_packet_size(MAX_PACKET_SIZE));
+    assert(is_valid_packet_size(DEFAULT_PACKET_SIZE));
+    assert(!is_valid_packet_size(0));
+    assert(!is_valid_packet_size(MIN_PACKET_SIZE - 1));
+    assert(!is_valid_packet_size(MAX_PACKET_SIZE + 1));
+}
+
+static void test_negotiation() {
+    // 0 lets the receiver choose
+    assert(negotiate_packet_size(0) == DEFAULT_PACKET_SIZE);
+    assert(negotiate_packet_size(0, MIN_PACKET_SIZE) == MIN_PACKET_SIZE);
+    // A valid request is kept, whatever the preference
+    assert(negotiate_packet_size(MAX_PACKET_SIZE, MIN_PACKET_SIZE) == MAX_PACKET_SIZE);
+    assert(negotiate_packet_size(0x8000) == 0x8000);
+    // Out of bounds requests and preferences are clamped
+    assert(negotiate_packet_size(1) == MIN_PACKET_SIZE);
+    assert(negotiate_packet_size(MAX_PACKET_SIZE * 4) == MAX_PACKET_SIZE);
+    assert(negotiate_packet_size(0, MAX_PACKET_SIZE * 4) == MAX_PACKET_SIZE);
+}
+
+static void test_config() {
+    FileShare::Config config;
+
+    assert(config.get_packet_size() == DEFAULT_PACKET_SIZE);
+    config.set_packet_size(MIN_PACKET_SIZE);
+    assert(config.get_packet_size() == MIN_PACKET_SIZE);
+    for (std::size_t size : {std::size_t(0), MIN_PACKET_SIZE - 1, MAX_PACKET_SIZE + 1}) {
+        bool thrown = false;
+
+        try {
+            config.set_packet_size(size);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+        assert(config.get_packet_size() == MIN_PACKET_SIZE);
+    }
+}
+
+int Protocol_TestPacketSize(int /* ac */, char ** const /* av */) {
+    std::cout << "Packet size bounds" << std::endl;
+    test_bounds();
+    std::cout << "Packet size negotiation" << std::endl;
+    test_negotiation();
+    std::cout << "Config packet size" << std::endl;
+    test_config();
+    return 0;
+}
@@ -0,0 +1,196 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 04:25:44 2026 Francois Michaut
+** Last update Mon Oct 19 09:19:12 2026 Francois Michaut
+**
+** TestFileList.cpp : Listing of a folder in FILE_LIST packets tests
+*/
+
+#include "FileShare/Protocol/Handler/v0.0.0/ProtocolHandler.hpp"
+#include "FileShare/TransferHandler.hpp"
+#include "FileShare/Utils/HashCache.hpp"
+#include "FileShare/Utils/Time.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <fstream>
+#include <set>
+
+using namespace FileShare;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("file_list");
+// MAGIC_BYTES, COMMAND_CODE, MESSAGE_ID and PAYLOAD_SIZE
+static constexpr std::size_t MAX_HEADER_SIZE = 10;
+
+static auto list(
+    FileMapping &mapping, const std::string &path, std::size_t packet_size, std::size_t &packet_count,
+    std::uint8_t fields = 0, std::size_t max_depth = 0
+) -> std::vector<Protocol::FileInfo> {
+    Protocol::Handler::v0_0_0::ProtocolHandler protocol;
+    // Moved, like the handlers kept by the peers
+    ListFilesTransferHandler handler = ListFilesTransferHandler(path, mapping, packet_size, fields, max_depth);
+    FileListTransferHandler receiver;
+
+    packet_count = 0;
+    while (auto packet = handler.get_next_packet(1)) {
+        std::string raw = protocol.format_request(Protocol::Request{.code=Protocol::CommandCode::FILE_LIST, .request=packet, .message_id=0});
+        Protocol::Request parsed;
+
+        // Only a single entry bigger than the packet size can make it go over
+        assert(raw.size() <= packet_size + MAX_HEADER_SIZE || packet->files.size() == 1);
+        assert(protocol.parse_request(raw, parsed) == raw.size());
+        receiver.receive_packet(*std::dynamic_pointer_cast<Protocol::FileListData>(parsed.request));
+        packet_count++;
+    }
+    assert(handler.finished() && receiver.finished());
+    return receiver.get_file_list();
+}
+
+static void test_host_folder() {
+    std::filesystem::create_directories(test_dir / "folder" / "sub_folder");
+    for (int i = 0; i < 1000; i++) {
+        std::ofstream(test_dir / "folder" / ("file_with_a_rather_long_name_" + std::to_string(i)));
+    }
+
+    FileMapping mapping{RootPathNode({PathNode::make_host_node("folder", PathNode::HOST_FOLDER, test_dir / "folder", PathNode::VISIBLE)})};
+    std::size_t packet_count = 0;
+    auto files = list(mapping, "//fsp/folder", Protocol::MIN_PACKET_SIZE, packet_count);
+    std::set<std::string> paths;
+
+    for (const auto &file : files) {
+        paths.insert(file.path);
+        assert((file.file_type == Protocol::FileType::DIRECTORY) == file.path.ends_with("sub_folder"));
+    }
+    assert(files.size() == 1001 && paths.size() == 1001);
+    assert(paths.contains("//fsp/folder/file_with_a_rather_long_name_999"));
+    // Packets are filled: about 50 bytes per entry, plus the final empty packet
+    assert(packet_count <= (1001 * 50 / Protocol::MIN_PACKET_SIZE) + 2);
+    // Bigger packets hold more entries
+    assert(list(mapping, "//fsp/folder", Protocol::MAX_PACKET_SIZE, packet_count).size() == 1001);
+    assert(packet_count == 2);
+    std::filesystem::remove_all(test_dir);
+}
+
+static void test_virtual_folder() {
+    std::vector<PathNode> nodes;
+
+    for (int i = 0; i < 300; i++) {
+        nodes.emplace_back(PathNode::make_virtual_node(std::string(100, 'a') + std::to_string(i), PathNode::VISIBLE));
+    }
+
+    FileMapping mapping{RootPathNode(nodes)};
+    std::size_t packet_count = 0;
+    auto files = list(mapping, "//fsp", Protocol::MIN_PACKET_SIZE, packet_count);
+
+    assert(files.size() == 300);
+    assert(packet_count > 2);
+    // Entries bigger than the packet are still sent, one per packet
+    assert(list(mapping, "//fsp", 16, packet_count).size() == 300);
+    assert(packet_count == 301);
+}
+
+static void test_fields() {
+    Protocol::Handler::v0_0_0::ProtocolHandler protocol;
+    Protocol::Request parsed;
+    std::string raw = protocol.format_list_files(1, Protocol::ListFilesData("//fsp/folder", Protocol::FILE_INFO_SIZE | Protocol::FILE_INFO_HASH));
+
+    assert(protocol.parse_request(raw, parsed) == raw.size());
+    assert(std::dynamic_pointer_cast<Protocol::ListFilesData>(parsed.request)->fields == (Protocol::FILE_INFO_SIZE | Protocol::FILE_INFO_HASH));
+    raw = protocol.format_list_files(1, Protocol::ListFilesData("//fsp/folder"));
+    assert(protocol.parse_request(raw, parsed) == raw.size());
+    assert(std::dynamic_pointer_cast<Protocol::ListFilesData>(parsed.request)->fields == 0);
+
+    std::filesystem::create_directories(test_dir / "folder" / "sub_folder");
+    std::ofstream(test_dir / "folder" / "hashed") << "hashed content";
+    std::ofstream(test_dir / "folder" / "not_hashed") << "content";
+    std::filesystem::permissions(test_dir / "folder" / "not_hashed", std::filesystem::perms::owner_read);
+    Utils::HashCache::global().file_hash(Utils::HashAlgorithm::SHA512, test_dir / "folder" / "hashed");
+
+    FileMapping mapping{RootPathNode({PathNode::make_host_node("folder", PathNode::HOST_FOLDER, test_dir / "folder", PathNode::VISIBLE)})};
+    std::size_t packet_count = 0;
+
+    for (const auto &file : list(mapping, "//fsp/folder", Protocol::MIN_PACKET_SIZE, packet_count, Protocol::FILE_INFO_FIELDS)) {
+        std::filesystem::path host_path = test_dir / "folder" / std::filesystem::path(file.path).filename();
+
+        // Sent with a precision of a second
+        assert(file.last_updated.has_value() && Utils::to_epoch(file.last_updated.value()) == Utils::to_epoch(std::filesystem::last_write_time(host_path)));
+        assert(file.mode == std::filesystem::status(host_path).permissions());
+        if (file.file_type == Protocol::FileType::DIRECTORY) {
+            assert(!file.size.has_value() && !file.hash.has_value());
+        } else {
+            assert(file.size == std::filesystem::file_size(host_path));
+            // Only cached hashes are sent
+            assert(file.hash.has_value() == (host_path.filename() == "hashed"));
+        }
+        if (file.hash.has_value()) {
+            assert(file.hash == Utils::file_hash(Utils::HashAlgorithm::SHA512, host_path));
+        }
+    }
+    // Only the fields asked for are filled
+    for (const auto &file : list(mapping, "//fsp/folder", Protocol::MIN_PACKET_SIZE, packet_count, Protocol::FILE_INFO_MODE)) {
+        assert(file.mode.has_value() && !file.size.has_value() && !file.last_updated.has_value() && !file.hash.has_value());
+    }
+    std::filesystem::remove_all(test_dir);
+}
+
+static auto list_paths(FileMapping &mapping, const std::string &path, std::size_t max_depth) -> std::set<std::string> {
+    std::set<std::string> result;
+    std::size_t packet_count = 0;
+
+    for (const auto &file : list(mapping, path, Protocol::MIN_PACKET_SIZE, packet_count, 0, max_depth)) {
+        assert(result.insert(file.path + (file.file_type == Protocol::FileType::DIRECTORY ? "/" : "")).second);
+    }
+    return result;
+}
+
+static void test_recursive() {
+    Protocol::Handler::v0_0_0::ProtocolHandler protocol;
+    Protocol::Request parsed;
+    std::string raw = protocol.format_list_files(1, Protocol::ListFilesData("//fsp", 0, 3));
+
+    assert(protocol.parse_request(raw, parsed) == raw.size());
+    assert(std::dynamic_pointer_cast<Protocol::ListFilesData>(parsed.request)->max_depth == 3);
+
+    std::filesystem::create_directories(test_dir / "folder" / "a" / "b" / "c");
+    std::ofstream(test_dir / "folder" / "file");
+    std::ofstream(test_dir / "folder" / "a" / "b" / "file");
+    std::ofstream(test_dir / "folder" / "a" / "b" / "c" / "file");
+    // Not walked, or it would never end
+    std::filesystem::create_directory_symlink(test_dir / "folder", test_dir / "folder" / "a" / "loop");
+
+    FileMapping mapping{RootPathNode(std::vector<PathNode>{
+        PathNode::make_host_node("folder", PathNode::HOST_FOLDER, test_dir / "folder", PathNode::VISIBLE),
+        PathNode::make_virtual_node("virtual", PathNode::VISIBLE, std::vector<PathNode>{
+            PathNode::make_host_node("b", PathNode::HOST_FOLDER, test_dir / "folder" / "a" / "b", PathNode::VISIBLE),
+            PathNode::make_host_node("file", PathNode::HOST_FILE, test_dir / "folder" / "file", PathNode::VISIBLE),
+        }),
+    })};
+
+    assert(list_paths(mapping, "//fsp/folder", 0) == std::set<std::string>({"//fsp/folder/a/", "//fsp/folder/file"}));
+    assert(list_paths(mapping, "//fsp/folder", 1) == std::set<std::string>({
+        "//fsp/folder/a/", "//fsp/folder/file", "//fsp/folder/a/b/", "//fsp/folder/a/loop/"
+    }));
+    assert(list_paths(mapping, "//fsp/folder", 100) == std::set<std::string>({
+        "//fsp/folder/a/", "//fsp/folder/file", "//fsp/folder/a/b/", "//fsp/folder/a/loop/",
+        "//fsp/folder/a/b/c/", "//fsp/folder/a/b/file", "//fsp/folder/a/b/c/file"
+    }));
+    // Virtual folders, then the host folders in them
+    assert(list_paths(mapping, "//fsp", 2) == std::set<std::string>({
+        "//fsp/folder/", "//fsp/virtual/", "//fsp/folder/a/", "//fsp/folder/file", "//fsp/folder/a/b/", "//fsp/folder/a/loop/",
+        "//fsp/virtual/b/", "//fsp/virtual/file", "//fsp/virtual/b/c/", "//fsp/virtual/b/file"
+    }));
+    std::filesystem::remove_all(test_dir);
+}
+
+int TestFileList(int /* ac */, char ** const /* av */) {
+    test_host_folder();
+    test_virtual_folder();
+    test_fields();
+    test_recursive();
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 05:18:34 2026 Francois Michaut
+** Last update Mon Oct 19 05:18:34 2026 Francois Michaut
+**
+** TestHelpers.hpp : Files and data shared by the tests
+*/
+
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace FileShare::Tests {
+    // Each test uses its own folder, so they can run in parallel
+    inline auto test_directory(const std::string &name) -> std::filesystem::path {
+        return std::filesystem::temp_directory_path() / ("fsp_test_" + name);
+    }
+
+    // Creates the parent folders if needed
+    inline void write_file(const std::filesystem::path &path, std::string_view content) {
+        if (path.has_parent_path()) {
+            std::filesystem::create_directories(path.parent_path());
+        }
+        std::ofstream(path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc)
+            .write(content.data(), static_cast<std::streamsize>(content.size()));
+    }
+
+    inline auto read_file(const std::filesystem::path &path) -> std::string {
+        std::ifstream file(path, std::ios_base::binary | std::ios_base::in);
+
+        return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    }
+
+    // The same seed always gives the same data
+    inline auto random_bytes(std::size_t size, unsigned int seed) -> std::string {
+        std::mt19937 generator(seed);
+        std::string result(size, '\0');
+
+        for (char &c : result) {
+            c = static_cast<char>(generator());
+        }
+        return result;
+    }
+}
@@ -0,0 +1,224 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 05:03:31 2026 Francois Michaut
+** Last update Mon Oct 19 09:22:38 2026 Francois Michaut
+**
+** TestListingCache.cpp : Cache of the host folders listed tests
+*/
+
+#include "FileShare/ListingCache.hpp"
+#include "FileShare/TransferHandler.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <fstream>
+#include <set>
+
+using namespace FileShare;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("listing_cache");
+
+static auto make_reader(const std::filesystem::path &path, std::uint8_t fields, int &calls) -> ListingCache::Reader {
+    return [&path, fields, &calls]() -> std::optional<CachedListing> {
+        CachedListing listing{.fields=fields, .entries={}};
+
+        calls++;
+        for (const auto &entry : std::filesystem::directory_iterator(path)) {
+            listing.entries.emplace_back(CachedListing::Entry{
+                .info=Protocol::FileInfo{.path=entry.path().filename().string(), .file_type=Protocol::FileType::FILE}, .is_symlink=false
+            });
+        }
+        return listing;
+    };
+}
+
+static void test_invalidation() {
+    ListingCache cache;
+    std::filesystem::path folder = test_dir / "folder";
+    int calls = 0;
+    auto reader = make_reader(folder, Protocol::FILE_INFO_SIZE, calls);
+
+    std::filesystem::create_directories(folder);
+    std::ofstream(folder / "file");
+    if (!cache.is_enabled()) {
+        // Nothing is kept, each listing is read again
+        assert(cache.get(folder, 0, reader) && cache.get(folder, 0, reader) && calls == 2);
+        std::filesystem::remove_all(test_dir);
+        return;
+    }
+
+    auto listing = cache.get(folder, 0, reader);
+
+    assert(listing && listing->entries.size() == 1 && calls == 1);
+    assert(cache.get(folder, Protocol::FILE_INFO_SIZE, reader) == listing && calls == 1);
+    // Created
+    std::ofstream(folder / "other");
+    listing = cache.get(folder, 0, reader);
+    assert(listing->entries.size() == 2 && calls == 2);
+    assert(cache.get(folder, 0, reader) == listing && calls == 2);
+    // Modified
+    std::ofstream(folder / "other", std::ios_base::app) << "content";
+    assert(cache.get(folder, 0, reader) != listing && calls == 3);
+    // Removed
+    std::filesystem::remove(folder / "other");
+    listing = cache.get(folder, 0, reader);
+    assert(listing->entries.size() == 1 && calls == 4);
+    // Missing fields are read again
+    assert(cache.get(folder, Protocol::FILE_INFO_MODE, reader) != listing && calls == 5);
+    cache.invalidate(folder);
+    assert(cache.size() == 0);
+    cache.get(folder, 0, reader);
+    assert(calls == 6 && cache.size() == 1);
+    // Not cached when the reader fails, only remembered as too big
+    assert(cache.get(test_dir, 0, []() { return std::nullopt; }) == nullptr);
+    assert(cache.size() == 2 && !cache.start_read(test_dir).has_value());
+    std::filesystem::remove_all(test_dir);
+}
+
+static void test_capacity() {
+    ListingCache cache(2);
+    int calls = 0;
+    std::vector<std::filesystem::path> folders = {test_dir / "a", test_dir / "b", test_dir / "c"};
+    std::vector<ListingCache::Reader> readers;
+
+    if (!cache.is_enabled()) {
+        return;
+    }
+    for (const auto &folder : folders) {
+        std::filesystem::create_directories(folder);
+        readers.emplace_back(make_reader(folder, 0, calls));
+    }
+    cache.get(folders[0], 0, readers[0]);
+    cache.get(folders[1], 0, readers[1]);
+    cache.get(folders[0], 0, readers[0]);
+    // The least recently used is dropped
+    cache.get(folders[2], 0, readers[2]);
+    assert(cache.size() == 2 && calls == 3);
+    cache.get(folders[0], 0, readers[0]);
+    assert(calls == 3);
+    cache.get(folders[1], 0, readers[1]);
+    assert(calls == 4);
+    std::filesystem::remove_all(test_dir);
+}
+
+static void test_reads() {
+    ListingCache cache;
+    std::filesystem::path folder = test_dir / "read_folder";
+    auto listing = std::make_shared<const CachedListing>(CachedListing{.fields=0, .entries={}});
+
+    std::filesystem::create_directories(folder);
+    if (!cache.is_enabled()) {
+        assert(!cache.start_read(folder).has_value());
+        std::filesystem::remove_all(test_dir);
+        return;
+    }
+
+    // Only the last read started is kept
+    auto first = cache.start_read(folder);
+    auto second = cache.start_read(folder);
+
+    assert(first.has_value() && second.has_value() && cache.find(folder, 0) == nullptr);
+    cache.finish_read(folder, first.value(), listing);
+    assert(cache.find(folder, 0) == nullptr);
+    cache.finish_read(folder, second.value(), listing);
+    assert(cache.find(folder, 0) == listing);
+
+    // Changed while being read
+    auto changed = cache.start_read(folder);
+
+    std::ofstream(folder / "file");
+    cache.finish_read(folder, changed.value(), listing);
+    assert(cache.find(folder, 0) == nullptr);
+
+    // Too big: not read for the cache again until it changes
+    cache.finish_read(folder, cache.start_read(folder).value(), nullptr);
+    assert(!cache.start_read(folder).has_value() && cache.find(folder, 0) == nullptr);
+    std::ofstream(folder / "other");
+    assert(cache.start_read(folder).has_value());
+    std::filesystem::remove_all(test_dir);
+}
+
+static auto list(FileMapping &mapping, const std::shared_ptr<ListingCache> &cache, std::uint8_t fields) -> std::vector<Protocol::FileInfo> {
+    ListFilesTransferHandler handler("//fsp/folder", mapping, Protocol::MIN_PACKET_SIZE, fields, 1, cache);
+    FileListTransferHandler receiver;
+
+    while (auto packet = handler.get_next_packet(1)) {
+        receiver.receive_packet(*packet);
+    }
+    return receiver.get_file_list();
+}
+
+static void test_transfer_handler() {
+    auto cache = std::make_shared<ListingCache>();
+    FileMapping mapping{RootPathNode({PathNode::make_host_node("folder", PathNode::HOST_FOLDER, test_dir / "folder", PathNode::VISIBLE)})};
+    std::uint8_t fields = Protocol::FILE_INFO_SIZE | Protocol::FILE_INFO_UPDATED_AT;
+
+    std::filesystem::create_directories(test_dir / "folder" / "sub_folder");
+    std::ofstream(test_dir / "folder" / "file") << "content";
+    std::ofstream(test_dir / "folder" / "sub_folder" / "file") << "other content";
+
+    auto uncached = list(mapping, nullptr, fields);
+    auto first = list(mapping, cache, fields);
+    auto second = list(mapping, cache, fields);
+    auto to_set = [](const std::vector<Protocol::FileInfo> &files) {
+        std::set<std::tuple<std::string, std::optional<std::size_t>, bool>> result;
+
+        for (const auto &file : files) {
+            result.emplace(file.path, file.size, file.last_updated.has_value());
+        }
+        return result;
+    };
+
+    assert(uncached.size() == 3);
+    assert(to_set(first) == to_set(uncached) && to_set(second) == to_set(uncached));
+    assert(!cache->is_enabled() || cache->size() == 2);
+    // Fields not requested are not sent, even if they are cached
+    for (const auto &file : list(mapping, cache, Protocol::FILE_INFO_UPDATED_AT)) {
+        assert(!file.size.has_value() && file.last_updated.has_value());
+    }
+    std::ofstream(test_dir / "folder" / "sub_folder" / "new");
+    assert(list(mapping, cache, fields).size() == 4);
+    std::filesystem::remove_all(test_dir);
+}
+
+static void test_streamed() {
+    auto cache = std::make_shared<ListingCache>();
+    FileMapping mapping{RootPathNode({PathNode::make_host_node("big", PathNode::HOST_FOLDER, test_dir / "big", PathNode::VISIBLE)})};
+
+    if (!cache->is_enabled()) {
+        return;
+    }
+    std::filesystem::create_directories(test_dir / "big");
+    for (int i = 0; i < 1000; i++) {
+        std::ofstream(test_dir / "big" / ("file_" + std::to_string(i)));
+    }
+
+    ListFilesTransferHandler handler("//fsp/big", mapping, Protocol::MIN_PACKET_SIZE, Protocol::FILE_INFO_SIZE, 0, cache);
+    std::size_t count = handler.get_next_packet(1)->files.size();
+
+    // The folder is stored once it was sent whole, it is not read before the first packet
+    assert(count < 1000 && cache->find(test_dir / "big", Protocol::FILE_INFO_SIZE) == nullptr);
+    for (auto packet = handler.get_next_packet(1); packet; packet = handler.get_next_packet(1)) {
+        count += packet->files.size();
+    }
+
+    auto listing = cache->find(test_dir / "big", Protocol::FILE_INFO_SIZE);
+
+    assert(count == 1000 && listing && listing->entries.size() == 1000);
+    assert(listing->entries.front().info.size == 0 && listing->entries.front().info.path.starts_with("file_"));
+    std::filesystem::remove_all(test_dir);
+}
+
+int TestListingCache(int /* ac */, char ** const /* av */) {
+    test_invalidation();
+    test_capacity();
+    test_reads();
+    test_transfer_handler();
+    test_streamed();
+    return 0;
+}
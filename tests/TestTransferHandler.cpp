@@ -0,0 +1,487 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 05:28:22 2026 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
+**
+** TestTransferHandler.cpp : File transfers between an upload and a download handler tests
+*/
+
+#include "FileShare/Errors/TransferErrors.hpp"
+#include "FileShare/TransferHandler.hpp"
+#include "FileShare/TransferJournal.hpp"
+#include "FileShare/Utils/ChunkStore.hpp"
+#include "FileShare/Utils/FileHash.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+using namespace FileShare;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("transfer_handler");
+static constexpr std::size_t PACKET_SIZE = 0x1000;
+
+static auto make_request(const std::string &content, std::size_t packet_size = PACKET_SIZE) -> std::shared_ptr<Protocol::SendFileData> {
+    Utils::Hasher hasher(Utils::HashAlgorithm::SHA256);
+    std::size_t total_packets = (content.size() + packet_size - 1) / packet_size;
+
+    hasher.update(content);
+    return std::make_shared<Protocol::SendFileData>(
+        "file", Utils::HashAlgorithm::SHA256, hasher.digest(), std::filesystem::file_time_type(), packet_size, total_packets
+    );
+}
+
+// Every packet of the upload, to give them to the download in any order
+static auto all_packets(UploadTransferHandler &upload) -> std::vector<std::shared_ptr<Protocol::DataPacketData>> {
+    std::vector<std::shared_ptr<Protocol::DataPacketData>> packets;
+
+    for (auto packet = upload.get_next_packet(0); packet; packet = upload.get_next_packet(0)) {
+        packets.push_back(std::move(packet));
+    }
+    return packets;
+}
+
+// Moves at most `max_packets` packets from upload to download. Returns the number moved.
+static auto transfer(UploadTransferHandler &upload, DownloadTransferHandler &download, std::size_t max_packets = -1) -> std::size_t {
+    std::size_t count = 0;
+
+    for (; count < max_packets; count++) {
+        auto packet = upload.get_next_packet(0);
+
+        if (!packet) {
+            break;
+        }
+        assert(download.receive_packet(*packet) == Protocol::StatusCode::STATUS_OK);
+        upload.packet_acknowledged(*packet);
+    }
+    return count;
+}
+
+static void test_resume() {
+    std::string content = random_bytes((PACKET_SIZE * 10) + 123, 1);
+    std::filesystem::path source = test_dir / "resume_source";
+    std::string destination = test_dir / "resume_destination";
+    auto request = make_request(content);
+
+    write_file(source, content);
+    assert(DownloadTransferHandler::resume_packet_start(destination, PACKET_SIZE) == 0);
+    {
+        UploadTransferHandler upload(source, request, 0);
+        DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+        // Interrupted: the handler is destroyed before the end
+        assert(transfer(upload, download, 4) == 4);
+        assert(!download.finished());
+    }
+    assert(std::filesystem::exists(destination + DownloadTransferHandler::TEMP_EXTENSION));
+    assert(DownloadTransferHandler::resume_packet_start(destination, PACKET_SIZE) == 4);
+
+    // Resuming from before the end of what we have drops the rest. total_packets only counts the packets sent.
+    request->total_packets -= 3;
+    UploadTransferHandler upload(source, request, 3);
+    DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request), 3);
+
+    assert(transfer(upload, download) == 8);
+    assert(download.finished() && upload.finished());
+    assert(read_file(destination) == content);
+    assert(!std::filesystem::exists(destination + DownloadTransferHandler::TEMP_EXTENSION));
+    assert(!std::filesystem::exists(destination + DownloadTransferHandler::RESUME_EXTENSION));
+}
+
+// What the Server does: the journal lists the download, its resume state tells where to start from
+static void test_resume_after_restart() {
+    std::string content = random_bytes((PACKET_SIZE * 8) + 42, 7);
+    std::filesystem::path source = test_dir / "restart_source";
+    std::filesystem::path journal_path = test_dir / "restart_journal";
+    std::string destination = test_dir / "restart_destination";
+    auto request = make_request(content);
+
+    write_file(source, content);
+    {
+        TransferJournal journal(journal_path);
+        UploadTransferHandler upload(source, request, 0);
+        DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+        journal.add("device", request->filepath);
+        // Killed in the middle of the download: nothing removes it from the journal
+        assert(transfer(upload, download, 5) == 5);
+    }
+
+    TransferJournal journal(journal_path);
+    std::vector<std::string> files = journal.get_files("device");
+
+    assert(files == std::vector<std::string>{request->filepath});
+
+    // The RECEIVE_FILE asks for packet_start, and the SEND_FILE in reply only counts the packets after it
+    std::size_t packet_start = DownloadTransferHandler::resume_packet_start(destination, PACKET_SIZE);
+
+    assert(packet_start == 5);
+    request->total_packets -= packet_start;
+
+    UploadTransferHandler upload(source, request, packet_start);
+    DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request), packet_start);
+
+    assert(transfer(upload, download) == 4);
+    assert(download.finished() && read_file(destination) == content);
+    journal.remove("device", files.front());
+    assert(journal.size() == 0);
+}
+
+static void test_resume_changed_file() {
+    std::string content = random_bytes(PACKET_SIZE * 6, 2);
+    std::filesystem::path source = test_dir / "changed_source";
+    std::string destination = test_dir / "changed_destination";
+    auto request = make_request(content);
+
+    write_file(source, content);
+    {
+        UploadTransferHandler upload(source, request, 0);
+        DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+        transfer(upload, download, 3);
+    }
+    assert(DownloadTransferHandler::resume_packet_start(destination, PACKET_SIZE) == 3);
+
+    // The file changed on the peer's side since: what we have is useless
+    content = random_bytes(PACKET_SIZE * 6, 3);
+    request = make_request(content);
+    request->total_packets -= 3;
+    try {
+        DownloadTransferHandler download(destination, request, 3);
+        assert(false);
+    } catch (const Errors::Transfer::ResumeError &) {}
+    assert(!std::filesystem::exists(destination + DownloadTransferHandler::TEMP_EXTENSION));
+    assert(DownloadTransferHandler::resume_packet_start(destination, PACKET_SIZE) == 0);
+}
+
+static void test_reorder() {
+    // Big packets, so the reorder buffer only holds a few of them
+    std::size_t packet_size = Protocol::MAX_PACKET_SIZE;
+    std::size_t window = DownloadTransferHandler::REORDER_BUFFER_SIZE / packet_size;
+    std::string content = random_bytes((packet_size * (window + 4)) + 10, 4);
+    std::filesystem::path source = test_dir / "reorder_source";
+    std::string destination = test_dir / "reorder_destination";
+    auto request = make_request(content, packet_size);
+
+    write_file(source, content);
+    UploadTransferHandler upload(source, request, 0);
+    auto packets = all_packets(upload);
+
+    assert(packets.size() == window + 5);
+    {
+        DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+        download.receive_packet(*packets[0]);
+        download.receive_packet(*packets[2]);
+        download.receive_packet(*packets[3]);
+        // The early packets are held in memory: only the first one counts as received if interrupted
+    }
+    assert(DownloadTransferHandler::resume_packet_start(destination, packet_size) == 1);
+    {
+        DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+        download.receive_packet(*packets[0]);
+        download.receive_packet(*packets[2]);
+        download.receive_packet(*packets[3]);
+        download.receive_packet(*packets[1]);
+        // The missing packet arrived: the buffered ones are written after it, in order
+    }
+    assert(DownloadTransferHandler::resume_packet_start(destination, packet_size) == 4);
+
+    DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+    download.receive_packet(*packets[0]);
+    download.receive_packet(*packets[2]);
+    // Too far ahead to be buffered: written right away, leaving a hole for packet 1
+    download.receive_packet(*packets[window + 2]);
+    for (std::size_t i = 3; i < packets.size(); i++) {
+        if (i != window + 2) {
+            download.receive_packet(*packets[i]);
+        }
+    }
+    // Packets received twice are only counted once, whether they were buffered or written
+    download.receive_packet(*packets[0]);
+    download.receive_packet(*packets[3]);
+    download.receive_packet(*packets[window + 2]);
+    assert(download.get_current_size() == content.size() - packet_size);
+    assert(!download.finished());
+    download.receive_packet(*packets[1]);
+    assert(download.finished());
+    assert(download.get_current_size() == content.size());
+    assert(read_file(destination) == content);
+}
+
+static void test_invalid_packets() {
+    std::string content = random_bytes((PACKET_SIZE * 2) + 10, 10);
+    std::filesystem::path source = test_dir / "invalid_source";
+    std::string destination = test_dir / "invalid_destination";
+    auto request = make_request(content);
+
+    write_file(source, content);
+    UploadTransferHandler upload(source, request, 0);
+    auto packets = all_packets(upload);
+    Protocol::DataPacketData past_end = *packets[2];
+    Protocol::DataPacketData short_packet = *packets[0];
+
+    past_end.packet_id = 3;
+    short_packet.data.resize(10);
+    for (const auto *packet : {&past_end, &short_packet}) {
+        DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+        assert(download.receive_packet(*packets[1]) == Protocol::StatusCode::STATUS_OK);
+        // Not a packet of this SEND_FILE: the download fails instead of throwing
+        assert(download.receive_packet(*packet) == Protocol::StatusCode::BAD_REQUEST);
+        assert(download.finished() && download.get_error() == Protocol::StatusCode::BAD_REQUEST);
+        assert(!std::filesystem::exists(destination + DownloadTransferHandler::TEMP_EXTENSION));
+    }
+}
+
+static void test_sparse_reorder() {
+    std::size_t packet_size = Protocol::MAX_PACKET_SIZE;
+    std::size_t window = DownloadTransferHandler::REORDER_BUFFER_SIZE / packet_size;
+    std::size_t data_size = (packet_size * (window + 4)) + 10;
+    std::vector<Utils::FileRange> holes = {{.offset=0x10000, .size=0x100000}, {.offset=data_size + 0x100000, .size=0x8000}};
+    std::string content = random_bytes(data_size + 0x108000, 10);
+    std::filesystem::path source = test_dir / "sparse_source";
+    std::string destination = test_dir / "sparse_destination";
+
+    for (const auto &hole : holes) {
+        std::fill_n(content.begin() + static_cast<std::ptrdiff_t>(hole.offset), hole.size, '\0');
+    }
+    write_file(source, content);
+
+    auto request = make_request(content, packet_size);
+
+    request->holes = holes;
+    request->file_size = content.size();
+    request->total_packets = (data_size / packet_size) + 1;
+
+    UploadTransferHandler upload(source, request, 0);
+    auto packets = all_packets(upload);
+    DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+    assert(packets.size() == window + 5);
+    // The packets after a missing one are hashed from the disk once it arrives, with the holes in between
+    download.receive_packet(*packets[0]);
+    download.receive_packet(*packets[window + 2]);
+    for (std::size_t i = 2; i < packets.size(); i++) {
+        if (i != window + 2) {
+            download.receive_packet(*packets[i]);
+        }
+    }
+    assert(!download.finished());
+    download.receive_packet(*packets[1]);
+    assert(download.finished());
+    assert(read_file(destination) == content);
+}
+
+static void test_chunk_mismatch() {
+    std::size_t chunk_size = PACKET_SIZE * 2;
+    std::string content = random_bytes((chunk_size * 3) + 10, 7);
+    std::filesystem::path source = test_dir / "chunks_source";
+    std::string destination = test_dir / "chunks_destination";
+    auto request = make_request(content);
+
+    write_file(source, content);
+    request->chunk_size = chunk_size;
+    request->chunk_hashes = Utils::chunk_hashes(Utils::HashAlgorithm::SHA256, source, chunk_size);
+
+    UploadTransferHandler upload(source, request, 0);
+    DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+    auto packets = all_packets(upload);
+    Protocol::DataPacketData corrupted = *packets[2];
+
+    corrupted.data[10] ^= 1;
+    assert(download.receive_packet(*packets[0]) == Protocol::StatusCode::STATUS_OK);
+    assert(download.receive_packet(*packets[1]) == Protocol::StatusCode::STATUS_OK);
+    assert(download.receive_packet(corrupted) == Protocol::StatusCode::STATUS_OK);
+    // The chunk is verified once complete
+    assert(download.receive_packet(*packets[3]) == Protocol::StatusCode::CHUNK_MISMATCH);
+    assert(download.get_mismatched_chunk() == 1);
+    for (std::size_t i = 4; i < packets.size(); i++) {
+        assert(download.receive_packet(*packets[i]) == Protocol::StatusCode::STATUS_OK);
+    }
+    assert(!download.finished());
+
+    // Sent again by the peer
+    upload.resend_chunk(1);
+    auto resent = all_packets(upload);
+
+    assert(resent.size() == 2 && resent[0]->packet_id == 2 && resent[1]->packet_id == 3);
+    download.receive_packet(*resent[0]);
+    assert(download.receive_packet(*resent[1]) == Protocol::StatusCode::STATUS_OK);
+    assert(download.finished());
+    assert(read_file(destination) == content);
+}
+
+static void test_chunk_retries() {
+    std::size_t chunk_size = PACKET_SIZE * 2;
+    std::string content = random_bytes(chunk_size * 2, 8);
+    std::filesystem::path source = test_dir / "retries_source";
+    std::string destination = test_dir / "retries_destination";
+    auto request = make_request(content);
+
+    write_file(source, content);
+    request->chunk_size = chunk_size;
+    request->chunk_hashes = Utils::chunk_hashes(Utils::HashAlgorithm::SHA256, source, chunk_size);
+
+    UploadTransferHandler upload(source, request, 0);
+    auto packets = all_packets(upload);
+    Protocol::DataPacketData corrupted = *packets[0];
+
+    corrupted.data[0] ^= 1;
+    {
+        DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+        // The chunk keeps failing: the download gives up after MAX_CHUNK_RETRIES retries
+        for (std::size_t i = 0; i < DownloadTransferHandler::MAX_CHUNK_RETRIES; i++) {
+            download.receive_packet(corrupted);
+            assert(download.receive_packet(*packets[1]) == Protocol::StatusCode::CHUNK_MISMATCH);
+            assert(download.get_mismatched_chunk() == 0);
+            // The rejected chunk is not counted twice
+            assert(download.get_current_size() == 0);
+        }
+        download.receive_packet(corrupted);
+        assert(download.receive_packet(*packets[1]) == Protocol::StatusCode::INTERNAL_ERROR);
+        assert(download.finished() && download.get_error() == Protocol::StatusCode::INTERNAL_ERROR);
+        assert(!std::filesystem::exists(destination + DownloadTransferHandler::TEMP_EXTENSION));
+    }
+
+    // A good chunk resets the count of failures
+    DownloadTransferHandler download(destination, std::make_shared<Protocol::SendFileData>(*request));
+
+    for (std::size_t i = 0; i < DownloadTransferHandler::MAX_CHUNK_RETRIES; i++) {
+        download.receive_packet(corrupted);
+        assert(download.receive_packet(*packets[1]) == Protocol::StatusCode::CHUNK_MISMATCH);
+    }
+    download.receive_packet(*packets[0]);
+    assert(download.receive_packet(*packets[1]) == Protocol::StatusCode::STATUS_OK);
+    corrupted = *packets[2];
+    corrupted.data[0] ^= 1;
+    for (std::size_t i = 0; i < DownloadTransferHandler::MAX_CHUNK_RETRIES; i++) {
+        download.receive_packet(corrupted);
+        assert(download.receive_packet(*packets[3]) == Protocol::StatusCode::CHUNK_MISMATCH);
+        assert(download.get_mismatched_chunk() == 1);
+    }
+    download.receive_packet(*packets[2]);
+    assert(download.receive_packet(*packets[3]) == Protocol::StatusCode::STATUS_OK);
+    assert(download.finished());
+    assert(download.get_current_size() == content.size());
+    assert(read_file(destination) == content);
+}
+
+static void test_deduplication() {
+    constexpr std::size_t average_size = 0x1000;
+    Utils::ChunkStore store(test_dir / Utils::ChunkStore::FOLDER_NAME);
+    std::string original = random_bytes(average_size * 32, 9);
+    std::string modified = original;
+    std::filesystem::path source = test_dir / "dedup_source";
+    std::string first_destination = test_dir / "dedup_first";
+    std::string second_destination = test_dir / "dedup_second";
+
+    modified.insert(modified.size() / 2, "inserted data");
+    write_file(source, original);
+    {
+        auto request = make_request(original);
+
+        request->content_chunks = Utils::content_chunks(Utils::HashAlgorithm::SHA256, source, average_size);
+        UploadTransferHandler upload(source, request, 0);
+        DownloadTransferHandler download(first_destination, std::make_shared<Protocol::SendFileData>(*request), 0, store);
+
+        // Nothing known yet: the whole file is sent
+        assert(download.get_known_chunks().empty());
+        assert(transfer(upload, download) == request->total_packets);
+        assert(download.finished() && read_file(first_destination) == original);
+    }
+    // The store points into the downloaded file instead of keeping a copy of the chunks
+    assert(std::filesystem::file_size(first_destination) == original.size());
+
+    write_file(source, modified);
+    auto request = make_request(modified);
+
+    request->content_chunks = Utils::content_chunks(Utils::HashAlgorithm::SHA256, source, average_size);
+    UploadTransferHandler upload(source, request, 0);
+    DownloadTransferHandler download(second_destination, std::make_shared<Protocol::SendFileData>(*request), 0, store);
+    const auto &known_chunks = download.get_known_chunks();
+    std::size_t full_packets = request->total_packets;
+
+    assert(known_chunks.size() == request->content_chunks.size());
+    // Only the chunks around the insertion are missing
+    assert(std::ranges::count(known_chunks, false) >= 1 && std::ranges::count(known_chunks, false) <= 2);
+    upload.skip_known_chunks(known_chunks);
+    assert(transfer(upload, download) < full_packets / 4);
+    assert(download.finished() && upload.finished());
+    assert(read_file(second_destination) == modified);
+
+    // Once the file it points into changes, a chunk is forgotten
+    assert(store.contains(request->content_chunks[0].hash));
+    write_file(first_destination, "changed");
+    write_file(second_destination, "changed");
+    assert(!store.contains(request->content_chunks[0].hash));
+}
+
+static void test_inline_mismatch() {
+    std::string destination = test_dir / "inline_destination";
+    auto request = make_request("inline content");
+
+    request->total_packets = 0;
+    request->inline_content = "something else";
+    try {
+        DownloadTransferHandler download(destination, request);
+        assert(false);
+    } catch (const Errors::Transfer::HashMismatchError &) {}
+    // Nothing is left behind, the destructor did not run
+    assert(!std::filesystem::exists(destination));
+    assert(!std::filesystem::exists(destination + DownloadTransferHandler::TEMP_EXTENSION));
+
+    // Given to a sink which fails: it still learns the transfer is over
+    int finished = 0;
+    auto sink = std::make_shared<Utils::CallbackByteSink>(
+        [](std::string_view) { throw std::runtime_error("Write failed"); },
+        [&finished](bool complete) { assert(!complete); finished++; }
+    );
+
+    request->inline_content = "inline content";
+    try {
+        DownloadTransferHandler download(sink, request);
+        assert(false);
+    } catch (const std::runtime_error &) {}
+    assert(finished == 1);
+
+    DownloadTransferHandler download(destination, request);
+
+    assert(download.finished() && read_file(destination) == "inline content");
+}
+
+int TestTransferHandler(int /* ac */, char ** const /* av */) {
+    std::filesystem::remove_all(test_dir);
+    std::filesystem::create_directories(test_dir);
+    std::cout << "Resume an interrupted download" << std::endl;
+    test_resume();
+    std::cout << "Resume after a restart" << std::endl;
+    test_resume_after_restart();
+    std::cout << "Resume after the file changed" << std::endl;
+    test_resume_changed_file();
+    std::cout << "Reorder packets" << std::endl;
+    test_reorder();
+    std::cout << "Invalid packets" << std::endl;
+    test_invalid_packets();
+    std::cout << "Reorder sparse file packets" << std::endl;
+    test_sparse_reorder();
+    std::cout << "Chunk hash mismatch" << std::endl;
+    test_chunk_mismatch();
+    std::cout << "Chunk retries" << std::endl;
+    test_chunk_retries();
+    std::cout << "Deduplicated transfer" << std::endl;
+    test_deduplication();
+    std::cout << "Inline content mismatch" << std::endl;
+    test_inline_mismatch();
+    std::filesystem::remove_all(test_dir);
+    return 0;
+}
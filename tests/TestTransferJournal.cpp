@@ -0,0 +1,111 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:42:17 2026 Francois Michaut
+** Last update Mon Oct 19 08:59:53 2026 Francois Michaut
+**
+** TestTransferJournal.cpp : Journal of the downloads in progress tests
+*/
+
+#include "FileShare/TransferJournal.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <fstream>
+
+using namespace FileShare;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("transfer_journal");
+static const std::filesystem::path journal_path = test_dir / "journal";
+
+static void test_reload() {
+    {
+        TransferJournal journal(journal_path);
+
+        journal.add("device_1", "/a");
+        journal.add("device_1", "/b");
+        journal.add("device_1", "/b");
+        journal.add("device_2", "/a");
+        journal.remove("device_1", "/a");
+        // Only written by flush(), which waits for FLUSH_INTERVAL unless forced
+        journal.flush();
+        assert(std::filesystem::file_size(journal_path) == 0);
+        journal.flush(true);
+        assert(std::filesystem::file_size(journal_path) != 0);
+        journal.add("device_3", "/c"); // Written when destroyed
+    }
+
+    TransferJournal journal(journal_path);
+
+    assert(journal.size() == 3);
+    assert(journal.get_files("device_1") == std::vector<std::string>{"/b"});
+    assert(journal.get_files("device_2") == std::vector<std::string>{"/a"});
+    assert(journal.contains("device_3", "/c") && !journal.contains("device_1", "/a"));
+    assert(journal.get_files("device").empty());
+}
+
+static void test_compaction() {
+    std::size_t size = 0;
+
+    {
+        TransferJournal journal(journal_path);
+
+        size = std::filesystem::file_size(journal_path);
+        for (int i = 0; i < 100; i++) {
+            journal.add("device_4", "/file_" + std::to_string(i));
+            journal.remove("device_4", "/file_" + std::to_string(i));
+        }
+    }
+    assert(std::filesystem::file_size(journal_path) > size);
+    TransferJournal journal(journal_path);
+
+    assert(std::filesystem::file_size(journal_path) == size);
+    assert(journal.size() == 3 && journal.get_files("device_4").empty());
+}
+
+static void test_torn_record() {
+    {
+        TransferJournal journal(journal_path);
+
+        journal.add("device_5", "/d");
+        journal.add("device_5", "/e");
+    }
+    // Crashed while writing the last record
+    std::filesystem::resize_file(journal_path, std::filesystem::file_size(journal_path) - 3);
+    {
+        TransferJournal journal(journal_path);
+
+        assert(journal.get_files("device_5") == std::vector<std::string>{"/d"});
+    }
+    // Garbage after the valid records
+    std::ofstream(journal_path, std::ios_base::binary | std::ios_base::app) << "garbage";
+    {
+        TransferJournal journal(journal_path);
+
+        assert(journal.size() == 4 && journal.contains("device_5", "/d"));
+    }
+    std::ofstream(journal_path, std::ios_base::binary | std::ios_base::trunc) << "not a journal";
+    assert(TransferJournal(journal_path).size() == 0);
+    std::filesystem::remove_all(test_dir);
+}
+
+static void test_disabled() {
+    TransferJournal journal("");
+
+    journal.add("device", "/a");
+    journal.flush(true);
+    assert(journal.contains("device", "/a"));
+}
+
+int TestTransferJournal(int /* ac */, char ** const /* av */) {
+    std::filesystem::remove_all(test_dir);
+    test_reload();
+    test_compaction();
+    test_torn_record();
+    test_disabled();
+    return 0;
+}
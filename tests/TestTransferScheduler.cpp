@@ -0,0 +1,150 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:34:13 2026 Francois Michaut
+** Last update Mon Oct 19 08:56:38 2026 Francois Michaut
+**
+** TestTransferScheduler.cpp : Transfer scheduling fairness and limits tests
+*/
+
+#include "FileShare/TransferScheduler.hpp"
+
+#include <cassert>
+#include <vector>
+
+using namespace FileShare;
+
+// Counts the packets each transfer sent, up to `limit` packets
+struct FakeTransfer {
+    std::size_t sent = 0;
+    std::size_t limit = static_cast<std::size_t>(-1);
+    std::size_t packet_size = 1;
+
+    auto callback() -> TransferScheduler::SendPacketCallback {
+        return [this]() -> std::size_t {
+            if (sent >= limit) {
+                return 0;
+            }
+            sent++;
+            return packet_size;
+        };
+    }
+};
+
+static void test_peer_fairness() {
+    TransferScheduler scheduler(0);
+    std::vector<FakeTransfer> transfers(5);
+
+    // 4 transfers for the first peer, 1 for the second: each peer still gets half
+    for (std::size_t i = 0; i < 4; i++) {
+        scheduler.add_transfer("first", 1, Config::NORMAL, transfers[i].callback());
+    }
+    scheduler.add_transfer("second", 1, Config::NORMAL, transfers[4].callback());
+    assert(scheduler.run(1000) == 1000);
+    assert(transfers[4].sent == 500);
+    for (std::size_t i = 0; i < 4; i++) {
+        assert(transfers[i].sent == 125);
+    }
+}
+
+static void test_weights() {
+    TransferScheduler scheduler(0);
+    std::vector<FakeTransfer> transfers(3);
+
+    scheduler.add_transfer("first", 3, Config::NORMAL, transfers[0].callback());
+    scheduler.add_transfer("second", 1, Config::NORMAL, transfers[1].callback());
+    assert(scheduler.run(400) == 400);
+    assert(transfers[0].sent == 300 && transfers[1].sent == 100);
+    // A peer which was idle gets its share from now on, without catching up
+    scheduler.add_transfer("third", 1, Config::NORMAL, transfers[2].callback());
+    assert(scheduler.run(500) == 500);
+    assert(transfers[2].sent == 100);
+}
+
+static void test_packet_sizes() {
+    TransferScheduler scheduler(0);
+    std::vector<FakeTransfer> transfers(3);
+
+    // Same peer or not, bigger packets do not get more bytes through
+    transfers[0].packet_size = 4;
+    scheduler.add_transfer("first", 1, Config::NORMAL, transfers[0].callback());
+    scheduler.add_transfer("first", 1, Config::NORMAL, transfers[1].callback());
+    assert(scheduler.run(50) == 50);
+    assert(transfers[0].sent == 10 && transfers[1].sent == 40);
+    transfers[2].packet_size = 2;
+    scheduler.add_transfer("second", 1, Config::NORMAL, transfers[2].callback());
+    assert(scheduler.run(60) == 60);
+    assert((transfers[0].sent - 10) * 4 + (transfers[1].sent - 40) == transfers[2].sent * 2);
+}
+
+static void test_priorities() {
+    TransferScheduler scheduler(0);
+    std::vector<FakeTransfer> transfers(3);
+
+    transfers[0].limit = 10;
+    scheduler.add_transfer("first", 1, Config::BACKGROUND, transfers[2].callback());
+    scheduler.add_transfer("second", 1, Config::NORMAL, transfers[1].callback());
+    scheduler.add_transfer("third", 1, Config::HIGH, transfers[0].callback());
+    assert(scheduler.run(20) == 20);
+    assert(transfers[0].sent == 10 && transfers[1].sent == 10 && transfers[2].sent == 0);
+}
+
+static void test_max_active_transfers() {
+    TransferScheduler scheduler(2);
+    std::vector<FakeTransfer> transfers(4);
+    std::vector<TransferScheduler::TransferID> ids;
+
+    ids.push_back(scheduler.add_transfer("first", 1, Config::NORMAL, transfers[0].callback()));
+    ids.push_back(scheduler.add_transfer("first", 1, Config::NORMAL, transfers[1].callback()));
+    ids.push_back(scheduler.add_transfer("first", 1, Config::NORMAL, transfers[2].callback()));
+    ids.push_back(scheduler.add_transfer("second", 1, Config::NORMAL, transfers[3].callback()));
+    assert(scheduler.get_active_count() == 2 && scheduler.get_queued_count() == 2);
+    assert(scheduler.run(10) == 10);
+    assert(transfers[2].sent == 0 && transfers[3].sent == 0);
+    // The peer without active transfers goes before the older transfer of the other one
+    scheduler.remove_transfer(ids[0]);
+    assert(scheduler.is_active(ids[3]) && !scheduler.is_active(ids[2]));
+    scheduler.remove_transfer(ids[1]);
+    assert(scheduler.is_active(ids[2]));
+    assert(scheduler.get_active_count() == 2 && scheduler.get_queued_count() == 0);
+    // Blocked transfers are skipped until the next run
+    transfers[2].limit = transfers[2].sent + 1;
+    transfers[3].limit = transfers[3].sent + 2;
+    assert(scheduler.run(10) == 3);
+    transfers[2].limit++;
+    assert(scheduler.run(10) == 1);
+    scheduler.remove_transfer(ids[2]);
+    scheduler.remove_transfer(ids[3]);
+    assert(scheduler.get_active_count() == 0 && scheduler.run(10) == 0);
+}
+
+static void test_start_now() {
+    TransferScheduler scheduler(1);
+    std::vector<FakeTransfer> transfers(3);
+    std::vector<TransferScheduler::TransferID> ids;
+
+    ids.push_back(scheduler.add_transfer("first", 1, Config::NORMAL, transfers[0].callback()));
+    // Waited on by a blocking call: it does not queue behind the active one
+    ids.push_back(scheduler.add_transfer("second", 1, Config::NORMAL, transfers[1].callback(), true));
+    ids.push_back(scheduler.add_transfer("third", 1, Config::NORMAL, transfers[2].callback()));
+    assert(scheduler.is_active(ids[0]) && scheduler.is_active(ids[1]) && !scheduler.is_active(ids[2]));
+    assert(scheduler.run(10) == 10);
+    assert(transfers[0].sent == 5 && transfers[1].sent == 5 && transfers[2].sent == 0);
+    // It still counts towards the limit
+    scheduler.remove_transfer(ids[0]);
+    assert(!scheduler.is_active(ids[2]));
+    scheduler.remove_transfer(ids[1]);
+    assert(scheduler.is_active(ids[2]) && scheduler.get_queued_count() == 0);
+}
+
+int TestTransferScheduler(int /* ac */, char ** const /* av */) {
+    test_peer_fairness();
+    test_weights();
+    test_packet_sizes();
+    test_priorities();
+    test_max_active_transfers();
+    test_start_now();
+    return 0;
+}
@@ -0,0 +1,85 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 06:00:29 2026 Francois Michaut
+** Last update Mon Oct 19 06:00:29 2026 Francois Michaut
+**
+** TestBufferPool.cpp : BufferPool tests
+*/
+
+#include "FileShare/Utils/BufferPool.hpp"
+
+#include <cassert>
+
+using namespace FileShare::Utils;
+
+static void test_acquire_release() {
+    BufferPool pool;
+    std::string buffer = pool.acquire(0x1000);
+    const char *data = buffer.data();
+
+    assert(buffer.size() == 0x1000);
+    assert(pool.size() == 0);
+
+    pool.release(std::move(buffer));
+    assert(pool.size() == 1);
+
+    // Smaller or equal requests get the released buffer back, without reallocating
+    buffer = pool.acquire(0x800);
+    assert(pool.size() == 0);
+    assert(buffer.size() == 0x800);
+    assert(buffer.data() == data);
+
+    pool.release(std::move(buffer));
+    buffer = pool.acquire(0x1000);
+    assert(buffer.size() == 0x1000);
+    assert(buffer.data() == data);
+
+    // Nothing left in the pool: a new buffer is allocated
+    std::string other = pool.acquire(0x1000);
+    assert(other.size() == 0x1000);
+    assert(other.data() != data);
+}
+
+static void test_empty_buffers() {
+    BufferPool pool;
+
+    // Buffers without any allocation are not worth keeping
+    pool.release(std::string());
+    assert(pool.size() == 0);
+    pool.release(pool.acquire(0));
+    assert(pool.size() == 0);
+}
+
+static void test_capacity() {
+    BufferPool pool(2);
+    std::string first = pool.acquire(0x100);
+    std::string second = pool.acquire(0x100);
+    std::string third = pool.acquire(0x100);
+
+    pool.release(std::move(first));
+    pool.release(std::move(second));
+    assert(pool.size() == 2);
+    // The pool is full: the buffer is dropped
+    pool.release(std::move(third));
+    assert(pool.size() == 2);
+
+    (void)pool.acquire(0x100);
+    (void)pool.acquire(0x100);
+    assert(pool.size() == 0);
+
+    BufferPool disabled(0);
+
+    disabled.release(disabled.acquire(0x100));
+    assert(disabled.size() == 0);
+}
+
+int Utils_TestBufferPool(int, char**)
+{
+    test_acquire_release();
+    test_empty_buffers();
+    test_capacity();
+    return 0;
+}
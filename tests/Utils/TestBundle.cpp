@@ -0,0 +1,179 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:35:12 2026 Francois Michaut
+** Last update Mon Oct 19 09:04:24 2026 Francois Michaut
+**
+** TestBundle.cpp : Bundle of small files tests
+*/
+
+#include "FileShare/Utils/Bundle.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+using namespace FileShare::Utils;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("bundle");
+
+static auto make_bundle() -> std::vector<BundleFile> {
+    std::vector<BundleFile> files;
+
+    for (int i = 0; i < 50; i++) {
+        std::string path = (i % 2 == 0 ? "dir/file_" : "file_") + std::to_string(i);
+
+        write_file(test_dir / "source" / path, std::string(i * 37, static_cast<char>('a' + (i % 26))));
+        files.emplace_back(BundleFile{.host_path=test_dir / "source" / path, .path=path});
+    }
+    return files;
+}
+
+// The whole bundle, read in small parts so they cross the segments of the source
+static auto read_bundle(const BundleByteSource &source) -> std::string {
+    std::string bundle(source.get_size(), '\0');
+
+    for (std::size_t offset = 0; offset < bundle.size(); offset += 100) {
+        assert(source.read(bundle.data() + offset, std::min<std::size_t>(100, bundle.size() - offset), offset) == std::min<std::size_t>(100, bundle.size() - offset));
+    }
+    assert(source.read(bundle.data(), 1, bundle.size()) == 0);
+    return bundle;
+}
+
+static void check_files(const std::vector<BundleFile> &files) {
+    for (const auto &file : files) {
+        assert(read_file(test_dir / "destination" / file.path) == read_file(file.host_path));
+        assert(!std::filesystem::exists(test_dir / "destination" / (file.path + BundleReader::TEMP_EXTENSION)));
+    }
+}
+
+static void test_round_trip() {
+    auto files = make_bundle();
+    BundleByteSource source(HashAlgorithm::SHA256, files);
+    std::string bundle = read_bundle(source);
+    Hasher hasher(HashAlgorithm::SHA256);
+
+    hasher.update(bundle);
+    assert(source.get_hash() == hasher.digest());
+    // Read at once, from the middle of a segment to the end
+    {
+        std::string end(bundle.size() - 10, '\0');
+
+        assert(source.read(end.data(), end.size() + 10, 10) == end.size());
+        assert(end == bundle.substr(10));
+    }
+    // All at once
+    {
+        BundleReader reader(test_dir / "destination", HashAlgorithm::SHA256);
+
+        reader.feed(bundle);
+        assert(reader.get_file_count() == files.size());
+        assert(reader.commit() == 0);
+    }
+    check_files(files);
+    std::filesystem::remove_all(test_dir / "destination");
+    // Byte by byte, so every header and hash is split between calls
+    {
+        BundleReader reader(test_dir / "destination", HashAlgorithm::SHA256);
+
+        for (char c : bundle) {
+            reader.feed({&c, 1});
+        }
+        assert(reader.commit() == 0);
+    }
+    check_files(files);
+    std::filesystem::remove_all(test_dir / "destination");
+}
+
+static void test_up_to_date() {
+    auto files = make_bundle();
+    std::string bundle = read_bundle(BundleByteSource(HashAlgorithm::SHA256, files));
+    auto updated_at = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+
+    {
+        BundleReader reader(test_dir / "destination", HashAlgorithm::SHA256);
+
+        reader.feed(bundle);
+        assert(reader.commit() == 0);
+    }
+    // Files we already have are not replaced
+    std::filesystem::last_write_time(test_dir / "destination" / files[0].path, updated_at);
+    {
+        BundleReader reader(test_dir / "destination", HashAlgorithm::SHA256);
+
+        reader.feed(bundle);
+        assert(reader.commit() == 0);
+    }
+    assert(std::filesystem::last_write_time(test_dir / "destination" / files[0].path) == updated_at);
+    check_files(files);
+    std::filesystem::remove_all(test_dir / "destination");
+}
+
+static void test_corrupted() {
+    auto files = make_bundle();
+    std::string bundle = read_bundle(BundleByteSource(HashAlgorithm::SHA256, files));
+    // Truncated: nothing is written
+    {
+        BundleReader reader(test_dir / "destination", HashAlgorithm::SHA256);
+        bool thrown = false;
+
+        reader.feed(std::string_view(bundle).substr(0, bundle.size() - 1));
+        try {
+            reader.commit();
+        } catch (std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    assert(!std::filesystem::exists(test_dir / "destination" / files[0].path));
+    assert(!std::filesystem::exists(test_dir / "destination" / (files[0].path + BundleReader::TEMP_EXTENSION)));
+    // Corrupted content: only that file is rejected
+    bundle[bundle.size() / 2] ^= 1;
+    {
+        BundleReader reader(test_dir / "destination", HashAlgorithm::SHA256);
+
+        reader.feed(bundle);
+        assert(reader.commit() == 1);
+    }
+    // Not committed: the files are removed
+    {
+        BundleReader reader(test_dir / "other", HashAlgorithm::SHA256);
+
+        reader.feed(bundle);
+    }
+    assert(std::filesystem::is_empty(test_dir / "other" / "dir"));
+    std::filesystem::remove_all(test_dir);
+}
+
+static void test_invalid_path() {
+    std::vector<BundleFile> files;
+    bool thrown = false;
+
+    write_file(test_dir / "source" / "file", "content");
+    files.emplace_back(BundleFile{.host_path=test_dir / "source" / "file", .path="../file"});
+    std::string bundle = read_bundle(BundleByteSource(HashAlgorithm::SHA256, files));
+
+    try {
+        BundleReader reader(test_dir / "destination", HashAlgorithm::SHA256);
+
+        reader.feed(bundle);
+    } catch (std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(!std::filesystem::exists(test_dir / "file.fsdownload"));
+    std::filesystem::remove_all(test_dir);
+}
+
+int Utils_TestBundle(int /* ac */, char ** const /* av */) {
+    test_round_trip();
+    test_up_to_date();
+    test_corrupted();
+    test_invalid_path();
+    return 0;
+}
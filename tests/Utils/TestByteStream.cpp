@@ -0,0 +1,259 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:48:08 2026 Francois Michaut
+** Last update Mon Oct 19 09:10:48 2026 Francois Michaut
+**
+** TestByteStream.cpp : Transfers from and to memory, pipes and callbacks
+*/
+
+#include "FileShare/TransferHandler.hpp"
+#include "FileShare/Utils/ByteStream.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <fstream>
+#include <vector>
+
+#ifndef OS_WINDOWS
+  #include <unistd.h>
+#endif
+
+using namespace FileShare;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("byte_stream");
+static constexpr std::size_t PACKET_SIZE = 0x1000;
+
+static auto make_request(const std::string &data) -> std::shared_ptr<Protocol::SendFileData> {
+    Utils::Hasher hasher(Utils::HashAlgorithm::SHA256);
+
+    hasher.update(data);
+    return std::make_shared<Protocol::SendFileData>(
+        "/file", Utils::HashAlgorithm::SHA256, hasher.digest(), std::filesystem::file_time_type(),
+        PACKET_SIZE, (data.size() / PACKET_SIZE) + (data.size() % PACKET_SIZE == 0 ? 0 : 1)
+    );
+}
+
+// Sends the packets in pairs, the second one first. Corrupts the packet `corrupted` once.
+static void transfer(UploadTransferHandler &upload, DownloadTransferHandler &download, std::size_t corrupted = SIZE_MAX) {
+    while (!upload.finished()) {
+        auto first = upload.get_next_packet(0);
+        auto second = upload.get_next_packet(0);
+
+        for (const auto &packet : {second, first}) {
+            if (!packet) {
+                continue;
+            }
+            if (packet->packet_id == corrupted) {
+                packet->data[0] ^= 1;
+                corrupted = SIZE_MAX;
+            }
+            if (download.receive_packet(*packet) == Protocol::StatusCode::CHUNK_MISMATCH) {
+                upload.resend_chunk(download.get_mismatched_chunk());
+            }
+            upload.packet_acknowledged(*packet);
+        }
+    }
+    assert(download.finished());
+}
+
+static void test_memory() {
+    std::string data = random_bytes((PACKET_SIZE * 20) + 123, 1);
+    auto request = make_request(data);
+    auto sink = std::make_shared<Utils::MemoryByteSink>();
+    UploadTransferHandler upload(std::make_shared<Utils::MemoryByteSource>(data), request);
+    DownloadTransferHandler download(sink, request);
+
+    transfer(upload, download);
+    assert(sink->is_complete());
+    assert(sink->get_data() == data);
+}
+
+static void test_hash_tree() {
+    std::string data = random_bytes((PACKET_SIZE * 20) + 123, 2);
+    auto request = make_request(data);
+    std::size_t chunk_size = PACKET_SIZE * 4;
+    std::string written;
+    bool complete = false;
+
+    std::filesystem::create_directories(test_dir);
+    std::ofstream(test_dir / "source", std::ios_base::binary | std::ios_base::out | std::ios_base::trunc) << data;
+    request->chunk_size = chunk_size;
+    request->chunk_hashes = Utils::chunk_hashes(Utils::HashAlgorithm::SHA256, test_dir / "source", chunk_size);
+    {
+        auto sink = std::make_shared<Utils::CallbackByteSink>(
+            [&written](std::string_view part) { written.append(part); },
+            [&complete](bool success) { complete = success; }
+        );
+        UploadTransferHandler upload(
+            std::make_shared<Utils::CallbackByteSource>([&data](char *buffer, std::size_t size, std::size_t offset) {
+                return data.copy(buffer, size, offset);
+            }), request
+        );
+        DownloadTransferHandler download(sink, request);
+
+        // The corrupted chunk is never given to the sink
+        transfer(upload, download, 5);
+    }
+    assert(complete);
+    assert(written == data);
+    std::filesystem::remove_all(test_dir);
+}
+
+static void test_far_ahead() {
+    std::size_t packet_size = DownloadTransferHandler::REORDER_BUFFER_SIZE / 4;
+    std::string data = random_bytes(packet_size * 6, 6);
+    auto request = make_request(data);
+    auto sink = std::make_shared<Utils::MemoryByteSink>();
+
+    request->packet_size = packet_size;
+    request->total_packets = 6;
+
+    UploadTransferHandler upload(std::make_shared<Utils::MemoryByteSource>(data), request);
+    DownloadTransferHandler download(sink, request);
+    std::vector<std::shared_ptr<Protocol::DataPacketData>> packets;
+
+    for (auto packet = upload.get_next_packet(0); packet; packet = upload.get_next_packet(0)) {
+        packets.push_back(std::move(packet));
+    }
+    // The packets arrive last first: the sink only holds the ones up to REORDER_BUFFER_SIZE ahead
+    for (std::size_t i = packets.size() - 1; i > 0; i--) {
+        Protocol::StatusCode status = download.receive_packet(*packets[i]);
+
+        assert(status == (i == 5 ? Protocol::StatusCode::TOO_MANY_REQUESTS : Protocol::StatusCode::STATUS_OK));
+        if (status == Protocol::StatusCode::TOO_MANY_REQUESTS) {
+            upload.resend_packet(packets[i]->packet_id);
+        }
+        upload.packet_acknowledged(*packets[i]);
+    }
+    assert(download.receive_packet(*packets[0]) == Protocol::StatusCode::STATUS_OK);
+    upload.packet_acknowledged(*packets[0]);
+    assert(!download.finished());
+
+    auto resent = upload.get_next_packet(0);
+
+    assert(resent && resent->packet_id == 5);
+    assert(download.receive_packet(*resent) == Protocol::StatusCode::STATUS_OK);
+    upload.packet_acknowledged(*resent);
+    assert(upload.finished() && download.finished());
+    assert(sink->get_data() == data);
+}
+
+static void test_holes() {
+    std::string data(0x40000, '\0');
+    std::string sent;
+    auto sink = std::make_shared<Utils::MemoryByteSink>();
+
+    std::ranges::fill(data.begin() + 0x8000, data.begin() + 0x10000, 'a');
+    std::ranges::fill(data.end() - 0x100, data.end(), 'b');
+    sent = data.substr(0x8000, 0x8000) + data.substr(data.size() - 0x100);
+
+    auto request = make_request(data);
+
+    // Only the data around the holes is sent, the sink gets the zeros back
+    request->holes = {{.offset=0, .size=0x8000}, {.offset=0x10000, .size=data.size() - 0x10100}};
+    request->file_size = data.size();
+    request->total_packets = (sent.size() / PACKET_SIZE) + 1;
+    {
+        UploadTransferHandler upload(std::make_shared<Utils::MemoryByteSource>(data), request);
+        DownloadTransferHandler download(sink, request);
+
+        transfer(upload, download);
+    }
+    assert(sink->is_complete());
+    assert(sink->get_data() == data);
+}
+
+static void test_range() {
+    std::string data = random_bytes(PACKET_SIZE * 30, 5);
+    std::string range = data.substr(0x3456, PACKET_SIZE * 10);
+    auto request = make_request(range);
+    auto sink = std::make_shared<Utils::MemoryByteSink>();
+
+    std::filesystem::create_directories(test_dir);
+    std::ofstream(test_dir / "source", std::ios_base::binary | std::ios_base::out | std::ios_base::trunc) << data;
+    // Only the range is read from the file, and the hash is the one of the range
+    request->range = Utils::FileRange{.offset=0x3456, .size=range.size()};
+    {
+        UploadTransferHandler upload((test_dir / "source").string(), request, 0);
+        DownloadTransferHandler download(sink, request);
+
+        transfer(upload, download);
+    }
+    assert(sink->is_complete());
+    assert(sink->get_data() == range);
+    // Resuming counts the packets from the start of the range
+    request = std::make_shared<Protocol::SendFileData>(*request);
+    request->total_packets = 1;
+    {
+        UploadTransferHandler upload((test_dir / "source").string(), request, 9);
+        auto packet = upload.get_next_packet(0);
+
+        assert(packet->data == range.substr(PACKET_SIZE * 9));
+        upload.packet_acknowledged(*packet);
+        assert(upload.finished());
+    }
+    std::filesystem::remove_all(test_dir);
+}
+
+static void test_cancelled() {
+    std::string data = random_bytes(PACKET_SIZE * 4, 3);
+    auto request = make_request(data);
+    auto sink = std::make_shared<Utils::MemoryByteSink>();
+    bool thrown = false;
+
+    {
+        UploadTransferHandler upload(std::make_shared<Utils::MemoryByteSource>(data), request);
+        DownloadTransferHandler download(sink, request);
+
+        download.receive_packet(*upload.get_next_packet(0));
+    }
+    assert(!sink->is_complete());
+    // The sink can't be a folder or the file a delta is applied on
+    request->delta_block_size = PACKET_SIZE;
+    try {
+        DownloadTransferHandler download(sink, request);
+    } catch (std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+static void test_pipe() {
+#ifndef OS_WINDOWS
+    std::string data = random_bytes(PACKET_SIZE * 3, 4);
+    std::string received(data.size(), '\0');
+    std::size_t size = 0;
+    int fds[2];
+
+    assert(pipe(fds) == 0);
+
+    Utils::FileDescriptor input(fds[0]);
+
+    {
+        Utils::FileByteSink sink{Utils::FileDescriptor(fds[1])};
+
+        sink.write(data);
+    }
+    // Written in order at the position of the descriptor, which a pipe doesn't have
+    for (ssize_t ret = 1; size < received.size() && ret > 0; size += ret) {
+        ret = read(input, received.data() + size, received.size() - size);
+    }
+    assert(received == data);
+#endif
+}
+
+int Utils_TestByteStream(int /* ac */, char ** const /* av */) {
+    test_memory();
+    test_hash_tree();
+    test_far_ahead();
+    test_holes();
+    test_range();
+    test_cancelled();
+    test_pipe();
+    return 0;
+}
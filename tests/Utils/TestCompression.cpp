@@ -0,0 +1,75 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:59:12 2026 Francois Michaut
+** Last update Mon Oct 19 08:29:23 2026 Francois Michaut
+**
+** TestCompression.cpp : Packet compression tests
+*/
+
+#include "FileShare/Utils/Compression.hpp"
+
+#include <cassert>
+#include <random>
+#include <stdexcept>
+
+using namespace FileShare::Utils;
+
+static void test_round_trip() {
+    std::string data;
+    std::string compressed;
+
+    for (int i = 0; i < 1000; i++) {
+        data += "2026-10-19 01:57:30 INFO transfer " + std::to_string(i) + " finished\n";
+    }
+    assert(compress(CompressionAlgorithm::ZSTD, data, compressed));
+    assert(compressed.size() * 3 < data.size());
+    assert(decompress(CompressionAlgorithm::ZSTD, compressed, data.size()) == data);
+    assert(!compress(CompressionAlgorithm::NONE, data, compressed));
+    assert(decompress(CompressionAlgorithm::NONE, data, data.size()) == data);
+}
+
+static void test_incompressible() {
+    std::mt19937 generator(42);
+    std::string data(0x10000, '\0');
+    std::string compressed;
+
+    for (char &c : data) {
+        c = static_cast<char>(generator());
+    }
+    assert(!compress(CompressionAlgorithm::ZSTD, data, compressed));
+    assert(!compress(CompressionAlgorithm::ZSTD, "", compressed));
+}
+
+static void test_invalid() {
+    std::string data(0x1000, 'a');
+    std::string compressed;
+    bool thrown = false;
+
+    assert(compress(CompressionAlgorithm::ZSTD, data, compressed));
+    // Bigger than allowed once decompressed
+    try {
+        decompress(CompressionAlgorithm::ZSTD, compressed, data.size() - 1);
+    } catch (std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        decompress(CompressionAlgorithm::ZSTD, data, data.size());
+    } catch (std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(is_valid_compression(0x01));
+    assert(!is_valid_compression(0x42));
+}
+
+int Utils_TestCompression(int /* ac */, char ** const /* av */) {
+    test_round_trip();
+    test_incompressible();
+    test_invalid();
+    return 0;
+}
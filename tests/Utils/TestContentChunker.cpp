@@ -0,0 +1,169 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 02:16:40 2026 Francois Michaut
+** Last update Mon Oct 19 08:34:58 2026 Francois Michaut
+**
+** TestContentChunker.cpp : Content-defined chunking and chunk store tests
+*/
+
+#include "FileShare/Utils/ChunkStore.hpp"
+#include "FileShare/Utils/ContentChunker.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <set>
+#include <thread>
+
+#include <fcntl.h>
+
+using namespace FileShare::Utils;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("content_chunker");
+
+static auto hashes(const std::vector<ContentChunk> &chunks) -> std::set<std::string> {
+    std::set<std::string> result;
+
+    for (const auto &chunk : chunks) {
+        result.insert(chunk.hash);
+    }
+    return result;
+}
+
+static void test_chunk_sizes() {
+    ContentChunker chunker(0x1000);
+    std::string data = random_bytes(0x100000, 1);
+    std::size_t count = 0;
+
+    assert(chunker.get_min_size() == 0x400 && chunker.get_max_size() == 0x8000);
+    for (std::string_view remaining = data; !remaining.empty(); count++) {
+        std::size_t size = chunker.cut(remaining);
+
+        assert(size <= chunker.get_max_size());
+        assert(size >= chunker.get_min_size() || size == remaining.size());
+        remaining = remaining.substr(size);
+    }
+    // Close to the average size
+    assert(count > data.size() / 0x2000 && count < data.size() / 0x800);
+    assert(ContentChunker(3000).get_average_size() == 0x1000);
+    assert(content_chunk_size(0) == DEFAULT_CONTENT_CHUNK_SIZE);
+    assert(content_chunk_size(DEFAULT_CONTENT_CHUNK_SIZE * MAX_CONTENT_CHUNKS * 3) == DEFAULT_CONTENT_CHUNK_SIZE * 4);
+}
+
+static void test_shifted_content() {
+    std::string data = random_bytes(0x200000, 2);
+    std::string modified = data;
+
+    std::filesystem::create_directories(test_dir);
+    modified.insert(0x80000, "inserted data");
+    write_file(test_dir / "original", data);
+    write_file(test_dir / "modified", modified);
+
+    auto original_chunks = content_chunks(HashAlgorithm::SHA256, test_dir / "original", 0x4000);
+    auto modified_chunks = content_chunks(HashAlgorithm::SHA256, test_dir / "modified", 0x4000);
+    auto original_hashes = hashes(original_chunks);
+    std::size_t total = 0;
+    std::size_t changed = 0;
+
+    for (const auto &chunk : original_chunks) {
+        total += chunk.size;
+    }
+    assert(total == data.size());
+    // Unlike fixed size blocks, only the chunks around the insertion change
+    for (const auto &chunk : modified_chunks) {
+        changed += original_hashes.contains(chunk.hash) ? 0 : 1;
+    }
+    assert(changed >= 1 && changed <= 2);
+    assert(content_chunks(HashAlgorithm::SHA256, test_dir / "original", 0x4000).size() == original_chunks.size());
+    write_file(test_dir / "empty", "");
+    assert(content_chunks(HashAlgorithm::SHA256, test_dir / "empty", 0x4000).empty());
+}
+
+static void test_chunk_store() {
+    ChunkStore store(test_dir / "store");
+    std::string data = random_bytes(0x10000, 3);
+
+    write_file(test_dir / "source", data);
+    auto chunks = content_chunks(HashAlgorithm::SHA256, test_dir / "source", 0x1000);
+    std::size_t offset = 0;
+
+    for (const auto &chunk : chunks) {
+        assert(!store.contains(chunk.hash));
+        assert(store.store(HashAlgorithm::SHA256, chunk, test_dir / "source", offset));
+        assert(store.contains(chunk.hash));
+        offset += chunk.size;
+    }
+    // The data does not match the hash
+    assert(!store.store(HashAlgorithm::SHA256, ContentChunk{.size=chunks[1].size, .hash=std::string(32, 'x')}, test_dir / "source", 0));
+    assert(!store.contains(std::string(32, 'x')));
+    {
+        FileDescriptor output(test_dir / "output", O_WRONLY | O_CREAT | O_TRUNC);
+
+        offset = 0;
+        for (const auto &chunk : chunks) {
+            store.copy_to(chunk, output, offset);
+            offset += chunk.size;
+        }
+    }
+    assert(file_hash(HashAlgorithm::SHA256, test_dir / "output") == file_hash(HashAlgorithm::SHA256, test_dir / "source"));
+    assert(store.verify(HashAlgorithm::SHA256, chunks[0].hash));
+    // Modified without changing its size or modification time: only verify() notices
+    auto mtime = std::filesystem::last_write_time(test_dir / "source");
+
+    data[0] = static_cast<char>(~data[0]);
+    write_file(test_dir / "source", data);
+    std::filesystem::last_write_time(test_dir / "source", mtime);
+    assert(store.contains(chunks[0].hash));
+    assert(!store.verify(HashAlgorithm::SHA256, chunks[0].hash));
+    assert(!store.contains(chunks[0].hash));
+    // Any other change makes the store forget the chunks of the file
+    write_file(test_dir / "source", data + "appended");
+    assert(!store.contains(chunks[1].hash));
+    std::filesystem::remove_all(test_dir);
+}
+
+static void test_chunk_store_capacity() {
+    ChunkStore store(test_dir / "small_store", 2);
+    std::string data = random_bytes(0x8000, 4);
+
+    std::filesystem::create_directories(test_dir);
+    write_file(test_dir / "source", data);
+    auto chunks = content_chunks(HashAlgorithm::SHA256, test_dir / "source", 0x1000);
+    std::size_t offset = 0;
+
+    assert(chunks.size() > 2);
+    for (const auto &chunk : chunks) {
+        assert(store.store(HashAlgorithm::SHA256, chunk, test_dir / "source", offset));
+        offset += chunk.size;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    {
+        FileDescriptor output(test_dir / "output", O_WRONLY | O_CREAT | O_TRUNC);
+
+        // Used last: kept by trim()
+        store.copy_to(chunks[0], output, 0);
+    }
+    store.trim();
+
+    std::size_t remaining = 0;
+
+    for (const auto &chunk : chunks) {
+        remaining += store.contains(chunk.hash) ? 1 : 0;
+    }
+    assert(remaining == 2);
+    assert(store.contains(chunks[0].hash));
+    std::filesystem::remove_all(test_dir);
+}
+
+int Utils_TestContentChunker(int /* ac */, char ** const /* av */) {
+    test_chunk_sizes();
+    test_shifted_content();
+    test_chunk_store();
+    test_chunk_store_capacity();
+    return 0;
+}
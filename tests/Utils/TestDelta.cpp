@@ -0,0 +1,91 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:41:01 2026 Francois Michaut
+** Last update Mon Oct 19 08:19:55 2026 Francois Michaut
+**
+** TestDelta.cpp : rsync-like delta tests
+*/
+
+#include "FileShare/Utils/Delta.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <filesystem>
+
+using namespace FileShare::Utils;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("delta");
+
+static void test_rolling_checksum() {
+    std::string data = random_bytes(1000, 1);
+    std::size_t window = 100;
+    RollingChecksum checksum(std::string_view(data).substr(0, window));
+
+    for (std::size_t i = 0; i + window < data.size(); i++) {
+        checksum.roll(data[i], data[i + window]);
+        assert(checksum.digest() == RollingChecksum(std::string_view(data).substr(i + 1, window)).digest());
+    }
+}
+
+// Returns the number of bytes which had to be sent as literals
+static auto check_delta(const std::string &old_content, const std::string &new_content, std::size_t block_size) -> std::size_t {
+    std::filesystem::path old_path = test_dir / "old";
+    std::filesystem::path new_path = test_dir / "new";
+    std::filesystem::path delta_path = test_dir / "delta";
+    std::filesystem::path output_path = test_dir / "output";
+
+    write_file(old_path, old_content);
+    write_file(new_path, new_content);
+
+    auto signature = file_signature(HashAlgorithm::MD5, old_path, block_size);
+    std::size_t literal_size = make_delta(signature, new_path, delta_path);
+
+    assert(signature.blocks.size() == (old_content.size() + block_size - 1) / block_size);
+    apply_delta(old_path, delta_path, output_path, block_size);
+    assert(read_file(output_path) == new_content);
+    return literal_size;
+}
+
+static void test_delta() {
+    std::size_t block_size = 1024;
+    std::string old_content = random_bytes(100 * block_size + 123, 2);
+    std::string modified = old_content;
+
+    std::filesystem::create_directories(test_dir);
+
+    assert(check_delta(old_content, old_content, block_size) == 0);
+    // Modified in place: only the modified block is sent
+    modified[50 * block_size + 10] ^= 1;
+    assert(check_delta(old_content, modified, block_size) == block_size);
+    // Insertion: the blocks after it are found at their new offset
+    modified = old_content;
+    modified.insert(10 * block_size + 7, "inserted data");
+    assert(check_delta(old_content, modified, block_size) == block_size + 13);
+    // Deletion, and a shorter last block
+    modified = old_content.substr(0, 20 * block_size) + old_content.substr(21 * block_size, 50 * block_size);
+    assert(check_delta(old_content, modified, block_size) == 0);
+    // Nothing in common
+    modified = random_bytes(5000, 3);
+    assert(check_delta(old_content, modified, block_size) == modified.size());
+    assert(check_delta("", modified, block_size) == modified.size());
+    assert(check_delta(old_content, "", block_size) == 0);
+    // Literals bigger than what is read at once, and than a single instruction holds, between copies
+    std::string literal = random_bytes(0x280000, 4);
+
+    modified = old_content.substr(0, 10 * block_size) + literal + old_content.substr(10 * block_size);
+    assert(check_delta(old_content, modified, block_size) == literal.size());
+    modified = literal + old_content.substr(0, 100 * block_size) + literal;
+    assert(check_delta(old_content, modified, block_size) == literal.size() * 2);
+    std::filesystem::remove_all(test_dir);
+}
+
+int Utils_TestDelta(int /* ac */, char ** const /* av */) {
+    test_rolling_checksum();
+    test_delta();
+    return 0;
+}
@@ -0,0 +1,89 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 06:05:03 2026 Francois Michaut
+** Last update Mon Oct 19 06:05:03 2026 Francois Michaut
+**
+** TestFileDescriptor.cpp : Positioned writes and preallocation tests
+*/
+
+#include "FileShare/Utils/FileDescriptor.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <filesystem>
+
+#include <fcntl.h>
+
+using namespace FileShare::Utils;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("file_descriptor");
+
+static void test_pwrite() {
+    std::string first = random_bytes(0x1000, 1);
+    std::string second = random_bytes(0x1000, 2);
+    std::string last = random_bytes(0x123, 3);
+    std::filesystem::path path = test_dir / "pwrite";
+
+    {
+        FileDescriptor file(path, O_WRONLY | O_CREAT | O_TRUNC);
+
+        // Out of order, like packets of a download
+        file.pwrite(last.data(), last.size(), 0x3000);
+        file.pwrite(first.data(), first.size(), 0);
+        file.pwrite(second.data(), second.size(), 0x1000);
+    }
+
+    std::string content = read_file(path);
+
+    assert(content.size() == 0x3000 + last.size());
+    assert(content.substr(0, 0x1000) == first);
+    assert(content.substr(0x1000, 0x1000) == second);
+    // Never written: reads as zeros
+    assert(content.substr(0x2000, 0x1000) == std::string(0x1000, '\0'));
+    assert(content.substr(0x3000) == last);
+
+    FileDescriptor file(path, O_RDONLY);
+    std::string buffer(0x1000, '\0');
+
+    // The file position is not used
+    assert(file.pread(buffer.data(), buffer.size(), 0x1000) == buffer.size());
+    assert(buffer == second);
+    assert(file.pread(buffer.data(), buffer.size(), 0x3000) == last.size());
+    assert(buffer.substr(0, last.size()) == last);
+    assert(file.pread(buffer.data(), buffer.size(), 0x10000) == 0);
+}
+
+static void test_allocate() {
+    std::string data = random_bytes(0x1000, 4);
+    std::filesystem::path path = test_dir / "allocate";
+    FileDescriptor file(path, O_RDWR | O_CREAT | O_TRUNC);
+
+    // Reserving space must not change the file size, or a short download would keep trailing zeros
+    file.allocate(0, 0x100000);
+    assert(std::filesystem::file_size(path) == 0);
+
+    file.pwrite(data.data(), data.size(), 0x2000);
+    file.allocate(0x1000, 0x100000);
+    assert(std::filesystem::file_size(path) == 0x3000);
+
+    std::string buffer(data.size(), '\0');
+
+    assert(file.pread(buffer.data(), buffer.size(), 0x2000) == buffer.size());
+    assert(buffer == data);
+    assert(file.pread(buffer.data(), buffer.size(), 0x3000) == 0);
+}
+
+int Utils_TestFileDescriptor(int, char**)
+{
+    std::filesystem::remove_all(test_dir);
+    std::filesystem::create_directories(test_dir);
+    test_pwrite();
+    test_allocate();
+    std::filesystem::remove_all(test_dir);
+    return 0;
+}
@@ -4,13 +4,111 @@
 ** Author Francois Michaut
 **
 ** Started on  Tue May  9 11:24:47 2023 Francois Michaut
-** Last update Tue Jul 18 22:02:16 2023 Francois Michaut
+** Last update Mon Oct 19 08:14:40 2026 Francois Michaut
 **
 ** TestFileHash.cpp : FileHash helper function tests
 */
 
+#include "FileShare/Utils/FileHash.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+
+using namespace FileShare::Utils;
+using namespace FileShare::Tests;
+
+static auto to_hex(const std::string &digest) -> std::string {
+    static constexpr const char *digits = "0123456789abcdef";
+    std::string result;
+
+    for (unsigned char c : digest) {
+        result += digits[c >> 4];
+        result += digits[c & 0x0F];
+    }
+    return result;
+}
+
+static void test_known_digests() {
+    Hasher md5(HashAlgorithm::MD5);
+    Hasher sha256(HashAlgorithm::SHA256);
+
+    md5.update("abc");
+    sha256.update("abc");
+    assert(to_hex(md5.digest()) == "900150983cd24fb0d6963f7d28e17f72");
+    assert(to_hex(sha256.digest()) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    assert(md5.digest().size() == algo_hash_size(HashAlgorithm::MD5));
+    assert(sha256.digest().size() == algo_hash_size(HashAlgorithm::SHA256));
+}
+
+static void test_incremental_hash() {
+    std::string data = random_bytes(100000, 42);
+    Hasher full(HashAlgorithm::SHA512);
+    Hasher parts(HashAlgorithm::SHA512);
+
+    full.update(data);
+    for (std::size_t i = 0; i < data.size(); i += 777) {
+        parts.update(std::string_view(data).substr(i, 777));
+    }
+    assert(full.digest() == parts.digest());
+    assert(parts.get_size() == data.size());
+
+    // Copies continue independently from the same state
+    Hasher copy = parts;
+
+    copy.update("more");
+    assert(copy.digest() != parts.digest());
+    assert(parts.digest() == full.digest());
+}
+
+static void test_file_hash() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "fsp_test_file_hash.bin";
+    std::string data = random_bytes(200000, 42);
+    Hasher range(HashAlgorithm::SHA256);
+    Hasher expected(HashAlgorithm::SHA256);
+
+    std::ofstream(path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc) << data;
+
+    expected.update(data);
+    assert(file_hash(HashAlgorithm::SHA256, path) == expected.digest());
+
+    expected = Hasher(HashAlgorithm::SHA256);
+    expected.update(std::string_view(data).substr(1000, 5000));
+    assert(range.update_file(path, 1000, 5000) == 5000);
+    assert(range.digest() == expected.digest());
+
+    // Reading past the end of the file stops at the end of the file
+    assert(range.update_file(path, data.size() - 10, 100) == 10);
+    std::filesystem::remove(path);
+}
+
+static void test_chunk_hashes() {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "fsp_test_chunk_hashes.bin";
+    std::string data = random_bytes(100000, 42);
+    std::size_t chunk_size = 4096;
+
+    std::ofstream(path, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc) << data;
+
+    auto chunks = chunk_hashes(HashAlgorithm::SHA256, path, chunk_size, 4);
+
+    assert(chunks.size() == (data.size() / chunk_size) + 1);
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+        Hasher expected(HashAlgorithm::SHA256);
+
+        expected.update(std::string_view(data).substr(i * chunk_size, chunk_size));
+        assert(chunks[i] == expected.digest());
+    }
+    assert(chunk_hashes(HashAlgorithm::SHA256, path, chunk_size, 1) == chunks);
+    std::filesystem::remove(path);
+}
+
 int Utils_TestFileHash(int, char **)
 {
-    // TODO
+    test_known_digests();
+    test_incremental_hash();
+    test_file_hash();
+    test_chunk_hashes();
     return 0;
 }
@@ -0,0 +1,140 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:10:59 2026 Francois Michaut
+** Last update Mon Oct 19 08:34:58 2026 Francois Michaut
+**
+** TestHashCache.cpp : File hash cache tests
+*/
+
+#include "FileShare/Utils/HashCache.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <filesystem>
+
+using namespace FileShare::Utils;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("hash_cache");
+
+static void test_lru_eviction() {
+    HashCache cache(2);
+    HashCache::Key a{.inode=1};
+    HashCache::Key b{.inode=2};
+    HashCache::Key c{.inode=3};
+
+    cache.insert(a, "a");
+    cache.insert(b, "b");
+    assert(cache.find(a) == "a"); // a is now the most recently used
+    cache.insert(c, "c");
+    assert(cache.size() == 2);
+    assert(cache.find(a) == "a");
+    assert(!cache.find(b).has_value());
+    assert(cache.find(c) == "c");
+
+    cache.set_capacity(1);
+    assert(cache.size() == 1);
+    assert(cache.find(c) == "c");
+}
+
+static void test_invalidation() {
+    HashCache cache;
+    std::filesystem::path path = test_dir / "file";
+
+    write_file(path, "first content");
+    std::string hash = cache.file_hash(HashAlgorithm::SHA256, path);
+    assert(hash == file_hash(HashAlgorithm::SHA256, path));
+    assert(cache.find(HashCache::make_key(HashAlgorithm::SHA256, path)) == hash);
+    assert(!cache.find(HashCache::make_key(HashAlgorithm::MD5, path)).has_value());
+
+    write_file(path, "second, longer, content");
+    assert(!cache.find(HashCache::make_key(HashAlgorithm::SHA256, path)).has_value());
+    assert(cache.file_hash(HashAlgorithm::SHA256, path) == file_hash(HashAlgorithm::SHA256, path));
+    assert(cache.file_hash(HashAlgorithm::SHA256, path) != hash);
+
+    // Same size, different modification time
+    auto mtime = std::filesystem::last_write_time(path);
+    hash = cache.file_hash(HashAlgorithm::SHA256, path);
+    std::filesystem::last_write_time(path, mtime + std::chrono::seconds(10));
+    assert(!cache.find(HashCache::make_key(HashAlgorithm::SHA256, path)).has_value());
+}
+
+static void test_chunk_hashes() {
+    HashCache cache;
+    std::filesystem::path path = test_dir / "chunked";
+    std::size_t chunk_size = 0x1000;
+
+    write_file(path, random_bytes((chunk_size * 3) + 10, 5));
+    auto hashes = cache.chunk_hashes(HashAlgorithm::SHA256, path, chunk_size);
+
+    assert(hashes == chunk_hashes(HashAlgorithm::SHA256, path, chunk_size));
+    assert(hashes.size() == 4 && cache.size() == 1);
+    assert(cache.chunk_hashes(HashAlgorithm::SHA256, path, chunk_size) == hashes);
+    assert(cache.size() == 1);
+    // Neither the whole file hash nor the ones of other chunk sizes share the entry
+    assert(!cache.find(HashCache::make_key(HashAlgorithm::SHA256, path)).has_value());
+    assert(cache.chunk_hashes(HashAlgorithm::SHA256, path, chunk_size * 2).size() == 2);
+    assert(cache.size() == 2);
+
+    write_file(path, random_bytes(chunk_size, 6));
+    assert(cache.chunk_hashes(HashAlgorithm::SHA256, path, chunk_size) == chunk_hashes(HashAlgorithm::SHA256, path, chunk_size));
+}
+
+static void test_content_chunks() {
+    HashCache cache;
+    std::filesystem::path path = test_dir / "content_chunked";
+    std::size_t average_size = 0x1000;
+
+    write_file(path, random_bytes(average_size * 16, 7));
+    auto chunks = cache.content_chunks(HashAlgorithm::SHA256, path, average_size);
+    auto expected = content_chunks(HashAlgorithm::SHA256, path, average_size);
+
+    assert(chunks.size() == expected.size() && chunks.size() > 1);
+    for (std::size_t i = 0; i < chunks.size(); i++) {
+        assert(chunks[i].size == expected[i].size && chunks[i].hash == expected[i].hash);
+    }
+    assert(cache.size() == 1);
+    // Served from the cache, and not mixed up with the fixed size chunks of the same size
+    assert(cache.content_chunks(HashAlgorithm::SHA256, path, average_size)[0].size == expected[0].size);
+    assert(cache.size() == 1);
+    assert(cache.chunk_hashes(HashAlgorithm::SHA256, path, average_size).size() == 16);
+    assert(cache.size() == 2);
+}
+
+static void test_persistence() {
+    std::filesystem::path cache_file = test_dir / "hashes.cache";
+    std::filesystem::path path = test_dir / "persisted";
+    std::string hash;
+
+    write_file(path, "persisted content");
+    {
+        HashCache cache;
+
+        cache.set_persistent_file(cache_file);
+        hash = cache.file_hash(HashAlgorithm::SHA512, path);
+    } // Saved on destruction
+    assert(std::filesystem::exists(cache_file));
+
+    HashCache cache;
+
+    cache.set_persistent_file(cache_file);
+    assert(cache.size() == 1);
+    assert(cache.find(HashCache::make_key(HashAlgorithm::SHA512, path)) == hash);
+}
+
+int Utils_TestHashCache(int, char **)
+{
+    std::filesystem::remove_all(test_dir);
+    std::filesystem::create_directories(test_dir);
+    test_lru_eviction();
+    test_invalidation();
+    test_chunk_hashes();
+    test_content_chunks();
+    test_persistence();
+    std::filesystem::remove_all(test_dir);
+    return 0;
+}
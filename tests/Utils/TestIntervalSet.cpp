@@ -0,0 +1,95 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 01:51:41 2026 Francois Michaut
+** Last update Mon Oct 19 01:51:41 2026 Francois Michaut
+**
+** TestIntervalSet.cpp : IntervalSet tests
+*/
+
+#include "FileShare/Utils/IntervalSet.hpp"
+
+#include <cassert>
+#include <sstream>
+
+#include <cereal/archives/binary.hpp>
+#include <cereal/types/map.hpp>
+
+using namespace FileShare::Utils;
+
+static void test_insert() {
+    IntervalSet set;
+
+    assert(set.empty());
+    set.insert(10, 20);
+    set.insert(30);
+    assert(set.count() == 11);
+    assert(set.get_intervals().size() == 2);
+    // Adjacent and overlapping ranges are merged
+    set.insert(20, 25);
+    set.insert(5, 12);
+    set.insert(25, 30);
+    assert(set.get_intervals().size() == 1);
+    assert(set.get_intervals().at(5) == 31);
+    assert(set.count() == 26);
+    assert(set.front() == 5);
+    set.insert(15);
+    set.insert(40, 40);
+    assert(set.count() == 26);
+    assert(set.contains(5) && set.contains(30));
+    assert(!set.contains(4) && !set.contains(31));
+}
+
+static void test_erase() {
+    IntervalSet set;
+
+    set.insert(0, 100);
+    assert(set.erase(50));
+    assert(!set.erase(50));
+    assert(!set.erase(100));
+    assert(set.get_intervals().size() == 2);
+    assert(set.count() == 99);
+    assert(set.erase(0));
+    assert(set.front() == 1);
+    assert(set.erase(99));
+    assert(!set.contains(99) && set.contains(98) && set.contains(51));
+    for (std::size_t i = 0; i < 100; i++) {
+        set.erase(i);
+    }
+    assert(set.empty());
+    assert(set.count() == 0);
+    set.insert(3);
+    set.clear();
+    assert(set.empty() && set.count() == 0);
+}
+
+static void test_serialize() {
+    IntervalSet set;
+    IntervalSet result;
+    std::stringstream ss;
+
+    set.insert(0, 10);
+    set.insert(1000, 1000000);
+    set.erase(5);
+    {
+        cereal::BinaryOutputArchive archive(ss);
+
+        archive(set);
+    }
+    {
+        cereal::BinaryInputArchive archive(ss);
+
+        archive(result);
+    }
+    assert(result == set);
+    assert(result.count() == 999009);
+}
+
+int Utils_TestIntervalSet(int /* ac */, char ** const /* av */) {
+    test_insert();
+    test_erase();
+    test_serialize();
+    return 0;
+}
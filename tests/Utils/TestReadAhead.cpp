@@ -0,0 +1,109 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:16:05 2026 Francois Michaut
+** Last update Mon Oct 19 08:48:54 2026 Francois Michaut
+**
+** TestReadAhead.cpp : Parallel read ahead tests
+*/
+
+#include "FileShare/Utils/ReadAhead.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <stdexcept>
+
+using namespace FileShare::Utils;
+
+static auto make_data(std::size_t size) -> std::string {
+    std::string result(size, '\0');
+
+    for (std::size_t i = 0; i < size; i++) {
+        result[i] = static_cast<char>(i * 7 + i / 251);
+    }
+    return result;
+}
+
+static auto read_from(const std::string &data) -> ReadAhead::ReadFunction {
+    return [&data](char *buffer, std::size_t size, std::size_t offset) -> std::size_t {
+        if (offset >= data.size())
+            return 0;
+        size = std::min(size, data.size() - offset);
+        std::memcpy(buffer, data.data() + offset, size);
+        return size;
+    };
+}
+
+static void test_ordered_blocks() {
+    std::string data = make_data(1000 * 64 + 10);
+    auto pool = std::make_shared<BufferPool>();
+
+    // The last block is shorter, and reading starts at block 3
+    for (std::size_t threads : {1, 2, 8}) {
+        ReadAhead read_ahead(read_from(data), pool, 64, 3 * 64, 998, 16, threads);
+        std::string result;
+
+        for (std::size_t i = 0; i < 998; i++) {
+            std::string block = read_ahead.next();
+
+            assert(block.size() == (i == 997 ? 10 : 64));
+            result += block;
+            pool->release(std::move(block));
+        }
+        assert(result == data.substr(3 * 64));
+        auto stats = read_ahead.get_stats();
+        assert(stats.depth == 16 && stats.threads == threads);
+        assert(stats.blocks_read == 998 && stats.queued == 0);
+        bool thrown = false;
+        try {
+            read_ahead.next();
+        } catch (std::runtime_error &) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+}
+
+static void test_read_error() {
+    std::string data = make_data(100 * 64);
+    auto read = [&data](char *buffer, std::size_t size, std::size_t offset) -> std::size_t {
+        if (offset == 50 * 64)
+            throw std::runtime_error("Read failed");
+        std::memcpy(buffer, data.data() + offset, size);
+        return size;
+    };
+    ReadAhead read_ahead(read, std::make_shared<BufferPool>(), 64, 0, 100, 4, 3);
+    bool thrown = false;
+
+    for (std::size_t i = 0; i < 50; i++) {
+        assert(read_ahead.next() == data.substr(i * 64, 64));
+    }
+    try {
+        read_ahead.next();
+    } catch (std::runtime_error &) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+static void test_early_destruction() {
+    std::string data = make_data(100 * 64);
+
+    // The threads are stopped while they wait for room, or in the middle of reads
+    for (std::size_t used = 0; used < 5; used++) {
+        ReadAhead read_ahead(read_from(data), std::make_shared<BufferPool>(), 64, 0, 100, 4, 4);
+
+        for (std::size_t i = 0; i < used; i++) {
+            assert(read_ahead.next() == data.substr(i * 64, 64));
+        }
+    }
+}
+
+int Utils_TestReadAhead(int /* ac */, char ** const /* av */) {
+    test_ordered_blocks();
+    test_read_error();
+    test_early_destruction();
+    return 0;
+}
@@ -0,0 +1,76 @@
+/*
+** Project LibFileShareProtocol, 2026
+**
+** Author Francois Michaut
+**
+** Started on  Mon Oct 19 03:01:50 2026 Francois Michaut
+** Last update Mon Oct 19 08:46:40 2026 Francois Michaut
+**
+** TestSparse.cpp : Sparse files holes tests
+*/
+
+#include "FileShare/Utils/Sparse.hpp"
+
+#include "TestHelpers.hpp"
+
+#include <cassert>
+#include <filesystem>
+
+#include <fcntl.h>
+
+using namespace FileShare::Utils;
+using namespace FileShare::Tests;
+
+static const std::filesystem::path test_dir = test_directory("sparse");
+
+static void test_data_extents() {
+    std::vector<FileRange> holes = {{.offset=0, .size=100}, {.offset=150, .size=50}, {.offset=300, .size=100}};
+    auto extents = data_extents(holes, 400);
+
+    assert(extents.size() == 2);
+    assert(extents[0].offset == 0 && extents[0].file_offset == 100 && extents[0].size == 50);
+    assert(extents[1].offset == 50 && extents[1].file_offset == 200 && extents[1].size == 100);
+    assert(extents_size(extents) == 150);
+
+    extents = data_extents({{.offset=100, .size=100}}, 300);
+    assert(extents.size() == 2 && extents[1].offset == 100 && extents[1].file_offset == 200 && extents[1].size == 100);
+    assert(data_extents({}, 300).size() == 1);
+    assert(data_extents({{.offset=0, .size=300}}, 300).empty());
+}
+
+static void test_find_holes() {
+    std::string data(0x1000, 'x');
+
+    std::filesystem::create_directories(test_dir);
+    {
+        FileDescriptor file(test_dir / "sparse", O_WRONLY | O_CREAT | O_TRUNC);
+
+        // data | hole | data | hole up to the end
+        file.pwrite(data.data(), data.size(), 0);
+        file.pwrite(data.data(), data.size(), 0x400000);
+    }
+    std::filesystem::resize_file(test_dir / "sparse", 0x800000);
+
+    FileDescriptor file(test_dir / "sparse", O_RDONLY);
+    auto holes = find_holes(file, 0x800000);
+
+    // Not every filesystem reports holes: then the whole file is data
+    for (const auto &hole : holes) {
+        std::string content(hole.size, '\1');
+
+        assert(hole.size >= MIN_HOLE_SIZE && hole.offset + hole.size <= 0x800000);
+        assert(file.pread(content.data(), content.size(), hole.offset) == content.size());
+        assert(content == std::string(hole.size, '\0'));
+    }
+    if (!holes.empty()) {
+        assert(holes.size() == 2 && holes.back().offset + holes.back().size == 0x800000);
+        assert(extents_size(data_extents(holes, 0x800000)) < 0x100000);
+    }
+    std::filesystem::remove_all(test_dir);
+}
+
+int Utils_TestSparse(int /* ac */, char ** const /* av */) {
+    test_data_extents();
+    test_find_holes();
+    return 0;
+}